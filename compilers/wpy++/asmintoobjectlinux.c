@@ -0,0 +1,21 @@
+// asmintoobjectlinux.c
+#include <stdio.h>
+#include <stdlib.h>
+
+// Assemble a Linux x86-64 NASM source file into an ELF64 object file.
+// Returns 0 on success, nonzero on failure.
+int assemble_to_object_linux(const char *asm_path, const char *obj_path) {
+    char cmd[512];
+    // Use NASM with -f elf64 for a System V object
+    snprintf(cmd, sizeof(cmd), "nasm -f elf64 %s -o %s", asm_path, obj_path);
+
+    printf("Assembling (Linux x86-64): %s\n", cmd);
+    int ret = system(cmd);
+    if (ret != 0) {
+        fprintf(stderr, "Assembly failed for Linux build (code %d)\n", ret);
+        return 1;
+    }
+
+    printf("Object file created: %s\n", obj_path);
+    return 0;
+}
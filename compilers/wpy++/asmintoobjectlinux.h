@@ -0,0 +1,11 @@
+// asmintoobjectlinux.h
+#ifndef ASMINTOOBJECTLINUX_H
+#define ASMINTOOBJECTLINUX_H
+
+// Assemble a Linux x86-64 NASM source file into an ELF64 object file.
+// asm_path: path to the .asm file (e.g. "out.asm")
+// obj_path: path to the .o file to create (e.g. "out.o")
+// Returns 0 on success, nonzero on failure.
+int assemble_to_object_linux(const char *asm_path, const char *obj_path);
+
+#endif // ASMINTOOBJECTLINUX_H
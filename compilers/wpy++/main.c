@@ -12,6 +12,9 @@
 #include "gra_pyppintoasm.h"
 #include "gra_asmintoobject.h"
 #include "gra_objectintoexe.h"
+#include "pyppintoasmlinux.h"
+#include "asmintoobjectlinux.h"
+#include "objectintoexelinux.h"
 
 static void show_help() {
     printf("Usage: wpy++.exe <source_file.pypp> [options]\n");
@@ -20,6 +23,7 @@ static void show_help() {
     printf("  --version, -v    Show version information\n");
     printf("  --win32          Build as Win32 GDI app (graphics pipeline) PLEASE REMEMBER THIS IS A WIP (WORK IN PROGRESS)\n");
     printf("  --no32           Skip 32-bit build (only produce 64-bit executable)\n");
+    printf("  --linux          Build a static Linux x86-64 executable with no libc (default on Linux)\n");
 }
 
 static void show_version() {
@@ -78,6 +82,11 @@ int generate_asm_to_file(ASTNode *ast, const char *out_path);
 
 int main(int argc, char *argv[]) {
     int is_win32_mode = 0;
+#ifdef __linux__
+    int is_linux_mode = 1; // a Linux host builds Linux executables
+#else
+    int is_linux_mode = 0;
+#endif
     int attempt_32 = 1; // whether to try producing a 32-bit build
     const char *filepath = NULL;
 
@@ -99,6 +108,8 @@ int main(int argc, char *argv[]) {
             is_win32_mode = 1;
         } else if (strcmp(argv[i], "--no32") == 0) {
             attempt_32 = 0;
+        } else if (strcmp(argv[i], "--linux") == 0) {
+            is_linux_mode = 1;
         } else {
             filepath = argv[i];
         }
@@ -156,6 +167,11 @@ int main(int argc, char *argv[]) {
     int status = 0;
 
     if (is_win32_mode) {
+#ifndef _WIN32
+        fprintf(stderr, "wpy++.exe: \033[1;31mfatal error:\033[0m the graphics pipeline (--win32) needs Windows\n");
+        status = 1;
+        goto cleanup;
+#endif
         // Graphics pipeline (Win32 GDI)
         if (gra_generate_asm_to_file(ast) != 0) {
             fprintf(stderr, "wpy++.exe: \033[1;31mfatal error:\033[0m failed to generate graphics assembly\n");
@@ -178,6 +194,25 @@ int main(int argc, char *argv[]) {
             goto cleanup;
         }
         printf("Executable created: outgra.exe\n");
+    } else if (is_linux_mode) {
+        // Linux pipeline: System V x86-64, raw syscalls, static ELF
+        if (generate_asm_linux(ast) != 0) {
+            fprintf(stderr, "wpy++.exe: \033[1;31mfatal error:\033[0m failed to generate Linux assembly\n");
+            status = 1;
+            goto cleanup;
+        }
+
+        if (assemble_to_object_linux("out.asm", "out.o") != 0) {
+            fprintf(stderr, "wpy++.exe: \033[1;31mfatal error:\033[0m failed to assemble Linux object\n");
+            status = 1;
+            goto cleanup;
+        }
+
+        if (object_to_exe_linux("out.o", "out") != 0) {
+            fprintf(stderr, "wpy++.exe: \033[1;31mfatal error:\033[0m failed to link Linux executable\n");
+            status = 1;
+            goto cleanup;
+        }
     } else {
         // Console pipeline
         char outpath[512];
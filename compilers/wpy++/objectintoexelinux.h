@@ -0,0 +1,9 @@
+// objectintoexelinux.h
+#ifndef OBJECTINTOEXELINUX_H
+#define OBJECTINTOEXELINUX_H
+
+// Link a Linux x86-64 object file into a static ELF executable that uses
+// no libc. Returns 0 on success, nonzero on failure.
+int object_to_exe_linux(const char *obj_path, const char *exe_path);
+
+#endif // OBJECTINTOEXELINUX_H
@@ -1,8 +1,10 @@
 // pyppgraphics.c
+#include "pyppgraphics.h"
+
+#ifdef _WIN32
 #include <windows.h>
 #include <string.h>
 #include <strings.h>
-#include "pyppgraphics.h"
 
 // Global state (simple demo; you can encapsulate later)
 static const char *g_title = "Python++";
@@ -115,3 +117,46 @@ void graphics_Loop(void) {
         DispatchMessageA(&msg);
     }
 }
+
+#else
+// The graphics runtime draws with Win32 GDI. Elsewhere it only says so, so
+// that the compiler itself still builds.
+#include <stdio.h>
+#include <stdlib.h>
+
+static void graphics_unsupported(void) {
+    fprintf(stderr, "pyppgraphics: the graphics pipeline needs Windows\n");
+    exit(1);
+}
+
+void graphics_Init(const char *title, int width, int height) {
+    (void)title;
+    (void)width;
+    (void)height;
+    graphics_unsupported();
+}
+
+void graphics_Clear(const char *color) {
+    (void)color;
+    graphics_unsupported();
+}
+
+void graphics_DrawText(int x, int y, const char *text) {
+    (void)x;
+    (void)y;
+    (void)text;
+    graphics_unsupported();
+}
+
+void graphics_DrawRect(int x, int y, int w, int h) {
+    (void)x;
+    (void)y;
+    (void)w;
+    (void)h;
+    graphics_unsupported();
+}
+
+void graphics_Loop(void) {
+    graphics_unsupported();
+}
+#endif
@@ -0,0 +1,195 @@
+// pyppintoasmlinux.c
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "parser.h"
+#include "pyppintoasmlinux.h"
+
+// -------- Linux x86-64 codegen (System V, no libc) --------
+// The program is its own runtime: _start runs main's statements, a print
+// is a write syscall on stdout and return is an exit_group syscall, so
+// the executable needs no libc, no dynamic loader and no startup code.
+// Consecutive prints are merged at compile time into one string and one
+// write.
+
+#define SYS_WRITE      1
+#define SYS_EXIT_GROUP 231
+#define ERR_EINTR      4
+
+typedef struct {
+    char **strings;      // text of str0, str1, ... (written after the code)
+    int str_count;
+    char *pending;       // prints not written yet, merged into one
+    size_t pending_len;
+    int uses_write;      // whether pypp_write has to be emitted
+    int exited;          // main's top level has returned: the rest is dead
+} CodegenCtx;
+
+static void gen_node(ASTNode *node, FILE *out, CodegenCtx *ctx);
+
+// -------- Safe NASM byte emitter --------
+// Like the Win64 emitter, without the null terminator: write takes a
+// length, which the label_len constant after the bytes gives. A double
+// quote goes out as a number, since NASM has no escape for it in "...".
+static void emit_nasm_db_bytes(FILE *out, const char *label, const char *s) {
+    fprintf(out, "%s db ", label);
+
+    int open = 0;
+    int first_item = 1;
+
+    for (size_t i = 0; s[i]; i++) {
+        unsigned char b = (unsigned char)s[i];
+        int printable = (b >= 32 && b != 127 && b != '"');
+
+        if (printable) {
+            if (!open) {
+                if (!first_item) fprintf(out, ", ");
+                fprintf(out, "\"");
+                open = 1;
+                first_item = 0;
+            }
+            fputc(b, out);
+        } else {
+            if (open) {
+                fprintf(out, "\"");
+                open = 0;
+            }
+            if (!first_item) fprintf(out, ", ");
+            fprintf(out, "%u", b);
+            first_item = 0;
+        }
+    }
+    if (open) fprintf(out, "\"");
+    fprintf(out, "\n");
+    fprintf(out, "%s_len equ $ - %s\n", label, label);
+}
+
+// -------- Prints --------
+static void queue_print(CodegenCtx *ctx, const char *text) {
+    size_t n = strlen(text);
+    if (n == 0) return;
+    ctx->pending = (char*)realloc(ctx->pending, ctx->pending_len + n + 1);
+    memcpy(ctx->pending + ctx->pending_len, text, n + 1);
+    ctx->pending_len += n;
+}
+
+// Writes out the prints queued since the last statement that was not one.
+static void flush_prints(FILE *out, CodegenCtx *ctx) {
+    if (ctx->pending_len == 0) return;
+    ctx->strings = (char**)realloc(ctx->strings, sizeof(char*) * (ctx->str_count + 1));
+    ctx->strings[ctx->str_count] = ctx->pending;
+    fprintf(out, "    lea rsi, [rel str%d]     ; RSI = &string\n", ctx->str_count);
+    fprintf(out, "    mov edx, str%d_len       ; RDX = length\n", ctx->str_count);
+    fprintf(out, "    call pypp_write\n");
+    ctx->str_count++;
+    ctx->pending = NULL;
+    ctx->pending_len = 0;
+    ctx->uses_write = 1;
+}
+
+// -------- Public API: always write to "out.asm" --------
+int generate_asm_linux(ASTNode *ast) {
+    const char *out_path = "out.asm";
+    FILE *out = fopen(out_path, "w");
+    if (!out) {
+        perror("generate_asm_linux: fopen");
+        return 1;
+    }
+
+    // 1) Text section: _start is main
+    fprintf(out, "section .text\n");
+    fprintf(out, "global _start\n\n");
+    fprintf(out, "_start:\n");
+
+    CodegenCtx ctx = {0};
+    for (int i = 0; i < ast->child_count; i++) {
+        gen_node(ast->children[i], out, &ctx);
+    }
+    flush_prints(out, &ctx);
+
+    // main ran off its end without a return
+    if (!ctx.exited) {
+        fprintf(out, "    xor edi, edi             ; RDI = exit code 0\n");
+        fprintf(out, "    mov eax, %d             ; exit_group\n", SYS_EXIT_GROUP);
+        fprintf(out, "    syscall\n");
+    }
+
+    // 2) write(1, rsi, rdx), repeated until all of it is out; the
+    //    syscall leaves rsi and rdx alone
+    if (ctx.uses_write) {
+        fprintf(out, "\npypp_write:\n");
+        fprintf(out, "    mov eax, %d               ; write\n", SYS_WRITE);
+        fprintf(out, "    mov edi, 1               ; stdout\n");
+        fprintf(out, "    syscall\n");
+        fprintf(out, "    cmp rax, -%d              ; interrupted: try again\n", ERR_EINTR);
+        fprintf(out, "    je pypp_write\n");
+        fprintf(out, "    test rax, rax            ; error: drop the rest\n");
+        fprintf(out, "    jle .done\n");
+        fprintf(out, "    add rsi, rax\n");
+        fprintf(out, "    sub rdx, rax\n");
+        fprintf(out, "    jnz pypp_write\n");
+        fprintf(out, ".done:\n");
+        fprintf(out, "    ret\n");
+    }
+
+    // 3) Read-only data: the merged print strings
+    if (ctx.str_count > 0) {
+        fprintf(out, "\nsection .rodata\n");
+        for (int i = 0; i < ctx.str_count; i++) {
+            char label[32];
+            snprintf(label, sizeof(label), "str%d", i);
+            emit_nasm_db_bytes(out, label, ctx.strings[i]);
+            free(ctx.strings[i]);
+        }
+    }
+    free(ctx.strings);
+
+    fclose(out);
+    printf("Assembly written to %s\n", out_path);
+    return 0;
+}
+
+// -------- Code emission --------
+static void gen_node(ASTNode *node, FILE *out, CodegenCtx *ctx) {
+    if (!node) return;
+
+    switch (node->type) {
+        case AST_FUNCTION:
+            if (node->value && strcmp(node->value, "main") == 0) {
+                for (int i = 0; i < node->child_count; i++) {
+                    gen_node(node->children[i], out, ctx);
+                }
+            }
+            break;
+
+        case AST_BLOCK:
+            for (int i = 0; i < node->child_count && !ctx->exited; i++) {
+                gen_node(node->children[i], out, ctx);
+            }
+            break;
+
+        case AST_PRINT: {
+            ASTNode *lit = node->child_count > 0 ? node->children[0] : NULL;
+            if (lit && lit->type == AST_LITERAL && lit->value) queue_print(ctx, lit->value);
+            break;
+        }
+
+        case AST_RETURN: {
+            long long code = 0;
+            if (node->child_count > 0 && node->children[0] && node->children[0]->value) {
+                const char *imm = node->children[0]->value;
+                if (strcmp(imm, "failure") == 0) code = 1;
+                else if (strcmp(imm, "success") != 0) code = atoll(imm);
+            }
+            flush_prints(out, ctx);
+            fprintf(out, "    mov edi, %d              ; RDI = exit code\n", (int)(code & 0xff));
+            fprintf(out, "    mov eax, %d             ; exit_group\n", SYS_EXIT_GROUP);
+            fprintf(out, "    syscall\n");
+            ctx->exited = 1;
+            break;
+        }
+
+        default:
+            break;
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef PYPPINTOASMLINUX_H
+#define PYPPINTOASMLINUX_H
+
+#include "parser.h"
+
+// Generate Linux x86-64 NASM assembly from the parsed AST, with its own
+// _start and raw write/exit_group syscalls instead of libc.
+// Writes to "out.asm" and returns 0 on success, nonzero on error.
+int generate_asm_linux(ASTNode *ast);
+
+#endif // PYPPINTOASMLINUX_H
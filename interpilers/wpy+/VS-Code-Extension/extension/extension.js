@@ -1,7 +1,88 @@
 const vscode = require('vscode');
+const { spawn } = require('child_process');
+
+// Minimal Language Server Protocol client for `wpy+ --lsp`: the server
+// keeps every open .pyp document, re-lexes and re-parses only what an edit
+// touched, and answers with diagnostics and hovers.
+class Server {
+    constructor(command, output) {
+        this.pending = new Map();
+        this.nextId = 1;
+        this.buffer = Buffer.alloc(0);
+        this.onNotification = () => {};
+        this.process = spawn(command, ['--lsp']);
+        this.process.on('error', err => {
+            output.appendLine(`Cannot start ${command}: ${err.message}`);
+            for (const { reject } of this.pending.values()) reject(err);
+            this.pending.clear();
+            this.process = null;
+        });
+        this.process.on('exit', () => { this.process = null; });
+        this.process.stderr.on('data', data => output.append(data.toString()));
+        this.process.stdout.on('data', data => this.receive(data));
+    }
+
+    send(message) {
+        if (!this.process) return;
+        const body = Buffer.from(JSON.stringify({ jsonrpc: '2.0', ...message }), 'utf8');
+        this.process.stdin.write(`Content-Length: ${body.length}\r\n\r\n`);
+        this.process.stdin.write(body);
+    }
+
+    request(method, params) {
+        const id = this.nextId++;
+        return new Promise((resolve, reject) => {
+            if (!this.process) return reject(new Error('language server is not running'));
+            this.pending.set(id, { resolve, reject });
+            this.send({ id, method, params });
+        });
+    }
+
+    notify(method, params) {
+        this.send({ method, params });
+    }
+
+    receive(data) {
+        this.buffer = Buffer.concat([this.buffer, data]);
+        for (;;) {
+            const headerEnd = this.buffer.indexOf('\r\n\r\n');
+            if (headerEnd < 0) return;
+            const match = /Content-Length: (\d+)/i.exec(this.buffer.slice(0, headerEnd).toString());
+            const length = match ? parseInt(match[1], 10) : 0;
+            if (this.buffer.length < headerEnd + 4 + length) return;
+            const body = this.buffer.slice(headerEnd + 4, headerEnd + 4 + length).toString('utf8');
+            this.buffer = this.buffer.slice(headerEnd + 4 + length);
+
+            const message = JSON.parse(body);
+            if (message.id !== undefined && this.pending.has(message.id)) {
+                const { resolve, reject } = this.pending.get(message.id);
+                this.pending.delete(message.id);
+                if (message.error) reject(new Error(message.error.message));
+                else resolve(message.result);
+            } else if (message.method) {
+                this.onNotification(message.method, message.params);
+            }
+        }
+    }
+
+    async stop() {
+        if (!this.process) return;
+        try {
+            await this.request('shutdown', null);
+        } finally {
+            this.notify('exit', null);
+        }
+    }
+}
+
+function toRange(range) {
+    return new vscode.Range(range.start.line, range.start.character, range.end.line, range.end.character);
+}
+
+let server = null;
 
 /** @param {vscode.ExtensionContext} context */
-function activate(context) {
+async function activate(context) {
     console.log('Python+ language support activated');
 
     const selector = { language: 'python+', scheme: 'file' };
@@ -15,19 +96,83 @@ function activate(context) {
     });
     context.subscriptions.push(completionProvider);
 
-    // Hover provider for include pseudo-module
-    const hoverProvider = vscode.languages.registerHoverProvider(selector, {
-        provideHover(document, position) {
-            const word = document.getText(document.getWordRangeAtPosition(position));
-            if (word === 'pyppstdio') {
-                return new vscode.Hover('pyppstdio: standard I/O utilities for Python+ (print, input)');
+    // Diagnostics and hovers come from the language server
+    const output = vscode.window.createOutputChannel('Python+');
+    const diagnostics = vscode.languages.createDiagnosticCollection('python+');
+    context.subscriptions.push(output, diagnostics);
+
+    const command = vscode.workspace.getConfiguration('pythonPlus').get('serverPath') || 'wpy+';
+    server = new Server(command, output);
+    server.onNotification = (method, params) => {
+        if (method !== 'textDocument/publishDiagnostics') return;
+        const uri = vscode.Uri.parse(params.uri);
+        diagnostics.set(uri, params.diagnostics.map(d => {
+            const diagnostic = new vscode.Diagnostic(toRange(d.range), d.message, vscode.DiagnosticSeverity.Error);
+            diagnostic.source = d.source;
+            return diagnostic;
+        }));
+    };
+    try {
+        await server.request('initialize', {
+            processId: process.pid,
+            rootUri: vscode.workspace.workspaceFolders ? vscode.workspace.workspaceFolders[0].uri.toString() : null,
+            capabilities: {}
+        });
+    } catch (err) {
+        output.appendLine(`Python+ language server unavailable: ${err.message}`);
+        return;
+    }
+    server.notify('initialized', {});
+
+    const isPyp = document => document.languageId === 'python+' && document.uri.scheme === 'file';
+    const open = document => {
+        if (!isPyp(document)) return;
+        server.notify('textDocument/didOpen', {
+            textDocument: {
+                uri: document.uri.toString(),
+                languageId: 'python+',
+                version: document.version,
+                text: document.getText()
             }
-            return null;
-        }
-    });
-    context.subscriptions.push(hoverProvider);
+        });
+    };
+    vscode.workspace.textDocuments.forEach(open);
+    context.subscriptions.push(
+        vscode.workspace.onDidOpenTextDocument(open),
+        vscode.workspace.onDidChangeTextDocument(event => {
+            if (!isPyp(event.document) || event.contentChanges.length === 0) return;
+            server.notify('textDocument/didChange', {
+                textDocument: { uri: event.document.uri.toString(), version: event.document.version },
+                contentChanges: event.contentChanges.map(change => ({
+                    range: {
+                        start: { line: change.range.start.line, character: change.range.start.character },
+                        end: { line: change.range.end.line, character: change.range.end.character }
+                    },
+                    text: change.text
+                }))
+            });
+        }),
+        vscode.workspace.onDidCloseTextDocument(document => {
+            if (!isPyp(document)) return;
+            server.notify('textDocument/didClose', { textDocument: { uri: document.uri.toString() } });
+            diagnostics.delete(document.uri);
+        }),
+        vscode.languages.registerHoverProvider(selector, {
+            async provideHover(document, position) {
+                const result = await server.request('textDocument/hover', {
+                    textDocument: { uri: document.uri.toString() },
+                    position: { line: position.line, character: position.character }
+                });
+                if (!result) return null;
+                return new vscode.Hover(new vscode.MarkdownString(result.contents.value),
+                                        result.range ? toRange(result.range) : undefined);
+            }
+        })
+    );
 }
 
-function deactivate() {}
+function deactivate() {
+    return server ? server.stop() : undefined;
+}
 
 module.exports = { activate, deactivate };
@@ -0,0 +1,717 @@
+#include <stdlib.h>
+#include <string.h>
+#include "algo.h"
+#include "array.h"
+#include "parallel.h"
+
+typedef long long i64;
+typedef unsigned long long u64;
+
+// -----------------------------
+// Float keys
+// -----------------------------
+// Floats are sorted as 64-bit signed keys: flipping the low 63 bits of
+// negative values makes integer order match IEEE 754 total order, and
+// subtracting NEG_NAN_COUNT rotates the negative NaNs (the lowest keys)
+// past the positive ones, so every NaN ends up last. Both steps are
+// bijective, so a key converts back to exactly the double it came from.
+#define NEG_NAN_COUNT ((1ULL << 52) - 1)
+
+static inline i64 float_key(double f) {
+    u64 bits;
+    memcpy(&bits, &f, sizeof(bits));
+    bits ^= (u64)((i64)bits >> 63) >> 1;
+    return (i64)(bits - NEG_NAN_COUNT);
+}
+
+static inline double key_float(i64 key) {
+    u64 bits = (u64)key + NEG_NAN_COUNT;
+    bits ^= (u64)((i64)bits >> 63) >> 1;
+    double f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// In place: the doubles and their keys share the buffer.
+static void to_keys(void *data, i64 n) {
+    double *f = data;
+    i64 *k = data;
+    for (i64 i = 0; i < n; i++) k[i] = float_key(f[i]);
+}
+
+static void from_keys(void *data, i64 n) {
+    double *f = data;
+    i64 *k = data;
+    for (i64 i = 0; i < n; i++) f[i] = key_float(k[i]);
+}
+
+// -----------------------------
+// Pattern-defeating quicksort
+// -----------------------------
+// Orson Peters' pdqsort: median-of-3 (ninther on large ranges) pivots,
+// BlockQuicksort's branchless partitioning, a check for already sorted
+// runs after a partition that moved nothing, a separate path for runs of
+// equal elements, and heapsort once too many partitions came out lopsided.
+#define INSERTION_THRESHOLD 24
+#define NINTHER_THRESHOLD 128
+#define PARTIAL_INSERTION_LIMIT 8
+#define PARTITION_BLOCK 64
+
+static inline void swap(i64 *a, i64 *b) {
+    i64 t = *a;
+    *a = *b;
+    *b = t;
+}
+
+static inline void sort2(i64 *a, i64 *b) {
+    if (*b < *a) swap(a, b);
+}
+
+static inline void sort3(i64 *a, i64 *b, i64 *c) {
+    sort2(a, b);
+    sort2(b, c);
+    sort2(a, b);
+}
+
+static void insertion_sort(i64 *begin, i64 *end) {
+    if (begin == end) return;
+    for (i64 *cur = begin + 1; cur != end; cur++) {
+        i64 *sift = cur, *sift_1 = cur - 1;
+        if (*sift < *sift_1) {
+            i64 tmp = *sift;
+            do {
+                *sift-- = *sift_1;
+            } while (sift != begin && tmp < *--sift_1);
+            *sift = tmp;
+        }
+    }
+}
+
+// Only for ranges with an element before them that is no larger than
+// any of theirs: it stops the scan instead of a bounds check.
+static void unguarded_insertion_sort(i64 *begin, i64 *end) {
+    if (begin == end) return;
+    for (i64 *cur = begin + 1; cur != end; cur++) {
+        i64 *sift = cur, *sift_1 = cur - 1;
+        if (*sift < *sift_1) {
+            i64 tmp = *sift;
+            do {
+                *sift-- = *sift_1;
+            } while (tmp < *--sift_1);
+            *sift = tmp;
+        }
+    }
+}
+
+// Insertion sort that gives up (returning 0) after moving a few elements.
+static int partial_insertion_sort(i64 *begin, i64 *end) {
+    if (begin == end) return 1;
+    i64 moved = 0;
+    for (i64 *cur = begin + 1; cur != end; cur++) {
+        i64 *sift = cur, *sift_1 = cur - 1;
+        if (*sift < *sift_1) {
+            i64 tmp = *sift;
+            do {
+                *sift-- = *sift_1;
+            } while (sift != begin && tmp < *--sift_1);
+            *sift = tmp;
+            moved += cur - sift;
+            if (moved > PARTIAL_INSERTION_LIMIT) return 0;
+        }
+    }
+    return 1;
+}
+
+static void sift_down(i64 *heap, i64 n, i64 root) {
+    i64 value = heap[root];
+    for (;;) {
+        i64 child = 2 * root + 1;
+        if (child >= n) break;
+        if (child + 1 < n && heap[child] < heap[child + 1]) child++;
+        if (!(value < heap[child])) break;
+        heap[root] = heap[child];
+        root = child;
+    }
+    heap[root] = value;
+}
+
+static void heap_sort(i64 *begin, i64 *end) {
+    i64 n = end - begin;
+    for (i64 i = n / 2; i-- > 0;) sift_down(begin, n, i);
+    for (i64 i = n - 1; i > 0; i--) {
+        swap(begin, begin + i);
+        sift_down(begin, i, 0);
+    }
+}
+
+// Puts the pivot for [begin, end) at *begin.
+static void choose_pivot(i64 *begin, i64 *end) {
+    i64 size = end - begin, half = size / 2;
+    if (size > NINTHER_THRESHOLD) {
+        sort3(begin, begin + half, end - 1);
+        sort3(begin + 1, begin + (half - 1), end - 2);
+        sort3(begin + 2, begin + (half + 1), end - 3);
+        sort3(begin + (half - 1), begin + half, begin + (half + 1));
+        swap(begin, begin + half);
+    } else {
+        sort3(begin + half, begin, end - 1);
+    }
+}
+
+// Moves the wrong-side elements named by two offset blocks across.
+static void swap_offsets(i64 *first, i64 *last, const unsigned char *offsets_l,
+                         const unsigned char *offsets_r, size_t num, int use_swaps) {
+    if (use_swaps) {
+        // with equal counts, a cyclic permutation would not be valid
+        for (size_t i = 0; i < num; i++) swap(first + offsets_l[i], last - offsets_r[i]);
+    } else if (num > 0) {
+        i64 *l = first + offsets_l[0], *r = last - offsets_r[0];
+        i64 tmp = *l;
+        *l = *r;
+        for (size_t i = 1; i < num; i++) {
+            l = first + offsets_l[i];
+            *r = *l;
+            r = last - offsets_r[i];
+            *l = *r;
+        }
+        *r = tmp;
+    }
+}
+
+// Partitions [begin, end) around the pivot at *begin: smaller elements
+// before it, the rest after. Returns its final position, and sets
+// *already_partitioned if no element had to move.
+static i64 *partition_right(i64 *begin, i64 *end, int *already_partitioned) {
+    i64 pivot = *begin;
+    i64 *first = begin, *last = end;
+
+    // the median of 3 guarantees an element >= pivot after it
+    while (*++first < pivot) {}
+    if (first - 1 == begin) {
+        while (first < last && !(*--last < pivot)) {}
+    } else {
+        while (!(*--last < pivot)) {}
+    }
+
+    *already_partitioned = first >= last;
+    if (!*already_partitioned) {
+        swap(first, last);
+        first++;
+
+        // BlockQuicksort (Edelkamp and Weiss): record the offsets of
+        // misplaced elements in blocks without branching on the
+        // comparisons, then swap them in bulk
+        unsigned char offsets_l[PARTITION_BLOCK], offsets_r[PARTITION_BLOCK];
+        i64 *offsets_l_base = first, *offsets_r_base = last;
+        size_t num_l = 0, num_r = 0, start_l = 0, start_r = 0;
+
+        while (first < last) {
+            size_t unknown = (size_t)(last - first);
+            size_t left_split = num_l == 0 ? (num_r == 0 ? unknown / 2 : unknown) : 0;
+            size_t right_split = num_r == 0 ? unknown - left_split : 0;
+
+            if (left_split >= PARTITION_BLOCK) {
+                for (size_t i = 0; i < PARTITION_BLOCK;) {
+                    offsets_l[num_l] = (unsigned char)i++; num_l += !(*first < pivot); first++;
+                    offsets_l[num_l] = (unsigned char)i++; num_l += !(*first < pivot); first++;
+                    offsets_l[num_l] = (unsigned char)i++; num_l += !(*first < pivot); first++;
+                    offsets_l[num_l] = (unsigned char)i++; num_l += !(*first < pivot); first++;
+                }
+            } else {
+                for (size_t i = 0; i < left_split;) {
+                    offsets_l[num_l] = (unsigned char)i++; num_l += !(*first < pivot); first++;
+                }
+            }
+
+            if (right_split >= PARTITION_BLOCK) {
+                for (size_t i = 0; i < PARTITION_BLOCK;) {
+                    offsets_r[num_r] = (unsigned char)++i; num_r += *--last < pivot;
+                    offsets_r[num_r] = (unsigned char)++i; num_r += *--last < pivot;
+                    offsets_r[num_r] = (unsigned char)++i; num_r += *--last < pivot;
+                    offsets_r[num_r] = (unsigned char)++i; num_r += *--last < pivot;
+                }
+            } else {
+                for (size_t i = 0; i < right_split;) {
+                    offsets_r[num_r] = (unsigned char)++i; num_r += *--last < pivot;
+                }
+            }
+
+            size_t num = num_l < num_r ? num_l : num_r;
+            swap_offsets(offsets_l_base, offsets_r_base, offsets_l + start_l, offsets_r + start_r,
+                         num, num_l == num_r);
+            num_l -= num;
+            num_r -= num;
+            start_l += num;
+            start_r += num;
+            if (num_l == 0) {
+                start_l = 0;
+                offsets_l_base = first;
+            }
+            if (num_r == 0) {
+                start_r = 0;
+                offsets_r_base = last;
+            }
+        }
+
+        // one block may still hold misplaced elements
+        if (num_l) {
+            while (num_l--) swap(offsets_l_base + offsets_l[start_l + num_l], --last);
+            first = last;
+        }
+        if (num_r) {
+            while (num_r--) swap(offsets_r_base - offsets_r[start_r + num_r], first++);
+            last = first;
+        }
+    }
+
+    i64 *pivot_pos = first - 1;
+    *begin = *pivot_pos;
+    *pivot_pos = pivot;
+    return pivot_pos;
+}
+
+// The other way round: elements equal to the pivot go left. Used when the
+// pivot equals the element just before the range, so that everything it
+// puts left of the pivot is equal and needs no more sorting.
+static i64 *partition_left(i64 *begin, i64 *end) {
+    i64 pivot = *begin;
+    i64 *first = begin, *last = end;
+
+    while (pivot < *--last) {}
+    if (last + 1 == end) {
+        while (first < last && !(pivot < *++first)) {}
+    } else {
+        while (!(pivot < *++first)) {}
+    }
+    while (first < last) {
+        swap(first, last);
+        while (pivot < *--last) {}
+        while (!(pivot < *++first)) {}
+    }
+
+    *begin = *last;
+    *last = pivot;
+    return last;
+}
+
+static void pdqsort_loop(i64 *begin, i64 *end, int bad_allowed, int leftmost) {
+    for (;;) {
+        i64 size = end - begin;
+        if (size < INSERTION_THRESHOLD) {
+            if (leftmost) insertion_sort(begin, end);
+            else unguarded_insertion_sort(begin, end);
+            return;
+        }
+
+        choose_pivot(begin, end);
+        if (!leftmost && !(begin[-1] < *begin)) {
+            begin = partition_left(begin, end) + 1;
+            continue;
+        }
+
+        int already_partitioned;
+        i64 *pivot_pos = partition_right(begin, end, &already_partitioned);
+        i64 l_size = pivot_pos - begin, r_size = end - (pivot_pos + 1);
+
+        if (l_size < size / 8 || r_size < size / 8) {
+            if (--bad_allowed == 0) {
+                heap_sort(begin, end);
+                return;
+            }
+            // break up patterns that fool the median of 3
+            if (l_size >= INSERTION_THRESHOLD) {
+                swap(begin, begin + l_size / 4);
+                swap(pivot_pos - 1, pivot_pos - l_size / 4);
+                if (l_size > NINTHER_THRESHOLD) {
+                    swap(begin + 1, begin + (l_size / 4 + 1));
+                    swap(begin + 2, begin + (l_size / 4 + 2));
+                    swap(pivot_pos - 2, pivot_pos - (l_size / 4 + 1));
+                    swap(pivot_pos - 3, pivot_pos - (l_size / 4 + 2));
+                }
+            }
+            if (r_size >= INSERTION_THRESHOLD) {
+                swap(pivot_pos + 1, pivot_pos + (1 + r_size / 4));
+                swap(end - 1, end - r_size / 4);
+                if (r_size > NINTHER_THRESHOLD) {
+                    swap(pivot_pos + 2, pivot_pos + (2 + r_size / 4));
+                    swap(pivot_pos + 3, pivot_pos + (3 + r_size / 4));
+                    swap(end - 2, end - (1 + r_size / 4));
+                    swap(end - 3, end - (2 + r_size / 4));
+                }
+            }
+        } else if (already_partitioned && partial_insertion_sort(begin, pivot_pos) &&
+                   partial_insertion_sort(pivot_pos + 1, end)) {
+            return;
+        }
+
+        // recurse into the left part, loop on the right
+        pdqsort_loop(begin, pivot_pos, bad_allowed, leftmost);
+        begin = pivot_pos + 1;
+        leftmost = 0;
+    }
+}
+
+static int log2_floor(u64 n) {
+    int log = 0;
+    while (n >>= 1) log++;
+    return log;
+}
+
+static void pdqsort(i64 *d, i64 n) {
+    if (n > 1) pdqsort_loop(d, d + n, log2_floor((u64)n), 1);
+}
+
+// -----------------------------
+// Radix sort
+// -----------------------------
+// MSD radix sort on 8-bit digits, permuting each level in place with
+// American flag sort's cycle walk, so no second buffer is needed. The
+// first level starts at the highest bit where the values differ, and a
+// level whose values all share a digit is skipped. Buckets smaller than
+// RADIX_CUTOFF go to pdqsort.
+#define RADIX_CUTOFF 256
+#define SIGN_BIT (1ULL << 63)
+
+static inline int digit(i64 v, int shift) {
+    return (int)((((u64)v ^ SIGN_BIT) >> shift) & 0xFF);
+}
+
+static inline int next_shift(int shift) {
+    return shift > 8 ? shift - 8 : 0;
+}
+
+// Shift of the first digit for values whose bits differ at `diff`, or -1
+// when they are all equal. Digits may overlap at the bottom: bits above
+// the current digit are equal within a bucket.
+static int first_shift(u64 diff) {
+    if (diff == 0) return -1;
+    int high = log2_floor(diff);
+    return high > 7 ? high - 7 : 0;
+}
+
+static u64 differing_bits(const i64 *d, i64 n) {
+    u64 diff = 0;
+    for (i64 i = 1; i < n; i++) diff |= (u64)d[i] ^ (u64)d[0];
+    return diff;
+}
+
+// Moves every element into the bucket of its digit. head[b] starts at
+// the bucket's first slot and ends at tail[b]; slots before head[b] are
+// done. Rather than following one cycle of displaced elements at a time
+// (each move waiting on the last), each pass swaps every unplaced element
+// of a bucket straight to its destination, four independent swaps per
+// step as in ska_sort, and passes repeat until one bucket is left.
+static void permute(i64 *d, i64 *head, const i64 *tail, int shift) {
+    int remaining[256], count = 0;
+    for (int b = 0; b < 256; b++) {
+        if (head[b] < tail[b]) remaining[count++] = b;
+    }
+    while (count > 1) {
+        int kept = 0;
+        for (int r = 0; r < count; r++) {
+            int b = remaining[r];
+            i64 it = head[b], end = tail[b];
+            for (; it + 4 <= end; it += 4) {
+                int k0 = digit(d[it], shift), k1 = digit(d[it + 1], shift);
+                int k2 = digit(d[it + 2], shift), k3 = digit(d[it + 3], shift);
+                swap(d + it, d + head[k0]++);
+                swap(d + it + 1, d + head[k1]++);
+                swap(d + it + 2, d + head[k2]++);
+                swap(d + it + 3, d + head[k3]++);
+            }
+            for (; it < end; it++) swap(d + it, d + head[digit(d[it], shift)]++);
+            if (head[b] < tail[b]) remaining[kept++] = b;
+        }
+        count = kept;
+    }
+}
+
+static void radix_sort(i64 *d, i64 n, int shift) {
+    i64 count[256];
+    for (;;) {
+        if (n < RADIX_CUTOFF) {
+            pdqsort(d, n);
+            return;
+        }
+        memset(count, 0, sizeof(count));
+        for (i64 i = 0; i < n; i++) count[digit(d[i], shift)]++;
+        if (count[digit(d[0], shift)] != n) break;
+        if (shift == 0) return;
+        shift = next_shift(shift);
+    }
+
+    i64 head[256], tail[256], sum = 0;
+    for (int b = 0; b < 256; b++) {
+        head[b] = sum;
+        sum += count[b];
+        tail[b] = sum;
+    }
+    permute(d, head, tail, shift);
+    if (shift == 0) return;
+    for (int b = 0; b < 256; b++) {
+        if (count[b] > 1) radix_sort(d + tail[b] - count[b], count[b], next_shift(shift));
+    }
+}
+
+static void sort_ints(i64 *d, i64 n) {
+    int shift = first_shift(differing_bits(d, n));
+    if (shift >= 0) radix_sort(d, n, shift);
+}
+
+// -----------------------------
+// Parallel radix sort
+// -----------------------------
+// Three passes over the array run as parallel_run chunks: converting
+// float keys and finding the differing bits, then counting first digits
+// per chunk. The first-level permutation is a single walk on the calling
+// thread; after it the 256 buckets are independent and sort as chunks
+// (work stealing evens out uneven buckets).
+#define PARALLEL_SORT_MIN (1 << 17)
+#define SORT_CHUNK_MIN (1 << 16)
+#define SORT_CHUNKS 256
+
+typedef struct {
+    i64 *data;
+    i64 length;
+    int floats;                    // data holds doubles, sorted as keys
+    int chunk_count;
+    int shift;
+    i64 reference;                 // key of data[0]
+    u64 diff[SORT_CHUNKS];         // bits differing from reference, per chunk
+    i64 count[SORT_CHUNKS][256];   // first digits, per chunk
+    i64 start[257];                // bucket boundaries
+} SortJob;
+
+static void chunk_range(const SortJob *job, int chunk, i64 *lo, i64 *hi) {
+    *lo = job->length * chunk / job->chunk_count;
+    *hi = job->length * (chunk + 1) / job->chunk_count;
+}
+
+static void scan_chunk(void *ctx, int worker, int chunk) {
+    (void)worker;
+    SortJob *job = ctx;
+    i64 lo, hi;
+    chunk_range(job, chunk, &lo, &hi);
+    if (job->floats) to_keys(job->data + lo, hi - lo);
+    u64 diff = 0;
+    for (i64 i = lo; i < hi; i++) diff |= (u64)job->data[i] ^ (u64)job->reference;
+    job->diff[chunk] = diff;
+}
+
+static void count_chunk(void *ctx, int worker, int chunk) {
+    (void)worker;
+    SortJob *job = ctx;
+    i64 lo, hi, *count = job->count[chunk];
+    chunk_range(job, chunk, &lo, &hi);
+    memset(count, 0, sizeof(job->count[chunk]));
+    for (i64 i = lo; i < hi; i++) count[digit(job->data[i], job->shift)]++;
+}
+
+static void bucket_chunk(void *ctx, int worker, int bucket) {
+    (void)worker;
+    SortJob *job = ctx;
+    i64 *d = job->data + job->start[bucket];
+    i64 n = job->start[bucket + 1] - job->start[bucket];
+    if (n > 1 && job->shift > 0) radix_sort(d, n, next_shift(job->shift));
+    if (job->floats) from_keys(d, n);
+}
+
+static const char *sort_parallel(Array *array, int floats) {
+    i64 n = array->length;
+    if (n < PARALLEL_SORT_MIN || parallel_workers() == 1) {
+        if (floats) to_keys(array->data, n);
+        sort_ints(array->data, n);
+        if (floats) from_keys(array->data, n);
+        return NULL;
+    }
+
+    SortJob *job = malloc(sizeof(SortJob));
+    if (!job) return "out of memory";
+    job->data = array->data;
+    job->length = n;
+    job->floats = floats;
+    job->chunk_count = n / SORT_CHUNK_MIN < SORT_CHUNKS ? (int)(n / SORT_CHUNK_MIN) : SORT_CHUNKS;
+    job->reference = floats ? float_key(array->floats[0]) : array->ints[0];
+
+    parallel_run(job->chunk_count, scan_chunk, job);
+    u64 diff = 0;
+    for (int c = 0; c < job->chunk_count; c++) diff |= job->diff[c];
+    job->shift = first_shift(diff);
+    if (job->shift < 0) {
+        if (floats) from_keys(job->data, n);
+        free(job);
+        return NULL;
+    }
+
+    parallel_run(job->chunk_count, count_chunk, job);
+    i64 head[256], tail[256], sum = 0;
+    for (int b = 0; b < 256; b++) {
+        job->start[b] = head[b] = sum;
+        for (int c = 0; c < job->chunk_count; c++) sum += job->count[c][b];
+        tail[b] = sum;
+    }
+    job->start[256] = sum;
+    permute(job->data, head, tail, job->shift);
+
+    parallel_run(256, bucket_chunk, job);
+    free(job);
+    return NULL;
+}
+
+// -----------------------------
+// Selection and search
+// -----------------------------
+// Introselect: quickselect with pdqsort's pivots and partitions, which
+// sorts the remaining range once too many partitions came out lopsided.
+static void select_nth(i64 *d, i64 n, i64 nth) {
+    i64 *begin = d, *end = d + n, *target = d + nth;
+    int bad_allowed = log2_floor((u64)n);
+    while (end - begin >= INSERTION_THRESHOLD) {
+        choose_pivot(begin, end);
+        if (begin != d && !(begin[-1] < *begin)) {
+            // everything up to the returned position equals the pivot
+            i64 *pivot_pos = partition_left(begin, end);
+            if (target <= pivot_pos) return;
+            begin = pivot_pos + 1;
+            continue;
+        }
+
+        int already_partitioned;
+        i64 size = end - begin;
+        i64 *pivot_pos = partition_right(begin, end, &already_partitioned);
+        if (pivot_pos == target) return;
+        if ((pivot_pos - begin < size / 8 || end - pivot_pos - 1 < size / 8) && --bad_allowed == 0) {
+            pdqsort(begin, end - begin);
+            return;
+        }
+        if (target < pivot_pos) end = pivot_pos;
+        else begin = pivot_pos + 1;
+    }
+    if (begin == d) insertion_sort(begin, end);
+    else unguarded_insertion_sort(begin, end);
+}
+
+// Leaves the k largest of d[0..n-1] at the front in descending order.
+static void top_k(i64 *d, i64 n, i64 k) {
+    if (k == 0) return;
+    if (k < n) select_nth(d, n, n - k);
+    pdqsort(d + n - k, k);
+    for (i64 i = 0, j = n - 1; i < j; i++, j--) swap(d + i, d + j);
+}
+
+// Branchless lower bound: the loop has no data-dependent branch, only a
+// conditional move, so lookups cost no mispredictions.
+static i64 lower_bound(const i64 *d, i64 n, i64 key) {
+    if (n == 0) return 0;
+    const i64 *base = d;
+    while (n > 1) {
+        i64 half = n / 2;
+        base = base[half] < key ? base + half : base;
+        n -= half;
+    }
+    return (base - d) + (*base < key);
+}
+
+static i64 lower_bound_float(const double *d, i64 n, i64 key) {
+    if (n == 0) return 0;
+    const double *base = d;
+    while (n > 1) {
+        i64 half = n / 2;
+        base = float_key(base[half]) < key ? base + half : base;
+        n -= half;
+    }
+    return (base - d) + (float_key(*base) < key);
+}
+
+// -----------------------------
+// Builtins
+// -----------------------------
+#define ARG_ARRAY(n) ((Array *)args[n].p)
+
+const char *native_algo_sort_int(Value *args, Value *result) {
+    (void)result;
+    sort_ints(ARG_ARRAY(0)->ints, ARG_ARRAY(0)->length);
+    return NULL;
+}
+
+const char *native_algo_sort_float(Value *args, Value *result) {
+    (void)result;
+    Array *a = ARG_ARRAY(0);
+    to_keys(a->data, a->length);
+    pdqsort(a->data, a->length);
+    from_keys(a->data, a->length);
+    return NULL;
+}
+
+const char *native_algo_sort_parallel_int(Value *args, Value *result) {
+    (void)result;
+    return sort_parallel(ARG_ARRAY(0), 0);
+}
+
+const char *native_algo_sort_parallel_float(Value *args, Value *result) {
+    (void)result;
+    return sort_parallel(ARG_ARRAY(0), 1);
+}
+
+const char *native_algo_search_int(Value *args, Value *result) {
+    Array *a = ARG_ARRAY(0);
+    i64 i = lower_bound(a->ints, a->length, args[1].i);
+    result->i = i < a->length && a->ints[i] == args[1].i ? i : -1;
+    return NULL;
+}
+
+const char *native_algo_search_float(Value *args, Value *result) {
+    Array *a = ARG_ARRAY(0);
+    i64 key = float_key(args[1].f);
+    i64 i = lower_bound_float(a->floats, a->length, key);
+    result->i = i < a->length && float_key(a->floats[i]) == key ? i : -1;
+    return NULL;
+}
+
+const char *native_algo_bound_int(Value *args, Value *result) {
+    result->i = lower_bound(ARG_ARRAY(0)->ints, ARG_ARRAY(0)->length, args[1].i);
+    return NULL;
+}
+
+const char *native_algo_bound_float(Value *args, Value *result) {
+    result->i = lower_bound_float(ARG_ARRAY(0)->floats, ARG_ARRAY(0)->length, float_key(args[1].f));
+    return NULL;
+}
+
+const char *native_algo_nth_int(Value *args, Value *result) {
+    Array *a = ARG_ARRAY(0);
+    i64 k = args[1].i;
+    if (k < 0 || k >= a->length) return "nth index out of range";
+    select_nth(a->ints, a->length, k);
+    result->i = a->ints[k];
+    return NULL;
+}
+
+const char *native_algo_nth_float(Value *args, Value *result) {
+    Array *a = ARG_ARRAY(0);
+    i64 k = args[1].i;
+    if (k < 0 || k >= a->length) return "nth index out of range";
+    to_keys(a->data, a->length);
+    select_nth(a->data, a->length, k);
+    from_keys(a->data, a->length);
+    result->f = a->floats[k];
+    return NULL;
+}
+
+const char *native_algo_top_int(Value *args, Value *result) {
+    (void)result;
+    Array *a = ARG_ARRAY(0);
+    if (args[1].i < 0 || args[1].i > a->length) return "top count out of range";
+    top_k(a->ints, a->length, args[1].i);
+    return NULL;
+}
+
+const char *native_algo_top_float(Value *args, Value *result) {
+    (void)result;
+    Array *a = ARG_ARRAY(0);
+    if (args[1].i < 0 || args[1].i > a->length) return "top count out of range";
+    to_keys(a->data, a->length);
+    top_k(a->data, a->length, args[1].i);
+    from_keys(a->data, a->length);
+    return NULL;
+}
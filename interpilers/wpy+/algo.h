@@ -0,0 +1,35 @@
+#ifndef ALGO_H
+#define ALGO_H
+
+#include "compiler.h"
+
+// -----------------------------
+// pypstdio.algo: sorting, searching and selection
+// -----------------------------
+// All of these work in place on an int[] or float[] array's buffer. Int
+// arrays sort with an in-place MSD radix sort; float arrays with pattern-
+// defeating quicksort. Floats are ordered by their IEEE 754 total order
+// with every NaN moved last: -inf < ... < -0.0 < 0.0 < ... < inf < NaN.
+// algo.sort.parallel splits the radix sort over the parallel for thread
+// pool (WPY_THREADS) and gives the same result as algo.sort.
+const char *native_algo_sort_int(Value *args, Value *result);
+const char *native_algo_sort_float(Value *args, Value *result);
+const char *native_algo_sort_parallel_int(Value *args, Value *result);
+const char *native_algo_sort_parallel_float(Value *args, Value *result);
+
+// On sorted arrays: search returns the index of the first element equal
+// to x, or -1; bound returns how many elements are smaller than x.
+const char *native_algo_search_int(Value *args, Value *result);
+const char *native_algo_search_float(Value *args, Value *result);
+const char *native_algo_bound_int(Value *args, Value *result);
+const char *native_algo_bound_float(Value *args, Value *result);
+
+// nth(a, k) puts the element that sorting would put at a[k] there, with
+// nothing larger before it and nothing smaller after it, and returns it.
+// top(a, k) moves the k largest elements to a[0..k-1], largest first.
+const char *native_algo_nth_int(Value *args, Value *result);
+const char *native_algo_nth_float(Value *args, Value *result);
+const char *native_algo_top_int(Value *args, Value *result);
+const char *native_algo_top_float(Value *args, Value *result);
+
+#endif // ALGO_H
@@ -0,0 +1,776 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "array.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WPY_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// -----------------------------
+// Aligned storage
+// -----------------------------
+#define ARRAY_ALIGN 64
+
+// Zeroed, ARRAY_ALIGN-aligned block; the malloc'd pointer is kept just below it.
+static void *aligned_calloc(size_t bytes) {
+    void *raw = calloc(1, bytes + ARRAY_ALIGN + sizeof(void *));
+    if (!raw) return NULL;
+    uintptr_t addr = ((uintptr_t)raw + sizeof(void *) + ARRAY_ALIGN - 1) & ~(uintptr_t)(ARRAY_ALIGN - 1);
+    ((void **)addr)[-1] = raw;
+    return (void *)addr;
+}
+
+static void aligned_free(void *p) {
+    if (p) free(((void **)p)[-1]);
+}
+
+Array *array_new(VarType elem_type, long long length) {
+    if (length < 0 || length > ARRAY_MAX_LENGTH) return NULL;
+    Array *array = malloc(sizeof(Array));
+    if (!array) return NULL;
+    array->elem_type = elem_type;
+    array->length = length;
+    array->data = aligned_calloc((size_t)length * 8);
+    if (!array->data) {
+        free(array);
+        return NULL;
+    }
+    return array;
+}
+
+void array_free(Array *array) {
+    if (!array) return;
+    aligned_free(array->data);
+    free(array);
+}
+
+void array_print(FILE *out, const Array *array) {
+    fputc('[', out);
+    for (long long i = 0; i < array->length; i++) {
+        if (i) fputs(", ", out);
+        if (array->elem_type == VAR_INT) {
+            fprintf(out, "%lld", array->ints[i]);
+        } else {
+            char buf[32];
+            str_format_float(buf, sizeof(buf), array->floats[i]);
+            fputs(buf, out);
+        }
+    }
+    fputc(']', out);
+}
+
+// -----------------------------
+// Kernel table
+// -----------------------------
+// Integer kernels use unsigned arithmetic so that overflow wraps exactly
+// like the VM's scalar instructions instead of being undefined.
+typedef long long i64;
+typedef unsigned long long u64;
+
+typedef struct {
+    const char *name;
+    void (*fill_i)(i64 *d, i64 n, i64 v);
+    i64  (*sum_i)(const i64 *d, i64 n);
+    i64  (*min_i)(const i64 *d, i64 n);
+    i64  (*max_i)(const i64 *d, i64 n);
+    void (*scale_i)(i64 *d, i64 n, i64 k);
+    void (*add_i)(i64 *d, const i64 *s, i64 n);
+    i64  (*dot_i)(const i64 *a, const i64 *b, i64 n);
+    void (*fill_f)(double *d, i64 n, double v);
+    double (*sum_f)(const double *d, i64 n);
+    double (*min_f)(const double *d, i64 n);
+    double (*max_f)(const double *d, i64 n);
+    void (*scale_f)(double *d, i64 n, double k);
+    void (*add_f)(double *d, const double *s, i64 n);
+    double (*dot_f)(const double *a, const double *b, i64 n);
+    void (*sqrt_f)(double *d, i64 n);
+    void (*exp_f)(double *d, i64 n);
+    void (*log_f)(double *d, i64 n);
+} ArrayKernels;
+
+// -----------------------------
+// Scalar kernels (any CPU)
+// -----------------------------
+static void fill_i_scalar(i64 *d, i64 n, i64 v) { for (i64 i = 0; i < n; i++) d[i] = v; }
+static i64 sum_i_scalar(const i64 *d, i64 n) {
+    u64 s = 0;
+    for (i64 i = 0; i < n; i++) s += (u64)d[i];
+    return (i64)s;
+}
+static i64 min_i_scalar(const i64 *d, i64 n) {
+    i64 m = d[0];
+    for (i64 i = 1; i < n; i++) if (d[i] < m) m = d[i];
+    return m;
+}
+static i64 max_i_scalar(const i64 *d, i64 n) {
+    i64 m = d[0];
+    for (i64 i = 1; i < n; i++) if (d[i] > m) m = d[i];
+    return m;
+}
+static void scale_i_scalar(i64 *d, i64 n, i64 k) { for (i64 i = 0; i < n; i++) d[i] = (i64)((u64)d[i] * (u64)k); }
+static void add_i_scalar(i64 *d, const i64 *s, i64 n) { for (i64 i = 0; i < n; i++) d[i] = (i64)((u64)d[i] + (u64)s[i]); }
+static i64 dot_i_scalar(const i64 *a, const i64 *b, i64 n) {
+    u64 s = 0;
+    for (i64 i = 0; i < n; i++) s += (u64)a[i] * (u64)b[i];
+    return (i64)s;
+}
+
+static void fill_f_scalar(double *d, i64 n, double v) { for (i64 i = 0; i < n; i++) d[i] = v; }
+static double sum_f_scalar(const double *d, i64 n) {
+    double s = 0.0;
+    for (i64 i = 0; i < n; i++) s += d[i];
+    return s;
+}
+static double min_f_scalar(const double *d, i64 n) {
+    double m = d[0];
+    for (i64 i = 1; i < n; i++) if (d[i] < m) m = d[i];
+    return m;
+}
+static double max_f_scalar(const double *d, i64 n) {
+    double m = d[0];
+    for (i64 i = 1; i < n; i++) if (d[i] > m) m = d[i];
+    return m;
+}
+static void scale_f_scalar(double *d, i64 n, double k) { for (i64 i = 0; i < n; i++) d[i] *= k; }
+static void add_f_scalar(double *d, const double *s, i64 n) { for (i64 i = 0; i < n; i++) d[i] += s[i]; }
+static double dot_f_scalar(const double *a, const double *b, i64 n) {
+    double s = 0.0;
+    for (i64 i = 0; i < n; i++) s += a[i] * b[i];
+    return s;
+}
+
+static void sqrt_f_scalar(double *d, i64 n) { for (i64 i = 0; i < n; i++) d[i] = sqrt(d[i]); }
+static void exp_f_scalar(double *d, i64 n) { for (i64 i = 0; i < n; i++) d[i] = exp(d[i]); }
+static void log_f_scalar(double *d, i64 n) { for (i64 i = 0; i < n; i++) d[i] = log(d[i]); }
+
+static const ArrayKernels scalar_kernels = {
+    "scalar",
+    fill_i_scalar, sum_i_scalar, min_i_scalar, max_i_scalar, scale_i_scalar, add_i_scalar, dot_i_scalar,
+    fill_f_scalar, sum_f_scalar, min_f_scalar, max_f_scalar, scale_f_scalar, add_f_scalar, dot_f_scalar,
+    sqrt_f_scalar, exp_f_scalar, log_f_scalar
+};
+
+#ifdef WPY_X86_SIMD
+// -----------------------------
+// Vector exp / log
+// -----------------------------
+// Cephes' rational approximations (within 2 ulp of libm), written once on
+// GCC's generic 4 x double vectors. Inlined into the SSE2 and AVX2 kernels
+// below, they compile to 2 x 128-bit or 1 x 256-bit operations.
+typedef double v4d __attribute__((vector_size(32)));
+typedef __typeof__((v4d){0} < (v4d){0}) v4m;   // lane masks / 64-bit ints
+
+#define INLINE static inline __attribute__((always_inline))
+
+#define splat4(c) ((v4d){ (c), (c), (c), (c) })
+#define blend4(mask, a, b) ((v4d)(((mask) & (v4m)(a)) | (~(mask) & (v4m)(b))))
+
+// Runs a kernel on the last n < 4 elements, padded out with ones.
+#define TAIL4(kernel, d, n) do {                          \
+        v4d tail_ = { 1.0, 1.0, 1.0, 1.0 };               \
+        memcpy(&tail_, (d), sizeof(double) * (size_t)(n)); \
+        kernel(&tail_);                                   \
+        memcpy((d), &tail_, sizeof(double) * (size_t)(n)); \
+    } while (0)
+
+// 2^52 + 2^51: adding it rounds a double to an integer, kept in the low bits
+#define ROUND_MAGIC 0x1.8p52
+
+INLINE void exp4(v4d *io) {
+    v4d x = *io;
+    const v4d hi = splat4(709.782712893384);    // above: +inf
+    const v4d lo = splat4(-745.1332191019412);  // below: 0
+    v4m over = x > hi, under = x < lo;
+    v4d c = blend4(over, hi, blend4(under, lo, x));
+
+    // x = n ln2 + r, |r| <= ln2 / 2
+    v4d t = c * 1.4426950408889634073599 + ROUND_MAGIC;
+    v4d n = t - ROUND_MAGIC;
+    v4m ni = (v4m)t - (v4m)splat4(ROUND_MAGIC);
+    v4d r = c - n * 6.93145751953125E-1 - n * 1.42860682030941723212E-6;
+
+    v4d rr = r * r;
+    v4d px = r * ((1.26177193074810590878E-4 * rr + 3.02994407707441961300E-2) * rr +
+                  9.99999999999999999910E-1);
+    v4d qx = ((3.00198505138664455042E-6 * rr + 2.52448340349684104192E-3) * rr +
+              2.27265548208155028766E-1) * rr + 2.00000000000000000009E0;
+    v4d e = 1.0 + 2.0 * (px / (qx - px));
+
+    // scale by 2^n in two halves so subnormal and near-overflow results stay exact
+    v4m h = ni >> 1;
+    e = e * (v4d)((h + 1023) << 52) * (v4d)((ni - h + 1023) << 52);
+    e = blend4(over, splat4(INFINITY), e);
+    *io = blend4(under, splat4(0.0), e);
+}
+
+INLINE void log4(v4d *io) {
+    v4d x = *io;
+    // subnormals are scaled into the normal range first
+    v4m tiny = (x > 0.0) & (x < DBL_MIN);
+    v4d xs = blend4(tiny, x * 0x1p54, x);
+    v4m bits = (v4m)xs;
+
+    // x = m * 2^e with m in [sqrt(1/2), sqrt(2)), then f = m - 1
+    v4m ei = ((bits >> 52) & 0x7ff) - 1022 - (tiny & 54);
+    v4d m = (v4d)((bits & 0x000FFFFFFFFFFFFFLL) | 0x3FE0000000000000LL);
+    v4m small = m < 0.70710678118654752440;
+    ei = ei + small;
+    v4d f = blend4(small, m + m - 1.0, m - 1.0);
+    v4d e = (v4d)(ei + (v4m)splat4(ROUND_MAGIC)) - ROUND_MAGIC;
+
+    v4d z = f * f;
+    v4d p = ((((1.01875663804580931796E-4 * f + 4.97494994976747001425E-1) * f +
+               4.70579119878881725854E0) * f + 1.44989225341610930846E1) * f +
+             1.79368678507819816313E1) * f + 7.70838733755885391666E0;
+    v4d q = ((((f + 1.12873587189167450590E1) * f + 4.52279145837532221105E1) * f +
+              8.29875266912776603211E1) * f + 7.11544750618563894466E1) * f +
+            2.31251620126765340583E1;
+    v4d y = f * (z * p / q);
+    y = y - e * 2.121944400546905827679e-4;
+    y = y - 0.5 * z;
+    v4d r = f + y + e * 0.693359375;
+
+    r = blend4(x == 0.0, splat4(-INFINITY), r);
+    r = blend4(x < 0.0, splat4(NAN), r);
+    r = blend4(x == INFINITY, x, r);
+    *io = blend4(x != x, x, r);
+}
+#endif // WPY_X86_SIMD
+
+#ifdef WPY_X86_SIMD
+// -----------------------------
+// SSE2 kernels (every x86-64 CPU)
+// -----------------------------
+// SSE2 has no 64-bit integer compare or multiply, so min/max/scale/dot on
+// int arrays stay scalar at this level. Buffers start 64-byte aligned, so
+// the vector loops use aligned loads and stores from index 0.
+
+__attribute__((target("sse2")))
+static void fill_i_sse2(i64 *d, i64 n, i64 v) {
+    __m128i x = _mm_set1_epi64x(v);
+    i64 i = 0;
+    for (; i + 2 <= n; i += 2) _mm_store_si128((__m128i *)(d + i), x);
+    for (; i < n; i++) d[i] = v;
+}
+
+__attribute__((target("sse2")))
+static i64 sum_i_sse2(const i64 *d, i64 n) {
+    __m128i a0 = _mm_setzero_si128(), a1 = _mm_setzero_si128();
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) {
+        a0 = _mm_add_epi64(a0, _mm_load_si128((const __m128i *)(d + i)));
+        a1 = _mm_add_epi64(a1, _mm_load_si128((const __m128i *)(d + i + 2)));
+    }
+    i64 lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(a0, a1));
+    u64 s = (u64)lanes[0] + (u64)lanes[1];
+    for (; i < n; i++) s += (u64)d[i];
+    return (i64)s;
+}
+
+__attribute__((target("sse2")))
+static void add_i_sse2(i64 *d, const i64 *s, i64 n) {
+    i64 i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i x = _mm_load_si128((const __m128i *)(d + i));
+        __m128i y = _mm_load_si128((const __m128i *)(s + i));
+        _mm_store_si128((__m128i *)(d + i), _mm_add_epi64(x, y));
+    }
+    for (; i < n; i++) d[i] = (i64)((u64)d[i] + (u64)s[i]);
+}
+
+__attribute__((target("sse2")))
+static void fill_f_sse2(double *d, i64 n, double v) {
+    __m128d x = _mm_set1_pd(v);
+    i64 i = 0;
+    for (; i + 2 <= n; i += 2) _mm_store_pd(d + i, x);
+    for (; i < n; i++) d[i] = v;
+}
+
+__attribute__((target("sse2")))
+static double sum_f_sse2(const double *d, i64 n) {
+    __m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd();
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) {
+        a0 = _mm_add_pd(a0, _mm_load_pd(d + i));
+        a1 = _mm_add_pd(a1, _mm_load_pd(d + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(a0, a1));
+    double s = lanes[0] + lanes[1];
+    for (; i < n; i++) s += d[i];
+    return s;
+}
+
+__attribute__((target("sse2")))
+static double min_f_sse2(const double *d, i64 n) {
+    if (n < 2) return d[0];
+    __m128d m = _mm_loadu_pd(d);
+    i64 i = 2;
+    for (; i + 2 <= n; i += 2) m = _mm_min_pd(m, _mm_load_pd(d + i));
+    double lanes[2];
+    _mm_storeu_pd(lanes, m);
+    double r = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+    for (; i < n; i++) if (d[i] < r) r = d[i];
+    return r;
+}
+
+__attribute__((target("sse2")))
+static double max_f_sse2(const double *d, i64 n) {
+    if (n < 2) return d[0];
+    __m128d m = _mm_loadu_pd(d);
+    i64 i = 2;
+    for (; i + 2 <= n; i += 2) m = _mm_max_pd(m, _mm_load_pd(d + i));
+    double lanes[2];
+    _mm_storeu_pd(lanes, m);
+    double r = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+    for (; i < n; i++) if (d[i] > r) r = d[i];
+    return r;
+}
+
+__attribute__((target("sse2")))
+static void scale_f_sse2(double *d, i64 n, double k) {
+    __m128d x = _mm_set1_pd(k);
+    i64 i = 0;
+    for (; i + 2 <= n; i += 2) _mm_store_pd(d + i, _mm_mul_pd(_mm_load_pd(d + i), x));
+    for (; i < n; i++) d[i] *= k;
+}
+
+__attribute__((target("sse2")))
+static void add_f_sse2(double *d, const double *s, i64 n) {
+    i64 i = 0;
+    for (; i + 2 <= n; i += 2) _mm_store_pd(d + i, _mm_add_pd(_mm_load_pd(d + i), _mm_load_pd(s + i)));
+    for (; i < n; i++) d[i] += s[i];
+}
+
+__attribute__((target("sse2")))
+static double dot_f_sse2(const double *a, const double *b, i64 n) {
+    __m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd();
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) {
+        a0 = _mm_add_pd(a0, _mm_mul_pd(_mm_load_pd(a + i), _mm_load_pd(b + i)));
+        a1 = _mm_add_pd(a1, _mm_mul_pd(_mm_load_pd(a + i + 2), _mm_load_pd(b + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(a0, a1));
+    double s = lanes[0] + lanes[1];
+    for (; i < n; i++) s += a[i] * b[i];
+    return s;
+}
+
+__attribute__((target("sse2")))
+static void sqrt_f_sse2(double *d, i64 n) {
+    i64 i = 0;
+    for (; i + 2 <= n; i += 2) _mm_store_pd(d + i, _mm_sqrt_pd(_mm_load_pd(d + i)));
+    for (; i < n; i++) d[i] = sqrt(d[i]);
+}
+
+__attribute__((target("sse2")))
+static void exp_f_sse2(double *d, i64 n) {
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) exp4((v4d *)(d + i));
+    if (i < n) TAIL4(exp4, d + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void log_f_sse2(double *d, i64 n) {
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) log4((v4d *)(d + i));
+    if (i < n) TAIL4(log4, d + i, n - i);
+}
+
+static const ArrayKernels sse2_kernels = {
+    "sse2",
+    fill_i_sse2, sum_i_sse2, min_i_scalar, max_i_scalar, scale_i_scalar, add_i_sse2, dot_i_scalar,
+    fill_f_sse2, sum_f_sse2, min_f_sse2, max_f_sse2, scale_f_sse2, add_f_sse2, dot_f_sse2,
+    sqrt_f_sse2, exp_f_sse2, log_f_sse2
+};
+
+// -----------------------------
+// AVX2 kernels (picked at runtime)
+// -----------------------------
+
+// Low 64 bits of a 64x64-bit product per lane (AVX2 has no vpmullq).
+__attribute__((target("avx2")))
+static inline __m256i mullo_epi64_avx2(__m256i a, __m256i b) {
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i a_hi = _mm256_srli_epi64(a, 32);
+    __m256i b_hi = _mm256_srli_epi64(b, 32);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(a_hi, b), _mm256_mul_epu32(a, b_hi));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+static i64 hsum_epi64_avx2(__m256i v) {
+    i64 lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, v);
+    return (i64)((u64)lanes[0] + (u64)lanes[1] + (u64)lanes[2] + (u64)lanes[3]);
+}
+
+__attribute__((target("avx2")))
+static double hsum_pd_avx2(__m256d v) {
+    double lanes[4];
+    _mm256_storeu_pd(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+__attribute__((target("avx2")))
+static void fill_i_avx2(i64 *d, i64 n, i64 v) {
+    __m256i x = _mm256_set1_epi64x(v);
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_store_si256((__m256i *)(d + i), x);
+    for (; i < n; i++) d[i] = v;
+}
+
+__attribute__((target("avx2")))
+static i64 sum_i_avx2(const i64 *d, i64 n) {
+    __m256i a0 = _mm256_setzero_si256(), a1 = _mm256_setzero_si256();
+    i64 i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a0 = _mm256_add_epi64(a0, _mm256_load_si256((const __m256i *)(d + i)));
+        a1 = _mm256_add_epi64(a1, _mm256_load_si256((const __m256i *)(d + i + 4)));
+    }
+    u64 s = (u64)hsum_epi64_avx2(_mm256_add_epi64(a0, a1));
+    for (; i < n; i++) s += (u64)d[i];
+    return (i64)s;
+}
+
+__attribute__((target("avx2")))
+static i64 min_i_avx2(const i64 *d, i64 n) {
+    if (n < 4) return min_i_scalar(d, n);
+    __m256i m = _mm256_load_si256((const __m256i *)d);
+    i64 i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_load_si256((const __m256i *)(d + i));
+        m = _mm256_blendv_epi8(m, x, _mm256_cmpgt_epi64(m, x));
+    }
+    i64 lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, m);
+    i64 r = min_i_scalar(lanes, 4);
+    for (; i < n; i++) if (d[i] < r) r = d[i];
+    return r;
+}
+
+__attribute__((target("avx2")))
+static i64 max_i_avx2(const i64 *d, i64 n) {
+    if (n < 4) return max_i_scalar(d, n);
+    __m256i m = _mm256_load_si256((const __m256i *)d);
+    i64 i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_load_si256((const __m256i *)(d + i));
+        m = _mm256_blendv_epi8(m, x, _mm256_cmpgt_epi64(x, m));
+    }
+    i64 lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, m);
+    i64 r = max_i_scalar(lanes, 4);
+    for (; i < n; i++) if (d[i] > r) r = d[i];
+    return r;
+}
+
+__attribute__((target("avx2")))
+static void scale_i_avx2(i64 *d, i64 n, i64 k) {
+    __m256i x = _mm256_set1_epi64x(k);
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_load_si256((const __m256i *)(d + i));
+        _mm256_store_si256((__m256i *)(d + i), mullo_epi64_avx2(v, x));
+    }
+    for (; i < n; i++) d[i] = (i64)((u64)d[i] * (u64)k);
+}
+
+__attribute__((target("avx2")))
+static void add_i_avx2(i64 *d, const i64 *s, i64 n) {
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_load_si256((const __m256i *)(d + i));
+        __m256i y = _mm256_load_si256((const __m256i *)(s + i));
+        _mm256_store_si256((__m256i *)(d + i), _mm256_add_epi64(x, y));
+    }
+    for (; i < n; i++) d[i] = (i64)((u64)d[i] + (u64)s[i]);
+}
+
+__attribute__((target("avx2")))
+static i64 dot_i_avx2(const i64 *a, const i64 *b, i64 n) {
+    __m256i acc = _mm256_setzero_si256();
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_load_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_load_si256((const __m256i *)(b + i));
+        acc = _mm256_add_epi64(acc, mullo_epi64_avx2(x, y));
+    }
+    u64 s = (u64)hsum_epi64_avx2(acc);
+    for (; i < n; i++) s += (u64)a[i] * (u64)b[i];
+    return (i64)s;
+}
+
+__attribute__((target("avx2")))
+static void fill_f_avx2(double *d, i64 n, double v) {
+    __m256d x = _mm256_set1_pd(v);
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_store_pd(d + i, x);
+    for (; i < n; i++) d[i] = v;
+}
+
+__attribute__((target("avx2")))
+static double sum_f_avx2(const double *d, i64 n) {
+    __m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd();
+    i64 i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a0 = _mm256_add_pd(a0, _mm256_load_pd(d + i));
+        a1 = _mm256_add_pd(a1, _mm256_load_pd(d + i + 4));
+    }
+    double s = hsum_pd_avx2(_mm256_add_pd(a0, a1));
+    for (; i < n; i++) s += d[i];
+    return s;
+}
+
+__attribute__((target("avx2")))
+static double min_f_avx2(const double *d, i64 n) {
+    if (n < 4) return min_f_scalar(d, n);
+    __m256d m = _mm256_load_pd(d);
+    i64 i = 4;
+    for (; i + 4 <= n; i += 4) m = _mm256_min_pd(m, _mm256_load_pd(d + i));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, m);
+    double r = min_f_scalar(lanes, 4);
+    for (; i < n; i++) if (d[i] < r) r = d[i];
+    return r;
+}
+
+__attribute__((target("avx2")))
+static double max_f_avx2(const double *d, i64 n) {
+    if (n < 4) return max_f_scalar(d, n);
+    __m256d m = _mm256_load_pd(d);
+    i64 i = 4;
+    for (; i + 4 <= n; i += 4) m = _mm256_max_pd(m, _mm256_load_pd(d + i));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, m);
+    double r = max_f_scalar(lanes, 4);
+    for (; i < n; i++) if (d[i] > r) r = d[i];
+    return r;
+}
+
+__attribute__((target("avx2")))
+static void scale_f_avx2(double *d, i64 n, double k) {
+    __m256d x = _mm256_set1_pd(k);
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_store_pd(d + i, _mm256_mul_pd(_mm256_load_pd(d + i), x));
+    for (; i < n; i++) d[i] *= k;
+}
+
+__attribute__((target("avx2")))
+static void add_f_avx2(double *d, const double *s, i64 n) {
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_store_pd(d + i, _mm256_add_pd(_mm256_load_pd(d + i), _mm256_load_pd(s + i)));
+    for (; i < n; i++) d[i] += s[i];
+}
+
+__attribute__((target("avx2")))
+static double dot_f_avx2(const double *a, const double *b, i64 n) {
+    __m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd();
+    i64 i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a0 = _mm256_add_pd(a0, _mm256_mul_pd(_mm256_load_pd(a + i), _mm256_load_pd(b + i)));
+        a1 = _mm256_add_pd(a1, _mm256_mul_pd(_mm256_load_pd(a + i + 4), _mm256_load_pd(b + i + 4)));
+    }
+    double s = hsum_pd_avx2(_mm256_add_pd(a0, a1));
+    for (; i < n; i++) s += a[i] * b[i];
+    return s;
+}
+
+__attribute__((target("avx2")))
+static void sqrt_f_avx2(double *d, i64 n) {
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_store_pd(d + i, _mm256_sqrt_pd(_mm256_load_pd(d + i)));
+    for (; i < n; i++) d[i] = sqrt(d[i]);
+}
+
+__attribute__((target("avx2")))
+static void exp_f_avx2(double *d, i64 n) {
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) exp4((v4d *)(d + i));
+    if (i < n) TAIL4(exp4, d + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void log_f_avx2(double *d, i64 n) {
+    i64 i = 0;
+    for (; i + 4 <= n; i += 4) log4((v4d *)(d + i));
+    if (i < n) TAIL4(log4, d + i, n - i);
+}
+
+static const ArrayKernels avx2_kernels = {
+    "avx2",
+    fill_i_avx2, sum_i_avx2, min_i_avx2, max_i_avx2, scale_i_avx2, add_i_avx2, dot_i_avx2,
+    fill_f_avx2, sum_f_avx2, min_f_avx2, max_f_avx2, scale_f_avx2, add_f_avx2, dot_f_avx2,
+    sqrt_f_avx2, exp_f_avx2, log_f_avx2
+};
+#endif // WPY_X86_SIMD
+
+// -----------------------------
+// Runtime dispatch
+// -----------------------------
+static const ArrayKernels *active_kernels = NULL;
+
+static const ArrayKernels *kernels(void) {
+    if (active_kernels) return active_kernels;
+
+    const ArrayKernels *picked = &scalar_kernels;
+#ifdef WPY_X86_SIMD
+    const char *force = getenv("WPY_SIMD");
+    int allow_avx2 = !force || strcmp(force, "avx2") == 0;
+    int allow_sse2 = !force || strcmp(force, "scalar") != 0;
+    __builtin_cpu_init();
+    if (allow_avx2 && __builtin_cpu_supports("avx2")) picked = &avx2_kernels;
+    else if (allow_sse2 && __builtin_cpu_supports("sse2")) picked = &sse2_kernels;
+#endif
+    active_kernels = picked;
+    return picked;
+}
+
+const char *array_simd_level(void) {
+    return kernels()->name;
+}
+
+// -----------------------------
+// Builtins
+// -----------------------------
+#define ARG_ARRAY(n) ((Array *)args[n].p)
+
+const char *native_array_len(Value *args, Value *result) {
+    result->i = ARG_ARRAY(0)->length;
+    return NULL;
+}
+
+const char *native_array_fill_int(Value *args, Value *result) {
+    (void)result;
+    kernels()->fill_i(ARG_ARRAY(0)->ints, ARG_ARRAY(0)->length, args[1].i);
+    return NULL;
+}
+
+const char *native_array_fill_float(Value *args, Value *result) {
+    (void)result;
+    kernels()->fill_f(ARG_ARRAY(0)->floats, ARG_ARRAY(0)->length, args[1].f);
+    return NULL;
+}
+
+const char *native_array_sum_int(Value *args, Value *result) {
+    result->i = kernels()->sum_i(ARG_ARRAY(0)->ints, ARG_ARRAY(0)->length);
+    return NULL;
+}
+
+const char *native_array_sum_float(Value *args, Value *result) {
+    result->f = kernels()->sum_f(ARG_ARRAY(0)->floats, ARG_ARRAY(0)->length);
+    return NULL;
+}
+
+const char *native_array_min_int(Value *args, Value *result) {
+    if (ARG_ARRAY(0)->length == 0) return "min of an empty array";
+    result->i = kernels()->min_i(ARG_ARRAY(0)->ints, ARG_ARRAY(0)->length);
+    return NULL;
+}
+
+const char *native_array_min_float(Value *args, Value *result) {
+    if (ARG_ARRAY(0)->length == 0) return "min of an empty array";
+    result->f = kernels()->min_f(ARG_ARRAY(0)->floats, ARG_ARRAY(0)->length);
+    return NULL;
+}
+
+const char *native_array_max_int(Value *args, Value *result) {
+    if (ARG_ARRAY(0)->length == 0) return "max of an empty array";
+    result->i = kernels()->max_i(ARG_ARRAY(0)->ints, ARG_ARRAY(0)->length);
+    return NULL;
+}
+
+const char *native_array_max_float(Value *args, Value *result) {
+    if (ARG_ARRAY(0)->length == 0) return "max of an empty array";
+    result->f = kernels()->max_f(ARG_ARRAY(0)->floats, ARG_ARRAY(0)->length);
+    return NULL;
+}
+
+const char *native_array_scale_int(Value *args, Value *result) {
+    (void)result;
+    kernels()->scale_i(ARG_ARRAY(0)->ints, ARG_ARRAY(0)->length, args[1].i);
+    return NULL;
+}
+
+const char *native_array_scale_float(Value *args, Value *result) {
+    (void)result;
+    kernels()->scale_f(ARG_ARRAY(0)->floats, ARG_ARRAY(0)->length, args[1].f);
+    return NULL;
+}
+
+const char *native_array_add_int(Value *args, Value *result) {
+    (void)result;
+    if (ARG_ARRAY(0)->length != ARG_ARRAY(1)->length) return "arrays differ in length";
+    kernels()->add_i(ARG_ARRAY(0)->ints, ARG_ARRAY(1)->ints, ARG_ARRAY(0)->length);
+    return NULL;
+}
+
+const char *native_array_add_float(Value *args, Value *result) {
+    (void)result;
+    if (ARG_ARRAY(0)->length != ARG_ARRAY(1)->length) return "arrays differ in length";
+    kernels()->add_f(ARG_ARRAY(0)->floats, ARG_ARRAY(1)->floats, ARG_ARRAY(0)->length);
+    return NULL;
+}
+
+const char *native_array_dot_int(Value *args, Value *result) {
+    if (ARG_ARRAY(0)->length != ARG_ARRAY(1)->length) return "arrays differ in length";
+    result->i = kernels()->dot_i(ARG_ARRAY(0)->ints, ARG_ARRAY(1)->ints, ARG_ARRAY(0)->length);
+    return NULL;
+}
+
+const char *native_array_dot_float(Value *args, Value *result) {
+    if (ARG_ARRAY(0)->length != ARG_ARRAY(1)->length) return "arrays differ in length";
+    result->f = kernels()->dot_f(ARG_ARRAY(0)->floats, ARG_ARRAY(1)->floats, ARG_ARRAY(0)->length);
+    return NULL;
+}
+
+// -----------------------------
+// Math on float arrays (pypstdio.math.*)
+// -----------------------------
+const char *native_array_sqrt(Value *args, Value *result) {
+    (void)result;
+    kernels()->sqrt_f(ARG_ARRAY(0)->floats, ARG_ARRAY(0)->length);
+    return NULL;
+}
+
+const char *native_array_exp(Value *args, Value *result) {
+    (void)result;
+    kernels()->exp_f(ARG_ARRAY(0)->floats, ARG_ARRAY(0)->length);
+    return NULL;
+}
+
+const char *native_array_log(Value *args, Value *result) {
+    (void)result;
+    kernels()->log_f(ARG_ARRAY(0)->floats, ARG_ARRAY(0)->length);
+    return NULL;
+}
+
+// Small integer exponents use repeated squaring (a few multiplies, within a
+// few ulp of pow()); other exponents call pow() per element.
+const char *native_array_pow(Value *args, Value *result) {
+    (void)result;
+    double *d = ARG_ARRAY(0)->floats;
+    i64 n = ARG_ARRAY(0)->length;
+    double k = args[1].f;
+    if (k == floor(k) && fabs(k) <= 64) {
+        i64 e = (i64)fabs(k);
+        for (i64 i = 0; i < n; i++) {
+            double base = d[i], r = 1.0;
+            for (i64 bits = e; bits; bits >>= 1) {
+                if (bits & 1) r *= base;
+                base *= base;
+            }
+            d[i] = k < 0 ? 1.0 / r : r;
+        }
+    } else {
+        for (i64 i = 0; i < n; i++) d[i] = pow(d[i], k);
+    }
+    return NULL;
+}
@@ -0,0 +1,61 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include "compiler.h"
+
+// -----------------------------
+// pypstdio.variable.array.int / .float
+// -----------------------------
+// Elements are stored contiguously in a 64-byte aligned buffer so the bulk
+// operations below can run on whole SIMD registers.
+typedef struct {
+    VarType elem_type;    // VAR_INT or VAR_FLOAT
+    long long length;
+    union {
+        long long *ints;
+        double *floats;
+        void *data;
+    };
+} Array;
+
+// Longest array whose 8-byte elements, plus the alignment slack of
+// aligned_calloc, fit in a size_t.
+#define ARRAY_MAX_LENGTH ((long long)((SIZE_MAX - 128) / 8 < LLONG_MAX ? (SIZE_MAX - 128) / 8 : LLONG_MAX))
+
+// NULL when out of memory or when length is negative or over
+// ARRAY_MAX_LENGTH.
+Array *array_new(VarType elem_type, long long length);
+void array_free(Array *array);
+void array_print(FILE *out, const Array *array);
+
+// Name of the kernel set picked for this CPU ("avx2", "sse2" or "scalar").
+// The WPY_SIMD environment variable may force a lower level.
+const char *array_simd_level(void);
+
+// -----------------------------
+// Builtins (see builtins.c)
+// -----------------------------
+const char *native_array_len(Value *args, Value *result);
+const char *native_array_fill_int(Value *args, Value *result);
+const char *native_array_fill_float(Value *args, Value *result);
+const char *native_array_sum_int(Value *args, Value *result);
+const char *native_array_sum_float(Value *args, Value *result);
+const char *native_array_min_int(Value *args, Value *result);
+const char *native_array_min_float(Value *args, Value *result);
+const char *native_array_max_int(Value *args, Value *result);
+const char *native_array_max_float(Value *args, Value *result);
+const char *native_array_scale_int(Value *args, Value *result);
+const char *native_array_scale_float(Value *args, Value *result);
+const char *native_array_add_int(Value *args, Value *result);
+const char *native_array_add_float(Value *args, Value *result);
+const char *native_array_dot_int(Value *args, Value *result);
+const char *native_array_dot_float(Value *args, Value *result);
+const char *native_array_sqrt(Value *args, Value *result);
+const char *native_array_exp(Value *args, Value *result);
+const char *native_array_log(Value *args, Value *result);
+const char *native_array_pow(Value *args, Value *result);
+
+#endif // ARRAY_H
@@ -0,0 +1,153 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L   // clock_gettime
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "bench.h"
+
+struct BenchRun {
+    const char *name;
+    long long warmup;
+    long long iterations;
+    long long round;       // iterations started so far
+    long long started;     // clock when the current iteration began
+    long long total;       // sum of the timed iterations
+    long long min;
+    long long *samples;
+    long long kept;        // samples in use
+    uint64_t random;       // picks which samples to keep past BENCH_SAMPLES
+};
+
+long long bench_clock(void) {
+    struct timespec now;
+#ifndef _WIN32
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#else
+    timespec_get(&now, TIME_UTC);
+#endif
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// What reading the clock twice in a row measures: the cheapest of a few
+// tries, taken once and subtracted from every timing.
+static long long clock_cost = -1;
+
+static long long measure_clock_cost(void) {
+    long long best = LLONG_MAX;
+    for (int i = 0; i < 64; i++) {
+        long long a = bench_clock();
+        long long b = bench_clock();
+        if (b - a < best) best = b - a;
+    }
+    return best;
+}
+
+BenchRun *bench_start(const char *name, long long iterations, long long warmup, const char **error) {
+    if (iterations < 1) {
+        *error = "pypstdio.bench needs at least one iteration";
+        return NULL;
+    }
+    if (warmup == BENCH_DEFAULT_WARMUP) {
+        warmup = iterations / 10 > 0 ? iterations / 10 : 1;
+    } else if (warmup < 0) {
+        *error = "negative pypstdio.bench warmup count";
+        return NULL;
+    }
+    BenchRun *run = calloc(1, sizeof(BenchRun));
+    long long capacity = iterations < BENCH_SAMPLES ? iterations : BENCH_SAMPLES;
+    if (run) run->samples = malloc(sizeof(long long) * (size_t)capacity);
+    if (!run || !run->samples) {
+        free(run);
+        *error = "out of memory";
+        return NULL;
+    }
+    if (clock_cost < 0) clock_cost = measure_clock_cost();
+    run->name = name;
+    run->warmup = warmup;
+    run->iterations = iterations;
+    run->min = LLONG_MAX;
+    run->random = 0x9E3779B97F4A7C15ull;
+    return run;
+}
+
+// Keeps a uniform sample of the timings (reservoir sampling, Algorithm R):
+// timing number t replaces a random kept one with probability
+// BENCH_SAMPLES / t.
+static void record(BenchRun *run, long long t) {
+    run->total += t;
+    if (t < run->min) run->min = t;
+    long long seen = run->round - run->warmup;   // timings so far, counting t
+    if (run->kept < BENCH_SAMPLES) {
+        run->samples[run->kept++] = t;
+        return;
+    }
+    run->random ^= run->random << 13;
+    run->random ^= run->random >> 7;
+    run->random ^= run->random << 17;
+    uint64_t slot = run->random % (uint64_t)seen;
+    if (slot < BENCH_SAMPLES) run->samples[slot] = t;
+}
+
+static int compare_times(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Three significant digits in the largest unit that keeps the value >= 1.
+static void format_time(char *buf, size_t size, double ns) {
+    static const char *const units[] = { "ns", "us", "ms", "s" };
+    int unit = 0;
+    while (unit < 3 && ns >= 999.5) {
+        ns /= 1000;
+        unit++;
+    }
+    int decimals = ns < 9.995 ? 2 : ns < 99.95 ? 1 : 0;
+    snprintf(buf, size, "%.*f %s", decimals, ns, units[unit]);
+}
+
+static void format_rate(char *buf, size_t size, double rate) {
+    static const char *const suffixes[] = { "", "K", "M", "G" };
+    int suffix = 0;
+    while (suffix < 3 && rate >= 999.5) {
+        rate /= 1000;
+        suffix++;
+    }
+    int decimals = rate < 9.995 ? 2 : rate < 99.95 ? 1 : 0;
+    snprintf(buf, size, "%.*f%s", decimals, rate, suffixes[suffix]);
+}
+
+// Nearest-rank percentile of the sorted samples.
+static long long percentile(const BenchRun *run, int p) {
+    long long rank = (run->kept * p + 99) / 100;
+    return run->samples[rank > 0 ? rank - 1 : 0];
+}
+
+static void report(BenchRun *run, FILE *out) {
+    qsort(run->samples, (size_t)run->kept, sizeof(long long), compare_times);
+    char min[32], median[32], p99[32], rate[32];
+    format_time(min, sizeof(min), (double)run->min);
+    format_time(median, sizeof(median), (double)percentile(run, 50));
+    format_time(p99, sizeof(p99), (double)percentile(run, 99));
+    double total = run->total > 0 ? (double)run->total : 1.0;
+    format_rate(rate, sizeof(rate), (double)run->iterations * 1e9 / total);
+    fprintf(out, "bench %s: %lld runs, min %s, median %s, p99 %s, %s ops/s\n",
+            run->name, run->iterations, min, median, p99, rate);
+}
+
+int bench_next(BenchRun *run, FILE *out) {
+    if (run->round > run->warmup) {
+        long long t = bench_clock() - run->started - clock_cost;
+        record(run, t > 0 ? t : 0);
+    }
+    if (run->round == run->warmup + run->iterations) {
+        report(run, out);
+        free(run->samples);
+        free(run);
+        return 0;
+    }
+    run->round++;
+    if (run->round > run->warmup) run->started = bench_clock();
+    return 1;
+}
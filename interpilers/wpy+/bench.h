@@ -0,0 +1,36 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <limits.h>
+
+// -----------------------------
+// pypstdio.bench
+// -----------------------------
+// A run of a bench block: `warmup` untimed iterations, then `iterations`
+// timed ones, each timed on its own with the monotonic clock (less the
+// cost of reading it, measured once per process). The VM
+// calls bench_next() before every iteration; once all have run it prints
+//
+//   bench <name>: <n> runs, min <t>, median <t>, p99 <t>, <rate> ops/s
+//
+// to `out` and frees the run. Up to BENCH_SAMPLES timings are kept; past
+// that a uniform sample of them is, so memory does not grow with the
+// iteration count (min and ops/s stay exact).
+#define BENCH_SAMPLES (1 << 20)
+// passed when the script gives no warmup count: a tenth of the
+// iterations, at least one
+#define BENCH_DEFAULT_WARMUP LLONG_MIN
+
+typedef struct BenchRun BenchRun;
+
+// NULL, with *error set, if the counts are out of range or memory runs out.
+BenchRun *bench_start(const char *name, long long iterations, long long warmup, const char **error);
+
+// Returns 1 if another iteration should run, 0 when the run is over.
+int bench_next(BenchRun *run, FILE *out);
+
+// Monotonic clock in nanoseconds.
+long long bench_clock(void);
+
+#endif // BENCH_H
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "builder.h"
+
+Builder *builder_new(long long capacity_hint) {
+    Builder *b = calloc(1, sizeof(Builder));
+    if (!b) return NULL;
+    b->capacity = capacity_hint > 16 ? capacity_hint : 16;
+    b->data = malloc((size_t)b->capacity);
+    if (!b->data) {
+        free(b);
+        return NULL;
+    }
+    return b;
+}
+
+void builder_free(Builder *b) {
+    if (!b) return;
+    for (int i = 0; i < b->snapshot_count; i++) str_free(b->snapshots[i]);
+    free(b->snapshots);
+    free(b->data);
+    free(b);
+}
+
+void builder_print(FILE *out, const Builder *b) {
+    fwrite(b->data, 1, (size_t)b->length, out);
+}
+
+int builder_reserve(Builder *b, long long extra) {
+    if (b->length + extra <= b->capacity) return 1;
+    long long capacity = b->capacity;
+    while (capacity < b->length + extra) capacity *= 2;
+    char *data = realloc(b->data, (size_t)capacity);
+    if (!data) return 0;
+    b->data = data;
+    b->capacity = capacity;
+    return 1;
+}
+
+static const char *append(Builder *b, const char *text, long long length) {
+    if (!builder_reserve(b, length)) return "out of memory";
+    memcpy(b->data + b->length, text, (size_t)length);
+    b->length += length;
+    b->snapshot_fresh = 0;
+    return NULL;
+}
+
+// -----------------------------
+// Builtins
+// -----------------------------
+#define ARG_BUILDER(n) ((Builder *)args[n].p)
+
+const char *native_builder_append_str(Value *args, Value *result) {
+    (void)result;
+    const char *text = str_chars(args[1].str);
+    if (!text) return "out of memory";
+    return append(ARG_BUILDER(0), text, args[1].str->length);
+}
+
+const char *native_builder_append_int(Value *args, Value *result) {
+    (void)result;
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%lld", args[1].i);
+    return append(ARG_BUILDER(0), buf, n);
+}
+
+const char *native_builder_append_char(Value *args, Value *result) {
+    (void)result;
+    char c = (char)args[1].i;
+    return append(ARG_BUILDER(0), &c, 1);
+}
+
+const char *native_builder_append_float(Value *args, Value *result) {
+    (void)result;
+    char buf[32];
+    int n = str_format_float(buf, sizeof(buf), args[1].f);
+    return append(ARG_BUILDER(0), buf, n);
+}
+
+const char *native_builder_append_bool(Value *args, Value *result) {
+    (void)result;
+    return args[1].i ? append(ARG_BUILDER(0), "true", 4) : append(ARG_BUILDER(0), "false", 5);
+}
+
+const char *native_builder_len(Value *args, Value *result) {
+    result->i = ARG_BUILDER(0)->length;
+    return NULL;
+}
+
+// The contents as a string. Unchanged contents reuse the previous string.
+const char *native_builder_str(Value *args, Value *result) {
+    Builder *b = ARG_BUILDER(0);
+    if (b->snapshot_fresh) {
+        result->str = b->snapshots[b->snapshot_count - 1];
+        return NULL;
+    }
+    if (b->snapshot_count == b->snapshot_capacity) {
+        int capacity = b->snapshot_capacity ? b->snapshot_capacity * 2 : 8;
+        Str **grown = realloc(b->snapshots, sizeof(Str *) * capacity);
+        if (!grown) return "out of memory";
+        b->snapshots = grown;
+        b->snapshot_capacity = capacity;
+    }
+    Str *s = str_new(b->data, b->length);
+    if (!s) return "out of memory";
+    b->snapshots[b->snapshot_count++] = s;
+    b->snapshot_fresh = 1;
+    result->str = s;
+    return NULL;
+}
+
+const char *native_builder_clear(Value *args, Value *result) {
+    (void)result;
+    Builder *b = ARG_BUILDER(0);
+    b->length = 0;
+    b->snapshot_fresh = 0;
+    return NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef BUILDER_H
+#define BUILDER_H
+
+#include <stdio.h>
+#include "compiler.h"
+
+// -----------------------------
+// pypstdio.variable.builder
+// -----------------------------
+// Growable text buffer. Appends double the capacity when it runs out, so
+// building n bytes costs O(n) time and memory however it is split up.
+typedef struct {
+    char *data;
+    long long length;
+    long long capacity;
+    Str **snapshots;     // strings returned by builder.str, freed with the builder
+    int snapshot_count;
+    int snapshot_capacity;
+    int snapshot_fresh;  // the last snapshot still matches the contents
+} Builder;
+
+Builder *builder_new(long long capacity_hint);
+void builder_free(Builder *b);
+void builder_print(FILE *out, const Builder *b);
+// Makes room for `extra` more bytes, growing geometrically; 0 if out of memory.
+int builder_reserve(Builder *b, long long extra);
+
+// -----------------------------
+// Builtins (see builtins.c)
+// -----------------------------
+const char *native_builder_append_str(Value *args, Value *result);
+const char *native_builder_append_int(Value *args, Value *result);
+const char *native_builder_append_char(Value *args, Value *result);
+const char *native_builder_append_float(Value *args, Value *result);
+const char *native_builder_append_bool(Value *args, Value *result);
+const char *native_builder_len(Value *args, Value *result);
+const char *native_builder_str(Value *args, Value *result);
+const char *native_builder_clear(Value *args, Value *result);
+
+#endif // BUILDER_H
@@ -0,0 +1,247 @@
+#include <string.h>
+#include "builtins.h"
+#include "array.h"
+#include "algo.h"
+#include "map.h"
+#include "builder.h"
+#include "mathlib.h"
+#include "file.h"
+#include "input.h"
+#include "channel.h"
+#include "events.h"
+#include "interpiler.h"
+
+// -----------------------------
+// Builtin table
+// -----------------------------
+#define AI VAR_ARRAY_INT
+#define AF VAR_ARRAY_FLOAT
+#define MI VAR_MAP_INT
+#define MS VAR_MAP_STR
+#define SB VAR_BUILDER
+#define FR VAR_READER
+#define FW VAR_WRITER
+#define CI VAR_CHANNEL_INT
+#define CF VAR_CHANNEL_FLOAT
+#define II VAR_ITER_INT
+#define IF VAR_ITER_FLOAT
+
+const Builtin builtins[] = {
+    // Arrays
+    { "array.len",   VAR_INT,     1, { AI },              native_array_len },
+    { "array.len",   VAR_INT,     1, { AF },              native_array_len },
+    { "array.fill",  VAR_UNKNOWN, 2, { AI, VAR_INT },     native_array_fill_int },
+    { "array.fill",  VAR_UNKNOWN, 2, { AF, VAR_FLOAT },   native_array_fill_float },
+    { "array.sum",   VAR_INT,     1, { AI },              native_array_sum_int },
+    { "array.sum",   VAR_FLOAT,   1, { AF },              native_array_sum_float },
+    { "array.min",   VAR_INT,     1, { AI },              native_array_min_int },
+    { "array.min",   VAR_FLOAT,   1, { AF },              native_array_min_float },
+    { "array.max",   VAR_INT,     1, { AI },              native_array_max_int },
+    { "array.max",   VAR_FLOAT,   1, { AF },              native_array_max_float },
+    { "array.scale", VAR_UNKNOWN, 2, { AI, VAR_INT },     native_array_scale_int },
+    { "array.scale", VAR_UNKNOWN, 2, { AF, VAR_FLOAT },   native_array_scale_float },
+    { "array.add",   VAR_UNKNOWN, 2, { AI, AI },          native_array_add_int },
+    { "array.add",   VAR_UNKNOWN, 2, { AF, AF },          native_array_add_float },
+    { "array.dot",   VAR_INT,     2, { AI, AI },          native_array_dot_int },
+    { "array.dot",   VAR_FLOAT,   2, { AF, AF },          native_array_dot_float },
+
+    // Sorting, searching and selection, in place
+    { "algo.sort",          VAR_UNKNOWN, 1, { AI },              native_algo_sort_int },
+    { "algo.sort",          VAR_UNKNOWN, 1, { AF },              native_algo_sort_float },
+    { "algo.sort.parallel", VAR_UNKNOWN, 1, { AI },              native_algo_sort_parallel_int },
+    { "algo.sort.parallel", VAR_UNKNOWN, 1, { AF },              native_algo_sort_parallel_float },
+    { "algo.search",        VAR_INT,     2, { AI, VAR_INT },     native_algo_search_int },
+    { "algo.search",        VAR_INT,     2, { AF, VAR_FLOAT },   native_algo_search_float },
+    { "algo.bound",         VAR_INT,     2, { AI, VAR_INT },     native_algo_bound_int },
+    { "algo.bound",         VAR_INT,     2, { AF, VAR_FLOAT },   native_algo_bound_float },
+    { "algo.nth",           VAR_INT,     2, { AI, VAR_INT },     native_algo_nth_int },
+    { "algo.nth",           VAR_FLOAT,   2, { AF, VAR_INT },     native_algo_nth_float },
+    { "algo.top",           VAR_UNKNOWN, 2, { AI, VAR_INT },     native_algo_top_int },
+    { "algo.top",           VAR_UNKNOWN, 2, { AF, VAR_INT },     native_algo_top_float },
+
+    // Math: scalars, or whole float arrays in place
+    { "math.sqrt",   VAR_FLOAT,   1, { VAR_FLOAT },            native_math_sqrt },
+    { "math.exp",    VAR_FLOAT,   1, { VAR_FLOAT },            native_math_exp },
+    { "math.log",    VAR_FLOAT,   1, { VAR_FLOAT },            native_math_log },
+    { "math.pow",    VAR_FLOAT,   2, { VAR_FLOAT, VAR_FLOAT }, native_math_pow },
+    { "math.sqrt",   VAR_UNKNOWN, 1, { AF },                   native_array_sqrt },
+    { "math.exp",    VAR_UNKNOWN, 1, { AF },                   native_array_exp },
+    { "math.log",    VAR_UNKNOWN, 1, { AF },                   native_array_log },
+    { "math.pow",    VAR_UNKNOWN, 2, { AF, VAR_FLOAT },        native_array_pow },
+
+    // Maps
+    { "map.set",     VAR_UNKNOWN, 3, { MI, VAR_INT, VAR_INT },    native_map_set },
+    { "map.set",     VAR_UNKNOWN, 3, { MS, VAR_STRING, VAR_INT }, native_map_set },
+    { "map.get",     VAR_INT,     2, { MI, VAR_INT },             native_map_get },
+    { "map.get",     VAR_INT,     2, { MS, VAR_STRING },          native_map_get },
+    { "map.get",     VAR_INT,     3, { MI, VAR_INT, VAR_INT },    native_map_get_or },
+    { "map.get",     VAR_INT,     3, { MS, VAR_STRING, VAR_INT }, native_map_get_or },
+    { "map.has",     VAR_BOOL,    2, { MI, VAR_INT },             native_map_has },
+    { "map.has",     VAR_BOOL,    2, { MS, VAR_STRING },          native_map_has },
+    { "map.remove",  VAR_BOOL,    2, { MI, VAR_INT },             native_map_remove },
+    { "map.remove",  VAR_BOOL,    2, { MS, VAR_STRING },          native_map_remove },
+    { "map.len",     VAR_INT,     1, { MI },                      native_map_len },
+    { "map.len",     VAR_INT,     1, { MS },                      native_map_len },
+    { "map.next",    VAR_INT,     2, { MI, VAR_INT },             native_map_next },
+    { "map.next",    VAR_INT,     2, { MS, VAR_INT },             native_map_next },
+    { "map.key",     VAR_INT,     2, { MI, VAR_INT },             native_map_key },
+    { "map.key",     VAR_STRING,  2, { MS, VAR_INT },             native_map_key },
+    { "map.value",   VAR_INT,     2, { MI, VAR_INT },             native_map_value },
+    { "map.value",   VAR_INT,     2, { MS, VAR_INT },             native_map_value },
+
+    // String builders
+    { "builder.append", VAR_UNKNOWN, 2, { SB, VAR_STRING }, native_builder_append_str },
+    { "builder.append", VAR_UNKNOWN, 2, { SB, VAR_INT },    native_builder_append_int },
+    { "builder.append", VAR_UNKNOWN, 2, { SB, VAR_CHAR },   native_builder_append_char },
+    { "builder.append", VAR_UNKNOWN, 2, { SB, VAR_FLOAT },  native_builder_append_float },
+    { "builder.append", VAR_UNKNOWN, 2, { SB, VAR_BOOL },   native_builder_append_bool },
+    { "builder.len",    VAR_INT,     1, { SB },             native_builder_len },
+    { "builder.str",    VAR_STRING,  1, { SB },             native_builder_str },
+    { "builder.clear",  VAR_UNKNOWN, 1, { SB },             native_builder_clear },
+
+    // Files: line readers and buffered writers
+    { "file.next",      VAR_BOOL,    1, { FR },                      native_file_next },
+    { "file.line",      VAR_STRING,  1, { FR },                      native_file_line },
+    { "file.len",       VAR_INT,     1, { FR },                      native_file_len },
+    { "file.number",    VAR_INT,     1, { FR },                      native_file_number },
+    { "file.contains",  VAR_BOOL,    2, { FR, VAR_STRING },          native_file_contains },
+    { "file.starts",    VAR_BOOL,    2, { FR, VAR_STRING },          native_file_starts },
+    { "file.field",     VAR_STRING,  3, { FR, VAR_CHAR, VAR_INT },   native_file_field },
+    { "file.write",     VAR_UNKNOWN, 2, { FW, VAR_STRING },          native_file_write_str },
+    { "file.write",     VAR_UNKNOWN, 2, { FW, VAR_INT },             native_file_write_int },
+    { "file.write",     VAR_UNKNOWN, 2, { FW, VAR_CHAR },            native_file_write_char },
+    { "file.write",     VAR_UNKNOWN, 2, { FW, VAR_FLOAT },           native_file_write_float },
+    { "file.write",     VAR_UNKNOWN, 2, { FW, VAR_BOOL },            native_file_write_bool },
+    { "file.write",     VAR_UNKNOWN, 2, { FW, FR },                  native_file_write_line },
+    { "file.flush",     VAR_UNKNOWN, 1, { FW },                      native_file_flush },
+    { "file.temp",      VAR_STRING,  1, { VAR_STRING },              native_file_temp },
+
+    // CSV and other delimited records, read through a file reader
+    { "csv.next",       VAR_BOOL,    2, { FR, VAR_CHAR },            native_csv_next },
+    { "csv.count",      VAR_INT,     1, { FR },                      native_csv_count },
+    { "csv.field",      VAR_STRING,  2, { FR, VAR_INT },             native_csv_field },
+    { "csv.int",        VAR_INT,     2, { FR, VAR_INT },             native_csv_int },
+    { "csv.float",      VAR_FLOAT,   2, { FR, VAR_INT },             native_csv_float },
+    { "csv.equals",     VAR_BOOL,    3, { FR, VAR_INT, VAR_STRING }, native_csv_equals },
+
+    // Standard input: whitespace-separated tokens, or lines
+    { "input.int",      VAR_INT,     0, { 0 },                       native_input_int },
+    { "input.float",    VAR_FLOAT,   0, { 0 },                       native_input_float },
+    { "input.word",     VAR_STRING,  0, { 0 },                       native_input_word },
+    { "input.line",     VAR_STRING,  0, { 0 },                       native_input_line },
+    { "input.more",     VAR_BOOL,    0, { 0 },                       native_input_more },
+    { "input.eof",      VAR_BOOL,    0, { 0 },                       native_input_eof },
+    { "input.read",     VAR_INT,     1, { AI },                      native_input_read },
+    { "input.read",     VAR_INT,     1, { AF },                      native_input_read },
+
+    // Channels between tasks
+    { "channel.send",   VAR_UNKNOWN, 2, { CI, VAR_INT },             native_channel_send },
+    { "channel.send",   VAR_UNKNOWN, 2, { CF, VAR_FLOAT },           native_channel_send },
+    { "channel.recv",   VAR_INT,     1, { CI },                      native_channel_recv },
+    { "channel.recv",   VAR_FLOAT,   1, { CF },                      native_channel_recv },
+    { "channel.recv",   VAR_INT,     2, { CI, VAR_INT },             native_channel_recv_or },
+    { "channel.recv",   VAR_FLOAT,   2, { CF, VAR_FLOAT },           native_channel_recv_or },
+    { "channel.close",  VAR_UNKNOWN, 1, { CI },                      native_channel_close },
+    { "channel.close",  VAR_UNKNOWN, 1, { CF },                      native_channel_close },
+    { "channel.len",    VAR_INT,     1, { CI },                      native_channel_len },
+    { "channel.len",    VAR_INT,     1, { CF },                      native_channel_len },
+    { "task.wait",      VAR_UNKNOWN, 0, { 0 },                       native_task_wait },
+
+    // Iterators: generators and what pypstdio.iter.map / filter / take make
+    { "iter.next",      VAR_INT,     1, { II },                      native_iter_next },
+    { "iter.next",      VAR_FLOAT,   1, { IF },                      native_iter_next },
+    { "iter.next",      VAR_INT,     2, { II, VAR_INT },             native_iter_next_or },
+    { "iter.next",      VAR_FLOAT,   2, { IF, VAR_FLOAT },           native_iter_next_or },
+    { "iter.more",      VAR_BOOL,    1, { II },                      native_iter_more },
+    { "iter.more",      VAR_BOOL,    1, { IF },                      native_iter_more },
+    { "iter.chunk",     VAR_INT,     2, { II, AI },                  native_iter_chunk },
+    { "iter.chunk",     VAR_INT,     2, { IF, AF },                  native_iter_chunk },
+
+    // Event loop: sockets, pipes and timers for async functions
+    { "net.listen",     VAR_INT,     2, { VAR_STRING, VAR_INT },     native_net_listen },
+    { "net.port",       VAR_INT,     1, { VAR_INT },                 native_net_port },
+    { "net.pair",       VAR_UNKNOWN, 1, { AI },                      native_net_pair },
+    { "pipe.open",      VAR_UNKNOWN, 1, { AI },                      native_pipe_open },
+    { "io.close",       VAR_UNKNOWN, 1, { VAR_INT },                 native_io_close },
+    { "timer.now",      VAR_INT,     0, { 0 },                       native_timer_now },
+    { "net.accept",     VAR_INT,     1, { VAR_INT },                 native_net_accept },
+    { "net.connect",    VAR_INT,     2, { VAR_STRING, VAR_INT },     native_net_connect },
+    { "io.read",        VAR_INT,     2, { VAR_INT, SB },             native_io_read },
+    { "io.write",       VAR_INT,     2, { VAR_INT, VAR_STRING },     native_io_write_str },
+    { "io.write",       VAR_INT,     2, { VAR_INT, SB },             native_io_write_builder },
+    { "timer.sleep",    VAR_UNKNOWN, 1, { VAR_INT },                 native_timer_sleep },
+    { "loop.run",       VAR_UNKNOWN, 0, { 0 },                       native_loop_run },
+};
+
+const int builtin_count = sizeof(builtins) / sizeof(builtins[0]);
+
+// -----------------------------
+// Lookup
+// -----------------------------
+int builtin_name_exists(const char *name) {
+    for (int i = 0; i < builtin_count; i++) {
+        if (strcmp(builtins[i].name, name) == 0) return 1;
+    }
+    return 0;
+}
+
+// The builtins that may suspend their coroutine (see events.h). They can
+// only be called with `await`, from async functions.
+int builtin_awaits(int index) {
+    NativeFn fn = builtins[index].fn;
+    return fn == native_net_accept || fn == native_net_connect || fn == native_io_read ||
+           fn == native_io_write_str || fn == native_io_write_builder || fn == native_timer_sleep;
+}
+
+// The builtins whose only effect is their result, or a change to a
+// container passed in: no I/O, no clocks, and no threads that could change
+// the result (algo.sort.parallel sorts exactly like algo.sort).
+int builtin_pure(int index) {
+    static const char *const pure_modules[] = { "array.", "algo.", "map.", "builder.", "math." };
+    for (size_t i = 0; i < sizeof(pure_modules) / sizeof(pure_modules[0]); i++) {
+        if (strncmp(builtins[index].name, pure_modules[i], strlen(pure_modules[i])) == 0) return 1;
+    }
+    return 0;
+}
+
+// Which arguments a builtin changes, as a bit per parameter: the
+// containers it writes to, and the readers, builders and iterators whose
+// state it moves along (file.line copies into its reader, builder.str
+// keeps a snapshot in its builder). See the parallel for check in parser.c.
+int builtin_changes(int index) {
+    static const char *const first[] = {
+        "array.fill", "array.scale", "array.add", "algo.sort", "algo.sort.parallel", "algo.nth",
+        "algo.top", "map.set", "map.remove", "builder.append", "builder.str", "builder.clear",
+        "input.read", "net.pair", "pipe.open"
+    };
+    const Builtin *b = &builtins[index];
+    if (strcmp(b->name, "iter.chunk") == 0) return 3;
+    if (strcmp(b->name, "io.read") == 0) return 2;
+    if (strncmp(b->name, "file.", 5) == 0 || strncmp(b->name, "csv.", 4) == 0 ||
+        strncmp(b->name, "iter.", 5) == 0) {
+        return 1;
+    }
+    if (strncmp(b->name, "math.", 5) == 0) return b->params[0] == AF;
+    for (size_t i = 0; i < sizeof(first) / sizeof(first[0]); i++) {
+        if (strcmp(b->name, first[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+int find_builtin(const char *name, const VarType *arg_types, int argc,
+                 int (*accepts)(VarType param, VarType arg)) {
+    int fallback = -1;
+    for (int i = 0; i < builtin_count; i++) {
+        const Builtin *b = &builtins[i];
+        if (b->arity != argc || strcmp(b->name, name) != 0) continue;
+
+        int exact = 1, ok = 1;
+        for (int p = 0; p < argc; p++) {
+            if (b->params[p] != arg_types[p]) exact = 0;
+            if (!accepts(b->params[p], arg_types[p])) ok = 0;
+        }
+        if (exact) return i;
+        if (ok && fallback < 0) fallback = i;
+    }
+    return fallback;
+}
@@ -0,0 +1,35 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "compiler.h"
+
+// -----------------------------
+// pypstdio builtin functions
+// -----------------------------
+// A native receives its arguments already converted to the declared
+// parameter types. It returns NULL on success, or a runtime error message.
+typedef const char *(*NativeFn)(Value *args, Value *result);
+
+#define BUILTIN_MAX_PARAMS 4
+
+typedef struct {
+    const char *name;                      // path after "pypstdio.", e.g. "array.sum"
+    VarType result;                        // VAR_UNKNOWN: returns no value
+    int arity;
+    VarType params[BUILTIN_MAX_PARAMS];
+    NativeFn fn;
+} Builtin;
+
+extern const Builtin builtins[];
+extern const int builtin_count;
+
+// Overloads share a name and differ in parameter types. Returns the entry
+// whose parameters accept `arg_types`, preferring exact matches, or -1.
+int find_builtin(const char *name, const VarType *arg_types, int argc,
+                 int (*accepts)(VarType param, VarType arg));
+int builtin_name_exists(const char *name);
+int builtin_awaits(int index);
+int builtin_pure(int index);
+int builtin_changes(int index);
+
+#endif // BUILTINS_H
@@ -0,0 +1,259 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L   // clock_gettime, posix_memalign
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "channel.h"
+
+// Sends and receives that keep failing spin this many times before sleeping.
+#define CHANNEL_SPINS 200
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static Channel *registry = NULL;
+static _Atomic int aborted = 0;
+
+// 64-byte aligned block for a Channel; aligned_alloc is missing from
+// msvcrt, so Windows uses its own aligned heap.
+static Channel *channel_alloc(void) {
+#ifdef _WIN32
+    return _aligned_malloc(sizeof(Channel), 64);
+#else
+    void *p = NULL;
+    return posix_memalign(&p, 64, sizeof(Channel)) == 0 ? p : NULL;
+#endif
+}
+
+static void channel_free(Channel *ch) {
+#ifdef _WIN32
+    _aligned_free(ch);
+#else
+    free(ch);
+#endif
+}
+
+Channel *channel_new(VarType type, long long capacity) {
+    if (capacity > CHANNEL_MAX_CAPACITY) return NULL;
+    if (capacity < 2) capacity = 2;
+    // send_pos and recv_pos sit on their own cache lines
+    Channel *ch = channel_alloc();
+    if (!ch) return NULL;
+    memset(ch, 0, sizeof(Channel));
+    ch->cells = malloc(sizeof(ChannelCell) * (size_t)capacity);
+    if (!ch->cells) {
+        channel_free(ch);
+        return NULL;
+    }
+    ch->type = type;
+    ch->capacity = capacity;
+    for (long long i = 0; i < capacity; i++) atomic_init(&ch->cells[i].seq, i);
+    atomic_init(&ch->send_pos, 0);
+    atomic_init(&ch->recv_pos, 0);
+    atomic_init(&ch->closed, 0);
+    atomic_init(&ch->sleepers, 0);
+    pthread_mutex_init(&ch->lock, NULL);
+    pthread_cond_init(&ch->changed, NULL);
+
+    pthread_mutex_lock(&registry_lock);
+    ch->next = registry;
+    registry = ch;
+    pthread_mutex_unlock(&registry_lock);
+    return ch;
+}
+
+void channel_release(void) {
+    pthread_mutex_lock(&registry_lock);
+    while (registry) {
+        Channel *ch = registry;
+        registry = ch->next;
+        pthread_mutex_destroy(&ch->lock);
+        pthread_cond_destroy(&ch->changed);
+        free(ch->cells);
+        channel_free(ch);
+    }
+    atomic_store(&aborted, 0);
+    pthread_mutex_unlock(&registry_lock);
+}
+
+void channel_abort(void) {
+    atomic_store(&aborted, 1);
+    pthread_mutex_lock(&registry_lock);
+    for (Channel *ch = registry; ch; ch = ch->next) {
+        pthread_mutex_lock(&ch->lock);
+        pthread_cond_broadcast(&ch->changed);
+        pthread_mutex_unlock(&ch->lock);
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static long long channel_len(Channel *ch) {
+    long long n = atomic_load(&ch->send_pos) - atomic_load(&ch->recv_pos);
+    if (n < 0) return 0;
+    return n > ch->capacity ? ch->capacity : n;
+}
+
+void channel_print(FILE *out, Channel *ch) {
+    fprintf(out, "<channel.%s %lld/%lld%s>", ch->type == VAR_FLOAT ? "float" : "int",
+            channel_len(ch), ch->capacity, atomic_load(&ch->closed) ? " closed" : "");
+}
+
+// -----------------------------
+// Lock-free fast paths
+// -----------------------------
+// A cell at position p is free for the sender when its sequence is p, and
+// holds a value for the receiver when it is p + 1; the receiver then sets
+// it to p + capacity, the next lap's send position.
+static int try_send(Channel *ch, Value v) {
+    long long pos = atomic_load_explicit(&ch->send_pos, memory_order_relaxed);
+    for (;;) {
+        ChannelCell *cell = &ch->cells[pos % ch->capacity];
+        long long seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        long long diff = seq - pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ch->send_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->value = v;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;   // full: the receiver has not emptied this cell yet
+        } else {
+            pos = atomic_load_explicit(&ch->send_pos, memory_order_relaxed);
+        }
+    }
+}
+
+static int try_recv(Channel *ch, Value *v) {
+    long long pos = atomic_load_explicit(&ch->recv_pos, memory_order_relaxed);
+    for (;;) {
+        ChannelCell *cell = &ch->cells[pos % ch->capacity];
+        long long seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        long long diff = seq - (pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ch->recv_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *v = cell->value;
+                atomic_store_explicit(&cell->seq, pos + ch->capacity, memory_order_release);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;   // empty
+        } else {
+            pos = atomic_load_explicit(&ch->recv_pos, memory_order_relaxed);
+        }
+    }
+}
+
+// -----------------------------
+// Blocking slow paths
+// -----------------------------
+// Wakes threads sleeping on the channel. The sleeper count is read after
+// the queue changed, and sleepers recheck the queue after counting
+// themselves, so a wakeup is never lost; skipping the lock when nobody
+// sleeps keeps the fast path lock-free.
+static void wake(Channel *ch) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&ch->sleepers) == 0) return;
+    pthread_mutex_lock(&ch->lock);
+    pthread_cond_broadcast(&ch->changed);
+    pthread_mutex_unlock(&ch->lock);
+}
+
+// Sleeps until the channel has room (sending) or a value (receiving), or
+// is closed. Each wait is also bounded, so an abort is noticed even by a
+// thread that went to sleep just before it.
+static void sleep_until(Channel *ch, int sending) {
+    atomic_fetch_add(&ch->sleepers, 1);
+    pthread_mutex_lock(&ch->lock);
+    for (;;) {
+        int ready = atomic_load(&ch->closed) || atomic_load(&aborted) ||
+                    (sending ? channel_len(ch) < ch->capacity : channel_len(ch) > 0);
+        if (ready) break;
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += 50 * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&ch->changed, &ch->lock, &until);
+    }
+    pthread_mutex_unlock(&ch->lock);
+    atomic_fetch_sub(&ch->sleepers, 1);
+}
+
+static const char *channel_send(Channel *ch, Value v) {
+    for (int spin = 0;; spin++) {
+        if (atomic_load(&aborted)) return "stopped: another task failed";
+        if (atomic_load(&ch->closed)) return "send on a closed channel";
+        if (try_send(ch, v)) {
+            wake(ch);
+            return NULL;
+        }
+        if (spin < CHANNEL_SPINS) sched_yield();
+        else sleep_until(ch, 1);
+    }
+}
+
+// *got is 1 with a value, 0 once the channel is closed and drained.
+static const char *channel_recv(Channel *ch, Value *v, int *got) {
+    for (int spin = 0;; spin++) {
+        if (atomic_load(&aborted)) return "stopped: another task failed";
+        // closed is read before trying, so nothing sent before the close is missed
+        int closed = atomic_load(&ch->closed);
+        if (try_recv(ch, v)) {
+            wake(ch);
+            *got = 1;
+            return NULL;
+        }
+        if (closed) {
+            *got = 0;
+            return NULL;
+        }
+        if (spin < CHANNEL_SPINS) sched_yield();
+        else sleep_until(ch, 0);
+    }
+}
+
+// -----------------------------
+// Builtins
+// -----------------------------
+const char *native_channel_send(Value *args, Value *result) {
+    (void)result;
+    return channel_send(args[0].p, args[1]);
+}
+
+const char *native_channel_recv(Value *args, Value *result) {
+    int got;
+    const char *err = channel_recv(args[0].p, result, &got);
+    if (err) return err;
+    return got ? NULL : "receive from a closed, empty channel";
+}
+
+// channel.recv(ch, end): `end` once the channel is closed and drained.
+const char *native_channel_recv_or(Value *args, Value *result) {
+    int got;
+    const char *err = channel_recv(args[0].p, result, &got);
+    if (!err && !got) *result = args[1];
+    return err;
+}
+
+const char *native_channel_close(Value *args, Value *result) {
+    (void)result;
+    Channel *ch = args[0].p;
+    atomic_store(&ch->closed, 1);
+    pthread_mutex_lock(&ch->lock);
+    pthread_cond_broadcast(&ch->changed);
+    pthread_mutex_unlock(&ch->lock);
+    return NULL;
+}
+
+const char *native_channel_len(Value *args, Value *result) {
+    result->i = channel_len(args[0].p);
+    return NULL;
+}
@@ -0,0 +1,64 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "compiler.h"
+
+// -----------------------------
+// pypstdio.variable.channel.int / .float
+// -----------------------------
+// A bounded queue of ints or floats that any number of tasks send to and
+// receive from. Each cell carries a sequence number telling whose turn it
+// is: a sender claims the next write position with one compare-and-swap,
+// stores the value and bumps the cell's sequence; a receiver does the same
+// at the read position. Neither side takes a lock while the channel is
+// neither full nor empty. A side that has to wait spins briefly, then
+// sleeps on the channel's condition variable until the other side moves.
+typedef struct {
+    _Atomic long long seq;
+    Value value;
+} ChannelCell;
+
+typedef struct Channel Channel;
+
+struct Channel {
+    VarType type;                   // VAR_INT or VAR_FLOAT
+    long long capacity;             // cells, at least 2
+    ChannelCell *cells;
+    _Alignas(64) _Atomic long long send_pos;
+    _Alignas(64) _Atomic long long recv_pos;
+    _Alignas(64) _Atomic int closed;
+    _Atomic int sleepers;           // threads waiting on `changed`
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    Channel *next;                  // every live channel, for channel_release
+};
+
+// Largest capacity whose cells fit in a size_t.
+#define CHANNEL_MAX_CAPACITY ((long long)(SIZE_MAX / sizeof(ChannelCell) < LLONG_MAX ? SIZE_MAX / sizeof(ChannelCell) : LLONG_MAX))
+
+// NULL if out of memory or capacity is over CHANNEL_MAX_CAPACITY. Channels live until channel_release, since any
+// task may still hold one after the task that made it has finished.
+Channel *channel_new(VarType type, long long capacity);
+void channel_print(FILE *out, Channel *ch);
+
+// Makes every blocked and future send/receive fail, so tasks waiting on a
+// task that died can finish.
+void channel_abort(void);
+// Frees every channel. Only once no task is running.
+void channel_release(void);
+
+// -----------------------------
+// Builtins (see builtins.c)
+// -----------------------------
+const char *native_channel_send(Value *args, Value *result);
+const char *native_channel_recv(Value *args, Value *result);
+const char *native_channel_recv_or(Value *args, Value *result);
+const char *native_channel_close(Value *args, Value *result);
+const char *native_channel_len(Value *args, Value *result);
+
+#endif // CHANNEL_H
@@ -0,0 +1,1471 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "compiler.h"
+#include "builtins.h"
+#include "modules.h"
+#include "bench.h"
+
+// -----------------------------
+// Safe strdup replacement
+// -----------------------------
+static char *strdup_local(const char *s) {
+    if (!s) return NULL;
+    size_t n = strlen(s);
+    char *result = malloc(n + 1);
+    if (!result) return NULL;
+    memcpy(result, s, n);
+    result[n] = '\0';
+    return result;
+}
+
+// -----------------------------
+// Compiler state
+// -----------------------------
+typedef struct {
+    Program *program;
+    ASTNode *root;   // AST_PROGRAM, for callee signatures
+    Function *fn;
+    int depth;       // current operand stack depth
+    int line;        // line of the node being compiled
+
+    int next_function;   // next free entry for a generated function
+
+    // Loop-invariant expressions already computed into a temporary slot
+    ASTNode **hoisted;
+    int *hoisted_slots;
+    int hoisted_count;
+
+    int memo_key;    // @memo functions: first slot of the saved arguments, else -1
+    int generator;   // compiling a generator's body, which `return;` ends
+
+    // Escape analysis (see mark_scopes)
+    int *scopes;     // per slot: the scope a value stored there lives in
+    int scope;       // scope of the value being compiled
+    int loop_depth;  // loops around the code being compiled
+    int loop_mark;   // slot of the innermost LOOP_MARK around it in this function, or -1
+    unsigned char *shared;   // per slot: an iterator stored there may be
+                             // reached some other way (see find_shared)
+    ASTNode *probe;  // mark_scopes notes the scope this node's value lives in
+    int probe_scope;
+} Compiler;
+
+static const char *opcode_names[] = {
+    "CONST", "LOAD", "STORE", "POP", "CHAR_CAST", "INT_TO_FLOAT",
+    "ADD_INT", "SUB_INT", "MUL_INT", "DIV_INT", "MOD_INT", "NEG_INT",
+    "ADD_FLOAT", "SUB_FLOAT", "MUL_FLOAT", "DIV_FLOAT", "NEG_FLOAT",
+    "EQ_INT", "NE_INT", "LT_INT", "GT_INT", "LE_INT", "GE_INT",
+    "EQ_FLOAT", "NE_FLOAT", "LT_FLOAT", "GT_FLOAT", "LE_FLOAT", "GE_FLOAT",
+    "EQ_STR", "NE_STR", "CONCAT",
+    "PRINT_INT", "PRINT_CHAR", "PRINT_FLOAT", "PRINT_BOOL", "PRINT_STR",
+    "PRINT_UNDEFINED", "PRINT_SPACE", "PRINT_NEWLINE", "PRINT_ARRAY", "PRINT_MAP", "PRINT_BUILDER",
+    "PRINT_READER", "PRINT_CHANNEL",
+    "NEW_ARRAY", "INDEX_INT", "INDEX_FLOAT", "STORE_INDEX_INT", "STORE_INDEX_FLOAT", "NEW_MAP", "NEW_BUILDER",
+    "OPEN_READER", "OPEN_WRITER", "NEW_CHANNEL",
+    "CALL_NATIVE", "CALL_FFI",
+    "RETURN_STATUS", "RETURN_INT", "RETURN_CHAR", "RETURN_FLOAT", "RETURN_BOOL", "RETURN_STR",
+    "CALL", "ADOPT", "TAIL_CALL", "RETURN", "RETURN_VOID", "NO_RETURN", "SPAWN", "START",
+    "ITER_NEW", "ITER_NEXT", "ITER_DROP", "YIELD",
+    "MEMO_LOOKUP", "MEMO_STORE",
+    "JUMP", "JUMP_IF_FALSE", "JUMP_IF_TRUE", "LOOP_MARK", "LOOP_SWEEP",
+    "PARALLEL", "BENCH_START", "BENCH_NEXT", "SNAPSHOT",
+    "HALT"
+};
+
+const char *opcode_name(OpCode op) {
+    if ((size_t)op < sizeof(opcode_names) / sizeof(opcode_names[0])) return opcode_names[op];
+    return "?";
+}
+
+// Net operand stack effect of each instruction.
+static int stack_effect(OpCode op) {
+    switch (op) {
+        case OP_CONST:
+        case OP_LOAD:
+            return 1;
+        case OP_CHAR_CAST:
+        case OP_INT_TO_FLOAT:
+        case OP_NEG_INT:
+        case OP_NEG_FLOAT:
+        case OP_PRINT_UNDEFINED:
+        case OP_PRINT_SPACE:
+        case OP_PRINT_NEWLINE:
+        case OP_RETURN_STATUS:
+        case OP_RETURN_VOID:
+        case OP_NO_RETURN:
+        case OP_TAIL_CALL:
+        case OP_CALL_NATIVE:
+        case OP_CALL_FFI:
+        case OP_NEW_ARRAY:
+        case OP_NEW_MAP:
+        case OP_NEW_BUILDER:
+        case OP_OPEN_READER:
+        case OP_OPEN_WRITER:
+        case OP_NEW_CHANNEL:
+        case OP_JUMP:
+        case OP_LOOP_MARK:
+        case OP_LOOP_SWEEP:
+        case OP_ADOPT:
+        case OP_HALT:
+        case OP_MEMO_LOOKUP:
+        case OP_MEMO_STORE:
+        case OP_BENCH_NEXT:
+        case OP_ITER_NEXT:
+        case OP_ITER_DROP:
+        case OP_SNAPSHOT:
+            return 0;
+        case OP_BENCH_START:
+            return -2;
+        case OP_STORE_INDEX_INT:
+        case OP_STORE_INDEX_FLOAT:
+            return -3;
+        default:
+            // stores, prints, returns, indexing and binary operators consume one value
+            return -1;
+    }
+}
+
+static int emit(Compiler *c, OpCode op, int a) {
+    Function *fn = c->fn;
+    if (fn->code_count == fn->code_capacity) {
+        fn->code_capacity = fn->code_capacity ? fn->code_capacity * 2 : 64;
+        fn->code = realloc(fn->code, sizeof(Instr) * fn->code_capacity);
+        fn->lines = realloc(fn->lines, sizeof(int) * fn->code_capacity);
+    }
+    fn->code[fn->code_count].op = op;
+    fn->code[fn->code_count].a = a;
+    fn->code[fn->code_count].b = 0;
+    fn->lines[fn->code_count] = c->line;
+
+    c->depth += stack_effect(op);
+    if (c->depth > fn->max_stack) fn->max_stack = c->depth;
+    return fn->code_count++;
+}
+
+static int add_constant(Compiler *c, Value v) {
+    Program *p = c->program;
+    if (p->constant_count == p->constant_capacity) {
+        p->constant_capacity = p->constant_capacity ? p->constant_capacity * 2 : 16;
+        p->constants = realloc(p->constants, sizeof(Value) * p->constant_capacity);
+    }
+    p->constants[p->constant_count] = v;
+    return p->constant_count++;
+}
+
+static int add_string_constant(Compiler *c, const char *s) {
+    Program *p = c->program;
+    p->strings = realloc(p->strings, sizeof(char *) * (p->string_count + 1));
+    char *copy = strdup_local(s);
+    p->strings[p->string_count++] = copy;
+    Value v;
+    v.s = copy;
+    return add_constant(c, v);
+}
+
+static int add_text_constant(Compiler *c, const char *s) {
+    Program *p = c->program;
+    p->texts = realloc(p->texts, sizeof(Str *) * (p->text_count + 1));
+    Str *text = str_new(s, (long long)strlen(s));
+    p->texts[p->text_count++] = text;
+    Value v;
+    v.str = text;
+    return add_constant(c, v);
+}
+
+// -----------------------------
+// Expressions
+// -----------------------------
+static int is_integral(VarType t) {
+    return t == VAR_INT || t == VAR_CHAR || t == VAR_BOOL;
+}
+
+// Converts the value on top of the stack from one static type to another.
+static void emit_coerce(Compiler *c, VarType from, VarType to) {
+    if (to == VAR_FLOAT && is_integral(from)) emit(c, OP_INT_TO_FLOAT, 0);
+    else if (to == VAR_CHAR && from != VAR_CHAR) emit(c, OP_CHAR_CAST, 0);
+}
+
+static void compile_expr(Compiler *c, ASTNode *node);
+static void compile_call(Compiler *c, ASTNode *call, OpCode op);
+static int operands_scope(Compiler *c, ASTNode *node, int scope);
+static void patch_jump(Compiler *c, int at);
+
+static OpCode binary_opcode(TokenType op, int is_float, int is_string) {
+    if (is_string) {
+        if (op == TOKEN_PLUS) return OP_CONCAT;
+        return op == TOKEN_EQEQ ? OP_EQ_STR : OP_NE_STR;
+    }
+    switch (op) {
+        case TOKEN_PLUS:    return is_float ? OP_ADD_FLOAT : OP_ADD_INT;
+        case TOKEN_MINUS:   return is_float ? OP_SUB_FLOAT : OP_SUB_INT;
+        case TOKEN_STAR:    return is_float ? OP_MUL_FLOAT : OP_MUL_INT;
+        case TOKEN_SLASH:   return is_float ? OP_DIV_FLOAT : OP_DIV_INT;
+        case TOKEN_PERCENT: return OP_MOD_INT;
+        case TOKEN_EQEQ:    return is_float ? OP_EQ_FLOAT : OP_EQ_INT;
+        case TOKEN_BANGEQ:  return is_float ? OP_NE_FLOAT : OP_NE_INT;
+        case TOKEN_LT:      return is_float ? OP_LT_FLOAT : OP_LT_INT;
+        case TOKEN_GT:      return is_float ? OP_GT_FLOAT : OP_GT_INT;
+        case TOKEN_LTEQ:    return is_float ? OP_LE_FLOAT : OP_LE_INT;
+        default:            return is_float ? OP_GE_FLOAT : OP_GE_INT;
+    }
+}
+
+static void compile_binary(Compiler *c, ASTNode *node) {
+    ASTNode *l = node->children[0];
+    ASTNode *r = node->children[1];
+    int is_float = l->value_type == VAR_FLOAT || r->value_type == VAR_FLOAT;
+    int is_string = l->value_type == VAR_STRING;
+    VarType operand = is_float ? VAR_FLOAT : VAR_INT;
+    int scope = c->scope;
+
+    c->scope = operands_scope(c, node, scope);
+    compile_expr(c, l);
+    if (!is_string) emit_coerce(c, l->value_type, operand);
+    compile_expr(c, r);
+    if (!is_string) emit_coerce(c, r->value_type, operand);
+    c->scope = scope;
+    int at = emit(c, binary_opcode(node->op, is_float, is_string), 0);
+    if (c->fn->code[at].op == OP_CONCAT) {
+        // the arena is rewound at the end of the innermost loop iteration
+        // (or of the call), so only a value that dies there may go in it
+        c->fn->code[at].a = scope == c->loop_depth;
+        c->fn->code[at].b = scope;
+    }
+}
+
+// -----------------------------
+// Callees
+// -----------------------------
+// The parser numbers a file's own functions first; the slots after them
+// are functions of modules brought in with `use` (see modules.h).
+static const ModuleExport *imported(Compiler *c, ASTNode *call) {
+    if (call->slot < c->root->child_count) return NULL;
+    return module_function(call->value);
+}
+
+static VarType param_type(Compiler *c, ASTNode *call, int i) {
+    const ModuleExport *e = imported(c, call);
+    return e ? e->params[i] : c->root->children[call->slot]->children[i]->value_type;
+}
+
+static VarType result_type(Compiler *c, ASTNode *call) {
+    const ModuleExport *e = imported(c, call);
+    return e ? e->return_type : c->root->children[call->slot]->value_type;
+}
+
+static int is_async_call(Compiler *c, ASTNode *call) {
+    const ModuleExport *e = imported(c, call);
+    return e ? e->is_async : (c->root->children[call->slot]->int_value & FUNC_ASYNC) != 0;
+}
+
+// Operand of OP_CALL and friends: an imported function is numbered after
+// all of this program's functions by its entry in imports[].
+static int callee_index(Compiler *c, ASTNode *call) {
+    if (call->slot < c->root->child_count) return call->slot;
+    Program *p = c->program;
+    int i = 0;
+    while (i < p->import_count && strcmp(p->imports[i], call->value) != 0) i++;
+    if (i == p->import_count) {
+        p->imports = realloc(p->imports, sizeof(char *) * (p->import_count + 1));
+        p->imports[p->import_count++] = strdup_local(call->value);
+    }
+    return p->function_count + i;
+}
+
+static int calls_sharing(Compiler *c, ASTNode *call) {
+    const ModuleExport *e = imported(c, call);
+    return e ? e->shares : (c->root->children[call->slot]->int_value & FUNC_SHARES) != 0;
+}
+
+// -----------------------------
+// Escape analysis
+// -----------------------------
+// Each call frees what it allocated when it returns (see Function.region),
+// except values that may still be reachable afterwards. Since containers
+// only ever hold numbers and copies of strings, a value can only outlive
+// its frame by being returned, or by being handed to a task, a coroutine
+// or a callee that shares it (FUNC_SHARES). Within the frame, a value
+// that nothing reads after the loop iteration that made it is freed at
+// the end of that iteration (see OP_LOOP_SWEEP).
+//
+// So each value lives in a scope: SCOPE_ESCAPES, 0 for the frame, or d
+// for an iteration of the loop nested d deep; a smaller scope lives
+// longer. Which scope each local's values need is found by a
+// flow-insensitive fixpoint over the function body, and the allocating
+// instructions then record the answer in their b operand.
+
+// Nodes that name a local slot.
+static int uses_slot(ASTNode *node) {
+    return (node->type == AST_IDENTIFIER || node->type == AST_VAR_DECL || node->type == AST_ASSIGN ||
+            node->type == AST_INDEX || node->type == AST_STORE_INDEX) && node->slot >= 0;
+}
+
+static void count_uses(ASTNode *node, int *uses) {
+    if (!node) return;
+    if (uses_slot(node)) uses[node->slot]++;
+    for (int i = 0; i < node->child_count; i++) count_uses(node->children[i], uses);
+}
+
+static int reads(ASTNode *node, int slot) {
+    if (uses_slot(node) && node->slot == slot) return 1;
+    for (int i = 0; i < node->child_count; i++) {
+        if (reads(node->children[i], slot)) return 1;
+    }
+    return 0;
+}
+
+// Variables belong to the whole function, so one declared in a loop may
+// still be read after it, or by the next iteration before it is stored
+// again. A slot's values die with the iteration of a loop `depth` deep
+// only if every use of the slot is in the loop's body or step, and the
+// first statement of the body to use it is a store whose value does not
+// read it.
+static void loop_locals(Compiler *c, ASTNode *body, ASTNode *step, int depth, const int *uses, int count) {
+    int *inside = calloc((size_t)count + 1, sizeof(int));
+    unsigned char *stored = calloc((size_t)count + 1, 1);
+    for (int i = 0; i < body->child_count; i++) {
+        ASTNode *st = body->children[i];
+        if ((st->type == AST_VAR_DECL || st->type == AST_ASSIGN) && st->slot >= 0 && !inside[st->slot] &&
+            !reads(st->children[0], st->slot)) {
+            stored[st->slot] = 1;
+        }
+        count_uses(st, inside);
+    }
+    count_uses(step, inside);
+    for (int s = 0; s < count; s++) {
+        if (stored[s] && inside[s] == uses[s]) c->scopes[s] = depth;
+    }
+    free(inside);
+    free(stored);
+}
+
+// Starts each slot at the innermost loop whose iterations its values may
+// die with, or 0.
+static void find_loop_locals(Compiler *c, ASTNode *node, int depth, const int *uses, int count) {
+    if (node->type == AST_WHILE || node->type == AST_FOR || node->type == AST_PARALLEL_FOR) {
+        int is_while = node->type == AST_WHILE;
+        depth++;
+        loop_locals(c, node->children[is_while ? 1 : 3], is_while ? NULL : node->children[2], depth, uses, count);
+    }
+    for (int i = 0; i < node->child_count; i++) find_loop_locals(c, node->children[i], depth, uses, count);
+}
+
+// The scope of the operands of `node`, given its own: a string joined
+// from them points to them, the result of a call may be one of its
+// arguments or belong to one (builder.str), and an iterator keeps its
+// source and a generator's arguments. Anything else is read on the spot.
+static int operands_scope(Compiler *c, ASTNode *node, int scope) {
+    if (node->type == AST_CALL && calls_sharing(c, node)) return SCOPE_ESCAPES;
+    if (node->type != AST_CALL && node->type != AST_BUILTIN && node->type != AST_BINARY && node->type != AST_ITER) {
+        return c->loop_depth;
+    }
+    return var_type_on_heap(node->value_type) ? scope : c->loop_depth;
+}
+
+// The scope of the value stored by a declaration or assignment. A
+// container declaration's operand is a size or a path, which the
+// container does not keep.
+static int stored_scope(Compiler *c, ASTNode *node) {
+    if (node->slot < 0 || node->children[0]->value_type != node->value_type) return c->loop_depth;
+    return c->scopes[node->slot];
+}
+
+// One pass over `node`, whose value lives in `scope`. Returns whether a
+// slot was found to need a longer-lived scope.
+static int mark_scopes(Compiler *c, ASTNode *node, int scope) {
+    int changed = 0;
+    if (node == c->probe && scope < c->probe_scope) c->probe_scope = scope;
+    switch (node->type) {
+        case AST_IDENTIFIER:
+            if (node->slot >= 0 && scope < c->scopes[node->slot]) {
+                c->scopes[node->slot] = scope;
+                changed = 1;
+            }
+            return changed;
+        case AST_VAR_DECL:
+        case AST_ASSIGN:
+            scope = stored_scope(c, node);
+            break;
+        case AST_RETURN:
+            scope = SCOPE_ESCAPES;
+            break;
+        case AST_SPAWN:
+        case AST_START:
+            node = node->children[0];
+            scope = SCOPE_ESCAPES;
+            break;
+        case AST_WHILE:
+        case AST_FOR:
+        case AST_PARALLEL_FOR: {
+            // a for's init runs once, ahead of the loop
+            int first = node->type != AST_WHILE;
+            if (first) changed |= mark_scopes(c, node->children[0], c->loop_depth);
+            c->loop_depth++;
+            for (int i = first; i < node->child_count; i++) changed |= mark_scopes(c, node->children[i], c->loop_depth);
+            c->loop_depth--;
+            return changed;
+        }
+        default:
+            scope = operands_scope(c, node, scope);
+            break;
+    }
+    for (int i = 0; i < node->child_count; i++) changed |= mark_scopes(c, node->children[i], scope);
+    return changed;
+}
+
+// Whether `node` makes an iterator that nothing else refers to yet.
+static int fresh_iterator(Compiler *c, ASTNode *node) {
+    if (node->type == AST_ITER) return 1;
+    return node->type == AST_CALL && !imported(c, node) &&
+           (c->root->children[node->slot]->int_value & FUNC_GENERATOR) != 0;
+}
+
+// Marks the slots whose iterator may be reached other than through them:
+// a parameter's, or one that is read other than by a builtin (which keeps
+// nothing) or was stored from an existing iterator. Storing into any
+// other slot leaves its old iterator unreachable (see OP_ITER_DROP).
+static void find_shared(Compiler *c, ASTNode *node, ASTNode *parent) {
+    if (node->type == AST_PARAM && node->slot >= 0) c->shared[node->slot] = 1;
+    if (node->type == AST_IDENTIFIER && node->slot >= 0 && (!parent || parent->type != AST_BUILTIN)) {
+        c->shared[node->slot] = 1;
+    }
+    if ((node->type == AST_VAR_DECL || node->type == AST_ASSIGN) && node->slot >= 0 &&
+        !fresh_iterator(c, node->children[0])) {
+        c->shared[node->slot] = 1;
+    }
+    for (int i = 0; i < node->child_count; i++) find_shared(c, node->children[i], node);
+}
+
+static void find_scopes(Compiler *c, ASTNode *func) {
+    int count = func->local_count;
+    int *uses = calloc((size_t)count + 1, sizeof(int));
+    c->scopes = calloc((size_t)count + 1, sizeof(int));
+    count_uses(func, uses);
+    find_loop_locals(c, func, 0, uses, count);
+    free(uses);
+    c->loop_depth = 0;
+    while (mark_scopes(c, func, 0)) {}
+    c->shared = calloc((size_t)count + 1, 1);
+    find_shared(c, func, NULL);
+}
+
+static void free_scopes(Compiler *c) {
+    free(c->scopes);
+    free(c->shared);
+    c->scopes = NULL;
+    c->shared = NULL;
+}
+
+// Pushes the arguments converted to the callee's parameter types, then calls.
+static void compile_call(Compiler *c, ASTNode *call, OpCode op) {
+    int scope = c->scope;
+    c->scope = operands_scope(c, call, scope);
+    for (int i = 0; i < call->child_count; i++) {
+        compile_expr(c, call->children[i]);
+        emit_coerce(c, call->children[i]->value_type, param_type(c, call, i));
+    }
+    c->scope = scope;
+    int depth = c->depth;
+    emit(c, op, callee_index(c, call));
+    c->fn->code[c->fn->code_count - 1].b = call->child_count;
+
+    // the arguments are consumed; a plain call leaves the result behind
+    c->depth = depth - call->child_count;
+    if (op == OP_CALL && result_type(c, call) != VAR_UNKNOWN) c->depth++;
+    if (c->depth > c->fn->max_stack) c->fn->max_stack = c->depth;
+
+    // what a callee that shares nothing hands back is reachable only
+    // through its result
+    if (op == OP_CALL && var_type_on_heap(result_type(c, call)) && !calls_sharing(c, call) && scope >= 0 &&
+        (scope > 0 || !c->fn->region)) {
+        emit(c, OP_ADOPT, scope);
+    }
+}
+
+// Operand of OP_CALL_FFI: the function's entry in ffi[], added on its
+// first call.
+static int ffi_index(Compiler *c, ASTNode *call) {
+    Program *p = c->program;
+    int i = 0;
+    while (i < p->ffi_count && strcmp(p->ffi[i].symbol, call->value) != 0) i++;
+    if (i == p->ffi_count) {
+        p->ffi = realloc(p->ffi, sizeof(FfiImport) * (p->ffi_count + 1));
+        FfiImport *import = &p->ffi[p->ffi_count++];
+        import->library = strdup_local(call->var_value);
+        import->symbol = strdup_local(call->value);
+        import->types = strdup_local(call->var_type);
+        import->param_count = call->child_count;
+    }
+    return i;
+}
+
+// pypstdio.ffi.name(args): C keeps none of its arguments, and a string it
+// returns is a fresh copy that lives in the call's scope.
+static void compile_ffi(Compiler *c, ASTNode *call) {
+    int scope = c->scope;
+    c->scope = c->loop_depth;
+    for (int i = 0; i < call->child_count; i++) {
+        compile_expr(c, call->children[i]);
+        emit_coerce(c, call->children[i]->value_type, (VarType)(call->var_type[i + 1] - TYPE_CODE(0)));
+    }
+    c->scope = scope;
+    int depth = c->depth;
+    int at = emit(c, OP_CALL_FFI, ffi_index(c, call));
+    c->fn->code[at].b = scope;
+
+    c->depth = depth - call->child_count;
+    if (call->value_type != VAR_UNKNOWN) c->depth++;
+    if (c->depth > c->fn->max_stack) c->fn->max_stack = c->depth;
+}
+
+// Same as compile_call, for pypstdio builtins implemented in C.
+static void compile_builtin(Compiler *c, ASTNode *call) {
+    const Builtin *b = &builtins[call->slot];
+    int scope = c->scope;
+    c->scope = operands_scope(c, call, scope);
+    for (int i = 0; i < call->child_count; i++) {
+        compile_expr(c, call->children[i]);
+        emit_coerce(c, call->children[i]->value_type, b->params[i]);
+    }
+    c->scope = scope;
+    int depth = c->depth;
+    emit(c, OP_CALL_NATIVE, call->slot);
+    c->fn->code[c->fn->code_count - 1].b = call->child_count;
+
+    c->depth = depth - call->child_count;
+    if (b->result != VAR_UNKNOWN) c->depth++;
+    if (c->depth > c->fn->max_stack) c->fn->max_stack = c->depth;
+}
+
+// Emits a call of map's or filter's function on the value on top of the
+// stack, an element of type `elem`.
+static void emit_iter_call(Compiler *c, ASTNode *node, VarType elem) {
+    emit_coerce(c, elem, param_type(c, node, 0));
+    emit(c, OP_CALL, callee_index(c, node));
+    c->fn->code[c->fn->code_count - 1].b = 1;
+    c->depth++;
+}
+
+// pypstdio.iter.map, filter and take each make an iterator running a
+// generator body of their own, whose parameters are the source iterator
+// (slot 0) and take's count (slot 1):
+//
+//   map:                    filter:                 take:
+//   next:                   next:                   next:
+//       LOAD 0                  LOAD 0                  LOAD 1  CONST 0  GT_INT
+//       ITER_NEXT done          ITER_NEXT done          JUMP_IF_FALSE done
+//       CALL f                  STORE 1                 LOAD 1  CONST 1  SUB_INT  STORE 1
+//       YIELD                   LOAD 1  CALL f          LOAD 0
+//       JUMP next               JUMP_IF_FALSE next      ITER_NEXT done
+//   done:                       LOAD 1  YIELD           YIELD
+//       HALT                    JUMP next               JUMP next
+//                           done:  HALT             done:  HALT
+//
+// take counts down before it pulls, so it never pulls more than n values.
+static void compile_iter(Compiler *c, ASTNode *node) {
+    int scope = c->scope, depth = c->depth;
+    c->scope = operands_scope(c, node, scope);
+    for (int i = 0; i < node->child_count; i++) compile_expr(c, node->children[i]);
+    if (node->int_value == ITER_TAKE) emit_coerce(c, node->children[1]->value_type, VAR_INT);
+    c->scope = scope;
+    int index = c->next_function++;
+    int at = emit(c, OP_ITER_NEW, index);
+    c->fn->code[at].b = scope;
+    c->depth = depth + 1;
+    if (c->depth > c->fn->max_stack) c->fn->max_stack = c->depth;
+
+    static const char *kinds[] = { "map", "filter", "take" };
+    Function *parent = c->fn;
+    Function *fn = &c->program->functions[index];
+    size_t name_length = strlen(parent->name) + strlen(kinds[node->int_value]) + 2;
+    fn->name = malloc(name_length);
+    snprintf(fn->name, name_length, "%s.%s", parent->name, kinds[node->int_value]);
+    fn->param_count = node->child_count;
+    fn->local_count = node->int_value == ITER_FILTER ? 2 : node->child_count;
+    fn->owns_source = fresh_iterator(c, node->children[0]);
+    c->fn = fn;
+    c->depth = 0;
+
+    VarType elem = node->children[0]->value_type == VAR_ITER_FLOAT ? VAR_FLOAT : VAR_INT;
+    int next = fn->code_count, counted = -1;
+    if (node->int_value == ITER_TAKE) {
+        emit(c, OP_LOAD, 1);
+        emit(c, OP_CONST, add_constant(c, (Value){ .i = 0 }));
+        emit(c, OP_GT_INT, 0);
+        counted = emit(c, OP_JUMP_IF_FALSE, 0);
+        emit(c, OP_LOAD, 1);
+        emit(c, OP_CONST, add_constant(c, (Value){ .i = 1 }));
+        emit(c, OP_SUB_INT, 0);
+        emit(c, OP_STORE, 1);
+    }
+    emit(c, OP_LOAD, 0);
+    int pull = emit(c, OP_ITER_NEXT, 0);
+    if (node->int_value == ITER_MAP) {
+        emit_iter_call(c, node, elem);
+    } else if (node->int_value == ITER_FILTER) {
+        emit(c, OP_STORE, 1);
+        emit(c, OP_LOAD, 1);
+        emit_iter_call(c, node, elem);
+        emit(c, OP_JUMP_IF_FALSE, next);
+        emit(c, OP_LOAD, 1);
+    }
+    emit(c, OP_YIELD, 0);
+    emit(c, OP_JUMP, next);
+    patch_jump(c, pull);
+    if (counted >= 0) patch_jump(c, counted);
+    emit(c, OP_HALT, 0);
+
+    c->fn = parent;
+    c->depth = depth + 1;
+}
+
+static int find_hoisted(Compiler *c, ASTNode *node) {
+    for (int i = 0; i < c->hoisted_count; i++) {
+        if (c->hoisted[i] == node) return c->hoisted_slots[i];
+    }
+    return -1;
+}
+
+static void compile_expr(Compiler *c, ASTNode *node) {
+    if ((node->type == AST_BINARY || node->type == AST_UNARY) && c->hoisted_count > 0) {
+        int slot = find_hoisted(c, node);
+        if (slot >= 0) {
+            emit(c, OP_LOAD, slot);
+            return;
+        }
+    }
+
+    switch (node->type) {
+        case AST_LITERAL: {
+            if (node->value_type == VAR_STRING) {
+                emit(c, OP_CONST, add_text_constant(c, node->value));
+            } else {
+                Value v;
+                if (node->value_type == VAR_FLOAT) v.f = node->float_value;
+                else v.i = node->int_value;
+                emit(c, OP_CONST, add_constant(c, v));
+            }
+            break;
+        }
+        case AST_IDENTIFIER:
+            emit(c, OP_LOAD, node->slot);
+            break;
+        case AST_UNARY: {
+            int scope = c->scope;
+            c->scope = c->loop_depth;
+            compile_expr(c, node->children[0]);
+            c->scope = scope;
+            if (node->value_type == VAR_FLOAT) emit(c, OP_NEG_FLOAT, 0);
+            else emit(c, OP_NEG_INT, 0);
+            break;
+        }
+        case AST_BINARY:
+            compile_binary(c, node);
+            break;
+        case AST_CALL:
+            compile_call(c, node, OP_CALL);
+            break;
+        case AST_BUILTIN:
+            compile_builtin(c, node);
+            break;
+        case AST_FFI:
+            compile_ffi(c, node);
+            break;
+        case AST_ITER:
+            compile_iter(c, node);
+            break;
+        case AST_INDEX: {
+            int scope = c->scope;
+            emit(c, OP_LOAD, node->slot);
+            c->scope = c->loop_depth;
+            compile_expr(c, node->children[0]);
+            c->scope = scope;
+            emit(c, node->value_type == VAR_FLOAT ? OP_INDEX_FLOAT : OP_INDEX_INT, 0);
+            break;
+        }
+        default:
+            fprintf(stderr, "Compile error: node type %d is not an expression\n", node->type);
+            break;
+    }
+}
+
+// -----------------------------
+// Typed output
+// -----------------------------
+static OpCode typed_op(OpCode int_op, VarType type) {
+    // OP_xxx_INT, _CHAR, _FLOAT, _BOOL, _STR are laid out consecutively
+    switch (type) {
+        case VAR_CHAR:   return (OpCode)(int_op + 1);
+        case VAR_FLOAT:  return (OpCode)(int_op + 2);
+        case VAR_BOOL:   return (OpCode)(int_op + 3);
+        case VAR_STRING: return (OpCode)(int_op + 4);
+        default:         return int_op;
+    }
+}
+
+// Whether evaluating node may suspend the running coroutine.
+static int awaits(Compiler *c, ASTNode *node) {
+    if (node->type == AST_CALL && is_async_call(c, node)) return 1;
+    if (node->type == AST_BUILTIN && builtin_awaits(node->slot)) return 1;
+    for (int i = 0; i < node->child_count; i++) {
+        if (awaits(c, node->children[i])) return 1;
+    }
+    return 0;
+}
+
+static void compile_print(Compiler *c, ASTNode *node) {
+    // Other coroutines could print while an argument is awaited, so then
+    // all arguments are evaluated into fresh slots before the line starts.
+    int saved = -1;
+    if (awaits(c, node)) {
+        saved = c->fn->local_count;
+        c->fn->local_count += node->child_count;
+        for (int i = 0; i < node->child_count; i++) {
+            ASTNode *arg = node->children[i];
+            if (arg->type == AST_IDENTIFIER && arg->slot < 0) continue;
+            compile_expr(c, arg);
+            emit(c, OP_STORE, saved + i);
+        }
+    }
+    for (int i = 0; i < node->child_count; i++) {
+        ASTNode *arg = node->children[i];
+        if (arg->type == AST_IDENTIFIER && arg->slot < 0) {
+            emit(c, OP_PRINT_UNDEFINED, add_string_constant(c, arg->value));
+        } else {
+            if (saved >= 0) emit(c, OP_LOAD, saved + i);
+            else compile_expr(c, arg);
+            if (arg->value_type == VAR_ARRAY_INT || arg->value_type == VAR_ARRAY_FLOAT) {
+                emit(c, OP_PRINT_ARRAY, 0);
+            } else if (arg->value_type == VAR_MAP_INT || arg->value_type == VAR_MAP_STR) {
+                emit(c, OP_PRINT_MAP, 0);
+            } else if (arg->value_type == VAR_BUILDER) {
+                emit(c, OP_PRINT_BUILDER, 0);
+            } else if (arg->value_type == VAR_READER) {
+                emit(c, OP_PRINT_READER, 0);
+            } else if (arg->value_type == VAR_CHANNEL_INT || arg->value_type == VAR_CHANNEL_FLOAT) {
+                emit(c, OP_PRINT_CHANNEL, 0);
+            } else {
+                emit(c, typed_op(OP_PRINT_INT, arg->value_type), 0);
+            }
+        }
+        if (i < node->child_count - 1) emit(c, OP_PRINT_SPACE, 0);
+    }
+    emit(c, OP_PRINT_NEWLINE, 0);
+}
+
+// -----------------------------
+// Loop-invariant hoisting
+// -----------------------------
+// Slots are resolved and types checked at compile time, so the only
+// per-iteration work left to hoist is evaluating expressions whose
+// operands no statement in the loop writes.
+
+static void collect_writes(ASTNode *node, unsigned char *written) {
+    if (!node) return;
+    if ((node->type == AST_VAR_DECL || node->type == AST_ASSIGN) && node->slot >= 0) {
+        written[node->slot] = 1;
+    }
+    for (int i = 0; i < node->child_count; i++) collect_writes(node->children[i], written);
+}
+
+static int is_invariant(ASTNode *node, const unsigned char *written) {
+    switch (node->type) {
+        case AST_LITERAL:
+            return 1;
+        case AST_IDENTIFIER:
+            return node->slot >= 0 && !written[node->slot];
+        case AST_BINARY:
+            // integer division may trap, and must not run before the loop does
+            if ((node->op == TOKEN_SLASH || node->op == TOKEN_PERCENT) &&
+                node->value_type != VAR_FLOAT) {
+                return 0;
+            }
+            return is_invariant(node->children[0], written) &&
+                   is_invariant(node->children[1], written);
+        case AST_UNARY:
+            return is_invariant(node->children[0], written);
+        default:
+            return 0;
+    }
+}
+
+// The scope a hoisted string under `part` of a loop lives in: as long as
+// the value at the place the loop uses it would, and at least until the
+// loop ends. The fixpoint is already reached, so this pass only looks.
+static int hoisted_scope(Compiler *c, ASTNode *part, ASTNode *node) {
+    if (!var_type_on_heap(node->value_type)) return c->loop_depth;
+    c->probe = node;
+    c->probe_scope = INT_MAX;
+    c->loop_depth++;
+    mark_scopes(c, part, c->loop_depth);
+    c->loop_depth--;
+    c->probe = NULL;
+    return c->probe_scope < c->loop_depth ? c->probe_scope : c->loop_depth;
+}
+
+// Computes each maximal invariant expression under `node`, in `part` of
+// the loop, once into a fresh slot ahead of the loop.
+static void hoist_invariants(Compiler *c, ASTNode *part, ASTNode *node, const unsigned char *written) {
+    if (!node || node->type == AST_BENCH) return;
+    if ((node->type == AST_BINARY || node->type == AST_UNARY) && find_hoisted(c, node) < 0 &&
+        is_invariant(node, written)) {
+        int slot = c->fn->local_count++;
+        int scope = c->scope;
+        c->scope = hoisted_scope(c, part, node);
+        compile_expr(c, node);
+        c->scope = scope;
+        emit(c, OP_STORE, slot);
+
+        c->hoisted = realloc(c->hoisted, sizeof(ASTNode *) * (c->hoisted_count + 1));
+        c->hoisted_slots = realloc(c->hoisted_slots, sizeof(int) * (c->hoisted_count + 1));
+        c->hoisted[c->hoisted_count] = node;
+        c->hoisted_slots[c->hoisted_count] = slot;
+        c->hoisted_count++;
+        return;
+    }
+    for (int i = 0; i < node->child_count; i++) hoist_invariants(c, part, node->children[i], written);
+}
+
+// -----------------------------
+// Statements
+// -----------------------------
+static void compile_statement(Compiler *c, ASTNode *node);
+
+static void compile_block(Compiler *c, ASTNode *block) {
+    for (int i = 0; i < block->child_count; i++) compile_statement(c, block->children[i]);
+}
+
+static void patch_jump(Compiler *c, int at) {
+    c->fn->code[at].a = c->fn->code_count;
+}
+
+static void compile_if(Compiler *c, ASTNode *node) {
+    ASTNode *cond = node->children[0];
+    ASTNode *else_block = node->child_count > 2 ? node->children[2] : NULL;
+
+    // A folded condition selects its branch at compile time
+    if (cond->type == AST_LITERAL) {
+        if (cond->int_value) compile_block(c, node->children[1]);
+        else if (else_block) compile_block(c, else_block);
+        return;
+    }
+
+    compile_expr(c, cond);
+    int to_else = emit(c, OP_JUMP_IF_FALSE, 0);
+    compile_block(c, node->children[1]);
+    if (else_block) {
+        int to_end = emit(c, OP_JUMP, 0);
+        patch_jump(c, to_else);
+        compile_block(c, else_block);
+        patch_jump(c, to_end);
+    } else {
+        patch_jump(c, to_else);
+    }
+}
+
+// Whether running `node` may put something on the heap that an iteration
+// of the loop around it could free.
+static int allocates(Compiler *c, ASTNode *node) {
+    if (!node) return 0;
+    switch (node->type) {
+        case AST_BINARY:
+            if (node->value_type == VAR_STRING) return 1;
+            break;
+        case AST_VAR_DECL:
+            if (var_type_on_heap(node->value_type) && node->children[0]->value_type != node->value_type) return 1;
+            break;
+        case AST_ITER:
+            return 1;
+        case AST_CALL:
+            if (var_type_on_heap(result_type(c, node))) return 1;
+            break;
+        case AST_FFI:
+            if (node->value_type == VAR_STRING) return 1;
+            break;
+        default:
+            break;
+    }
+    for (int i = 0; i < node->child_count; i++) {
+        if (allocates(c, node->children[i])) return 1;
+    }
+    return 0;
+}
+
+// Lowers a loop to a rotated form with a single back-edge:
+//
+//       <hoisted invariants>
+//       LOOP_MARK mark, outer mark
+//       JUMP cond
+//   body:
+//       <body> <step>
+//       LOOP_SWEEP mark, depth
+//   cond:
+//       <cond>
+//       JUMP_IF_TRUE body
+//
+// LOOP_MARK and LOOP_SWEEP, which free what an iteration made for its own
+// use, are left out of loops that allocate nothing.
+static void compile_loop(Compiler *c, ASTNode *cond, ASTNode *step, ASTNode *body) {
+    if (cond->type == AST_LITERAL && !cond->int_value) return;
+
+    unsigned char *written = calloc(c->fn->local_count + 1, 1);
+    collect_writes(body, written);
+    collect_writes(step, written);
+    hoist_invariants(c, cond, cond, written);
+    hoist_invariants(c, step, step, written);
+    hoist_invariants(c, body, body, written);
+    free(written);
+
+    int mark = -1, outer = c->loop_mark;
+    if (allocates(c, cond) || allocates(c, step) || allocates(c, body)) {
+        mark = c->fn->local_count;
+        c->fn->local_count += 3;
+        int at = emit(c, OP_LOOP_MARK, mark);
+        c->fn->code[at].b = outer;
+        c->loop_mark = mark;
+    }
+    c->loop_depth++;
+    int to_cond = -1;
+    if (cond->type != AST_LITERAL) to_cond = emit(c, OP_JUMP, 0);
+    int body_start = c->fn->code_count;
+    compile_block(c, body);
+    if (step) compile_statement(c, step);
+    if (mark >= 0) {
+        int at = emit(c, OP_LOOP_SWEEP, mark);
+        c->fn->code[at].b = c->loop_depth;
+    }
+
+    if (to_cond >= 0) {
+        patch_jump(c, to_cond);
+        c->line = cond->line;
+        c->scope = c->loop_depth;
+        compile_expr(c, cond);
+        emit(c, OP_JUMP_IF_TRUE, body_start);
+    } else {
+        emit(c, OP_JUMP, body_start);
+    }
+    c->loop_depth--;
+    c->loop_mark = outer;
+}
+
+// A parallel for becomes OP_PARALLEL in the enclosing function and a
+// separate body function that runs one chunk of iterations, `left` of
+// them from i on:
+//
+//   enclosing:                    body function:
+//       <init>                        <hoisted invariants>
+//       <bound>                       JUMP cond
+//       PARALLEL loop             body:
+//                                     <body> i = i + step
+//                                     left = left - 1
+//                                     [LOOP_SWEEP mark, depth]
+//                                 cond:
+//                                     LOAD left  CONST 0  GT_INT
+//                                     JUMP_IF_TRUE body
+//                                     HALT
+//
+// The body function's first slots mirror the enclosing frame, so the body
+// compiles against the same slot numbers. As in compile_loop, a body that
+// allocates frees what each iteration made at its end.
+static void compile_parallel_for(Compiler *c, ASTNode *node) {
+    ASTNode *cond = node->children[1];
+    ASTNode *body = node->children[3];
+    ParallelLoop *loop = &c->program->loops[c->program->loop_count];
+    int loop_index = c->program->loop_count++;
+
+    compile_statement(c, node->children[0]);
+    c->line = node->line;
+    compile_expr(c, cond->children[1]);
+
+    Function *parent = c->fn;
+    loop->body = c->next_function++;
+    Function *fn = &c->program->functions[loop->body];
+    loop->index_slot = node->children[0]->slot;
+    loop->copy_count = parent->local_count;
+    loop->step = node->children[2]->children[0]->children[1]->int_value;
+    loop->inclusive = cond->op == TOKEN_LTEQ;
+    loop->reduce_count = node->child_count - 4;
+    for (int r = 0; r < loop->reduce_count; r++) {
+        loop->reduce_slots[r] = node->children[4 + r]->slot;
+        loop->reduce_types[r] = node->children[4 + r]->value_type;
+    }
+    emit(c, OP_PARALLEL, loop_index);
+
+    int depth = c->depth, hoisted_count = c->hoisted_count;
+    size_t name_length = strlen(parent->name) + sizeof(".parallel");
+    fn->name = malloc(name_length);
+    snprintf(fn->name, name_length, "%s.parallel", parent->name);
+    fn->local_count = parent->local_count;
+    loop->left_slot = fn->local_count++;
+    c->fn = fn;
+    c->depth = 0;
+
+    unsigned char *written = calloc(fn->local_count + 1, 1);
+    collect_writes(body, written);
+    written[loop->index_slot] = 1;
+    hoist_invariants(c, body, body, written);
+    free(written);
+
+    int mark = -1, outer = c->loop_mark;
+    c->loop_mark = -1;
+    if (allocates(c, body)) {
+        mark = fn->local_count;
+        fn->local_count += 3;
+        int at = emit(c, OP_LOOP_MARK, mark);
+        fn->code[at].b = -1;
+        c->loop_mark = mark;
+    }
+    c->loop_depth++;
+    int to_cond = emit(c, OP_JUMP, 0);
+    int body_start = fn->code_count;
+    compile_block(c, body);
+    c->line = node->line;
+    emit(c, OP_LOAD, loop->index_slot);
+    emit(c, OP_CONST, add_constant(c, (Value){ .i = loop->step }));
+    emit(c, OP_ADD_INT, 0);
+    emit(c, OP_STORE, loop->index_slot);
+    emit(c, OP_LOAD, loop->left_slot);
+    emit(c, OP_CONST, add_constant(c, (Value){ .i = 1 }));
+    emit(c, OP_SUB_INT, 0);
+    emit(c, OP_STORE, loop->left_slot);
+    if (mark >= 0) {
+        int at = emit(c, OP_LOOP_SWEEP, mark);
+        fn->code[at].b = c->loop_depth;
+    }
+    c->loop_depth--;
+    c->loop_mark = outer;
+    patch_jump(c, to_cond);
+    emit(c, OP_LOAD, loop->left_slot);
+    emit(c, OP_CONST, add_constant(c, (Value){ .i = 0 }));
+    emit(c, OP_GT_INT, 0);
+    emit(c, OP_JUMP_IF_TRUE, body_start);
+    emit(c, OP_HALT, 0);
+
+    c->fn = parent;
+    c->depth = depth;
+    c->hoisted_count = hoisted_count;
+}
+
+// pypstdio.bench loops over its body under the VM's control, which times
+// every iteration (see bench.h):
+//
+//       <iterations> <warmup>
+//       BENCH_START name, run
+//   next:
+//       BENCH_NEXT run, done
+//       <body>
+//       JUMP next
+//   done:
+//
+// The body is compiled as written: no invariants are hoisted out of it
+// and the optimization passes leave it alone, so every iteration does the
+// work it would outside the benchmark.
+static void compile_bench(Compiler *c, ASTNode *node) {
+    compile_expr(c, node->children[0]);
+    emit_coerce(c, node->children[0]->value_type, VAR_INT);
+    if (node->child_count > 2) {
+        compile_expr(c, node->children[1]);
+        emit_coerce(c, node->children[1]->value_type, VAR_INT);
+    } else {
+        emit(c, OP_CONST, add_constant(c, (Value){ .i = BENCH_DEFAULT_WARMUP }));
+    }
+    int run = c->fn->local_count++;
+    int start = emit(c, OP_BENCH_START, add_string_constant(c, node->value));
+    c->fn->code[start].b = run;
+
+    int next = emit(c, OP_BENCH_NEXT, run);
+    compile_block(c, node->children[node->child_count - 1]);
+    c->line = node->line;
+    emit(c, OP_JUMP, next);
+    c->fn->code[next].b = c->fn->code_count;
+}
+
+// spawn f(args) and async f(args) push the arguments and start a task or
+// coroutine on a generated function whose slots are those arguments:
+//
+//       CALL f  [POP]  HALT
+static void compile_spawn(Compiler *c, ASTNode *node, OpCode op) {
+    ASTNode *call = node->children[0];
+    int depth = c->depth;
+    c->scope = SCOPE_ESCAPES;
+    for (int i = 0; i < call->child_count; i++) {
+        compile_expr(c, call->children[i]);
+        emit_coerce(c, call->children[i]->value_type, param_type(c, call, i));
+    }
+    int index = c->next_function++;
+    emit(c, op, index);
+    c->fn->code[c->fn->code_count - 1].b = call->child_count;
+    c->depth = depth;
+
+    Function *parent = c->fn;
+    Function *fn = &c->program->functions[index];
+    const char *suffix = op == OP_SPAWN ? "spawn" : "async";
+    size_t name_length = strlen(call->value) + strlen(suffix) + 2;
+    fn->name = malloc(name_length);
+    snprintf(fn->name, name_length, "%s.%s", call->value, suffix);
+    fn->param_count = call->child_count;
+    fn->local_count = call->child_count;
+    c->fn = fn;
+    emit(c, OP_CALL, callee_index(c, call));
+    fn->code[fn->code_count - 1].b = call->child_count;
+    // the result, if any, replaces the arguments
+    c->depth = 0;
+    if (result_type(c, call) != VAR_UNKNOWN) {
+        c->depth = fn->max_stack = 1;
+        emit(c, OP_POP, 0);
+    }
+    emit(c, OP_HALT, 0);
+    c->fn = parent;
+    c->depth = depth;
+}
+
+static void compile_return(Compiler *c, ASTNode *node) {
+    int is_main = c->fn - c->program->functions == c->program->main_index;
+    c->scope = SCOPE_ESCAPES;
+
+    if (is_main) {
+        if (node->child_count == 0) {
+            emit(c, OP_RETURN_STATUS, add_string_constant(c, node->value));
+        } else {
+            ASTNode *value = node->children[0];
+            compile_expr(c, value);
+            emit(c, typed_op(OP_RETURN_INT, value->value_type), 0);
+        }
+        return;
+    }
+
+    if (node->child_count == 0) {
+        emit(c, c->generator ? OP_HALT : OP_RETURN_VOID, 0);
+        return;
+    }
+
+    // `return f(...)` reuses the frame when no conversion follows the call
+    // (and no result has to be remembered)
+    ASTNode *value = node->children[0];
+    if (value->type == AST_CALL && value->value_type == node->value_type && c->memo_key < 0) {
+        compile_call(c, value, OP_TAIL_CALL);
+        return;
+    }
+    compile_expr(c, value);
+    emit_coerce(c, value->value_type, node->value_type);
+    if (c->memo_key >= 0) emit(c, OP_MEMO_STORE, c->memo_key);
+    emit(c, OP_RETURN, 0);
+}
+
+static void compile_statement(Compiler *c, ASTNode *node) {
+    int scope = c->scope;
+    c->line = node->line;
+    c->scope = c->loop_depth;
+    switch (node->type) {
+        case AST_VAR_DECL:
+        case AST_ASSIGN: {
+            ASTNode *value = node->children[0];
+            c->scope = stored_scope(c, node);
+            compile_expr(c, value);
+            c->scope = c->loop_depth;
+            int allocated = c->fn->code_count;
+            if (node->type == AST_VAR_DECL && node->value_type == VAR_ARRAY_INT) {
+                emit(c, OP_NEW_ARRAY, VAR_INT);
+            } else if (node->type == AST_VAR_DECL && node->value_type == VAR_ARRAY_FLOAT) {
+                emit(c, OP_NEW_ARRAY, VAR_FLOAT);
+            } else if (node->type == AST_VAR_DECL && node->value_type == VAR_MAP_INT) {
+                emit(c, OP_NEW_MAP, VAR_INT);
+            } else if (node->type == AST_VAR_DECL && node->value_type == VAR_MAP_STR) {
+                emit(c, OP_NEW_MAP, VAR_STRING);
+            } else if (node->type == AST_VAR_DECL && node->value_type == VAR_BUILDER) {
+                emit(c, OP_NEW_BUILDER, 0);
+            } else if (node->type == AST_VAR_DECL && node->value_type == VAR_READER) {
+                emit(c, OP_OPEN_READER, 0);
+            } else if (node->type == AST_VAR_DECL && node->value_type == VAR_WRITER) {
+                emit(c, OP_OPEN_WRITER, 0);
+            } else if (node->type == AST_VAR_DECL && node->value_type == VAR_CHANNEL_INT) {
+                emit(c, OP_NEW_CHANNEL, VAR_INT);
+            } else if (node->type == AST_VAR_DECL && node->value_type == VAR_CHANNEL_FLOAT) {
+                emit(c, OP_NEW_CHANNEL, VAR_FLOAT);
+            } else {
+                emit_coerce(c, value->value_type, node->value_type);
+            }
+            if (node->type == AST_VAR_DECL && node->value_type != VAR_STRING && var_type_on_heap(node->value_type)) {
+                c->fn->code[allocated].b = node->slot >= 0 ? c->scopes[node->slot] : c->loop_depth;
+            }
+            // a slot freed with each loop iteration holds nothing to end
+            if ((node->value_type == VAR_ITER_INT || node->value_type == VAR_ITER_FLOAT) && node->slot >= 0 &&
+                !c->shared[node->slot] && c->scopes[node->slot] <= 0) {
+                int at = emit(c, OP_ITER_DROP, node->slot);
+                c->fn->code[at].b = c->loop_mark;
+            }
+            emit(c, OP_STORE, node->slot);
+            break;
+        }
+        case AST_STORE_INDEX: {
+            ASTNode *value = node->children[1];
+            emit(c, OP_LOAD, node->slot);
+            compile_expr(c, node->children[0]);
+            compile_expr(c, value);
+            emit_coerce(c, value->value_type, node->value_type);
+            emit(c, node->value_type == VAR_FLOAT ? OP_STORE_INDEX_FLOAT : OP_STORE_INDEX_INT, 0);
+            break;
+        }
+        case AST_PRINT:
+            compile_print(c, node);
+            break;
+        case AST_RETURN:
+            compile_return(c, node);
+            break;
+        case AST_BLOCK:
+            compile_block(c, node);
+            break;
+        case AST_IF:
+            compile_if(c, node);
+            break;
+        case AST_WHILE:
+            compile_loop(c, node->children[0], NULL, node->children[1]);
+            break;
+        case AST_FOR:
+            compile_statement(c, node->children[0]);
+            compile_loop(c, node->children[1], node->children[2], node->children[3]);
+            break;
+        case AST_PARALLEL_FOR:
+            compile_parallel_for(c, node);
+            break;
+        case AST_SPAWN:
+            compile_spawn(c, node, OP_SPAWN);
+            break;
+        case AST_START:
+            compile_spawn(c, node, OP_START);
+            break;
+        case AST_BENCH:
+            compile_bench(c, node);
+            break;
+        case AST_YIELD:
+            compile_expr(c, node->children[0]);
+            emit_coerce(c, node->children[0]->value_type, node->value_type);
+            emit(c, OP_YIELD, 0);
+            break;
+        case AST_SNAPSHOT:
+            emit(c, OP_SNAPSHOT, add_string_constant(c, node->value));
+            break;
+        case AST_CALL:
+            compile_call(c, node, OP_CALL);
+            if (node->value_type != VAR_UNKNOWN) emit(c, OP_POP, 0);
+            break;
+        case AST_BUILTIN:
+            compile_builtin(c, node);
+            if (node->value_type != VAR_UNKNOWN) emit(c, OP_POP, 0);
+            break;
+        case AST_FFI:
+            compile_ffi(c, node);
+            if (node->value_type != VAR_UNKNOWN) emit(c, OP_POP, 0);
+            break;
+        default:
+            compile_expr(c, node);
+            emit(c, OP_POP, 0);
+            break;
+    }
+    c->scope = scope;
+}
+
+// A generator function f compiles to two. f itself only packs its
+// arguments into an iterator; its body becomes f.generator, which that
+// iterator runs on frames of its own a value at a time (see interpiler.c):
+//
+//   f:                             f.generator:
+//       LOAD 0 .. LOAD n-1             <body>      yield x:  <x> YIELD
+//       ITER_NEW f.generator           HALT        return;:  HALT
+//       RETURN
+static void compile_generator(Compiler *c, ASTNode *func, Function *fn) {
+    int index = c->next_function++;
+    fn->name = strdup_local(func->value);
+    fn->param_count = func->param_count;
+    fn->local_count = func->param_count;
+    c->fn = fn;
+    c->depth = 0;
+    c->line = func->line;
+    for (int i = 0; i < func->param_count; i++) emit(c, OP_LOAD, i);
+    int at = emit(c, OP_ITER_NEW, index);
+    fn->code[at].b = SCOPE_ESCAPES;
+    c->depth = 1;
+    if (fn->max_stack < 1) fn->max_stack = 1;
+    emit(c, OP_RETURN, 0);
+
+    Function *body = &c->program->functions[index];
+    size_t name_length = strlen(func->value) + sizeof(".generator");
+    body->name = malloc(name_length);
+    snprintf(body->name, name_length, "%s.generator", func->value);
+    body->param_count = func->param_count;
+    body->local_count = func->local_count;
+    c->fn = body;
+    c->depth = 0;
+    c->hoisted_count = 0;
+    c->memo_key = -1;
+    c->generator = 1;
+    c->loop_mark = -1;
+    find_scopes(c, func);
+    for (int i = func->param_count; i < func->child_count; i++) {
+        compile_statement(c, func->children[i]);
+    }
+    c->line = func->line;
+    emit(c, OP_HALT, 0);
+    c->generator = 0;
+    free_scopes(c);
+}
+
+static void compile_function(Compiler *c, ASTNode *func, Function *fn) {
+    if (func->int_value & FUNC_GENERATOR) {
+        compile_generator(c, func, fn);
+        return;
+    }
+    fn->name = strdup_local(func->value);
+    fn->param_count = func->param_count;
+    fn->local_count = func->local_count;
+    c->fn = fn;
+    c->depth = 0;
+    c->line = func->line;
+    c->hoisted_count = 0;
+    c->memo_key = -1;
+
+    // a call can free everything it allocated unless it returns a string or
+    // container, or shares them with tasks or coroutines
+    c->loop_mark = -1;
+    find_scopes(c, func);
+    fn->region = !var_type_on_heap(func->value_type) && !(func->int_value & FUNC_SHARES);
+
+    // @memo: the arguments are saved past the locals, as the body may
+    // assign to its parameters before the result is stored
+    int lookup = -1;
+    if (func->slot > 0) {
+        fn->memo_size = func->slot;
+        c->memo_key = fn->local_count;
+        fn->local_count += fn->param_count;
+        lookup = emit(c, OP_MEMO_LOOKUP, c->memo_key);
+    }
+
+    for (int i = func->param_count; i < func->child_count; i++) {
+        compile_statement(c, func->children[i]);
+    }
+
+    c->line = func->line;
+    if (fn - c->program->functions == c->program->main_index) emit(c, OP_HALT, 0);
+    else if (func->value_type == VAR_UNKNOWN) emit(c, OP_RETURN_VOID, 0);
+    else emit(c, OP_NO_RETURN, 0);
+
+    // a remembered result is pushed and returned from here
+    if (lookup >= 0) {
+        fn->code[lookup].b = fn->code_count;
+        c->depth = 1;
+        if (fn->max_stack < 1) fn->max_stack = 1;
+        emit(c, OP_RETURN, 0);
+    }
+    c->memo_key = -1;
+    free_scopes(c);
+}
+
+static size_t count_nodes(ASTNode *node, ASTNodeType type) {
+    size_t count = node->type == type;
+    for (int i = 0; i < node->child_count; i++) count += count_nodes(node->children[i], type);
+    return count;
+}
+
+// -----------------------------
+// Entry points
+// -----------------------------
+Program *compile_program(ASTNode *root) {
+    if (!root || root->type != AST_PROGRAM) return NULL;
+
+    Program *program = calloc(1, sizeof(Program));
+    Compiler c;
+    memset(&c, 0, sizeof(c));
+    c.program = program;
+    c.root = root;
+
+    // parallel for bodies, spawn / async entry points and generator bodies
+    // are compiled into functions after the script's own
+    size_t loops = count_nodes(root, AST_PARALLEL_FOR);
+    size_t generated = loops + count_nodes(root, AST_SPAWN) + count_nodes(root, AST_START) +
+                       count_nodes(root, AST_ITER);
+    for (int i = 0; i < root->child_count; i++) generated += (root->children[i]->int_value & FUNC_GENERATOR) != 0;
+    program->function_count = root->child_count + (int)generated;
+    program->functions = calloc((unsigned)root->child_count + generated, sizeof(Function));
+    c.next_function = root->child_count;
+    program->loops = loops ? calloc(loops, sizeof(ParallelLoop)) : NULL;
+    program->main_index = -1;
+    for (int i = 0; i < root->child_count; i++) {
+        if (strcmp(root->children[i]->value, "main") == 0) program->main_index = i;
+    }
+    for (int i = 0; i < root->child_count; i++) {
+        compile_function(&c, root->children[i], &program->functions[i]);
+    }
+    free(c.hoisted);
+    free(c.hoisted_slots);
+    return program;
+}
+
+void free_program(Program *program) {
+    if (!program) return;
+    for (int i = 0; i < program->function_count; i++) {
+        free(program->functions[i].name);
+        free(program->functions[i].code);
+        free(program->functions[i].lines);
+    }
+    for (int i = 0; i < program->string_count; i++) free(program->strings[i]);
+    for (int i = 0; i < program->text_count; i++) str_free(program->texts[i]);
+    for (int i = 0; i < program->import_count; i++) free(program->imports[i]);
+    for (int i = 0; i < program->ffi_count; i++) {
+        free(program->ffi[i].library);
+        free(program->ffi[i].symbol);
+        free(program->ffi[i].types);
+    }
+    free(program->imports);
+    free(program->ffi);
+    free(program->texts);
+    free(program->functions);
+    free(program->loops);
+    free(program->constants);
+    free(program->strings);
+    free(program);
+}
+
+// How long what an allocating instruction makes lives (see SCOPE_ESCAPES).
+static const char *scope_note(int scope, char *buf, size_t size) {
+    if (scope < 0) return " (escapes)";
+    if (scope == 0) return "";
+    snprintf(buf, size, " (loop %d)", scope);
+    return buf;
+}
+
+void print_program(Program *program) {
+    if (!program) return;
+    char note[32];
+    for (int f = 0; f < program->function_count; f++) {
+        Function *fn = &program->functions[f];
+        printf("Code: %s (%d params, %d locals, stack %d", fn->name, fn->param_count, fn->local_count,
+               fn->max_stack);
+        if (fn->memo_size) printf(", memo %d", fn->memo_size);
+        if (fn->region) printf(", region");
+        printf(")\n");
+        for (int i = 0; i < fn->code_count; i++) {
+            Instr *ins = &fn->code[i];
+            if (ins->op == OP_CALL || ins->op == OP_TAIL_CALL) {
+                printf("  %4d  %-16s %d (%s, %d args)\n", i, opcode_name(ins->op), ins->a,
+                       program->functions[ins->a].name, ins->b);
+            } else if (ins->op == OP_ITER_NEW) {
+                printf("  %4d  %-16s %d (%s)%s\n", i, opcode_name(ins->op), ins->a, program->functions[ins->a].name,
+                       scope_note(ins->b, note, sizeof(note)));
+            } else if (ins->op == OP_CALL_NATIVE) {
+                printf("  %4d  %-16s %d (pypstdio.%s, %d args)\n", i, opcode_name(ins->op), ins->a,
+                       builtins[ins->a].name, ins->b);
+            } else if (ins->op == OP_CALL_FFI) {
+                const FfiImport *import = &program->ffi[ins->a];
+                printf("  %4d  %-16s %d (%s in %s)%s\n", i, opcode_name(ins->op), ins->a, import->symbol,
+                       import->library[0] ? import->library : "the interpiler", scope_note(ins->b, note, sizeof(note)));
+            } else if (ins->op == OP_CONCAT || (ins->op >= OP_NEW_ARRAY && ins->op <= OP_OPEN_WRITER)) {
+                printf("  %4d  %-16s %d%s\n", i, opcode_name(ins->op), ins->a, scope_note(ins->b, note, sizeof(note)));
+            } else if (ins->op == OP_LOOP_SWEEP) {
+                printf("  %4d  %-16s %d (loop %d)\n", i, opcode_name(ins->op), ins->a, ins->b);
+            } else {
+                printf("  %4d  %-16s %d\n", i, opcode_name(ins->op), ins->a);
+            }
+        }
+    }
+}
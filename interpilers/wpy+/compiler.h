@@ -0,0 +1,198 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "parser.h"
+#include "str.h"
+
+// -----------------------------
+// Runtime values
+// -----------------------------
+// Values carry no type tag: every instruction below is specialized to the
+// static type the parser inferred, so the VM never dispatches on types.
+typedef union {
+    long long i;      // int, char and bool
+    double f;         // float
+    Str *str;         // string
+    const char *s;    // names: `return` status words, undefined identifiers
+    void *p;          // int[] / float[] (Array), maps (Map), builders (Builder),
+                      // files (Reader, Writer), channels (Channel), iterators
+} Value;
+
+// -----------------------------
+// Instructions
+// -----------------------------
+// The instructions that allocate (OP_CONCAT, OP_NEW_ARRAY, OP_NEW_MAP,
+// OP_NEW_BUILDER, OP_OPEN_READER, OP_OPEN_WRITER, OP_ITER_NEW) have b = the
+// scope the value lives in: SCOPE_ESCAPES when it may outlive the frame, by
+// being returned or handed to a task or coroutine; 0 when it dies with the
+// frame; d > 0 when it dies at the end of an iteration of the loop nested d
+// deep. See Function.region and OP_LOOP_SWEEP.
+#define SCOPE_ESCAPES (-1)
+
+typedef enum {
+    OP_CONST,          // push constants[a]
+    OP_LOAD,           // push slots[a]
+    OP_STORE,          // slots[a] = pop
+    OP_POP,            // discard top of stack
+    OP_CHAR_CAST,      // truncate top int to a char
+
+    OP_INT_TO_FLOAT,   // convert top int/char/bool to a float
+
+    OP_ADD_INT, OP_SUB_INT, OP_MUL_INT, OP_DIV_INT, OP_MOD_INT, OP_NEG_INT,
+    OP_ADD_FLOAT, OP_SUB_FLOAT, OP_MUL_FLOAT, OP_DIV_FLOAT, OP_NEG_FLOAT,
+
+    OP_EQ_INT, OP_NE_INT, OP_LT_INT, OP_GT_INT, OP_LE_INT, OP_GE_INT,
+    OP_EQ_FLOAT, OP_NE_FLOAT, OP_LT_FLOAT, OP_GT_FLOAT, OP_LE_FLOAT, OP_GE_FLOAT,
+    OP_EQ_STR, OP_NE_STR,
+    OP_CONCAT,         // string + string (a rope node, see str.h); if a, a short
+                       // result may be bumped from the frame's arena
+
+    OP_PRINT_INT, OP_PRINT_CHAR, OP_PRINT_FLOAT, OP_PRINT_BOOL, OP_PRINT_STR,
+    OP_PRINT_UNDEFINED,  // print "[undefined:<constants[a].s>]"
+    OP_PRINT_SPACE,
+    OP_PRINT_NEWLINE,
+    OP_PRINT_ARRAY,
+    OP_PRINT_MAP,
+    OP_PRINT_BUILDER,
+    OP_PRINT_READER,     // the reader's current line
+    OP_PRINT_CHANNEL,
+
+    // arrays (bounds-checked element access)
+    OP_NEW_ARRAY,        // pop length, push a zeroed array of VarType a
+    OP_INDEX_INT,        // pop index, pop array, push element
+    OP_INDEX_FLOAT,
+    OP_STORE_INDEX_INT,  // pop value, pop index, pop array, store element
+    OP_STORE_INDEX_FLOAT,
+    OP_NEW_MAP,          // pop capacity hint, push an empty map with key VarType a
+    OP_NEW_BUILDER,      // pop capacity hint, push an empty string builder
+    OP_OPEN_READER,      // pop path, push a file reader
+    OP_OPEN_WRITER,      // pop path, push a file writer
+    OP_NEW_CHANNEL,      // pop capacity, push an empty channel of VarType a
+
+    OP_CALL_NATIVE,      // call builtins[a] with the top b values as arguments
+    OP_CALL_FFI,         // call ffi[a] with its arguments on top; a string
+                         // result lives in scope b (see ffi.h)
+
+    // main's returns end the program and report the returned value
+    OP_RETURN_STATUS,  // report `return success;` style status constants[a]
+    OP_RETURN_INT, OP_RETURN_CHAR, OP_RETURN_FLOAT, OP_RETURN_BOOL, OP_RETURN_STR,
+
+    // user function calls on the VM frame stack
+    OP_CALL,           // call functions[a] with the top b values as arguments
+                       // (before linking, a >= function_count names imports[a - function_count])
+    OP_ADOPT,          // right after a CALL: what the callee handed back lives in scope a
+    OP_TAIL_CALL,      // same, reusing the current frame
+    OP_RETURN,         // pop the result, drop the frame, push the result
+    OP_RETURN_VOID,    // drop the frame
+    OP_NO_RETURN,      // error: a typed function ended without `return`
+    OP_SPAWN,          // pop b arguments, run functions[a] on them in a new task
+    OP_START,          // pop b arguments, start functions[a] on them as a coroutine
+    OP_ITER_NEW,       // pop the arguments of generator body functions[a] and push
+                       // an iterator that runs it a value at a time
+    OP_ITER_NEXT,      // pop an iterator and push its next value; once it has ended, ip = a
+    OP_ITER_DROP,      // the iterator in slots[a], if any, is being replaced by
+                       // the only other reference to it: free it now, moving down
+                       // the marks of the loops from slots[b] (-1: none) out
+    OP_YIELD,          // pop a value and pause this generator, handing the value out
+    OP_MEMO_LOOKUP,    // @memo entry: if these arguments were seen, push the result
+                       // and ip = b; else copy them to slots[a] onwards
+    OP_MEMO_STORE,     // remember the top value as the result for the key in slots[a]
+
+    OP_JUMP,           // ip = a
+    OP_JUMP_IF_FALSE,  // pop; if zero, ip = a
+    OP_JUMP_IF_TRUE,   // pop; if non-zero, ip = a (loop back-edge)
+    OP_LOOP_MARK,      // before a loop: note the heap and arena tops in slots[a], slots[a + 1],
+                       // and b, the enclosing loop's mark slot (-1: none), in slots[a + 2]
+    OP_LOOP_SWEEP,     // end of an iteration: free what it made in scope b or deeper,
+                       // then note the tops again
+
+    OP_PARALLEL,       // pop the bound, run loops[a] across the thread pool
+    OP_BENCH_START,    // pop warmup, pop iterations, start a pypstdio.bench run
+                       // named constants[a].s, kept in slots[b]
+    OP_BENCH_NEXT,     // time the run in slots[a]; when it is over, print it and ip = b
+    OP_SNAPSHOT,       // with --snapshot, save the program and main's slots, whose
+                       // types constants[a].s gives (see AST_SNAPSHOT), and end the run
+    OP_HALT
+} OpCode;
+
+typedef struct {
+    OpCode op;
+    int a;
+    int b;
+} Instr;
+
+// -----------------------------
+// Compiled program
+// -----------------------------
+typedef struct {
+    char *name;
+    Instr *code;
+    int *lines;        // source line of each instruction
+    int code_count;
+    int code_capacity;
+    int param_count;   // parameters occupy slots 0 .. param_count-1
+    int local_count;
+    int max_stack;
+    int memo_size;     // @memo: most results remembered per thread; 0 if not memoized
+    int region;        // nothing allocated during a call outlives it: the call's
+                       // region is freed whole on return. Otherwise only what
+                       // was allocated in a scope of its own is, and what
+                       // escapes moves to the caller's region.
+    int owns_source;   // a map, filter or take body whose source iterator
+                       // (slot 0) was made for it alone, and ends with it
+} Function;
+
+// A `parallel for (i = start; i < bound; i = i + step)`. Its body is
+// compiled into functions[body], which runs a chunk of iterations on a
+// copy of the enclosing frame's first copy_count slots: slot left_slot of
+// them, from the value in slot index_slot on. Counting iterations instead
+// of comparing i with a limit keeps chunks that end near the top of the
+// int range from overflowing.
+#define PARALLEL_REDUCE_MAX 8
+
+typedef struct {
+    int body;
+    int index_slot;
+    int left_slot;
+    int copy_count;
+    long long step;
+    int inclusive;     // the bound was written with <=
+    int reduce_count;
+    int reduce_slots[PARALLEL_REDUCE_MAX];
+    VarType reduce_types[PARALLEL_REDUCE_MAX];   // VAR_INT or VAR_FLOAT: summed
+} ParallelLoop;
+
+// A function of a shared library, declared with
+// `ffi "library" func name(type a, ...) [type];`
+typedef struct {
+    char *library;
+    char *symbol;
+    char *types;       // the return type, then each parameter's (see TYPE_CODE)
+    int param_count;
+} FfiImport;
+
+typedef struct {
+    Function *functions;
+    int function_count;
+    int main_index;    // -1 in a module
+    Value *constants;
+    int constant_count;
+    int constant_capacity;
+    char **strings;    // name constants owned by the program
+    int string_count;
+    Str **texts;       // string literal constants owned by the program
+    int text_count;
+    ParallelLoop *loops;
+    int loop_count;
+    char **imports;    // "module.function" names called through `use`
+    int import_count;
+    FfiImport *ffi;    // foreign functions called through pypstdio.ffi
+    int ffi_count;
+} Program;
+
+Program *compile_program(ASTNode *root);
+void free_program(Program *program);
+void print_program(Program *program);
+const char *opcode_name(OpCode op);
+
+#endif // COMPILER_H
@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <string.h>
+#include "csv.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WPY_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// -----------------------------
+// Blocks
+// -----------------------------
+// Langdale and Lemire, "Parsing Gigabytes of JSON per Second" (2019),
+// applied to CSV: each kernel finds, per 64-byte block, the masks of
+// quotes and of separators-or-newlines, and hands them to index_block.
+// The last block is padded with zeros, which are none of the three
+// (csv.next refuses a NUL separator).
+
+// Bit i is the XOR of bits 0..i of x, so a quote mask becomes the mask of
+// the bytes from each opening quote up to, but not including, its
+// closing one.
+static inline uint64_t prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// Stores the offsets of the structural bytes outside `inside`; `carry` is
+// all ones while a quoted field runs on into the next block.
+static inline size_t index_block(uint64_t structural, uint64_t inside, uint64_t *carry, uint32_t base,
+                                 uint32_t *out) {
+    inside ^= *carry;
+    *carry = (uint64_t)((int64_t)inside >> 63);
+    uint64_t bits = structural & ~inside;
+    size_t n = 0;
+    while (bits) {
+        out[n++] = base + (uint32_t)__builtin_ctzll(bits);
+        bits &= bits - 1;
+    }
+    return n;
+}
+
+static size_t index_scalar(const unsigned char *s, size_t n, char sep, int *quoted, uint32_t *out) {
+    uint64_t carry = *quoted ? ~0ull : 0;
+    size_t count = 0;
+    for (size_t i = 0; i < n; i += 64) {
+        size_t end = i + 64 < n ? i + 64 : n;
+        uint64_t quotes = 0, structural = 0;
+        for (size_t j = i; j < end; j++) {
+            uint64_t bit = 1ull << (j - i);
+            if (s[j] == '"') quotes |= bit;
+            else if (s[j] == (unsigned char)sep || s[j] == '\n') structural |= bit;
+        }
+        count += index_block(structural, prefix_xor(quotes), &carry, (uint32_t)i, out + count);
+    }
+    *quoted = carry != 0;
+    return count;
+}
+
+#ifdef WPY_X86_SIMD
+// -----------------------------
+// Vector kernels
+// -----------------------------
+__attribute__((target("sse2")))
+static size_t index_sse2(const unsigned char *s, size_t n, char sep, int *quoted, uint32_t *out) {
+    const __m128i quote = _mm_set1_epi8('"'), separator = _mm_set1_epi8(sep), newline = _mm_set1_epi8('\n');
+    uint64_t carry = *quoted ? ~0ull : 0;
+    size_t count = 0;
+    unsigned char tail[64];
+    for (size_t i = 0; i < n; i += 64) {
+        const unsigned char *p = s + i;
+        if (i + 64 > n) {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, p, n - i);
+            p = tail;
+        }
+        uint64_t quotes = 0, structural = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i x = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+            uint64_t q = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, quote));
+            uint64_t d = (uint16_t)_mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(x, separator), _mm_cmpeq_epi8(x, newline)));
+            quotes |= q << (16 * k);
+            structural |= d << (16 * k);
+        }
+        count += index_block(structural, prefix_xor(quotes), &carry, (uint32_t)i, out + count);
+    }
+    *quoted = carry != 0;
+    return count;
+}
+
+// With AVX2 the prefix XOR is one carry-less multiply by all ones.
+__attribute__((target("avx2,pclmul")))
+static size_t index_avx2(const unsigned char *s, size_t n, char sep, int *quoted, uint32_t *out) {
+    const __m256i quote = _mm256_set1_epi8('"'), separator = _mm256_set1_epi8(sep),
+                  newline = _mm256_set1_epi8('\n');
+    const __m128i ones = _mm_set1_epi8((char)0xFF);
+    uint64_t carry = *quoted ? ~0ull : 0;
+    size_t count = 0;
+    unsigned char tail[64];
+    for (size_t i = 0; i < n; i += 64) {
+        const unsigned char *p = s + i;
+        if (i + 64 > n) {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, p, n - i);
+            p = tail;
+        }
+        __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+        uint64_t quotes = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, quote)) |
+                          (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, quote)) << 32;
+        uint64_t structural =
+            (uint32_t)_mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(lo, separator), _mm256_cmpeq_epi8(lo, newline))) |
+            (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(hi, separator), _mm256_cmpeq_epi8(hi, newline))) << 32;
+        uint64_t inside;
+        _mm_storel_epi64((__m128i *)&inside,
+                         _mm_clmulepi64_si128(_mm_set_epi64x(0, (long long)quotes), ones, 0));
+        count += index_block(structural, inside, &carry, (uint32_t)i, out + count);
+    }
+    *quoted = carry != 0;
+    return count;
+}
+#endif // WPY_X86_SIMD
+
+// -----------------------------
+// Runtime dispatch
+// -----------------------------
+typedef size_t (*IndexFn)(const unsigned char *s, size_t n, char sep, int *quoted, uint32_t *out);
+
+static IndexFn active_indexer = NULL;
+static const char *active_level = "scalar";
+
+static IndexFn indexer(void) {
+    if (active_indexer) return active_indexer;
+
+    IndexFn picked = index_scalar;
+#ifdef WPY_X86_SIMD
+    const char *force = getenv("WPY_SIMD");
+    int allow_avx2 = !force || strcmp(force, "avx2") == 0;
+    int allow_sse2 = !force || strcmp(force, "scalar") != 0;
+    __builtin_cpu_init();
+    if (allow_avx2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("pclmul")) {
+        picked = index_avx2;
+        active_level = "avx2";
+    } else if (allow_sse2 && __builtin_cpu_supports("sse2")) {
+        picked = index_sse2;
+        active_level = "sse2";
+    }
+#endif
+    active_indexer = picked;
+    return picked;
+}
+
+const char *csv_simd_level(void) {
+    indexer();
+    return active_level;
+}
+
+size_t csv_index(const char *s, size_t n, char sep, int *quoted, uint32_t *out) {
+    return indexer()((const unsigned char *)s, n, sep, quoted, out);
+}
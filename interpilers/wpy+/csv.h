@@ -0,0 +1,23 @@
+#ifndef CSV_H
+#define CSV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// -----------------------------
+// pypstdio.csv structural index
+// -----------------------------
+// The first of the two stages of csv.next (see file.c). csv_index() looks
+// at s[0..n) 64 bytes at a time, builds bitmasks of its double quotes,
+// separators and newlines with SIMD compares (AVX2 or SSE2, picked at
+// runtime like the array kernels; WPY_SIMD=scalar turns it off), turns
+// the quotes into a mask of the bytes inside quoted fields, and stores the
+// offsets of the separators and newlines outside it in `out`, which has
+// room for n entries. *quoted says whether s starts inside a quoted field,
+// and on return whether s[n - 1] is. Returns the number of offsets stored.
+// A doubled quote inside a quoted field leaves and re-enters it, so it
+// needs no special case.
+size_t csv_index(const char *s, size_t n, char sep, int *quoted, uint32_t *out);
+const char *csv_simd_level(void);
+
+#endif // CSV_H
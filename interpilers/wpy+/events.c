@@ -0,0 +1,573 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L   // getaddrinfo, clock_gettime
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include "events.h"
+#include "array.h"
+#include "builder.h"
+#include "str.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+// io.read asks for at most this many bytes at a time
+#define IO_CHUNK 65536
+
+const char event_wait[] = "awaitable builtin used outside an async function";
+_Thread_local EventWait *event_current = NULL;
+
+static _Thread_local char error_text[192];
+
+long long event_now(void) {
+    struct timespec now;
+#ifndef _WIN32
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#else
+    timespec_get(&now, TIME_UTC);
+#endif
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// -----------------------------
+// Poller
+// -----------------------------
+// Per fd, at most one coroutine waits to read and one to write. With
+// epoll an fd is registered, edge-triggered for both directions, the
+// first time anybody waits on it and stays registered until io.close, so
+// waiting costs no epoll_ctl call after the first. That misses nothing: a
+// builtin only waits after the fd reported EAGAIN, so the next change of
+// readiness comes as a fresh edge. Timers sit in a binary min-heap ordered
+// by deadline, then by the order they were parked.
+typedef struct {
+    void *reader;
+    void *writer;
+    int registered;       // with epoll
+} FdWaiters;
+
+typedef struct {
+    long long deadline;
+    unsigned long long order;
+    void *owner;
+} Timer;
+
+typedef struct {
+    int epfd;             // -1 when poll() is used
+    FdWaiters *fds;
+    int fd_capacity;
+    int fd_waiting;       // owners parked on fds
+    Timer *timers;
+    int timer_count;
+    int timer_capacity;
+    unsigned long long timer_order;
+} Poller;
+
+static _Thread_local Poller *poller = NULL;
+
+static Poller *poller_get(void) {
+    if (poller) return poller;
+    Poller *p = calloc(1, sizeof(Poller));
+    if (!p) return NULL;
+    p->epfd = -1;
+#ifdef __linux__
+    p->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (p->epfd < 0) {
+        free(p);
+        return NULL;
+    }
+#endif
+    poller = p;
+    return p;
+}
+
+void event_release(void) {
+    if (!poller) return;
+#ifndef _WIN32
+    if (poller->epfd >= 0) close(poller->epfd);
+#endif
+    free(poller->fds);
+    free(poller->timers);
+    free(poller);
+    poller = NULL;
+}
+
+static int poller_watch(Poller *p, int fd) {
+#ifdef __linux__
+    FdWaiters *f = &p->fds[fd];
+    if (f->registered) return 1;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(p->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) return 0;
+    f->registered = 1;
+#else
+    (void)p;
+    (void)fd;
+#endif
+    return 1;
+}
+
+// Drops fd from epoll before it is closed, since its number may be reused.
+static void poller_forget(int fd) {
+#ifdef __linux__
+    if (!poller || fd < 0 || fd >= poller->fd_capacity || !poller->fds[fd].registered) return;
+    epoll_ctl(poller->epfd, EPOLL_CTL_DEL, fd, NULL);
+    poller->fds[fd].registered = 0;
+#else
+    (void)fd;
+#endif
+}
+
+static int timer_before(const Timer *a, const Timer *b) {
+    return a->deadline < b->deadline || (a->deadline == b->deadline && a->order < b->order);
+}
+
+static int timer_push(Poller *p, long long deadline, void *owner) {
+    if (p->timer_count == p->timer_capacity) {
+        int capacity = p->timer_capacity ? p->timer_capacity * 2 : 64;
+        Timer *timers = realloc(p->timers, sizeof(Timer) * capacity);
+        if (!timers) return 0;
+        p->timers = timers;
+        p->timer_capacity = capacity;
+    }
+    Timer t = { deadline, p->timer_order++, owner };
+    int i = p->timer_count++;
+    while (i > 0 && timer_before(&t, &p->timers[(i - 1) / 2])) {
+        p->timers[i] = p->timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    p->timers[i] = t;
+    return 1;
+}
+
+static void *timer_pop(Poller *p) {
+    void *owner = p->timers[0].owner;
+    Timer last = p->timers[--p->timer_count];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= p->timer_count) break;
+        if (child + 1 < p->timer_count && timer_before(&p->timers[child + 1], &p->timers[child])) child++;
+        if (!timer_before(&p->timers[child], &last)) break;
+        p->timers[i] = p->timers[child];
+        i = child;
+    }
+    p->timers[i] = last;
+    return owner;
+}
+
+const char *event_park(EventWait *w, void *owner) {
+    Poller *p = poller_get();
+    if (!p) return "out of memory";
+    w->retry = 1;
+    if (w->fd < 0) return timer_push(p, w->deadline, owner) ? NULL : "out of memory";
+
+    if (w->fd >= p->fd_capacity) {
+        int capacity = p->fd_capacity ? p->fd_capacity : 64;
+        while (capacity <= w->fd) capacity *= 2;
+        FdWaiters *fds = realloc(p->fds, sizeof(FdWaiters) * capacity);
+        if (!fds) return "out of memory";
+        memset(fds + p->fd_capacity, 0, sizeof(FdWaiters) * (capacity - p->fd_capacity));
+        p->fds = fds;
+        p->fd_capacity = capacity;
+    }
+    FdWaiters *f = &p->fds[w->fd];
+    void **slot = w->events == EVENT_READ ? &f->reader : &f->writer;
+    if (*slot) {
+        snprintf(error_text, sizeof(error_text), "another coroutine is already waiting to %s fd %d",
+                 w->events == EVENT_READ ? "read" : "write", w->fd);
+        return error_text;
+    }
+    *slot = owner;
+    if (!poller_watch(p, w->fd)) {
+        *slot = NULL;
+        snprintf(error_text, sizeof(error_text), "cannot wait on fd %d: %s", w->fd, strerror(errno));
+        return error_text;
+    }
+    p->fd_waiting++;
+    return NULL;
+}
+
+static void wake_fd(Poller *p, int fd, int readable, int writable, void (*ready)(void *owner)) {
+    FdWaiters *f = &p->fds[fd];
+    void *reader = readable ? f->reader : NULL;
+    void *writer = writable ? f->writer : NULL;
+    if (reader) {
+        f->reader = NULL;
+        p->fd_waiting--;
+    }
+    if (writer) {
+        f->writer = NULL;
+        p->fd_waiting--;
+    }
+    if (reader) ready(reader);
+    if (writer) ready(writer);
+}
+
+int event_poll(void (*ready)(void *owner)) {
+    Poller *p = poller;
+    if (!p || (p->fd_waiting == 0 && p->timer_count == 0)) return 0;
+    int timeout = -1;
+    if (p->timer_count) {
+        long long wait = p->timers[0].deadline - event_now();
+        timeout = wait < 0 ? 0 : wait > INT_MAX ? INT_MAX : (int)wait;
+    }
+
+#if defined(__linux__)
+    struct epoll_event events[64];
+    int n = epoll_wait(p->epfd, events, 64, timeout);
+    for (int i = 0; i < n; i++) {
+        unsigned e = events[i].events;
+        wake_fd(p, events[i].data.fd, (e & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0,
+                (e & (EPOLLOUT | EPOLLHUP | EPOLLERR)) != 0, ready);
+    }
+#elif !defined(_WIN32)
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * (p->fd_waiting + 1));
+    if (!fds) return 0;
+    int count = 0;
+    for (int fd = 0; fd < p->fd_capacity; fd++) {
+        FdWaiters *f = &p->fds[fd];
+        if (!f->reader && !f->writer) continue;
+        fds[count].fd = fd;
+        fds[count].events = (short)((f->reader ? POLLIN : 0) | (f->writer ? POLLOUT : 0));
+        fds[count].revents = 0;
+        count++;
+    }
+    int n = poll(fds, (nfds_t)count, timeout);
+    for (int i = 0; i < count && n > 0; i++) {
+        int e = fds[i].revents;
+        if (!e) continue;
+        wake_fd(p, fds[i].fd, (e & (POLLIN | POLLHUP | POLLERR | POLLNVAL)) != 0,
+                (e & (POLLOUT | POLLHUP | POLLERR | POLLNVAL)) != 0, ready);
+    }
+    free(fds);
+#endif
+
+    long long now = event_now();
+    while (p->timer_count && p->timers[0].deadline <= now) ready(timer_pop(p));
+    return 1;
+}
+
+// -----------------------------
+// Builtins
+// -----------------------------
+#ifndef _WIN32
+static const char *io_error(const char *what) {
+    snprintf(error_text, sizeof(error_text), "%s: %s", what, strerror(errno));
+    return error_text;
+}
+
+static int would_block(void) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+static void make_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+// A peer that hangs up should fail the write, not kill the process.
+static void ignore_sigpipe(void) {
+    signal(SIGPIPE, SIG_IGN);
+}
+
+static const char *wait_fd(EventWait *w, int fd, int events) {
+    w->fd = fd;
+    w->events = events;
+    return EVENT_WAIT;
+}
+
+static void done(EventWait *w) {
+    w->retry = 0;
+    w->progress = 0;
+}
+
+static const char *resolve(Str *host, long long port, int passive, struct addrinfo **addrs) {
+    const char *name = str_chars(host);
+    if (!name) return "out of memory";
+    if (port < 0 || port > 65535) return "port must be between 0 and 65535";
+    char service[16];
+    snprintf(service, sizeof(service), "%lld", port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    int err = getaddrinfo(name[0] ? name : NULL, service, &hints, addrs);
+    if (err) {
+        snprintf(error_text, sizeof(error_text), "cannot resolve '%s': %s", name, gai_strerror(err));
+        return error_text;
+    }
+    return NULL;
+}
+
+// net.listen(host, port): a listening socket; host "" means every address
+// and port 0 picks a free one (see net.port).
+const char *native_net_listen(Value *args, Value *result) {
+    struct addrinfo *addrs;
+    const char *err = resolve(args[0].str, args[1].i, 1, &addrs);
+    if (err) return err;
+    ignore_sigpipe();
+    int fd = -1;
+    for (struct addrinfo *a = addrs; a; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) continue;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, a->ai_addr, a->ai_addrlen) == 0 && listen(fd, 128) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) err = io_error("net.listen");
+    freeaddrinfo(addrs);
+    if (err) return err;
+    make_nonblocking(fd);
+    result->i = fd;
+    return NULL;
+}
+
+const char *native_net_port(Value *args, Value *result) {
+    struct sockaddr_storage addr;
+    socklen_t length = sizeof(addr);
+    if (getsockname((int)args[0].i, (struct sockaddr *)&addr, &length) < 0) return io_error("net.port");
+    if (addr.ss_family == AF_INET) result->i = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+    else if (addr.ss_family == AF_INET6) result->i = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+    else result->i = 0;
+    return NULL;
+}
+
+// net.pair(fds) / pipe.open(fds) store two new fds in fds[0] and fds[1].
+static const char *store_pair(Value *args, int pair[2]) {
+    Array *fds = args[0].p;
+    if (fds->length < 2) {
+        close(pair[0]);
+        close(pair[1]);
+        return "needs an int array of length 2 or more";
+    }
+    make_nonblocking(pair[0]);
+    make_nonblocking(pair[1]);
+    fds->ints[0] = pair[0];
+    fds->ints[1] = pair[1];
+    return NULL;
+}
+
+const char *native_net_pair(Value *args, Value *result) {
+    (void)result;
+    int pair[2];
+    ignore_sigpipe();
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) return io_error("net.pair");
+    return store_pair(args, pair);
+}
+
+// pipe.open(fds): fds[0] is the read end, fds[1] the write end.
+const char *native_pipe_open(Value *args, Value *result) {
+    (void)result;
+    int pair[2];
+    ignore_sigpipe();
+    if (pipe(pair) < 0) return io_error("pipe.open");
+    return store_pair(args, pair);
+}
+
+const char *native_io_close(Value *args, Value *result) {
+    (void)result;
+    int fd = (int)args[0].i;
+    if (poller && fd >= 0 && fd < poller->fd_capacity &&
+        (poller->fds[fd].reader || poller->fds[fd].writer)) {
+        snprintf(error_text, sizeof(error_text), "io.close: a coroutine is still waiting on fd %d", fd);
+        return error_text;
+    }
+    poller_forget(fd);
+    return close(fd) < 0 ? io_error("io.close") : NULL;
+}
+
+const char *native_timer_now(Value *args, Value *result) {
+    (void)args;
+    result->i = event_now();
+    return NULL;
+}
+
+// -----------------------------
+// Awaitable builtins
+// -----------------------------
+const char *native_net_accept(Value *args, Value *result) {
+    EventWait *w = event_current;
+    if (!w) return EVENT_WAIT;
+    int fd = (int)args[0].i;
+    int client = accept(fd, NULL, NULL);
+    if (client < 0) {
+        if (would_block() || errno == ECONNABORTED) return wait_fd(w, fd, EVENT_READ);
+        done(w);
+        return io_error("net.accept");
+    }
+    done(w);
+    make_nonblocking(client);
+    result->i = client;
+    return NULL;
+}
+
+// The first call starts connecting; `progress` holds the socket until it
+// becomes writable, when SO_ERROR tells how the connect went.
+const char *native_net_connect(Value *args, Value *result) {
+    EventWait *w = event_current;
+    if (!w) return EVENT_WAIT;
+    if (!w->retry) {
+        struct addrinfo *addrs;
+        const char *err = resolve(args[0].str, args[1].i, 0, &addrs);
+        if (err) return err;
+        ignore_sigpipe();
+        int fd = -1;
+        errno = ECONNREFUSED;
+        for (struct addrinfo *a = addrs; a && fd < 0; a = a->ai_next) {
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd < 0) continue;
+            make_nonblocking(fd);
+            if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+                freeaddrinfo(addrs);
+                result->i = fd;
+                return NULL;
+            }
+            if (errno == EINPROGRESS) {
+                freeaddrinfo(addrs);
+                w->progress = fd;
+                return wait_fd(w, fd, EVENT_WRITE);
+            }
+            close(fd);
+            fd = -1;
+        }
+        err = io_error("net.connect");
+        freeaddrinfo(addrs);
+        return err;
+    }
+
+    int fd = (int)w->progress;
+    int status = 0;
+    socklen_t length = sizeof(status);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &status, &length) < 0) status = errno;
+    done(w);
+    if (status) {
+        poller_forget(fd);
+        close(fd);
+        errno = status;
+        return io_error("net.connect");
+    }
+    result->i = fd;
+    return NULL;
+}
+
+// io.read(fd, b): appends what is available (up to 64 KB) to b and returns
+// the number of bytes; 0 means end of file.
+const char *native_io_read(Value *args, Value *result) {
+    EventWait *w = event_current;
+    if (!w) return EVENT_WAIT;
+    int fd = (int)args[0].i;
+    Builder *b = args[1].p;
+    if (!builder_reserve(b, IO_CHUNK)) return "out of memory";
+    ssize_t n = read(fd, b->data + b->length, IO_CHUNK);
+    if (n < 0) {
+        if (would_block()) return wait_fd(w, fd, EVENT_READ);
+        done(w);
+        return io_error("io.read");
+    }
+    done(w);
+    if (n > 0) {
+        b->length += n;
+        b->snapshot_fresh = 0;
+    }
+    result->i = n;
+    return NULL;
+}
+
+// Writes all of text, `progress` bytes of which went out before a wait.
+static const char *write_all(int fd, const char *text, long long length, Value *result) {
+    EventWait *w = event_current;
+    if (!w) return EVENT_WAIT;
+    while (w->progress < length) {
+        ssize_t n = write(fd, text + w->progress, (size_t)(length - w->progress));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return wait_fd(w, fd, EVENT_WRITE);
+            done(w);
+            return io_error("io.write");
+        }
+        w->progress += n;
+    }
+    done(w);
+    result->i = length;
+    return NULL;
+}
+
+const char *native_io_write_str(Value *args, Value *result) {
+    const char *text = str_chars(args[1].str);
+    if (!text) return "out of memory";
+    return write_all((int)args[0].i, text, args[1].str->length, result);
+}
+
+const char *native_io_write_builder(Value *args, Value *result) {
+    Builder *b = args[1].p;
+    return write_all((int)args[0].i, b->data, b->length, result);
+}
+
+const char *native_timer_sleep(Value *args, Value *result) {
+    (void)result;
+    EventWait *w = event_current;
+    if (!w) return EVENT_WAIT;
+    if (!w->retry) {
+        w->fd = -1;
+        w->deadline = event_now() + (args[0].i > 0 ? args[0].i : 0);
+        return EVENT_WAIT;
+    }
+    done(w);
+    return NULL;
+}
+
+#else
+// No sockets or pipes on Windows yet; timers still work.
+static const char *unsupported(void) {
+    return "sockets and pipes are not supported on Windows";
+}
+
+const char *native_net_listen(Value *args, Value *result)  { (void)args; (void)result; return unsupported(); }
+const char *native_net_port(Value *args, Value *result)    { (void)args; (void)result; return unsupported(); }
+const char *native_net_pair(Value *args, Value *result)    { (void)args; (void)result; return unsupported(); }
+const char *native_pipe_open(Value *args, Value *result)   { (void)args; (void)result; return unsupported(); }
+const char *native_io_close(Value *args, Value *result)    { (void)args; (void)result; return unsupported(); }
+const char *native_net_accept(Value *args, Value *result)  { (void)args; (void)result; return unsupported(); }
+const char *native_net_connect(Value *args, Value *result) { (void)args; (void)result; return unsupported(); }
+const char *native_io_read(Value *args, Value *result)     { (void)args; (void)result; return unsupported(); }
+const char *native_io_write_str(Value *args, Value *result)     { (void)args; (void)result; return unsupported(); }
+const char *native_io_write_builder(Value *args, Value *result) { (void)args; (void)result; return unsupported(); }
+
+const char *native_timer_now(Value *args, Value *result) {
+    (void)args;
+    result->i = event_now();
+    return NULL;
+}
+
+const char *native_timer_sleep(Value *args, Value *result) {
+    (void)result;
+    EventWait *w = event_current;
+    if (!w) return EVENT_WAIT;
+    if (!w->retry) {
+        w->fd = -1;
+        w->deadline = event_now() + (args[0].i > 0 ? args[0].i : 0);
+        return EVENT_WAIT;
+    }
+    w->retry = 0;
+    return NULL;
+}
+#endif
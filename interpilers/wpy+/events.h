@@ -0,0 +1,63 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include "compiler.h"
+
+// -----------------------------
+// Event loop I/O
+// -----------------------------
+// Sockets, pipes and timers for async functions. The awaitable builtins
+// never block: when one would have to wait, it records what for in the
+// running coroutine's EventWait and returns EVENT_WAIT. The VM then
+// suspends the coroutine and the loop parks it with this thread's poller
+// (epoll on Linux, poll() elsewhere). Once the fd is ready or the deadline
+// has passed, the coroutine resumes by calling the same builtin again with
+// the same arguments; `progress` carries over what it had already done.
+#define EVENT_READ  1
+#define EVENT_WRITE 2
+
+typedef struct {
+    int fd;               // wait until fd is ready for `events`, or -1
+    int events;           // EVENT_READ or EVENT_WRITE
+    long long deadline;   // or until event_now() reaches this
+    long long progress;   // builtin state kept across retries
+    int retry;            // the builtin runs again after a wait
+} EventWait;
+
+// Returned by a builtin that has to wait. Its text is the error reported
+// if an awaitable builtin is somehow called outside a coroutine.
+extern const char event_wait[];
+#define EVENT_WAIT event_wait
+
+// The running coroutine's record; NULL outside coroutines. Set by the loop.
+extern _Thread_local EventWait *event_current;
+
+// Monotonic clock in milliseconds.
+long long event_now(void);
+
+// Parks `owner` until w's fd is ready or its deadline passes. NULL, or an
+// error message.
+const char *event_park(EventWait *w, void *owner);
+// Blocks until at least one parked owner is ready and passes each one to
+// `ready`. Returns 0 at once if nothing is parked.
+int event_poll(void (*ready)(void *owner));
+// Forgets everything parked on this thread.
+void event_release(void);
+
+// -----------------------------
+// Builtins (see builtins.c)
+// -----------------------------
+const char *native_net_listen(Value *args, Value *result);
+const char *native_net_port(Value *args, Value *result);
+const char *native_net_pair(Value *args, Value *result);
+const char *native_pipe_open(Value *args, Value *result);
+const char *native_io_close(Value *args, Value *result);
+const char *native_timer_now(Value *args, Value *result);
+const char *native_net_accept(Value *args, Value *result);
+const char *native_net_connect(Value *args, Value *result);
+const char *native_io_read(Value *args, Value *result);
+const char *native_io_write_str(Value *args, Value *result);
+const char *native_io_write_builder(Value *args, Value *result);
+const char *native_timer_sleep(Value *args, Value *result);
+
+#endif // EVENTS_H
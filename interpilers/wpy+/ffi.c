@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "ffi.h"
+#include "array.h"
+#include "str.h"
+
+#if !defined(_WIN32) && (defined(__x86_64__) || defined(__aarch64__))
+#define WPY_FFI 1
+#include <dlfcn.h>
+#endif
+
+int ffi_param_type(VarType type) {
+    return type == VAR_INT || type == VAR_CHAR || type == VAR_BOOL || type == VAR_FLOAT || type == VAR_STRING ||
+           type == VAR_ARRAY_INT || type == VAR_ARRAY_FLOAT;
+}
+
+int ffi_result_type(VarType type) {
+    return type == VAR_UNKNOWN || type == VAR_INT || type == VAR_CHAR || type == VAR_BOOL || type == VAR_FLOAT ||
+           type == VAR_STRING;
+}
+
+VarType ffi_result(const char *types) {
+    return types[0] == FFI_INT32 ? VAR_INT : (VarType)(types[0] - TYPE_CODE(0));
+}
+
+// -----------------------------
+// Call plans
+// -----------------------------
+// How each argument is passed: which of the integer registers (0 ..
+// FFI_INT_ARGS-1) or double registers (FFI_INT_ARGS ..) it goes in, and
+// what is put there.
+typedef enum {
+    PASS_INT,      // int, char, bool: the value
+    PASS_FLOAT,
+    PASS_STRING,   // its flat text
+    PASS_ARRAY     // its elements
+} Pass;
+
+typedef struct {
+    void *fn;
+    int param_count;
+    VarType result;
+    int int32;        // result declared int32
+    unsigned char pass[FFI_INT_ARGS + FFI_FLOAT_ARGS];
+    unsigned char reg[FFI_INT_ARGS + FFI_FLOAT_ARGS];
+} Binding;
+
+typedef struct {
+    char *path;
+    void *handle;
+} Library;
+
+static Binding *bindings = NULL;
+static Library *libraries = NULL;
+static int library_count = 0;
+
+#ifdef WPY_FFI
+// -----------------------------
+// Stubs
+// -----------------------------
+// One per class of result: integers and pointers come back in the first
+// integer register, doubles in the first double register.
+typedef long long (*IntStub)(long long, long long, long long, long long, long long, long long, double, double,
+                             double, double, double, double, double, double);
+typedef double (*FloatStub)(long long, long long, long long, long long, long long, long long, double, double,
+                            double, double, double, double, double, double);
+
+#define STUB_ARGS(x, d) x[0], x[1], x[2], x[3], x[4], x[5], d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7]
+
+// Assigns registers in declaration order, each class counting on its own.
+static int plan(Binding *b, const FfiImport *import) {
+    int ints = 0, floats = 0;
+    b->param_count = import->param_count;
+    b->result = ffi_result(import->types);
+    b->int32 = import->types[0] == FFI_INT32;
+    for (int i = 0; i < import->param_count; i++) {
+        VarType t = (VarType)(import->types[i + 1] - TYPE_CODE(0));
+        if (t == VAR_FLOAT) {
+            if (floats == FFI_FLOAT_ARGS) return 0;
+            b->pass[i] = PASS_FLOAT;
+            b->reg[i] = (unsigned char)(FFI_INT_ARGS + floats++);
+        } else {
+            if (ints == FFI_INT_ARGS) return 0;
+            if (t == VAR_STRING) b->pass[i] = PASS_STRING;
+            else if (t == VAR_ARRAY_INT || t == VAR_ARRAY_FLOAT) b->pass[i] = PASS_ARRAY;
+            else b->pass[i] = PASS_INT;
+            b->reg[i] = (unsigned char)ints++;
+        }
+    }
+    return 1;
+}
+
+// The library at `path` ("" for the interpiler and what it has loaded),
+// opened once however many imports name it.
+static void *open_library(const char *path) {
+    for (int i = 0; i < library_count; i++) {
+        if (strcmp(libraries[i].path, path) == 0) return libraries[i].handle;
+    }
+    void *handle = dlopen(path[0] ? path : NULL, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) return NULL;
+    libraries = realloc(libraries, sizeof(Library) * (size_t)(library_count + 1));
+    libraries[library_count].path = malloc(strlen(path) + 1);
+    strcpy(libraries[library_count].path, path);
+    libraries[library_count++].handle = handle;
+    return handle;
+}
+#endif
+
+int ffi_bind(const Program *program) {
+    if (!program->ffi_count) return 1;
+#ifndef WPY_FFI
+    fprintf(stderr, "wpy+.exe: pypstdio.ffi is not supported on this platform\n");
+    return 0;
+#else
+    bindings = calloc((size_t)program->ffi_count, sizeof(Binding));
+    for (int i = 0; i < program->ffi_count; i++) {
+        const FfiImport *import = &program->ffi[i];
+        void *handle = open_library(import->library);
+        if (!handle) {
+            fprintf(stderr, "wpy+.exe: cannot load library %s\n", dlerror());
+            ffi_release();
+            return 0;
+        }
+        dlerror();
+        bindings[i].fn = dlsym(handle, import->symbol);
+        if (!bindings[i].fn) {
+            const char *err = dlerror();
+            fprintf(stderr, "wpy+.exe: cannot bind %s: %s\n", import->symbol, err ? err : "symbol is NULL");
+            ffi_release();
+            return 0;
+        }
+        if (!plan(&bindings[i], import)) {
+            fprintf(stderr, "wpy+.exe: %s takes too many arguments for pypstdio.ffi\n", import->symbol);
+            ffi_release();
+            return 0;
+        }
+    }
+    return 1;
+#endif
+}
+
+const char *ffi_call(int index, const Value *args, Value *result) {
+#ifndef WPY_FFI
+    (void)index;
+    (void)args;
+    (void)result;
+    return "pypstdio.ffi is not supported on this platform";
+#else
+    const Binding *b = &bindings[index];
+    long long x[FFI_INT_ARGS] = { 0 };
+    double d[FFI_FLOAT_ARGS] = { 0 };
+    for (int i = 0; i < b->param_count; i++) {
+        switch ((Pass)b->pass[i]) {
+            case PASS_INT:
+                x[b->reg[i]] = args[i].i;
+                break;
+            case PASS_FLOAT:
+                d[b->reg[i] - FFI_INT_ARGS] = args[i].f;
+                break;
+            case PASS_STRING: {
+                const char *s = str_chars(args[i].str);
+                if (!s) return "out of memory";
+                x[b->reg[i]] = (long long)(intptr_t)s;
+                break;
+            }
+            case PASS_ARRAY:
+                x[b->reg[i]] = (long long)(intptr_t)((Array *)args[i].p)->data;
+                break;
+        }
+    }
+
+    if (b->result == VAR_FLOAT) {
+        result->f = ((FloatStub)b->fn)(STUB_ARGS(x, d));
+        return NULL;
+    }
+    long long r = ((IntStub)b->fn)(STUB_ARGS(x, d));
+    switch (b->result) {
+        case VAR_CHAR:
+            result->i = (char)r;
+            break;
+        case VAR_BOOL:
+            result->i = (unsigned char)r != 0;
+            break;
+        case VAR_STRING: {
+            const char *s = (const char *)(intptr_t)r;
+            result->str = str_new(s ? s : "", s ? (long long)strlen(s) : 0);
+            if (!result->str) return "out of memory";
+            break;
+        }
+        default:
+            result->i = b->int32 ? (int32_t)r : r;
+            break;
+    }
+    return NULL;
+#endif
+}
+
+void ffi_release(void) {
+#ifdef WPY_FFI
+    for (int i = 0; i < library_count; i++) {
+        dlclose(libraries[i].handle);
+        free(libraries[i].path);
+    }
+#endif
+    free(libraries);
+    free(bindings);
+    libraries = NULL;
+    library_count = 0;
+    bindings = NULL;
+}
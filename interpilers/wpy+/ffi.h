@@ -0,0 +1,59 @@
+#ifndef FFI_H
+#define FFI_H
+
+#include "compiler.h"
+
+// -----------------------------
+// pypstdio.ffi
+// -----------------------------
+// A script declares the C functions it calls in its header:
+//
+//   ffi "libm.so.6" func cos(float x) float;
+//
+// and calls them as pypstdio.ffi.cos(x). Before the program runs,
+// ffi_bind() dlopens each library once and looks up each symbol, and
+// works out a call plan for it: which argument register every parameter
+// goes in, and which stub calls it for its kind of result. A call then
+// only moves its arguments into place and jumps through the stub; the
+// declaration is not looked at again.
+//
+// int is a C long long, char a char, bool a bool, float a double and
+// string a NUL-terminated const char *; int[] and float[] pass a pointer
+// to the array's elements, which the function may change in place. A
+// string result is copied before the call returns, and NULL reads as "".
+// A result declared int32 is a C int: only its low 32 bits are set, so it
+// is sign-extended into an int.
+//
+// The stubs call every function as one taking FFI_INT_ARGS integer and
+// FFI_FLOAT_ARGS double arguments, which is how the x86-64 System V and
+// AArch64 calling conventions pass a non-variadic function's arguments
+// anyway: integers and doubles in two separate runs of registers. So a
+// foreign function takes no more than that of each, and cannot be
+// variadic (printf and the like). Other platforms refuse to bind.
+#define FFI_INT_ARGS 6
+#define FFI_FLOAT_ARGS 8
+
+// Whether a value of this type can be passed to, or returned from, a
+// foreign function.
+int ffi_param_type(VarType type);
+int ffi_result_type(VarType type);
+
+// types[0] of a declaration returning int32 (other results are TYPE_CODE)
+#define FFI_INT32 'Z'
+
+// The type a declaration's result has in the script.
+VarType ffi_result(const char *types);
+
+// Loads the libraries and symbols of program->ffi. 0 after printing an
+// error.
+int ffi_bind(const Program *program);
+
+// Calls program->ffi[index] with its arguments, already converted to the
+// declared types. A string result is a new Str the caller owns. NULL, or
+// a runtime error message.
+const char *ffi_call(int index, const Value *args, Value *result);
+
+// Closes the libraries opened by ffi_bind.
+void ffi_release(void);
+
+#endif // FFI_H
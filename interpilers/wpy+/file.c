@@ -0,0 +1,693 @@
+#ifndef _WIN32
+#define _DEFAULT_SOURCE   // madvise, fileno
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "file.h"
+#include "csv.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Streaming readers start with this much buffer; it doubles only when a
+// single line does not fit.
+#define READER_BUFFER (64 * 1024)
+// Mapped readers give consumed pages back to the OS in steps this large,
+// so resident memory stays flat however far into the file they get.
+#define READER_RELEASE_STEP (16LL * 1024 * 1024)
+#define WRITER_BUFFER (64 * 1024)
+// Line storage for strings comes in chunks of at least this much.
+#define LINE_CHUNK (4 * 1024)
+// csv.next indexes this much of the file at a time.
+#define CSV_CHUNK (64 * 1024)
+
+// -----------------------------
+// Readers
+// -----------------------------
+// Strings handed out for the current line live in these chunks, newest
+// first. Moving to the next line keeps only the newest one, emptied, so
+// the storage stays as big as one line's strings need.
+struct LineChunk {
+    LineChunk *next;
+    size_t used;
+    size_t size;
+    _Alignas(void *) char data[];
+};
+
+static Reader *reader_stream(Reader *r, FILE *stream) {
+    r->stream = stream;
+    r->capacity = READER_BUFFER;
+    r->buffer = malloc((size_t)r->capacity);
+    if (!r->buffer) {
+        reader_free(r);
+        return NULL;
+    }
+    r->data = r->buffer;
+    return r;
+}
+
+Reader *reader_open(const char *path) {
+    Reader *r = calloc(1, sizeof(Reader));
+    if (!r) return NULL;
+    if (strcmp(path, "-") == 0) return reader_stream(r, stdin);
+
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        free(r);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {
+            close(fd);
+            r->data = "";
+            return r;
+        }
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            close(fd);
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            r->map = map;
+            r->data = map;
+            r->size = st.st_size;
+            return r;
+        }
+    }
+    // pipes, devices, or a mapping the OS refused
+    FILE *stream = fdopen(fd, "rb");
+    if (!stream) close(fd);
+#else
+    FILE *stream = fopen(path, "rb");
+#endif
+    if (!stream) {
+        free(r);
+        return NULL;
+    }
+    return reader_stream(r, stream);
+}
+
+void reader_free(Reader *r) {
+    if (!r) return;
+#ifndef _WIN32
+    if (r->map) munmap(r->map, (size_t)r->size);
+#endif
+    if (r->stream && r->stream != stdin) fclose(r->stream);
+    while (r->strings) {
+        LineChunk *next = r->strings->next;
+        free(r->strings);
+        r->strings = next;
+    }
+    if (r->csv) {
+        free(r->csv->index);
+        free(r->csv->fields);
+        free(r->csv);
+    }
+    free(r->buffer);
+    free(r);
+}
+
+void reader_print(FILE *out, const Reader *r) {
+    fwrite(r->line, 1, (size_t)r->line_length, out);
+}
+
+// Moves the unread tail of a streaming reader to the front of its buffer
+// and reads more after it. Returns 0 on a read error.
+static int reader_fill(Reader *r) {
+    long long tail = r->size - r->pos;
+    memmove(r->buffer, r->buffer + r->pos, (size_t)tail);
+    r->size = tail;
+    r->pos = 0;
+    if (r->size == r->capacity) {
+        char *grown = realloc(r->buffer, (size_t)r->capacity * 2);
+        if (!grown) return 0;
+        r->buffer = grown;
+        r->capacity *= 2;
+    }
+    r->data = r->buffer;
+    size_t n = fread(r->buffer + r->size, 1, (size_t)(r->capacity - r->size), r->stream);
+    r->size += (long long)n;
+    if (n == 0) {
+        if (ferror(r->stream)) return 0;
+        r->eof = 1;
+    }
+    return 1;
+}
+
+#ifndef _WIN32
+// Drops mapped pages that lie wholly before `offset`.
+static void reader_release(Reader *r, long long offset) {
+    if (offset - r->released < READER_RELEASE_STEP) return;
+    long long page = sysconf(_SC_PAGESIZE);
+    long long end = offset / page * page;
+    madvise((char *)r->map + r->released, (size_t)(end - r->released), MADV_DONTNEED);
+    r->released = end;
+}
+#endif
+
+// Advances to the next line. Returns 1 for a line, 0 at the end of the
+// file, -1 on a read error.
+static int reader_next(Reader *r) {
+    for (;;) {
+        const char *start = r->data + r->pos;
+        long long available = r->size - r->pos;
+        const char *newline = available > 0 ? memchr(start, '\n', (size_t)available) : NULL;
+        if (newline || r->eof || !r->stream) {
+            if (!newline && available == 0) {
+                r->line = NULL;
+                r->line_length = 0;
+                return 0;
+            }
+            long long length = newline ? newline - start : available;
+            r->pos += newline ? length + 1 : length;
+            if (length > 0 && start[length - 1] == '\r') length--;
+            r->line = start;
+            r->line_length = length;
+            r->line_number++;
+#ifndef _WIN32
+            if (r->map) reader_release(r, start - r->data);
+#endif
+            return 1;
+        }
+        if (!reader_fill(r)) return -1;
+    }
+}
+
+// -----------------------------
+// CSV records
+// -----------------------------
+// The second stage of csv.next: records are cut out of the index that
+// csv_index builds a chunk at a time. A record ends at a newline outside
+// quotes; each field runs up to the next separator. Streaming readers
+// index what is buffered; when a record runs past it, the buffer is
+// refilled and the record is indexed again from its start.
+
+static int csv_add_field(CsvState *c, long long start, long long end) {
+    if (c->field_count == c->field_capacity) {
+        int capacity = c->field_capacity ? c->field_capacity * 2 : 16;
+        long long *grown = realloc(c->fields, sizeof(long long) * 2 * (size_t)capacity);
+        if (!grown) return 0;
+        c->fields = grown;
+        c->field_capacity = capacity;
+    }
+    c->fields[2 * c->field_count] = start;
+    c->fields[2 * c->field_count + 1] = end;
+    c->field_count++;
+    return 1;
+}
+
+// Starts indexing afresh at offset `from`, the start of a record.
+static void csv_restart(CsvState *c, long long from) {
+    c->count = c->at = 0;
+    c->base = c->scanned = from;
+    c->quoted = 0;
+}
+
+// Advances to the next record. Returns 1 for a record, 0 at the end of
+// the file, -1 on a read error and -2 when out of memory.
+static int csv_next(Reader *r, char sep) {
+    CsvState *c = r->csv;
+    if (!c) {
+        c = r->csv = calloc(1, sizeof(CsvState));
+        if (!c) return -2;
+        c->index = malloc(sizeof(uint32_t) * CSV_CHUNK);
+        if (!c->index) return -2;
+        c->resume = -1;
+    }
+    // file.next, or another separator, leaves the index behind
+    if (c->resume != r->pos || c->sep != sep) csv_restart(c, r->pos);
+    c->sep = sep;
+
+    long long start = r->pos, field = start, end;
+    c->field_count = 0;
+    for (;;) {
+        if (c->at < c->count) {
+            long long at = c->base + c->index[c->at++];
+            if (!csv_add_field(c, field, at)) return -2;
+            field = at + 1;
+            if (r->data[at] == '\n') {
+                end = at;
+                r->pos = at + 1;
+                break;
+            }
+        } else if (c->scanned < r->size) {
+            long long n = r->size - c->scanned < CSV_CHUNK ? r->size - c->scanned : CSV_CHUNK;
+            c->base = c->scanned;
+            c->count = (int)csv_index(r->data + c->base, (size_t)n, sep, &c->quoted, c->index);
+            c->at = 0;
+            c->scanned += n;
+        } else if (r->stream && !r->eof) {
+            if (!reader_fill(r)) return -1;
+            start = field = r->pos;
+            c->field_count = 0;
+            csv_restart(c, start);
+        } else {
+            if (start == r->size) {
+                r->line = NULL;
+                r->line_length = 0;
+                c->resume = r->pos;
+                return 0;
+            }
+            // the last record has no newline
+            if (!csv_add_field(c, field, r->size)) return -2;
+            end = r->size;
+            r->pos = r->size;
+            break;
+        }
+    }
+    if (end > start && r->data[end - 1] == '\r') {
+        end--;
+        c->fields[2 * c->field_count - 1]--;
+    }
+    c->resume = r->pos;
+    r->line = r->data + start;
+    r->line_length = end - start;
+    r->line_number++;
+#ifndef _WIN32
+    if (r->map) reader_release(r, start);
+#endif
+    return 1;
+}
+
+// Field n of the current record, with the quotes around it taken off.
+// *escaped is set if it holds doubled quotes. 0 if there is no field n.
+static int csv_field(const Reader *r, long long n, const char **text, long long *length, int *escaped) {
+    const CsvState *c = r->csv;
+    if (!c || !r->line || n < 0 || n >= c->field_count) return 0;
+    long long start = c->fields[2 * n], end = c->fields[2 * n + 1];
+    *escaped = 0;
+    if (end - start >= 2 && r->data[start] == '"' && r->data[end - 1] == '"') {
+        start++;
+        end--;
+        *escaped = memchr(r->data + start, '"', (size_t)(end - start)) != NULL;
+    }
+    *text = r->data + start;
+    *length = end - start;
+    return 1;
+}
+
+static void reader_recycle(Reader *r) {
+    LineChunk *chunk = r->strings;
+    if (!chunk) return;
+    while (chunk->next) {
+        LineChunk *next = chunk->next->next;
+        free(chunk->next);
+        chunk->next = next;
+    }
+    chunk->used = 0;
+}
+
+// Copies text into a transient string that lasts until the reader moves
+// to another line.
+static const char *reader_copy(Reader *r, const char *text, long long length, Value *result) {
+    size_t bytes = (STR_FLAT_SIZE(length) + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    LineChunk *chunk = r->strings;
+    if (!chunk || chunk->size - chunk->used < bytes) {
+        size_t size = bytes > LINE_CHUNK ? bytes : LINE_CHUNK;
+        chunk = malloc(sizeof(LineChunk) + size);
+        if (!chunk) return "out of memory";
+        chunk->next = r->strings;
+        chunk->used = 0;
+        chunk->size = size;
+        r->strings = chunk;
+    }
+    Str *s = (Str *)(chunk->data + chunk->used);
+    char *copy = (char *)(s + 1);
+    if (length) memcpy(copy, text, (size_t)length);
+    copy[length] = '\0';
+    s->length = length;
+    s->chars = copy;
+    s->left = NULL;
+    s->right = NULL;
+    s->transient = 1;
+    chunk->used += bytes;
+    result->str = s;
+    return NULL;
+}
+
+// -----------------------------
+// Writers
+// -----------------------------
+Writer *writer_open(const char *path) {
+    Writer *w = calloc(1, sizeof(Writer));
+    if (!w) return NULL;
+    w->capacity = WRITER_BUFFER;
+    w->data = malloc((size_t)w->capacity);
+    if (!w->data) {
+        free(w);
+        return NULL;
+    }
+    if (strcmp(path, "-") == 0) {
+        w->stream = stdout;
+        return w;
+    }
+    w->stream = fopen(path, "wb");
+    if (!w->stream) {
+        free(w->data);
+        free(w);
+        return NULL;
+    }
+    // the writer already buffers; stdio would only copy everything twice
+    setvbuf(w->stream, NULL, _IONBF, 0);
+    w->owns_stream = 1;
+    return w;
+}
+
+const char *writer_flush(Writer *w) {
+    size_t length = (size_t)w->length;
+    w->length = 0;
+    if (fwrite(w->data, 1, length, w->stream) != length || fflush(w->stream) != 0) {
+        return "file write failed";
+    }
+    return NULL;
+}
+
+static const char *writer_write(Writer *w, const char *text, long long length) {
+    if (length == 0) return NULL;
+    if (w->length + length > w->capacity) {
+        const char *err = writer_flush(w);
+        if (err) return err;
+        // too big to be worth buffering: straight to the file
+        if (length > w->capacity) {
+            return fwrite(text, 1, (size_t)length, w->stream) == (size_t)length ? NULL : "file write failed";
+        }
+    }
+    memcpy(w->data + w->length, text, (size_t)length);
+    w->length += length;
+    return NULL;
+}
+
+const char *writer_free(Writer *w) {
+    if (!w) return NULL;
+    const char *err = writer_flush(w);
+    if (w->owns_stream && fclose(w->stream) != 0 && !err) err = "file write failed";
+    free(w->data);
+    free(w);
+    return err;
+}
+
+// -----------------------------
+// Temporary paths
+// -----------------------------
+// The path of each name given to file.temp, made once and kept for the
+// run, so asking again in a loop costs nothing.
+typedef struct {
+    char *name;
+    Str *path;
+} TempPath;
+
+static TempPath *temp_paths = NULL;
+static int temp_path_count = 0;
+static pthread_mutex_t temp_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// TMPDIR (TEMP or TMP on Windows), else /tmp
+static const char *temp_dir(void) {
+    static const char *const vars[] = { "TMPDIR", "TEMP", "TMP" };
+    for (size_t i = 0; i < sizeof(vars) / sizeof(vars[0]); i++) {
+        const char *dir = getenv(vars[i]);
+        if (dir && dir[0]) return dir;
+    }
+    return "/tmp";
+}
+
+static const char *temp_path(const char *name, Value *result) {
+    for (int i = 0; i < temp_path_count; i++) {
+        if (strcmp(temp_paths[i].name, name) == 0) {
+            result->str = temp_paths[i].path;
+            return NULL;
+        }
+    }
+    const char *dir = temp_dir();
+    size_t dir_length = strlen(dir), name_length = strlen(name);
+    int slash = dir[dir_length - 1] == '/' || dir[dir_length - 1] == '\\';
+    char *text = malloc(dir_length + name_length + 2);
+    TempPath *grown = realloc(temp_paths, sizeof(TempPath) * (size_t)(temp_path_count + 1));
+    if (!text || !grown) {
+        free(text);
+        return "out of memory";
+    }
+    temp_paths = grown;
+    memcpy(text, dir, dir_length);
+    if (!slash) text[dir_length++] = '/';
+    memcpy(text + dir_length, name, name_length + 1);
+    Str *path = str_new(text, (long long)(dir_length + name_length));
+    char *kept = malloc(name_length + 1);
+    free(text);
+    if (!path || !kept) {
+        free(kept);
+        return "out of memory";
+    }
+    memcpy(kept, name, name_length + 1);
+    temp_paths[temp_path_count].name = kept;
+    temp_paths[temp_path_count++].path = path;
+    result->str = path;
+    return NULL;
+}
+
+// -----------------------------
+// Builtins
+// -----------------------------
+#define ARG_READER(n) ((Reader *)args[n].p)
+#define ARG_WRITER(n) ((Writer *)args[n].p)
+
+const char *native_file_next(Value *args, Value *result) {
+    reader_recycle(ARG_READER(0));
+    int status = reader_next(ARG_READER(0));
+    if (status < 0) return "file read failed";
+    result->i = status;
+    return NULL;
+}
+
+// The current line as a string: the one reader call that copies it.
+const char *native_file_line(Value *args, Value *result) {
+    Reader *r = ARG_READER(0);
+    return reader_copy(r, r->line, r->line_length, result);
+}
+
+const char *native_file_len(Value *args, Value *result) {
+    result->i = ARG_READER(0)->line_length;
+    return NULL;
+}
+
+const char *native_file_number(Value *args, Value *result) {
+    result->i = ARG_READER(0)->line_number;
+    return NULL;
+}
+
+const char *native_file_contains(Value *args, Value *result) {
+    Reader *r = ARG_READER(0);
+    const char *needle = str_chars(args[1].str);
+    if (!needle) return "out of memory";
+    long long n = args[1].str->length;
+    result->i = n == 0;
+    if (n == 0 || n > r->line_length) return NULL;
+    // memchr finds candidate first bytes a vector at a time
+    const char *p = r->line, *last = r->line + r->line_length - n;
+    while (p <= last) {
+        p = memchr(p, needle[0], (size_t)(last - p + 1));
+        if (!p) break;
+        if (memcmp(p, needle, (size_t)n) == 0) {
+            result->i = 1;
+            break;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+const char *native_file_starts(Value *args, Value *result) {
+    Reader *r = ARG_READER(0);
+    const char *prefix = str_chars(args[1].str);
+    if (!prefix) return "out of memory";
+    long long n = args[1].str->length;
+    result->i = n <= r->line_length && memcmp(r->line ? r->line : "", prefix, (size_t)n) == 0;
+    return NULL;
+}
+
+// Field `n` (from 0) of the current line split on `sep`; empty if the line
+// has fewer fields. Only the field is copied.
+const char *native_file_field(Value *args, Value *result) {
+    Reader *r = ARG_READER(0);
+    char sep = (char)args[1].i;
+    long long n = args[2].i;
+    const char *p = r->line, *end = r->line + r->line_length;
+    if (!p || n < 0) return reader_copy(r, "", 0, result);
+    for (; n > 0; n--) {
+        const char *next = memchr(p, sep, (size_t)(end - p));
+        if (!next) return reader_copy(r, "", 0, result);
+        p = next + 1;
+    }
+    const char *stop = memchr(p, sep, (size_t)(end - p));
+    return reader_copy(r, p, (stop ? stop : end) - p, result);
+}
+
+#define ARG_SEP(n) ((char)args[n].i)
+
+const char *native_csv_next(Value *args, Value *result) {
+    char sep = ARG_SEP(1);
+    if (sep == '"' || sep == '\n' || sep == '\r' || sep == '\0') {
+        return "a csv separator cannot be a quote or a newline";
+    }
+    reader_recycle(ARG_READER(0));
+    int status = csv_next(ARG_READER(0), sep);
+    if (status == -1) return "file read failed";
+    if (status == -2) return "out of memory";
+    result->i = status;
+    return NULL;
+}
+
+const char *native_csv_count(Value *args, Value *result) {
+    Reader *r = ARG_READER(0);
+    result->i = r->csv && r->line ? r->csv->field_count : 0;
+    return NULL;
+}
+
+// Field n as a string, doubled quotes made single; empty if there is no
+// field n. As with file.field, only the field is copied.
+const char *native_csv_field(Value *args, Value *result) {
+    Reader *r = ARG_READER(0);
+    const char *text;
+    long long length;
+    int escaped;
+    if (!csv_field(r, args[1].i, &text, &length, &escaped)) return reader_copy(r, "", 0, result);
+    if (!escaped) return reader_copy(r, text, length, result);
+    char *plain = malloc((size_t)length);
+    if (!plain) return "out of memory";
+    long long n = 0;
+    for (long long i = 0; i < length; i++) {
+        plain[n++] = text[i];
+        if (text[i] == '"' && i + 1 < length && text[i + 1] == '"') i++;
+    }
+    const char *err = reader_copy(r, plain, n, result);
+    free(plain);
+    return err;
+}
+
+// csv.int and csv.float read a field in place. Surrounding blanks are
+// allowed; anything else that is not part of the number is an error.
+static int csv_blank(char ch) {
+    return ch == ' ' || ch == '\t';
+}
+
+const char *native_csv_int(Value *args, Value *result) {
+    const char *text;
+    long long length;
+    int escaped;
+    if (!csv_field(ARG_READER(0), args[1].i, &text, &length, &escaped)) return "no such csv field";
+    const char *p = text, *end = text + length;
+    while (p < end && csv_blank(*p)) p++;
+    while (end > p && csv_blank(end[-1])) end--;
+    int negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) p++;
+    if (p == end) return "csv field is not an int";
+    unsigned long long v = 0, limit = negative ? 9223372036854775808ull : 9223372036854775807ull;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9') return "csv field is not an int";
+        unsigned digit = (unsigned)(*p - '0');
+        if (v > (limit - digit) / 10) return "csv field is out of int range";
+        v = v * 10 + digit;
+    }
+    result->i = negative ? (long long)(0 - v) : (long long)v;
+    return NULL;
+}
+
+const char *native_csv_float(Value *args, Value *result) {
+    const char *text;
+    long long length;
+    int escaped;
+    if (!csv_field(ARG_READER(0), args[1].i, &text, &length, &escaped)) return "no such csv field";
+    // strtod needs a terminated copy; numbers are short
+    char buf[128];
+    while (length > 0 && csv_blank(*text)) text++, length--;
+    while (length > 0 && csv_blank(text[length - 1])) length--;
+    if (length == 0 || length >= (long long)sizeof(buf)) return "csv field is not a float";
+    memcpy(buf, text, (size_t)length);
+    buf[length] = '\0';
+    char *stop;
+    result->f = strtod(buf, &stop);
+    if (stop != buf + length) return "csv field is not a float";
+    return NULL;
+}
+
+// Whether field n is `s`, compared in place.
+const char *native_csv_equals(Value *args, Value *result) {
+    const char *want = str_chars(args[2].str);
+    if (!want) return "out of memory";
+    long long want_length = args[2].str->length;
+    const char *text;
+    long long length;
+    int escaped;
+    result->i = 0;
+    if (!csv_field(ARG_READER(0), args[1].i, &text, &length, &escaped)) return NULL;
+    if (!escaped) {
+        result->i = length == want_length && memcmp(text, want, (size_t)length) == 0;
+        return NULL;
+    }
+    long long j = 0;
+    for (long long i = 0; i < length; i++, j++) {
+        if (j == want_length || text[i] != want[j]) return NULL;
+        if (text[i] == '"' && i + 1 < length && text[i + 1] == '"') i++;
+    }
+    result->i = j == want_length;
+    return NULL;
+}
+
+const char *native_file_write_str(Value *args, Value *result) {
+    (void)result;
+    const char *text = str_chars(args[1].str);
+    if (!text) return "out of memory";
+    return writer_write(ARG_WRITER(0), text, args[1].str->length);
+}
+
+const char *native_file_write_int(Value *args, Value *result) {
+    (void)result;
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%lld", args[1].i);
+    return writer_write(ARG_WRITER(0), buf, n);
+}
+
+const char *native_file_write_char(Value *args, Value *result) {
+    (void)result;
+    char c = (char)args[1].i;
+    return writer_write(ARG_WRITER(0), &c, 1);
+}
+
+const char *native_file_write_float(Value *args, Value *result) {
+    (void)result;
+    char buf[32];
+    int n = str_format_float(buf, sizeof(buf), args[1].f);
+    return writer_write(ARG_WRITER(0), buf, n);
+}
+
+const char *native_file_write_bool(Value *args, Value *result) {
+    (void)result;
+    return args[1].i ? writer_write(ARG_WRITER(0), "true", 4) : writer_write(ARG_WRITER(0), "false", 5);
+}
+
+// Writes a reader's current line (without its newline), copying it only
+// into the writer's buffer.
+const char *native_file_write_line(Value *args, Value *result) {
+    (void)result;
+    Reader *r = ARG_READER(1);
+    return writer_write(ARG_WRITER(0), r->line, r->line_length);
+}
+
+const char *native_file_flush(Value *args, Value *result) {
+    (void)result;
+    return writer_flush(ARG_WRITER(0));
+}
+
+const char *native_file_temp(Value *args, Value *result) {
+    const char *name = str_chars(args[0].str);
+    if (!name) return "out of memory";
+    pthread_mutex_lock(&temp_lock);
+    const char *err = temp_path(name, result);
+    pthread_mutex_unlock(&temp_lock);
+    return err;
+}
@@ -0,0 +1,106 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "compiler.h"
+
+// -----------------------------
+// pypstdio.variable.file.reader / .writer
+// -----------------------------
+// A reader walks a file one line at a time. Regular files are memory-mapped
+// and the current line points straight into the mapping; pipes and stdin
+// ("-") are read through a buffer that only grows to fit the longest line.
+// Either way memory use does not depend on the file's size, and a line is
+// only copied into a string when the script asks for it.
+//
+// Those strings (file.line, file.field, csv.field) belong to the current
+// line: they are bumped out of the reader's line storage, which is reused
+// once the reader moves on, and are marked transient so that a rope never
+// keeps one by reference (see str.h).
+//
+// csv.next reads the same way a record at a time, from a structural index
+// of the next CSV_CHUNK bytes (see csv.h); the record then stands in for
+// the current line, and its fields are offsets into the data.
+typedef struct {
+    char sep;
+    uint32_t *index;         // separators and newlines outside quotes, from base
+    int count;
+    int at;                  // next unread entry
+    long long base;
+    long long scanned;       // end of the indexed data
+    long long resume;        // where the next record starts, if nothing else moved
+    int quoted;              // the indexed data ends inside a quoted field
+    long long *fields;       // start, end of each field of the current record
+    int field_count;
+    int field_capacity;
+} CsvState;
+
+typedef struct LineChunk LineChunk;
+
+typedef struct {
+    const char *line;        // current line, without its '\n' (not NUL-terminated)
+    long long line_length;
+    long long line_number;   // 1-based; 0 before the first file.next
+    const char *data;        // mapping or buffer
+    long long size;          // valid bytes in data
+    long long pos;           // start of the next line
+    void *map;               // mmap base (NULL when streaming)
+    long long released;      // mapped bytes already handed back to the OS
+    FILE *stream;            // streaming source (NULL when mapped)
+    char *buffer;
+    long long capacity;
+    int eof;
+    LineChunk *strings;      // storage of the strings handed out for the current line
+    CsvState *csv;           // made by the first csv.next
+} Reader;
+
+// A writer collects output in its own buffer and hands it to the file in
+// large blocks: when the buffer fills, on file.flush, and at exit.
+typedef struct {
+    FILE *stream;
+    int owns_stream;         // 0 for stdout ("-")
+    char *data;
+    long long length;
+    long long capacity;
+} Writer;
+
+// NULL if the file cannot be opened; errno says why.
+Reader *reader_open(const char *path);
+void reader_free(Reader *r);
+void reader_print(FILE *out, const Reader *r);
+
+Writer *writer_open(const char *path);
+// Writes out the buffered bytes. NULL, or an error message.
+const char *writer_flush(Writer *w);
+// Flushes what is left, then closes the file. NULL, or an error message.
+const char *writer_free(Writer *w);
+
+// -----------------------------
+// Builtins (see builtins.c)
+// -----------------------------
+const char *native_file_next(Value *args, Value *result);
+const char *native_file_line(Value *args, Value *result);
+const char *native_file_len(Value *args, Value *result);
+const char *native_file_number(Value *args, Value *result);
+const char *native_file_contains(Value *args, Value *result);
+const char *native_file_starts(Value *args, Value *result);
+const char *native_file_field(Value *args, Value *result);
+const char *native_file_write_str(Value *args, Value *result);
+const char *native_file_write_int(Value *args, Value *result);
+const char *native_file_write_char(Value *args, Value *result);
+const char *native_file_write_float(Value *args, Value *result);
+const char *native_file_write_bool(Value *args, Value *result);
+const char *native_file_write_line(Value *args, Value *result);
+const char *native_file_flush(Value *args, Value *result);
+const char *native_file_temp(Value *args, Value *result);
+
+// pypstdio.csv: records of a delimited file, read through a file.reader
+const char *native_csv_next(Value *args, Value *result);
+const char *native_csv_count(Value *args, Value *result);
+const char *native_csv_field(Value *args, Value *result);
+const char *native_csv_int(Value *args, Value *result);
+const char *native_csv_float(Value *args, Value *result);
+const char *native_csv_equals(Value *args, Value *result);
+
+#endif // FILE_H
@@ -0,0 +1,382 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L   // read, fileno
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include "input.h"
+#include "array.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Bytes asked of the OS per read; the buffer grows past this only for a
+// single token or line longer than what is left of it.
+#define INPUT_BLOCK (1 << 20)
+
+typedef struct {
+    char *data;
+    long long size;          // valid bytes in data
+    long long pos;           // next unread byte
+    long long capacity;
+    int eof;
+    Str **strings;           // returned by input.word / input.line
+    int string_count;
+    int string_capacity;
+} Input;
+
+static Input in;
+
+void input_release(void) {
+    for (int i = 0; i < in.string_count; i++) str_free(in.strings[i]);
+    free(in.strings);
+    in.strings = NULL;
+    in.string_count = in.string_capacity = 0;
+}
+
+// -----------------------------
+// Buffering
+// -----------------------------
+// Moves the unread tail to the front of the buffer and reads more stdin
+// after it. Returns 0 on a read error or when out of memory.
+static int input_fill(void) {
+    long long tail = in.size - in.pos;
+    if (in.data) memmove(in.data, in.data + in.pos, (size_t)tail);
+    in.size = tail;
+    in.pos = 0;
+    if (in.capacity - in.size < INPUT_BLOCK / 2) {
+        long long capacity = in.capacity ? in.capacity * 2 : INPUT_BLOCK;
+        char *grown = realloc(in.data, (size_t)capacity);
+        if (!grown) return 0;
+        in.data = grown;
+        in.capacity = capacity;
+    }
+#ifndef _WIN32
+    // read() returns what is there instead of waiting for a full block
+    ssize_t n = read(fileno(stdin), in.data + in.size, (size_t)(in.capacity - in.size));
+    if (n < 0) return 0;
+#else
+    size_t n = fread(in.data + in.size, 1, (size_t)(in.capacity - in.size), stdin);
+    if (n == 0 && ferror(stdin)) return 0;
+#endif
+    if (n == 0) in.eof = 1;
+    in.size += (long long)n;
+    return 1;
+}
+
+// Index of the first byte at or after i that is not whitespace (or a
+// control character), or size.
+static long long scan_space(const char *s, long long i, long long size) {
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        // unsigned v <= ' ' exactly when max(v, ' ') == ' '
+        int blank = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, space), space));
+        if (blank != 0xFFFF) return i + __builtin_ctz(~blank & 0xFFFF);
+    }
+#endif
+    while (i < size && (unsigned char)s[i] <= ' ') i++;
+    return i;
+}
+
+// Index of the first whitespace byte at or after i, or size.
+static long long scan_token(const char *s, long long i, long long size) {
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        int blank = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, space), space));
+        if (blank) return i + __builtin_ctz(blank);
+    }
+#endif
+    while (i < size && (unsigned char)s[i] > ' ') i++;
+    return i;
+}
+
+// Skips whitespace and makes sure the whole token after it is buffered.
+// Returns 1 with the token at [in.pos, *end), 0 at the end of input, or
+// -1 on a read error.
+static int next_token(long long *end) {
+    for (;;) {
+        in.pos = scan_space(in.data, in.pos, in.size);
+        if (in.pos < in.size) break;
+        if (in.eof) return 0;
+        if (!input_fill()) return -1;
+    }
+    long long scanned = in.pos;
+    for (;;) {
+        long long stop = scan_token(in.data, scanned, in.size);
+        if (stop < in.size || in.eof) {
+            *end = stop;
+            return 1;
+        }
+        scanned = stop - in.pos;
+        if (!input_fill()) return -1;
+        scanned += in.pos;
+    }
+}
+
+static const char *token_error(int status) {
+    return status < 0 ? "stdin read failed" : "end of input";
+}
+
+static const char *keep_string(const char *text, long long length, Value *result) {
+    if (in.string_count == in.string_capacity) {
+        int capacity = in.string_capacity ? in.string_capacity * 2 : 16;
+        Str **grown = realloc(in.strings, sizeof(Str *) * capacity);
+        if (!grown) return "out of memory";
+        in.strings = grown;
+        in.string_capacity = capacity;
+    }
+    Str *s = str_new(text, length);
+    if (!s) return "out of memory";
+    in.strings[in.string_count++] = s;
+    result->str = s;
+    return NULL;
+}
+
+// -----------------------------
+// Number parsing
+// -----------------------------
+// SWAR digit handling on a little-endian 8-byte load: checks that all
+// eight bytes are '0'..'9', then combines them pairwise (2, 4, 8 digits)
+// with three multiplies instead of eight.
+static int eight_digits(uint64_t v) {
+    return (((v & 0xF0F0F0F0F0F0F0F0ULL) |
+             (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL);
+}
+
+static uint64_t eight_value(uint64_t v) {
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+         (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return v;
+}
+
+static const char *parse_int(const char *p, const char *end, long long *out) {
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    if (p == end) return "malformed int in input";
+    // leading zeros do not count toward the 19 digits
+    while (p < end && *p == '0') p++;
+
+    uint64_t value = 0;
+    int digits = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (end - p >= 8 && digits <= 11) {
+        uint64_t chunk;
+        memcpy(&chunk, p, 8);
+        if (!eight_digits(chunk)) break;
+        value = value * 100000000ULL + eight_value(chunk);
+        digits += 8;
+        p += 8;
+    }
+#endif
+    for (; p < end; p++) {
+        unsigned d = (unsigned char)*p - '0';
+        if (d > 9) return "malformed int in input";
+        // 19 digits always fit in 64 unsigned bits
+        if (++digits > 19) return "int in input out of range";
+        value = value * 10 + d;
+    }
+    if (value > (uint64_t)LLONG_MAX + negative) return "int in input out of range";
+    *out = negative ? (long long)(0 - value) : (long long)value;
+    return NULL;
+}
+
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Whether [p, end) is, ignoring case, one of the words strtod reads as
+// infinity or NaN that input.float accepts.
+static int special_float(const char *p, const char *end) {
+    static const char *const words[] = { "inf", "infinity", "nan" };
+    size_t length = (size_t)(end - p);
+    for (size_t w = 0; w < sizeof(words) / sizeof(words[0]); w++) {
+        if (strlen(words[w]) != length) continue;
+        size_t i = 0;
+        while (i < length && (p[i] | 0x20) == words[w][i]) i++;
+        if (i == length) return 1;
+    }
+    return 0;
+}
+
+// A float is [sign] digits [. digits] [e [sign] digits], with digits on at
+// least one side of the point, or [sign] inf / infinity / nan. Those whose
+// digits fit in 53 bits and whose power of ten is itself exact
+// (10^0..10^22) come out of one correctly rounded multiply or divide.
+// The rest (long mantissas, huge exponents, inf, nan) go through strtod,
+// which only ever sees the C locale here, and only once the token is
+// known to match: strtod also reads hex floats and "nan(...)".
+static const char *parse_float(const char *p, const char *end, double *out) {
+    const char *start = p;
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    const char *unsigned_start = p;
+
+    uint64_t mantissa = 0;
+    int significant = 0, exponent = 0, any = 0, exact = 1;
+    for (; p < end && (unsigned)(*p - '0') <= 9; p++, any = 1) {
+        if (significant < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            if (mantissa) significant++;
+        } else {
+            exponent++;
+            if (*p != '0') exact = 0;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && (unsigned)(*p - '0') <= 9; p++, any = 1) {
+            if (significant < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                if (mantissa) significant++;
+                exponent--;
+            } else if (*p != '0') {
+                exact = 0;
+            }
+        }
+    }
+    if (any && p < end && (*p == 'e' || *p == 'E')) {
+        const char *e = p + 1;
+        int exp_negative = 0, exp_value = 0;
+        if (e < end && (*e == '-' || *e == '+')) exp_negative = *e++ == '-';
+        if (e < end && (unsigned)(*e - '0') <= 9) {
+            for (; e < end && (unsigned)(*e - '0') <= 9; e++) {
+                if (exp_value < 100000) exp_value = exp_value * 10 + (*e - '0');
+            }
+            exponent += exp_negative ? -exp_value : exp_value;
+            p = e;
+        }
+    }
+
+    if (any && p == end && exact && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        double v = (double)mantissa;
+        v = exponent < 0 ? v / powers_of_ten[-exponent] : v * powers_of_ten[exponent];
+        *out = negative ? -v : v;
+        return NULL;
+    }
+    if (!(any && p == end) && !special_float(unsigned_start, end)) return "malformed float in input";
+
+    char small[64];
+    size_t length = (size_t)(end - start);
+    char *copy = length < sizeof(small) ? small : malloc(length + 1);
+    if (!copy) return "out of memory";
+    memcpy(copy, start, length);
+    copy[length] = '\0';
+    char *stop;
+    *out = strtod(copy, &stop);
+    int ok = length > 0 && stop == copy + length;
+    if (copy != small) free(copy);
+    return ok ? NULL : "malformed float in input";
+}
+
+// -----------------------------
+// Builtins
+// -----------------------------
+static const char *next_int(long long *out) {
+    long long end;
+    int status = next_token(&end);
+    if (status <= 0) return token_error(status);
+    const char *err = parse_int(in.data + in.pos, in.data + end, out);
+    in.pos = end;
+    return err;
+}
+
+static const char *next_float(double *out) {
+    long long end;
+    int status = next_token(&end);
+    if (status <= 0) return token_error(status);
+    const char *err = parse_float(in.data + in.pos, in.data + end, out);
+    in.pos = end;
+    return err;
+}
+
+const char *native_input_int(Value *args, Value *result) {
+    (void)args;
+    return next_int(&result->i);
+}
+
+const char *native_input_float(Value *args, Value *result) {
+    (void)args;
+    return next_float(&result->f);
+}
+
+const char *native_input_word(Value *args, Value *result) {
+    (void)args;
+    long long end;
+    int status = next_token(&end);
+    if (status <= 0) return token_error(status);
+    const char *err = keep_string(in.data + in.pos, end - in.pos, result);
+    in.pos = end;
+    return err;
+}
+
+// The rest of the current line, without its line break.
+const char *native_input_line(Value *args, Value *result) {
+    (void)args;
+    long long scanned = 0;
+    const char *newline;
+    for (;;) {
+        long long unscanned = in.size - in.pos - scanned;
+        newline = unscanned > 0 ? memchr(in.data + in.pos + scanned, '\n', (size_t)unscanned) : NULL;
+        if (newline || in.eof) break;
+        scanned = in.size - in.pos;
+        if (!input_fill()) return "stdin read failed";
+    }
+    if (!newline && in.pos == in.size) return "end of input";
+    long long length = newline ? newline - (in.data + in.pos) : in.size - in.pos;
+    const char *line = in.data + in.pos;
+    in.pos += newline ? length + 1 : length;
+    if (length > 0 && line[length - 1] == '\r') length--;
+    return keep_string(line, length, result);
+}
+
+// Whether another token follows (skipping whitespace, line breaks included).
+const char *native_input_more(Value *args, Value *result) {
+    (void)args;
+    long long end;
+    int status = next_token(&end);
+    if (status < 0) return token_error(status);
+    result->i = status;
+    return NULL;
+}
+
+// Whether stdin has no bytes left at all.
+const char *native_input_eof(Value *args, Value *result) {
+    (void)args;
+    while (in.pos == in.size && !in.eof) {
+        if (!input_fill()) return "stdin read failed";
+    }
+    result->i = in.pos == in.size;
+    return NULL;
+}
+
+// Fills an array with the next numbers from stdin and returns how many
+// were read: the array's length, or fewer if the input ends first.
+const char *native_input_read(Value *args, Value *result) {
+    Array *array = args[0].p;
+    long long n = 0;
+    for (; n < array->length; n++) {
+        long long end;
+        int status = next_token(&end);
+        if (status < 0) return token_error(status);
+        if (status == 0) break;
+        const char *err = array->elem_type == VAR_INT
+            ? parse_int(in.data + in.pos, in.data + end, &array->ints[n])
+            : parse_float(in.data + in.pos, in.data + end, &array->floats[n]);
+        in.pos = end;
+        if (err) return err;
+    }
+    result->i = n;
+    return NULL;
+}
@@ -0,0 +1,30 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "compiler.h"
+
+// -----------------------------
+// pypstdio.input
+// -----------------------------
+// Reads stdin in large blocks into one buffer and tokenizes it in place:
+// whitespace is skipped 16 bytes at a time, integers are converted 8 digits
+// at a time, and neither ints nor floats depend on the C locale. A token
+// or line split across two blocks is moved to the front of the buffer
+// before the next block is read after it.
+
+// Frees the strings returned by input.word / input.line. Buffered input
+// that has not been consumed yet is kept for the next program run.
+void input_release(void);
+
+// -----------------------------
+// Builtins (see builtins.c)
+// -----------------------------
+const char *native_input_int(Value *args, Value *result);
+const char *native_input_float(Value *args, Value *result);
+const char *native_input_word(Value *args, Value *result);
+const char *native_input_line(Value *args, Value *result);
+const char *native_input_more(Value *args, Value *result);
+const char *native_input_eof(Value *args, Value *result);
+const char *native_input_read(Value *args, Value *result);
+
+#endif // INPUT_H
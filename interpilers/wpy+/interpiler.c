@@ -1,146 +1,1849 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L   // open_memstream
+#endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include "interpiler.h"
+#include "compiler.h"
+#include "array.h"
+#include "map.h"
+#include "builder.h"
+#include "file.h"
+#include "input.h"
+#include "builtins.h"
+#include "parallel.h"
+#include "channel.h"
+#include "events.h"
+#include "modules.h"
+#include "passes.h"
+#include "bench.h"
+#include "snapshot.h"
+#include "ffi.h"
+
+InterpilerOptions interpiler_options = { 0, 0, 0, 2, 0, NULL };
+
+// -----------------------------
+// Call frames
+// -----------------------------
+// All frames and their slots live in two arrays allocated once per run,
+// so calls cost no allocation and recursion never grows the native stack.
+// Coroutines and generators start with small arrays that double when a
+// call needs more.
+#define FRAMES_MAX      65536
+#define VALUE_STACK_MAX (1 << 20)
+#define COROUTINE_FRAMES 8
+#define COROUTINE_VALUES 64
+
+typedef struct {
+    Function *fn;
+    int ip;          // resume point in the caller while a callee runs
+    int mark;        // heap objects made before this call (see Regions)
+    Value *slots;    // parameters, then locals, then the operand stack
+    char *arena_mark;
+} Frame;
 
 // -----------------------------
-// Safe strdup replacement
+// Heap objects
 // -----------------------------
-static char *strdup_local(const char *s) {
-    if (!s) return NULL;
-    size_t n = strlen(s);
-    char *result = malloc(n + 1);
-    if (!result) return NULL;
-    memcpy(result, s, n);
-    result[n] = '\0';
-    return result;
+// Arrays, maps, builders, files and strings that are not short-lived
+// belong to the frame regions below; what main makes lives until the
+// program ends.
+typedef struct {
+    VarType type;    // VAR_ARRAY_*, VAR_MAP_*, VAR_BUILDER, VAR_READER, VAR_WRITER, VAR_STRING or VAR_ITER_INT
+    int scope;       // the b operand of the instruction that made it (see SCOPE_ESCAPES)
+    void *ptr;
+} HeapObject;
+
+typedef struct {
+    HeapObject *objects;
+    int count;
+    int capacity;
+} Heap;
+
+static void heap_track(Heap *heap, VarType type, void *ptr, int scope) {
+    if (heap->count == heap->capacity) {
+        heap->capacity = heap->capacity ? heap->capacity * 2 : 16;
+        heap->objects = realloc(heap->objects, sizeof(HeapObject) * heap->capacity);
+    }
+    heap->objects[heap->count].type = type;
+    heap->objects[heap->count].scope = scope;
+    heap->objects[heap->count].ptr = ptr;
+    heap->count++;
+}
+
+// Writes out every writer's buffer. NULL, or the first error.
+static const char *heap_flush_writers(Heap *heap) {
+    const char *err = NULL;
+    for (int i = 0; i < heap->count; i++) {
+        if (heap->objects[i].type == VAR_WRITER) {
+            const char *e = writer_flush(heap->objects[i].ptr);
+            if (!err) err = e;
+        }
+    }
+    return err;
+}
+
+static const char *iter_free(void *iter);
+
+// NULL, or why a writer (or a generator's writer) could not be closed.
+static const char *heap_object_free(HeapObject *obj) {
+    if (obj->type == VAR_ITER_INT) return iter_free(obj->ptr);
+    if (obj->type == VAR_WRITER) return writer_free(obj->ptr);
+    if (obj->type == VAR_MAP_INT || obj->type == VAR_MAP_STR) map_free(obj->ptr);
+    else if (obj->type == VAR_BUILDER) builder_free(obj->ptr);
+    else if (obj->type == VAR_READER) reader_free(obj->ptr);
+    else if (obj->type == VAR_STRING) str_free(obj->ptr);
+    else array_free(obj->ptr);
+    return NULL;
+}
+
+static const char *heap_free(Heap *heap) {
+    const char *err = NULL;
+    for (int i = 0; i < heap->count; i++) {
+        const char *e = heap_object_free(&heap->objects[i]);
+        if (!err) err = e;
+    }
+    free(heap->objects);
+    heap->objects = NULL;
+    heap->count = heap->capacity = 0;
+    return err;
 }
 
 // -----------------------------
-// Symbol table with type support
+// Regions
 // -----------------------------
-typedef enum { VAR_INT, VAR_CHAR, VAR_STRING } VarType;
+// Every call owns the heap objects made while it runs, the ones past its
+// frame's mark, and releases them in one sweep when it returns. The
+// compiler's escape analysis has already said which of them can still be
+// reached afterwards: a region function frees them all; any other frees
+// those that do not escape and hands the rest down to its caller's
+// region, where they are freed in turn once that call returns. A loop
+// iteration is a region of its own in the same way: OP_LOOP_SWEEP frees
+// what the iteration made for its own use before the next one starts.
+// Nothing is counted or traced while the program runs.
+//
+// Short strings that die with their call or iteration are not even
+// malloc'd: they are bumped out of the Vm's arena, and a return or sweep
+// just moves the arena back to where the call or iteration found it.
+#define ARENA_CHUNK (16 * 1024)
+
+typedef struct ArenaChunk ArenaChunk;
+
+struct ArenaChunk {
+    ArenaChunk *prev;
+    char *end;
+    _Alignas(16) char data[];
+};
+
+typedef struct {
+    ArenaChunk *chunk;   // the chunk being filled; NULL while empty
+    char *top;           // next free byte in it
+    ArenaChunk *spare;   // an emptied chunk kept for reuse
+} Arena;
+
+static void *arena_grow(Arena *arena, size_t size) {
+    ArenaChunk *chunk = arena->spare;
+    if (chunk && (size_t)(chunk->end - chunk->data) >= size) {
+        arena->spare = NULL;
+    } else {
+        size_t capacity = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        chunk = malloc(sizeof(ArenaChunk) + capacity);
+        if (!chunk) return NULL;
+        chunk->end = chunk->data + capacity;
+    }
+    chunk->prev = arena->chunk;
+    arena->chunk = chunk;
+    arena->top = chunk->data + size;
+    return chunk->data;
+}
+
+static inline void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    if (arena->chunk && (size_t)(arena->chunk->end - arena->top) >= size) {
+        void *p = arena->top;
+        arena->top += size;
+        return p;
+    }
+    return arena_grow(arena, size);
+}
+
+// Frees everything allocated since arena->top was `mark`.
+static void arena_rewind(Arena *arena, char *mark) {
+    uintptr_t at = (uintptr_t)mark;
+    while (arena->chunk && !(at >= (uintptr_t)arena->chunk->data && at <= (uintptr_t)arena->chunk->end)) {
+        ArenaChunk *chunk = arena->chunk;
+        arena->chunk = chunk->prev;
+        if (arena->spare) free(arena->spare);
+        arena->spare = chunk;
+    }
+    arena->top = arena->chunk ? mark : NULL;
+}
+
+static void arena_release(Arena *arena) {
+    arena_rewind(arena, NULL);
+    free(arena->spare);
+    arena->spare = NULL;
+}
+
+// Frees the objects past `mark` that live in `scope` or a shorter-lived
+// one, keeping the rest in order. NULL, or why a writer it closed failed.
+static const char *heap_sweep(Heap *heap, int mark, int scope) {
+    const char *err = NULL;
+    int keep = mark;
+    for (int i = mark; i < heap->count; i++) {
+        if (heap->objects[i].scope < scope) {
+            heap->objects[keep++] = heap->objects[i];
+        } else {
+            const char *e = heap_object_free(&heap->objects[i]);
+            if (!err) err = e;
+        }
+    }
+    heap->count = keep;
+    return err;
+}
+
+// Ends the region of `frame`, whose call is returning.
+static const char *region_free(Heap *heap, Arena *arena, const Frame *frame) {
+    const char *err = heap_sweep(heap, frame->mark, frame->fn->region ? SCOPE_ESCAPES : 0);
+    arena_rewind(arena, frame->arena_mark);
+    return err;
+}
 
+// -----------------------------
+// Interpreter state
+// -----------------------------
+// One per thread running bytecode: main's, one per spawned task, and one
+// per pool worker while a `parallel for` runs; and one per coroutine and
+// per generator.
 typedef struct {
-    char *name;
-    VarType type;
-    union {
-        int int_value;
-        char char_value;
-        char *string_value;
-    };
-} Variable;
+    Program *program;
+    Frame *frames;
+    Value *stack;
+    int frame_capacity;
+    int stack_capacity;
+    Heap heap;
+    Arena arena;
+    FILE *out;       // where pypstdio.print goes
+    char *error;     // runtime errors are kept here instead of printed, if set
+    size_t error_size;
+
+    // While tasks run, `out` collects one line at a time into line_buf and
+    // each finished line goes to line_out in a single write, so lines from
+    // different threads never mix.
+    FILE *line_out;
+    char *line_buf;
+    size_t line_length;
+
+    // A coroutine waiting in an awaitable builtin resumes at resume_frame's
+    // ip, which is that builtin's OP_CALL_NATIVE, with this stack top. A
+    // generator resumes the same way after its OP_YIELD, and the value it
+    // yielded is the one at resume_sp.
+    int coroutine;
+    int generator;
+    Frame *resume_frame;
+    Value *resume_sp;
+} Vm;
+
+// Gives vm stacks of the given capacities; 0 if out of memory.
+static int vm_alloc(Vm *vm, int frame_capacity, int stack_capacity) {
+    vm->frames = malloc(sizeof(Frame) * frame_capacity);
+    vm->stack = malloc(sizeof(Value) * stack_capacity);
+    vm->frame_capacity = frame_capacity;
+    vm->stack_capacity = stack_capacity;
+    return vm->frames && vm->stack;
+}
 
-static Variable variables[256];
-static int var_count = 0;
+// Grows a coroutine's stacks so that frame number `depth` + 1 fits, and
+// the first `top` values, keeping the first `used`. Frames are moved to
+// point into the new value stack; the caller rebases its own pointers.
+// Returns 0 if that would pass FRAMES_MAX or VALUE_STACK_MAX, or memory
+// runs out.
+static int vm_grow(Vm *vm, long depth, size_t used, size_t top) {
+    int frame_capacity = vm->frame_capacity, stack_capacity = vm->stack_capacity;
+    while (depth + 2 > frame_capacity && frame_capacity < FRAMES_MAX) frame_capacity *= 2;
+    while (top > (size_t)stack_capacity && stack_capacity < VALUE_STACK_MAX) stack_capacity *= 2;
+    if (depth + 2 > frame_capacity || top > (size_t)stack_capacity) return 0;
+
+    Frame *frames = malloc(sizeof(Frame) * frame_capacity);
+    Value *stack = malloc(sizeof(Value) * stack_capacity);
+    if (!frames || !stack) {
+        free(frames);
+        free(stack);
+        return 0;
+    }
+    memcpy(stack, vm->stack, sizeof(Value) * used);
+    for (long f = 0; f <= depth; f++) {
+        frames[f] = vm->frames[f];
+        frames[f].slots = stack + (vm->frames[f].slots - vm->stack);
+    }
+    free(vm->frames);
+    free(vm->stack);
+    vm->frames = frames;
+    vm->stack = stack;
+    vm->frame_capacity = frame_capacity;
+    vm->stack_capacity = stack_capacity;
+    return 1;
+}
+
+// Switches vm to line-at-a-time output; 0 if that is not possible.
+static int vm_line_output(Vm *vm) {
+#ifndef _WIN32
+    FILE *lines = open_memstream(&vm->line_buf, &vm->line_length);
+    if (!lines) return 0;
+    vm->line_out = vm->out;
+    vm->out = lines;
+#endif
+    return 1;
+}
+
+static void vm_flush_line(Vm *vm) {
+    fflush(vm->out);
+    if (vm->line_length) {
+        fwrite(vm->line_buf, 1, vm->line_length, vm->line_out);
+        fseek(vm->out, 0, SEEK_SET);
+    }
+}
+
+static void vm_end_line_output(Vm *vm) {
+    if (!vm->line_out) return;
+    vm_flush_line(vm);
+    fclose(vm->out);
+    free(vm->line_buf);
+    vm->out = vm->line_out;
+    vm->line_out = NULL;
+    vm->line_buf = NULL;
+}
 
 // -----------------------------
 // Execution
 // -----------------------------
-static void execute_node(ASTNode *node) {
-    if (!node) return;
-
-    switch (node->type) {
-        case AST_FUNCTION:
-            for (int i = 0; i < node->child_count; i++) {
-                execute_node(node->children[i]);
-            }
-            break;
-
-        case AST_VAR_DECL:
-            if (strcmp(node->var_type, "int") == 0) {
-                variables[var_count].name = strdup_local(node->var_name);
-                variables[var_count].type = VAR_INT;
-                variables[var_count].int_value = atoi(node->var_value);
-                var_count++;
-            } else if (strcmp(node->var_type, "char") == 0) {
-                variables[var_count].name = strdup_local(node->var_name);
-                variables[var_count].type = VAR_CHAR;
-                variables[var_count].char_value = node->var_value[0]; // first character
-                var_count++;
-            } else if (strcmp(node->var_type, "string") == 0) {
-             variables[var_count].name = strdup_local(node->var_name);
-             variables[var_count].type = VAR_STRING;
-             variables[var_count].string_value = strdup_local(node->var_value);
-             var_count++;
-            }
-
-            break;
-
-        case AST_PRINT:
-            for (int i = 0; i < node->child_count; i++) {
-                ASTNode *arg = node->children[i];
-                if (arg->type == AST_LITERAL) {
-                    printf("%s", arg->value);
-                } else if (arg->type == AST_IDENTIFIER) {
-                    int found = 0;
-                    for (int v = 0; v < var_count; v++) {
-                        if (strcmp(variables[v].name, arg->value) == 0) {
-                            if (variables[v].type == VAR_INT) {
-                                printf("%d", variables[v].int_value);
-                            } else if (variables[v].type == VAR_CHAR) {
-                                printf("%c", variables[v].char_value);
-                            } else if (variables[v].type == VAR_STRING) {
-                                printf("%s", variables[v].string_value);
-                            }
-                            found = 1;
-                            break;
-                        }
-                    }
-                    if (!found) {
-                        printf("[undefined:%s]", arg->value);
+// a + b for OP_CONCAT; short results go in the arena if `in_arena`.
+static Str *vm_concat(Vm *vm, Str *a, Str *b, int in_arena, int scope) {
+    long long length = a->length + b->length;
+    if (in_arena && a->length && b->length && length <= STR_FLAT_MAX) {
+        void *memory = arena_alloc(&vm->arena, STR_FLAT_SIZE(length));
+        return memory ? str_concat_at(memory, a, b) : NULL;
+    }
+    Str *s = str_concat(a, b);
+    if (s && s != a && s != b) heap_track(&vm->heap, VAR_STRING, s, scope);
+    return s;
+}
+
+// Flattens a rope on first print; returns 0 if that runs out of memory.
+static int print_str(FILE *out, Str *s) {
+    const char *text = str_chars(s);
+    if (!text) return 0;
+    fwrite(text, 1, (size_t)s->length, out);
+    return 1;
+}
+
+static void print_float(FILE *out, double v) {
+    char buf[32];
+    str_format_float(buf, sizeof(buf), v);
+    fputs(buf, out);
+}
+
+// What pulling from a generator that failed returns. The generator has
+// reported its own error, so only the code outside every generator
+// reports this one.
+static const char iter_failed[] = "generator failed";
+
+static void runtime_error(Vm *vm, Function *fn, int ip, const char *msg) {
+    if (msg == iter_failed && vm->generator) return;
+    if (vm->error) {
+        snprintf(vm->error, vm->error_size, "Runtime error (line %d): %s", fn->lines[ip], msg);
+        return;
+    }
+    fflush(stdout);
+    fprintf(stderr, "Runtime error (line %d): %s\n", fn->lines[ip], msg);
+}
+
+// -----------------------------
+// @memo tables
+// -----------------------------
+// Each thread keeps its own table per @memo function, so lookups never
+// lock. A table hashes argument tuples into chains of entries, which are
+// also kept on a list from most to least recently used; once it holds
+// memo_size results, storing another evicts the least recently used.
+// Counters are added to memo_stats when the thread's tables are released.
+typedef struct {
+    int prev, next;      // recency list
+    int chain;           // next entry in the same bucket
+    Value result;
+} MemoEntry;
+
+typedef struct {
+    int width;           // arguments per key
+    int count, capacity;
+    MemoEntry *entries;
+    Value *keys;         // `width` values per entry
+    int *buckets;        // first entry of each chain, or -1
+    int mask;            // buckets - 1
+    int head, tail;      // most and least recently used
+    long long hits, misses, evictions;
+} Memo;
+
+typedef struct {
+    _Atomic long long hits, misses, evictions;
+} MemoStats;
+
+static MemoStats *memo_stats;            // per function, while --stats runs a program
+static _Thread_local Memo *memos;        // this thread's tables, per function
+static _Thread_local int memo_count;
+
+static uint64_t memo_hash(const Value *key, int width) {
+    uint64_t h = 0x9E3779B97F4A7C15ull;
+    for (int i = 0; i < width; i++) {
+        h = (h ^ (uint64_t)key[i].i) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+static Memo *memo_table(Program *program, Function *fn) {
+    if (!memos) {
+        memos = calloc((size_t)program->function_count, sizeof(Memo));
+        if (!memos) return NULL;
+        memo_count = program->function_count;
+    }
+    Memo *memo = &memos[fn - program->functions];
+    memo->width = fn->param_count;
+    return memo;
+}
+
+static int memo_find(Memo *m, const Value *key, uint64_t hash) {
+    if (!m->buckets) return -1;
+    for (int e = m->buckets[hash & (uint64_t)m->mask]; e >= 0; e = m->entries[e].chain) {
+        if (memcmp(&m->keys[(size_t)e * m->width], key, sizeof(Value) * m->width) == 0) return e;
+    }
+    return -1;
+}
+
+static void memo_unlink(Memo *m, int e) {
+    MemoEntry *entry = &m->entries[e];
+    if (entry->prev >= 0) m->entries[entry->prev].next = entry->next;
+    else m->head = entry->next;
+    if (entry->next >= 0) m->entries[entry->next].prev = entry->prev;
+    else m->tail = entry->prev;
+}
+
+static void memo_push_front(Memo *m, int e) {
+    m->entries[e].prev = -1;
+    m->entries[e].next = m->head;
+    if (m->head >= 0) m->entries[m->head].prev = e;
+    m->head = e;
+    if (m->tail < 0) m->tail = e;
+}
+
+static int memo_lookup(Memo *m, const Value *key, Value *result) {
+    int e = memo_find(m, key, memo_hash(key, m->width));
+    if (e < 0) {
+        m->misses++;
+        return 0;
+    }
+    m->hits++;
+    if (m->head != e) {
+        memo_unlink(m, e);
+        memo_push_front(m, e);
+    }
+    *result = m->entries[e].result;
+    return 1;
+}
+
+// Doubles the table (up to `size` entries) and rebuilds the chains.
+static int memo_grow(Memo *m, int size) {
+    int capacity = m->capacity ? m->capacity * 2 : 64;
+    if (capacity > size) capacity = size;
+    int buckets = 1;
+    while (buckets < capacity) buckets *= 2;
+    MemoEntry *entries = realloc(m->entries, sizeof(MemoEntry) * (size_t)capacity);
+    if (entries) m->entries = entries;
+    Value *keys = realloc(m->keys, sizeof(Value) * (size_t)capacity * (size_t)(m->width ? m->width : 1));
+    if (keys) m->keys = keys;
+    int *chains = malloc(sizeof(int) * (size_t)buckets);
+    if (!entries || !keys || !chains) {
+        free(chains);
+        return 0;
+    }
+    if (m->capacity == 0) m->head = m->tail = -1;
+    free(m->buckets);
+    m->buckets = chains;
+    m->mask = buckets - 1;
+    m->capacity = capacity;
+    for (int b = 0; b < buckets; b++) m->buckets[b] = -1;
+    for (int e = 0; e < m->count; e++) {
+        int b = (int)(memo_hash(&m->keys[(size_t)e * m->width], m->width) & (uint64_t)m->mask);
+        m->entries[e].chain = m->buckets[b];
+        m->buckets[b] = e;
+    }
+    return 1;
+}
+
+static void memo_store(Memo *m, int size, const Value *key, Value result) {
+    uint64_t hash = memo_hash(key, m->width);
+    int e = memo_find(m, key, hash);
+    if (e >= 0) {
+        m->entries[e].result = result;
+        return;
+    }
+    if (m->count == m->capacity && m->capacity < size && !memo_grow(m, size) && m->capacity == 0) return;
+
+    if (m->count < m->capacity) {
+        e = m->count++;
+    } else {
+        // reuse the least recently used entry
+        e = m->tail;
+        memo_unlink(m, e);
+        int *link = &m->buckets[memo_hash(&m->keys[(size_t)e * m->width], m->width) & (uint64_t)m->mask];
+        while (*link != e) link = &m->entries[*link].chain;
+        *link = m->entries[e].chain;
+        m->evictions++;
+    }
+    memcpy(&m->keys[(size_t)e * m->width], key, sizeof(Value) * m->width);
+    m->entries[e].result = result;
+    m->entries[e].chain = m->buckets[hash & (uint64_t)m->mask];
+    m->buckets[hash & (uint64_t)m->mask] = e;
+    memo_push_front(m, e);
+}
+
+// Frees this thread's tables, adding their counters to memo_stats.
+static void memo_release(void) {
+    if (!memos) return;
+    for (int f = 0; f < memo_count; f++) {
+        Memo *m = &memos[f];
+        if (memo_stats) {
+            atomic_fetch_add(&memo_stats[f].hits, m->hits);
+            atomic_fetch_add(&memo_stats[f].misses, m->misses);
+            atomic_fetch_add(&memo_stats[f].evictions, m->evictions);
+        }
+        free(m->entries);
+        free(m->keys);
+        free(m->buckets);
+    }
+    free(memos);
+    memos = NULL;
+    memo_count = 0;
+}
+
+static int run_parallel(Vm *vm, ParallelLoop *loop, Value *slots, long long start, long long count);
+static long long parallel_count(long long start, long long bound, const ParallelLoop *loop);
+static long long parallel_index(long long start, long long n, long long step);
+static int spawn_task(Vm *vm, Function *entry, Value *args, int arg_count);
+static int tasks_wait(void);
+static int loop_start(Vm *vm, Function *entry, Value *args, int arg_count);
+static int loop_run(void);
+typedef struct Iter Iter;
+static Iter *iter_new(Vm *vm, Function *entry, Value *args);
+static const char *iter_pull(Iter *it, Value *value, int *got);
+static const char *iter_drop(Vm *vm, const Frame *frame, Value *slots, int mark, Iter *it);
+static const char *snapshot(Vm *vm, int ip, Value *slots, const char *types);
+
+#define VM_SUSPENDED 2
+#define VM_YIELDED   3
+
+// Runs `entry` on slots the caller has filled in at vm->stack, until main
+// returns or the code halts. Returns 0, 1 after a runtime error,
+// VM_SUSPENDED when a coroutine has to wait, or VM_YIELDED when a generator
+// has a value; vm_run(vm, NULL) resumes it.
+// Every opcode already knows the static type of its operands, so the loop
+// only dispatches on the instruction.
+static int vm_run(Vm *vm, Function *entry) {
+    Program *program = vm->program;
+    Value *constants = program->constants;
+    FILE *out = vm->out;
+    int status = 0;
+
+    Frame *frame;
+    Function *fn;
+    Value *slots, *sp;
+    int ip;
+    if (entry) {
+        frame = vm->frames;
+        fn = entry;
+        frame->fn = fn;
+        frame->slots = vm->stack;
+        frame->mark = vm->heap.count;
+        frame->arena_mark = vm->arena.top;
+        slots = vm->stack;
+        sp = slots + fn->local_count;
+        ip = 0;
+    } else {
+        frame = vm->resume_frame;
+        fn = frame->fn;
+        slots = frame->slots;
+        sp = vm->resume_sp;
+        ip = frame->ip;
+    }
+    Instr *code = fn->code;
+
+    for (;;) {
+        Instr *ins = &code[ip++];
+        switch (ins->op) {
+            case OP_CONST:        *sp++ = constants[ins->a]; break;
+            case OP_LOAD:         *sp++ = slots[ins->a]; break;
+            case OP_STORE:        slots[ins->a] = *--sp; break;
+            case OP_POP:          sp--; break;
+            case OP_CHAR_CAST:    sp[-1].i = (char)sp[-1].i; break;
+            case OP_INT_TO_FLOAT: sp[-1].f = (double)sp[-1].i; break;
+
+            // int arithmetic wraps around (a parallel for steps its index
+            // past a bound of 9223372036854775807 once it is done)
+            case OP_ADD_INT: sp--; sp[-1].i = (long long)((unsigned long long)sp[-1].i + (unsigned long long)sp[0].i); break;
+            case OP_SUB_INT: sp--; sp[-1].i = (long long)((unsigned long long)sp[-1].i - (unsigned long long)sp[0].i); break;
+            case OP_MUL_INT: sp--; sp[-1].i = (long long)((unsigned long long)sp[-1].i * (unsigned long long)sp[0].i); break;
+            case OP_DIV_INT:
+            case OP_MOD_INT:
+                sp--;
+                if (sp[0].i == 0) {
+                    runtime_error(vm, fn, ip - 1, "division by zero");
+                    status = 1;
+                    goto done;
+                }
+                // the smallest int over -1 wraps to itself, remainder 0
+                if (sp[0].i == -1) sp[-1].i = ins->op == OP_DIV_INT ? (long long)(0 - (unsigned long long)sp[-1].i) : 0;
+                else if (ins->op == OP_DIV_INT) sp[-1].i /= sp[0].i;
+                else sp[-1].i %= sp[0].i;
+                break;
+            case OP_NEG_INT: sp[-1].i = (long long)(0 - (unsigned long long)sp[-1].i); break;
+
+            case OP_ADD_FLOAT: sp--; sp[-1].f += sp[0].f; break;
+            case OP_SUB_FLOAT: sp--; sp[-1].f -= sp[0].f; break;
+            case OP_MUL_FLOAT: sp--; sp[-1].f *= sp[0].f; break;
+            case OP_DIV_FLOAT: sp--; sp[-1].f /= sp[0].f; break;
+            case OP_NEG_FLOAT: sp[-1].f = -sp[-1].f; break;
+
+            case OP_EQ_INT: sp--; sp[-1].i = sp[-1].i == sp[0].i; break;
+            case OP_NE_INT: sp--; sp[-1].i = sp[-1].i != sp[0].i; break;
+            case OP_LT_INT: sp--; sp[-1].i = sp[-1].i <  sp[0].i; break;
+            case OP_GT_INT: sp--; sp[-1].i = sp[-1].i >  sp[0].i; break;
+            case OP_LE_INT: sp--; sp[-1].i = sp[-1].i <= sp[0].i; break;
+            case OP_GE_INT: sp--; sp[-1].i = sp[-1].i >= sp[0].i; break;
+
+            case OP_EQ_FLOAT: sp--; sp[-1].i = sp[-1].f == sp[0].f; break;
+            case OP_NE_FLOAT: sp--; sp[-1].i = sp[-1].f != sp[0].f; break;
+            case OP_LT_FLOAT: sp--; sp[-1].i = sp[-1].f <  sp[0].f; break;
+            case OP_GT_FLOAT: sp--; sp[-1].i = sp[-1].f >  sp[0].f; break;
+            case OP_LE_FLOAT: sp--; sp[-1].i = sp[-1].f <= sp[0].f; break;
+            case OP_GE_FLOAT: sp--; sp[-1].i = sp[-1].f >= sp[0].f; break;
+
+            case OP_EQ_STR: sp--; sp[-1].i = str_equal(sp[-1].str, sp[0].str); break;
+            case OP_NE_STR: sp--; sp[-1].i = !str_equal(sp[-1].str, sp[0].str); break;
+            case OP_CONCAT: {
+                sp--;
+                Str *s = vm_concat(vm, sp[-1].str, sp[0].str, ins->a, ins->b);
+                if (!s) {
+                    runtime_error(vm, fn, ip - 1, "out of memory");
+                    status = 1;
+                    goto done;
+                }
+                sp[-1].str = s;
+                break;
+            }
+
+            case OP_PRINT_INT:   fprintf(out, "%lld", (--sp)->i); break;
+            case OP_PRINT_CHAR:  fputc((int)(--sp)->i, out); break;
+            case OP_PRINT_FLOAT: print_float(out, (--sp)->f); break;
+            case OP_PRINT_BOOL:  fputs((--sp)->i ? "true" : "false", out); break;
+            case OP_PRINT_STR:
+                if (!print_str(out, (--sp)->str)) {
+                    runtime_error(vm, fn, ip - 1, "out of memory");
+                    status = 1;
+                    goto done;
+                }
+                break;
+            case OP_PRINT_UNDEFINED: fprintf(out, "[undefined:%s]", constants[ins->a].s); break;
+            case OP_PRINT_SPACE:   fputc(' ', out); break;
+            case OP_PRINT_NEWLINE:
+                fputc('\n', out);
+                if (vm->line_out) vm_flush_line(vm);
+                break;
+            case OP_PRINT_ARRAY:   array_print(out, (--sp)->p); break;
+            case OP_PRINT_MAP:     map_print(out, (--sp)->p); break;
+            case OP_PRINT_BUILDER: builder_print(out, (--sp)->p); break;
+            case OP_PRINT_READER:  reader_print(out, (--sp)->p); break;
+            case OP_PRINT_CHANNEL: channel_print(out, (--sp)->p); break;
+
+            case OP_NEW_ARRAY: {
+                if (sp[-1].i < 0 || sp[-1].i > ARRAY_MAX_LENGTH) {
+                    runtime_error(vm, fn, ip - 1, "array length out of range");
+                    status = 1;
+                    goto done;
+                }
+                Array *array = array_new((VarType)ins->a, sp[-1].i);
+                if (!array) {
+                    runtime_error(vm, fn, ip - 1, "out of memory");
+                    status = 1;
+                    goto done;
+                }
+                heap_track(&vm->heap, ins->a == VAR_INT ? VAR_ARRAY_INT : VAR_ARRAY_FLOAT, array, ins->b);
+                sp[-1].p = array;
+                break;
+            }
+            case OP_NEW_MAP: {
+                if (sp[-1].i < 0) {
+                    runtime_error(vm, fn, ip - 1, "negative map capacity");
+                    status = 1;
+                    goto done;
+                }
+                Map *map = map_new((VarType)ins->a, sp[-1].i);
+                if (!map) {
+                    runtime_error(vm, fn, ip - 1, "out of memory");
+                    status = 1;
+                    goto done;
+                }
+                heap_track(&vm->heap, ins->a == VAR_INT ? VAR_MAP_INT : VAR_MAP_STR, map, ins->b);
+                sp[-1].p = map;
+                break;
+            }
+            case OP_NEW_BUILDER: {
+                Builder *b = builder_new(sp[-1].i);
+                if (!b) {
+                    runtime_error(vm, fn, ip - 1, "out of memory");
+                    status = 1;
+                    goto done;
+                }
+                heap_track(&vm->heap, VAR_BUILDER, b, ins->b);
+                sp[-1].p = b;
+                break;
+            }
+            case OP_OPEN_READER:
+            case OP_OPEN_WRITER: {
+                const char *path = str_chars(sp[-1].str);
+                void *file = NULL;
+                if (path) file = ins->op == OP_OPEN_READER ? (void *)reader_open(path) : (void *)writer_open(path);
+                if (!file) {
+                    char msg[512];
+                    snprintf(msg, sizeof(msg), "cannot open '%s': %s", path ? path : "", strerror(errno));
+                    runtime_error(vm, fn, ip - 1, msg);
+                    status = 1;
+                    goto done;
+                }
+                heap_track(&vm->heap, ins->op == OP_OPEN_READER ? VAR_READER : VAR_WRITER, file, ins->b);
+                sp[-1].p = file;
+                break;
+            }
+            case OP_NEW_CHANNEL: {
+                // channels are not on the heap: any task may outlive their maker
+                if (sp[-1].i > CHANNEL_MAX_CAPACITY) {
+                    runtime_error(vm, fn, ip - 1, "channel capacity out of range");
+                    status = 1;
+                    goto done;
+                }
+                Channel *ch = channel_new((VarType)ins->a, sp[-1].i);
+                if (!ch) {
+                    runtime_error(vm, fn, ip - 1, "out of memory");
+                    status = 1;
+                    goto done;
+                }
+                sp[-1].p = ch;
+                break;
+            }
+            case OP_INDEX_INT:
+            case OP_INDEX_FLOAT: {
+                Array *array = sp[-2].p;
+                long long index = sp[-1].i;
+                if (index < 0 || index >= array->length) {
+                    runtime_error(vm, fn, ip - 1, "array index out of range");
+                    status = 1;
+                    goto done;
+                }
+                sp--;
+                if (ins->op == OP_INDEX_INT) sp[-1].i = array->ints[index];
+                else sp[-1].f = array->floats[index];
+                break;
+            }
+            case OP_STORE_INDEX_INT:
+            case OP_STORE_INDEX_FLOAT: {
+                Array *array = sp[-3].p;
+                long long index = sp[-2].i;
+                if (index < 0 || index >= array->length) {
+                    runtime_error(vm, fn, ip - 1, "array index out of range");
+                    status = 1;
+                    goto done;
+                }
+                if (ins->op == OP_STORE_INDEX_INT) array->ints[index] = sp[-1].i;
+                else array->floats[index] = sp[-1].f;
+                sp -= 3;
+                break;
+            }
+
+            case OP_CALL_NATIVE: {
+                Value *args = sp - ins->b;
+                Value result;
+                const char *err = builtins[ins->a].fn(args, &result);
+                if (err) {
+                    if (err == EVENT_WAIT && vm->coroutine) {
+                        // the builtin runs again, arguments and all, on resume
+                        frame->ip = ip - 1;
+                        vm->resume_frame = frame;
+                        vm->resume_sp = sp;
+                        return VM_SUSPENDED;
                     }
+                    runtime_error(vm, fn, ip - 1, err);
+                    status = 1;
+                    goto done;
+                }
+                sp = args;
+                if (builtins[ins->a].result != VAR_UNKNOWN) *sp++ = result;
+                break;
+            }
+
+            case OP_CALL_FFI: {
+                const FfiImport *import = &program->ffi[ins->a];
+                Value *args = sp - import->param_count;
+                Value result;
+                const char *err = ffi_call(ins->a, args, &result);
+                if (err) {
+                    runtime_error(vm, fn, ip - 1, err);
+                    status = 1;
+                    goto done;
                 }
-                if (i < node->child_count - 1) printf(" ");
+                sp = args;
+                if (import->types[0] == TYPE_CODE(VAR_STRING)) heap_track(&vm->heap, VAR_STRING, result.str, ins->b);
+                if (import->types[0] != TYPE_CODE(VAR_UNKNOWN)) *sp++ = result;
+                break;
             }
-            printf("\n");
-            break;
 
-        case AST_RETURN:
-            printf("Program returned: %s\n", node->value);
-            break;
+            case OP_RETURN_STATUS:
+            case OP_RETURN_INT:
+            case OP_RETURN_CHAR:
+            case OP_RETURN_FLOAT:
+            case OP_RETURN_BOOL:
+            case OP_RETURN_STR: {
+                // the program ends once every coroutine and task has
+                if (loop_run() || tasks_wait()) {
+                    status = 1;
+                    goto done;
+                }
+                // output still buffered in writers belongs before the report
+                const char *err = heap_flush_writers(&vm->heap);
+                if (err) {
+                    runtime_error(vm, fn, ip - 1, err);
+                    status = 1;
+                    goto done;
+                }
+                fputs("Program returned: ", stdout);
+                switch (ins->op) {
+                    case OP_RETURN_STATUS: fputs(constants[ins->a].s, stdout); break;
+                    case OP_RETURN_INT:    printf("%lld", (--sp)->i); break;
+                    case OP_RETURN_CHAR:   putchar((char)(--sp)->i); break;
+                    case OP_RETURN_FLOAT:  print_float(stdout, (--sp)->f); break;
+                    case OP_RETURN_BOOL:   fputs((--sp)->i ? "true" : "false", stdout); break;
+                    default:               print_str(stdout, (--sp)->str); break;
+                }
+                putchar('\n');
+                goto done;
+            }
 
-        case AST_LITERAL:
-            printf("%s", node->value);
-            break;
+            case OP_CALL: {
+                Function *callee = &program->functions[ins->a];
+                Value *base = sp - ins->b;
+                if (frame == vm->frames + vm->frame_capacity - 1 ||
+                    base + callee->local_count + callee->max_stack > vm->stack + vm->stack_capacity) {
+                    long depth = (long)(frame - vm->frames);
+                    size_t at = (size_t)(base - vm->stack), used = (size_t)(sp - vm->stack);
+                    if (!vm_grow(vm, depth, used, at + callee->local_count + callee->max_stack)) {
+                        runtime_error(vm, fn, ip - 1, "stack overflow");
+                        status = 1;
+                        goto done;
+                    }
+                    frame = vm->frames + depth;
+                    slots = frame->slots;
+                    base = vm->stack + at;
+                    sp = vm->stack + used;
+                }
+                frame->ip = ip;
+                frame++;
+                frame->fn = callee;
+                frame->slots = base;
+                frame->mark = vm->heap.count;
+                frame->arena_mark = vm->arena.top;
+                memset(sp, 0, sizeof(Value) * (callee->local_count - ins->b));
 
-        case AST_IDENTIFIER:
-            for (int v = 0; v < var_count; v++) {
-                if (strcmp(variables[v].name, node->value) == 0) {
-                    if (variables[v].type == VAR_INT) {
-                        printf("%d", variables[v].int_value);
-                    } else if (variables[v].type == VAR_CHAR) {
-                        printf("%c", variables[v].char_value);
-                    } else if (variables[v].type == VAR_STRING) {
-                        printf("%s", variables[v].string_value);
+                fn = callee;
+                code = callee->code;
+                slots = base;
+                sp = base + callee->local_count;
+                ip = 0;
+                break;
+            }
+            case OP_TAIL_CALL: {
+                // Move the arguments over the current frame and start the callee
+                Function *callee = &program->functions[ins->a];
+                if (slots + callee->local_count + callee->max_stack > vm->stack + vm->stack_capacity) {
+                    long depth = (long)(frame - vm->frames);
+                    size_t at = (size_t)(slots - vm->stack), used = (size_t)(sp - vm->stack);
+                    if (!vm_grow(vm, depth, used, at + callee->local_count + callee->max_stack)) {
+                        runtime_error(vm, fn, ip - 1, "stack overflow");
+                        status = 1;
+                        goto done;
                     }
-                    return;
+                    frame = vm->frames + depth;
+                    slots = frame->slots;
+                    sp = vm->stack + used;
+                }
+                memmove(slots, sp - ins->b, sizeof(Value) * ins->b);
+                memset(slots + ins->b, 0, sizeof(Value) * (callee->local_count - ins->b));
+                // a region callee frees only its own allocations if the
+                // caller had some that escape
+                if (callee->region && !fn->region) {
+                    frame->mark = vm->heap.count;
+                    frame->arena_mark = vm->arena.top;
+                }
+                frame->fn = callee;
+
+                fn = callee;
+                code = callee->code;
+                sp = slots + callee->local_count;
+                ip = 0;
+                break;
+            }
+            case OP_RETURN:
+            case OP_RETURN_VOID: {
+                // The result takes the place of the callee's first argument
+                if (ins->op == OP_RETURN) {
+                    slots[0] = sp[-1];
+                    sp = slots + 1;
+                } else {
+                    sp = slots;
+                }
+                const char *err = NULL;
+                if (vm->heap.count > frame->mark || vm->arena.top != frame->arena_mark) {
+                    err = region_free(&vm->heap, &vm->arena, frame);
+                }
+                frame--;
+                fn = frame->fn;
+                code = fn->code;
+                slots = frame->slots;
+                ip = frame->ip;
+                // a writer that could not be closed fails the call
+                if (err) {
+                    runtime_error(vm, fn, ip - 1, err);
+                    status = 1;
+                    goto done;
+                }
+                break;
+            }
+            case OP_ADOPT:
+                // the callee's frame, just popped, still holds its mark
+                for (int i = frame[1].mark; i < vm->heap.count; i++) vm->heap.objects[i].scope = ins->a;
+                break;
+            case OP_NO_RETURN:
+                runtime_error(vm, fn, ip - 1, "function ended without returning a value");
+                status = 1;
+                goto done;
+            case OP_SPAWN:
+                sp -= ins->b;
+                if (!spawn_task(vm, &program->functions[ins->a], sp, ins->b)) {
+                    runtime_error(vm, fn, ip - 1, "cannot start a task");
+                    status = 1;
+                    goto done;
+                }
+                out = vm->out;   // the first spawn switches to line output
+                break;
+            case OP_MEMO_LOOKUP: {
+                Memo *memo = memo_table(program, fn);
+                Value result;
+                if (memo && memo_lookup(memo, slots, &result)) {
+                    *sp++ = result;
+                    ip = ins->b;
+                } else {
+                    memcpy(slots + ins->a, slots, sizeof(Value) * fn->param_count);
+                }
+                break;
+            }
+            case OP_MEMO_STORE: {
+                Memo *memo = memo_table(program, fn);
+                if (memo) memo_store(memo, fn->memo_size, slots + ins->a, sp[-1]);
+                break;
+            }
+            case OP_START:
+                sp -= ins->b;
+                if (!loop_start(vm, &program->functions[ins->a], sp, ins->b)) {
+                    runtime_error(vm, fn, ip - 1, "cannot start a coroutine");
+                    status = 1;
+                    goto done;
+                }
+                break;
+
+            case OP_ITER_NEW: {
+                Function *entry = &program->functions[ins->a];
+                sp -= entry->param_count;
+                Iter *it = iter_new(vm, entry, sp);
+                if (!it) {
+                    runtime_error(vm, fn, ip - 1, "cannot start a generator");
+                    status = 1;
+                    goto done;
+                }
+                heap_track(&vm->heap, VAR_ITER_INT, it, ins->b);
+                (sp++)->p = it;
+                break;
+            }
+            case OP_ITER_NEXT: {
+                int got;
+                const char *err = iter_pull(sp[-1].p, &sp[-1], &got);
+                if (err) {
+                    runtime_error(vm, fn, ip - 1, err);
+                    status = 1;
+                    goto done;
+                }
+                if (!got) {
+                    sp--;
+                    ip = ins->a;
+                }
+                break;
+            }
+            case OP_ITER_DROP: {
+                const char *err = slots[ins->a].p ? iter_drop(vm, frame, slots, ins->b, slots[ins->a].p) : NULL;
+                if (err) {
+                    runtime_error(vm, fn, ip - 1, err);
+                    status = 1;
+                    goto done;
+                }
+                break;
+            }
+            case OP_YIELD:
+                frame->ip = ip;
+                vm->resume_frame = frame;
+                vm->resume_sp = --sp;
+                return VM_YIELDED;
+
+            case OP_JUMP:
+                ip = ins->a;
+                break;
+            case OP_JUMP_IF_FALSE:
+                if (!(--sp)->i) ip = ins->a;
+                break;
+            case OP_JUMP_IF_TRUE:
+                if ((--sp)->i) ip = ins->a;
+                break;
+            case OP_LOOP_MARK:
+                slots[ins->a].i = vm->heap.count;
+                slots[ins->a + 1].p = vm->arena.top;
+                slots[ins->a + 2].i = ins->b;
+                break;
+            case OP_LOOP_SWEEP: {
+                int mark = (int)slots[ins->a].i;
+                if (vm->heap.count == mark && vm->arena.top == slots[ins->a + 1].p) break;
+                const char *err = heap_sweep(&vm->heap, mark, ins->b);
+                arena_rewind(&vm->arena, slots[ins->a + 1].p);
+                slots[ins->a].i = vm->heap.count;
+                if (err) {
+                    runtime_error(vm, fn, ip - 1, err);
+                    status = 1;
+                    goto done;
+                }
+                break;
+            }
+
+            case OP_PARALLEL: {
+                ParallelLoop *loop = &program->loops[ins->a];
+                long long start = slots[loop->index_slot].i;
+                long long count = parallel_count(start, (--sp)->i, loop);
+                if (count > 0 && !run_parallel(vm, loop, slots, start, count)) {
+                    status = 1;
+                    goto done;
+                }
+                if (vm->line_out) vm_flush_line(vm);
+                slots[loop->index_slot].i = parallel_index(start, count, loop->step);
+                break;
+            }
+
+            case OP_BENCH_START: {
+                long long warmup = (--sp)->i;
+                long long iterations = (--sp)->i;
+                const char *err = NULL;
+                slots[ins->b].p = bench_start(constants[ins->a].s, iterations, warmup, &err);
+                if (!slots[ins->b].p) {
+                    runtime_error(vm, fn, ip - 1, err);
+                    status = 1;
+                    goto done;
                 }
+                break;
             }
-            printf("[undefined:%s]", node->value);
-            break;
+            case OP_BENCH_NEXT:
+                if (!bench_next(slots[ins->a].p, out)) ip = ins->b;
+                break;
+
+            case OP_SNAPSHOT: {
+                if (!interpiler_options.snapshot_path) break;
+                const char *err = snapshot(vm, ip, slots, constants[ins->a].s);
+                if (err) {
+                    runtime_error(vm, fn, ip - 1, err);
+                    status = 1;
+                }
+                goto done;
+            }
+
+            case OP_HALT:
+                goto done;
+        }
+    }
+
+done:
+    return status;
+}
+
+// -----------------------------
+// parallel for
+// -----------------------------
+// The iterations are cut into a fixed number of chunks, independent of the
+// thread count. Each chunk runs the loop's body function on a private copy
+// of the enclosing frame, prints into its own buffer and sums its own
+// reductions; afterwards the buffers are written out and the sums added in
+// chunk order. Output and results are therefore the same as a sequential
+// run would give (floating-point sums are grouped by chunk), however the
+// chunks were scheduled.
+#define PARALLEL_CHUNKS 256
+
+// Iterations of i = start; i < bound (<= if inclusive); i = i + step,
+// worked out in unsigned arithmetic so that bounds near either end of the
+// int range do not overflow. A loop of 2^63 or more iterations, which
+// could never finish anyway, counts LLONG_MAX of them.
+static long long parallel_count(long long start, long long bound, const ParallelLoop *loop) {
+    if (start > bound || (start == bound && !loop->inclusive)) return 0;
+    unsigned long long span = (unsigned long long)bound - (unsigned long long)start - !loop->inclusive;
+    unsigned long long steps = span / (unsigned long long)loop->step;
+    return steps >= (unsigned long long)LLONG_MAX ? LLONG_MAX : (long long)steps + 1;
+}
+
+// start + n * step, wrapping as OP_ADD_INT does.
+static long long parallel_index(long long start, long long n, long long step) {
+    return (long long)((unsigned long long)start + (unsigned long long)n * (unsigned long long)step);
+}
+
+// First iteration of chunk `chunk`: count * chunk / chunk_count without
+// the product overflowing.
+static long long chunk_start(long long count, int chunk, int chunk_count) {
+    return count / chunk_count * chunk + count % chunk_count * chunk / chunk_count;
+}
+
+typedef struct {
+    char *text;           // captured pypstdio.print output
+    size_t length;
+    Value *sums;          // the chunk's reduction totals
+    char error[256];      // runtime error, if the chunk failed
+} ChunkResult;
+
+typedef struct {
+    Program *program;
+    ParallelLoop *loop;
+    Value *slots;         // the enclosing frame
+    long long start;
+    long long count;      // iterations
+    int chunk_count;
+    ChunkResult *chunks;
+    Vm *vms;              // one per pool participant, set up on first use
+    _Atomic int failed;   // lowest failed chunk so far, or chunk_count
+} ParallelJob;
 
-        default:
-            fprintf(stderr, "Unknown node type %d\n", node->type);
-            break;
+static void run_chunk(void *arg, int worker, int chunk) {
+    ParallelJob *job = arg;
+    ParallelLoop *loop = job->loop;
+    ChunkResult *result = &job->chunks[chunk];
+    // once a chunk fails, only the chunks before it still matter
+    if (chunk > atomic_load(&job->failed)) return;
+
+    Vm *vm = &job->vms[worker];
+    if (!vm->stack) {
+        vm->program = job->program;
+        vm_alloc(vm, FRAMES_MAX, VALUE_STACK_MAX);
+        vm->error_size = sizeof(result->error);
+    }
+    vm->error = result->error;
+#ifndef _WIN32
+    vm->out = open_memstream(&result->text, &result->length);
+#else
+    vm->out = tmpfile();
+#endif
+    if (!vm->frames || !vm->stack || !vm->out) {
+        snprintf(result->error, sizeof(result->error), "Runtime error: out of memory");
+    } else {
+        Function *body = &job->program->functions[loop->body];
+        long long lo = chunk_start(job->count, chunk, job->chunk_count);
+        long long hi = chunk_start(job->count, chunk + 1, job->chunk_count);
+        memcpy(vm->stack, job->slots, sizeof(Value) * loop->copy_count);
+        memset(vm->stack + loop->copy_count, 0, sizeof(Value) * (body->local_count - loop->copy_count));
+        for (int r = 0; r < loop->reduce_count; r++) {
+            if (loop->reduce_types[r] == VAR_FLOAT) vm->stack[loop->reduce_slots[r]].f = 0.0;
+            else vm->stack[loop->reduce_slots[r]].i = 0;
+        }
+        vm->stack[loop->index_slot].i = parallel_index(job->start, lo, loop->step);
+        vm->stack[loop->left_slot].i = hi - lo;
+        vm_run(vm, body);
+        for (int r = 0; r < loop->reduce_count; r++) result->sums[r] = vm->stack[loop->reduce_slots[r]];
+    }
+    if (vm->out) {
+#ifndef _WIN32
+        fclose(vm->out);
+#else
+        long size = ftell(vm->out);
+        result->text = size > 0 ? malloc((size_t)size) : NULL;
+        rewind(vm->out);
+        if (result->text) result->length = fread(result->text, 1, (size_t)size, vm->out);
+        fclose(vm->out);
+#endif
+    }
+    // nothing made here can outlive the chunk: the body writes no
+    // variable of the enclosing frame except int/float reductions
+    const char *err = heap_free(&vm->heap);
+    if (err && !result->error[0]) snprintf(result->error, sizeof(result->error), "Runtime error: %s", err);
+    arena_rewind(&vm->arena, NULL);
+    // pool threads keep no @memo results between chunks
+    if (worker != 0) memo_release();
+
+    if (result->error[0]) {
+        int failed = atomic_load(&job->failed);
+        while (chunk < failed && !atomic_compare_exchange_weak(&job->failed, &failed, chunk)) {}
     }
 }
 
+static int run_parallel(Vm *vm, ParallelLoop *loop, Value *slots, long long start, long long count) {
+    ParallelJob job;
+    memset(&job, 0, sizeof(job));
+    job.program = vm->program;
+    job.loop = loop;
+    job.slots = slots;
+    job.start = start;
+    job.count = count;
+    job.chunk_count = count < PARALLEL_CHUNKS ? (int)count : PARALLEL_CHUNKS;
+    atomic_init(&job.failed, job.chunk_count);
+    int workers = parallel_workers();
+    job.chunks = calloc((size_t)job.chunk_count, sizeof(ChunkResult));
+    job.vms = calloc((size_t)workers, sizeof(Vm));
+    Value *sums = calloc((size_t)job.chunk_count * (loop->reduce_count + 1), sizeof(Value));
+    if (!job.chunks || !job.vms || !sums) {
+        free(job.chunks);
+        free(job.vms);
+        free(sums);
+        runtime_error(vm, &vm->program->functions[loop->body], 0, "out of memory");
+        return 0;
+    }
+    for (int c = 0; c < job.chunk_count; c++) job.chunks[c].sums = sums + (size_t)c * (loop->reduce_count + 1);
+
+    parallel_run(job.chunk_count, run_chunk, &job);
+
+    int failed = atomic_load(&job.failed);
+    for (int c = 0; c < job.chunk_count; c++) {
+        ChunkResult *result = &job.chunks[c];
+        if (c <= failed && result->length) fwrite(result->text, 1, result->length, vm->out);
+        free(result->text);
+        if (c >= failed) continue;
+        for (int r = 0; r < loop->reduce_count; r++) {
+            Value *total = &slots[loop->reduce_slots[r]];
+            if (loop->reduce_types[r] == VAR_FLOAT) total->f += result->sums[r].f;
+            else total->i = (long long)((unsigned long long)total->i + (unsigned long long)result->sums[r].i);
+        }
+    }
+    if (failed < job.chunk_count) {
+        if (vm->error) {
+            snprintf(vm->error, vm->error_size, "%s", job.chunks[failed].error);
+        } else {
+            fflush(stdout);
+            fprintf(stderr, "%s\n", job.chunks[failed].error);
+        }
+    }
+    for (int w = 0; w < workers; w++) {
+        arena_release(&job.vms[w].arena);
+        free(job.vms[w].frames);
+        free(job.vms[w].stack);
+    }
+    free(job.vms);
+    free(job.chunks);
+    free(sums);
+    return failed == job.chunk_count;
+}
+
+// -----------------------------
+// async / await
+// -----------------------------
+// Each thread that starts coroutines runs its own event loop. A coroutine
+// is a Vm of its own whose stacks start small and grow on demand, so many
+// thousands fit in memory; and since calls never recurse on the C stack,
+// suspending one is just vm_run returning with its frames left in place.
+// Ready coroutines run in the order they became ready, each until it
+// finishes or waits; when none is ready the loop blocks in the poller.
+// What a coroutine allocated stays alive with the Vm that started the
+// loop, since its strings and arrays may have been handed back.
+typedef struct Coroutine Coroutine;
+
+struct Coroutine {
+    Vm vm;
+    Function *entry;        // until its first run
+    EventWait wait;
+    Coroutine *next_ready;
+    Coroutine *prev;        // in the list of unfinished coroutines
+    Coroutine *next;
+};
+
+static _Thread_local struct {
+    Vm *owner;              // the thread's main or task Vm
+    Coroutine *ready;
+    Coroutine *ready_tail;
+    Coroutine *live;
+    int failed;
+} loop;
+
+static void loop_ready(void *owner) {
+    Coroutine *co = owner;
+    co->next_ready = NULL;
+    if (loop.ready_tail) loop.ready_tail->next_ready = co;
+    else loop.ready = co;
+    loop.ready_tail = co;
+}
+
+static int loop_start(Vm *vm, Function *entry, Value *args, int arg_count) {
+    int values = entry->local_count + entry->max_stack;
+    Coroutine *co = calloc(1, sizeof(Coroutine));
+    if (!co || !vm_alloc(&co->vm, COROUTINE_FRAMES, values > COROUTINE_VALUES ? values : COROUTINE_VALUES)) {
+        if (co) {
+            free(co->vm.frames);
+            free(co->vm.stack);
+        }
+        free(co);
+        return 0;
+    }
+    if (!vm->coroutine) loop.owner = vm;
+    co->vm.program = vm->program;
+    co->vm.coroutine = 1;
+    co->vm.out = loop.owner->line_out ? loop.owner->line_out : loop.owner->out;
+    co->entry = entry;
+    co->wait.fd = -1;
+    memcpy(co->vm.stack, args, sizeof(Value) * arg_count);
+
+    co->next = loop.live;
+    if (loop.live) loop.live->prev = co;
+    loop.live = co;
+    loop_ready(co);
+    return 1;
+}
+
+static void loop_finish(Coroutine *co) {
+    if (co->prev) co->prev->next = co->next;
+    else loop.live = co->next;
+    if (co->next) co->next->prev = co->prev;
+
+    vm_end_line_output(&co->vm);
+    Heap *heap = &co->vm.heap;
+    for (int i = 0; i < heap->count; i++) {
+        // what a coroutine leaves behind outlives the owner's loop iteration
+        int scope = heap->objects[i].scope > 0 ? 0 : heap->objects[i].scope;
+        heap_track(&loop.owner->heap, heap->objects[i].type, heap->objects[i].ptr, scope);
+    }
+    free(heap->objects);
+    arena_release(&co->vm.arena);
+    free(co->vm.frames);
+    free(co->vm.stack);
+    free(co);
+}
+
+static void loop_step(Coroutine *co) {
+    // a print never waits halfway (see compile_print), but once tasks print
+    // too, lines have to go out whole
+    if (loop.owner->line_out && !co->vm.line_out) {
+        co->vm.out = loop.owner->line_out;
+        vm_line_output(&co->vm);
+    }
+    event_current = &co->wait;
+    int status = vm_run(&co->vm, co->entry);
+    event_current = NULL;
+    co->entry = NULL;
+
+    if (status == VM_SUSPENDED) {
+        const char *err = event_park(&co->wait, co);
+        if (!err) return;
+        runtime_error(&co->vm, co->vm.resume_frame->fn, co->vm.resume_frame->ip, err);
+        status = 1;
+    }
+    if (status) loop.failed = 1;
+    loop_finish(co);
+}
+
+// Runs coroutines until all have finished. Returns 1 if one failed; the
+// rest are then left where they are for loop_discard.
+static int loop_run(void) {
+    while (loop.live && !loop.failed) {
+        while (loop.ready && !loop.failed) {
+            Coroutine *co = loop.ready;
+            loop.ready = co->next_ready;
+            if (!loop.ready) loop.ready_tail = NULL;
+            loop_step(co);
+        }
+        // every unfinished coroutine is ready or parked, so this only waits
+        if (loop.live && !loop.failed && !event_poll(loop_ready)) break;
+    }
+    int failed = loop.failed;
+    loop.failed = 0;
+    return failed;
+}
+
+// Drops every unfinished coroutine and the thread's poller.
+static void loop_discard(void) {
+    while (loop.live) loop_finish(loop.live);
+    loop.ready = loop.ready_tail = NULL;
+    loop.owner = NULL;
+    event_release();
+}
+
+const char *native_loop_run(Value *args, Value *result) {
+    (void)args;
+    (void)result;
+    return loop_run() ? "a coroutine failed" : NULL;
+}
+
+// -----------------------------
+// Generators
+// -----------------------------
+// A generator is a Vm of its own, like a coroutine, that runs only when
+// its value is pulled: until its next yield, which suspends it with the
+// value on top of its stack, or until it halts. Pulls run it on the
+// puller's thread and native stack, so each pull through a chain of
+// iterators nests one vm_run per link. Values are only int or float, so
+// nothing a generator allocates can be reached from outside it: its heap
+// goes as soon as it ends, or with the iterator if that is dropped first
+// (see OP_ITER_DROP).
+#define ITER_NESTING 256
+
+enum { ITER_READY, ITER_RUNNING, ITER_DONE, ITER_FAILED };
+
+struct Iter {
+    Vm vm;
+    Function *entry;    // until its first run
+    int state;
+    int buffered;       // iter.more pulled `value` ahead
+    Value value;
+    Iter *source;       // made for this map, filter or take alone (see Function.owns_source)
+};
+
+static _Thread_local int iter_depth;
+
+static Iter *iter_new(Vm *vm, Function *entry, Value *args) {
+    int values = entry->local_count + entry->max_stack;
+    Iter *it = calloc(1, sizeof(Iter));
+    if (!it || !vm_alloc(&it->vm, COROUTINE_FRAMES, values > COROUTINE_VALUES ? values : COROUTINE_VALUES)) {
+        if (it) {
+            free(it->vm.frames);
+            free(it->vm.stack);
+        }
+        free(it);
+        return NULL;
+    }
+    it->vm.program = vm->program;
+    it->vm.generator = 1;
+    it->vm.out = vm->line_out ? vm->line_out : vm->out;
+    if (vm->line_out) vm_line_output(&it->vm);
+    it->entry = entry;
+    if (entry->owns_source) it->source = args[0].p;
+    memcpy(it->vm.stack, args, sizeof(Value) * entry->param_count);
+    memset(it->vm.stack + entry->param_count, 0, sizeof(Value) * (entry->local_count - entry->param_count));
+    return it;
+}
+
+static const char *iter_stop(Iter *it);
+
+// Frees what the generator's Vm holds, once it has ended, and ends the
+// source it owns, which nothing else can pull from. NULL, or why a writer
+// it made could not be closed.
+static const char *iter_end(Iter *it) {
+    vm_end_line_output(&it->vm);
+    const char *err = heap_free(&it->vm.heap);
+    arena_release(&it->vm.arena);
+    free(it->vm.frames);
+    free(it->vm.stack);
+    it->vm.frames = NULL;
+    it->vm.stack = NULL;
+    // the source is kept, ended, for iter_drop to free along with it
+    if (it->source) {
+        const char *e = iter_stop(it->source);
+        if (!err) err = e;
+    }
+    return err;
+}
+
+// Ends an iterator nothing will pull from again, without running it on.
+static const char *iter_stop(Iter *it) {
+    if (it->state != ITER_READY) return NULL;
+    it->state = ITER_DONE;
+    it->buffered = 0;
+    return iter_end(it);
+}
+
+static const char *iter_free(void *iter) {
+    Iter *it = iter;
+    const char *err = NULL;
+    // the source is on the heap too, and may already be gone
+    it->source = NULL;
+    if (it->state != ITER_DONE && it->state != ITER_FAILED) err = iter_end(it);
+    free(it);
+    return err;
+}
+
+// Frees an iterator nothing refers to any more, with the sources made for
+// it alone, and takes them off the heap. They belong to `frame`'s region,
+// most likely made not long ago, so the search starts from the newest
+// object; the marks of the loops running in the frame, from slots[mark]
+// out, move down past each. One not found there is not this frame's to
+// free: a parallel for's body starts with a copy of the enclosing slots.
+static const char *iter_drop(Vm *vm, const Frame *frame, Value *slots, int mark, Iter *it) {
+    Heap *heap = &vm->heap;
+    const char *err = NULL;
+    while (it) {
+        Iter *source = it->source;
+        int i = heap->count - 1;
+        while (i >= frame->mark && heap->objects[i].ptr != it) i--;
+        if (i < frame->mark) break;
+        memmove(&heap->objects[i], &heap->objects[i + 1], sizeof(HeapObject) * (size_t)(heap->count - i - 1));
+        heap->count--;
+        for (int m = mark; m >= 0; m = (int)slots[m + 2].i) {
+            if (slots[m].i > i) slots[m].i--;
+        }
+        const char *e = iter_free(it);
+        if (!err) err = e;
+        it = source;
+    }
+    return err;
+}
+
+// Runs the generator to its next value (*got = 1) or its end (*got = 0).
+// A generator's own runtime error has been reported by the time this
+// returns iter_failed.
+static const char *iter_pull(Iter *it, Value *value, int *got) {
+    *got = 0;
+    if (it->buffered) {
+        it->buffered = 0;
+        *value = it->value;
+        *got = 1;
+        return NULL;
+    }
+    if (it->state == ITER_DONE) return NULL;
+    if (it->state == ITER_FAILED) return iter_failed;
+    if (it->state == ITER_RUNNING) return "generator is already running";
+    if (iter_depth == ITER_NESTING) return "generators nested too deeply";
+
+    it->state = ITER_RUNNING;
+    iter_depth++;
+    int status = vm_run(&it->vm, it->entry);
+    iter_depth--;
+    it->entry = NULL;
+    if (status == VM_YIELDED) {
+        it->state = ITER_READY;
+        *value = *it->vm.resume_sp;
+        *got = 1;
+        return NULL;
+    }
+    it->state = status ? ITER_FAILED : ITER_DONE;
+    const char *err = iter_end(it);
+    return status ? iter_failed : err;
+}
+
+const char *native_iter_next(Value *args, Value *result) {
+    int got;
+    const char *err = iter_pull(args[0].p, result, &got);
+    if (err) return err;
+    return got ? NULL : "next from an exhausted iterator";
+}
+
+// iter.next(it, end): `end` once the iterator is exhausted.
+const char *native_iter_next_or(Value *args, Value *result) {
+    int got;
+    const char *err = iter_pull(args[0].p, result, &got);
+    if (!err && !got) *result = args[1];
+    return err;
+}
+
+const char *native_iter_more(Value *args, Value *result) {
+    Iter *it = args[0].p;
+    int got;
+    const char *err = iter_pull(it, &it->value, &got);
+    it->buffered = got;
+    result->i = got;
+    return err;
+}
+
+// iter.chunk(it, buf): fills buf from the front and returns how many
+// values it took, fewer than buf's length only at the end.
+const char *native_iter_chunk(Value *args, Value *result) {
+    Array *buf = args[1].p;
+    long long n = 0;
+    while (n < buf->length) {
+        Value v;
+        int got;
+        const char *err = iter_pull(args[0].p, &v, &got);
+        if (err) return err;
+        if (!got) break;
+        if (buf->elem_type == VAR_FLOAT) buf->floats[n++] = v.f;
+        else buf->ints[n++] = v.i;
+    }
+    result->i = n;
+    return NULL;
+}
+
+// -----------------------------
+// spawn
+// -----------------------------
+// Every task is a thread of its own, so a task blocked on a channel never
+// holds up another. A task's arrays may be passed on to tasks that outlive
+// it, so its heap is only freed with main's, once every task has ended.
+// A runtime error in a task aborts all channels: tasks and main waiting
+// on one stop with an error instead of waiting forever.
+typedef struct Task Task;
+
+struct Task {
+    Vm vm;
+    Function *entry;
+    pthread_t thread;
+    Task *next;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    Task *all;           // every task started this run
+    int running;
+    int failed;
+} tasks = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0 };
+
+static _Thread_local int in_task;
+
+static void *task_main(void *arg) {
+    Task *task = arg;
+    in_task = 1;
+    int status = vm_run(&task->vm, task->entry);
+    if (!status) status = loop_run();
+    loop_discard();
+    memo_release();
+    if (status) channel_abort();
+    vm_end_line_output(&task->vm);
+
+    pthread_mutex_lock(&tasks.lock);
+    if (status) tasks.failed = 1;
+    if (--tasks.running == 0) pthread_cond_broadcast(&tasks.finished);
+    pthread_mutex_unlock(&tasks.lock);
+    return NULL;
+}
+
+static int spawn_task(Vm *vm, Function *entry, Value *args, int arg_count) {
+    if (!vm->line_out && vm->out == stdout && !vm_line_output(vm)) return 0;
+    fflush(vm->out);
+
+    Task *task = calloc(1, sizeof(Task));
+    if (!task) return 0;
+    task->entry = entry;
+    task->vm.program = vm->program;
+    int allocated = vm_alloc(&task->vm, FRAMES_MAX, VALUE_STACK_MAX);
+    task->vm.out = vm->line_out ? vm->line_out : vm->out;
+    if (!allocated || !vm_line_output(&task->vm)) {
+        free(task->vm.frames);
+        free(task->vm.stack);
+        free(task);
+        return 0;
+    }
+    memcpy(task->vm.stack, args, sizeof(Value) * arg_count);
+
+    pthread_mutex_lock(&tasks.lock);
+    if (pthread_create(&task->thread, NULL, task_main, task) != 0) {
+        pthread_mutex_unlock(&tasks.lock);
+        vm_end_line_output(&task->vm);
+        free(task->vm.frames);
+        free(task->vm.stack);
+        free(task);
+        return 0;
+    }
+    task->next = tasks.all;
+    tasks.all = task;
+    tasks.running++;
+    pthread_mutex_unlock(&tasks.lock);
+    return 1;
+}
+
+// Waits until no task is running. Returns 1 if any task failed.
+static int tasks_wait(void) {
+    pthread_mutex_lock(&tasks.lock);
+    while (tasks.running > 0) pthread_cond_wait(&tasks.finished, &tasks.lock);
+    int failed = tasks.failed;
+    pthread_mutex_unlock(&tasks.lock);
+    return failed;
+}
+
+// Frees the finished tasks; call after tasks_wait. NULL, or why a writer
+// one of them made could not be closed.
+static const char *tasks_release(void) {
+    const char *err = NULL;
+    while (tasks.all) {
+        Task *task = tasks.all;
+        tasks.all = task->next;
+        pthread_join(task->thread, NULL);
+        const char *e = heap_free(&task->vm.heap);
+        if (!err) err = e;
+        arena_release(&task->vm.arena);
+        free(task->vm.frames);
+        free(task->vm.stack);
+        free(task);
+    }
+    tasks.failed = 0;
+    return err;
+}
+
+const char *native_task_wait(Value *args, Value *result) {
+    (void)args;
+    (void)result;
+    if (in_task) return "task.wait can only be called from main";
+    return tasks_wait() ? "a spawned task failed" : NULL;
+}
+
+// -----------------------------
+// Snapshots
+// -----------------------------
+// pypstdio.snapshot() stands directly in main's body (see parse_snapshot),
+// so once no task or coroutine is running, main's slots are everything
+// the rest of the run can reach. On --resume, what they pointed at is
+// rebuilt and belongs to main's region again.
+static const char *snapshot(Vm *vm, int ip, Value *slots, const char *types) {
+    pthread_mutex_lock(&tasks.lock);
+    int running = tasks.running;
+    pthread_mutex_unlock(&tasks.lock);
+    if (running || loop.live) return "pypstdio.snapshot() cannot save running tasks or coroutines";
+    const char *err = heap_flush_writers(&vm->heap);
+    if (err) return err;
+    fflush(stdout);
+    err = snapshot_save(interpiler_options.snapshot_path, vm->program, ip, slots, types);
+    if (!err) printf("Snapshot saved: %s\n", interpiler_options.snapshot_path);
+    return err;
+}
+
+// Runs main on a fresh stack, or from where `resumed` left it, and frees
+// everything it allocated.
+static int execute(Program *program, Snapshot *resumed) {
+    if (!ffi_bind(program)) return 1;
+    Vm vm;
+    memset(&vm, 0, sizeof(vm));
+    vm.program = program;
+    vm.out = stdout;
+    if (!vm_alloc(&vm, FRAMES_MAX, VALUE_STACK_MAX)) {
+        fprintf(stderr, "Runtime error: out of memory\n");
+        ffi_release();
+        free(vm.frames);
+        free(vm.stack);
+        return 1;
+    }
+    Function *main_fn = &program->functions[program->main_index];
+    memset(vm.stack, 0, sizeof(Value) * main_fn->local_count);
+
+    int status;
+    if (resumed) {
+        memcpy(vm.stack, resumed->slots, sizeof(Value) * resumed->slot_count);
+        for (int i = 0; i < resumed->object_count; i++) {
+            heap_track(&vm.heap, resumed->objects[i].type, resumed->objects[i].ptr, SCOPE_ESCAPES);
+        }
+        Frame *frame = &vm.frames[0];
+        frame->fn = main_fn;
+        frame->ip = resumed->ip;
+        frame->mark = 0;
+        frame->slots = vm.stack;
+        frame->arena_mark = NULL;
+        vm.resume_frame = frame;
+        vm.resume_sp = vm.stack + main_fn->local_count;
+        status = vm_run(&vm, NULL);
+    } else {
+        status = vm_run(&vm, main_fn);
+    }
+    if (!status) status = loop_run();
+    loop_discard();
+    if (status) channel_abort();
+    if (tasks_wait()) status = 1;
+    vm_end_line_output(&vm);
+    // writers still open are closed here; one that fails fails the run
+    const char *err = tasks_release();
+    channel_release();
+    memo_release();
+    ffi_release();
+
+    const char *main_err = heap_free(&vm.heap);
+    if (!err) err = main_err;
+    if (err) {
+        fflush(stdout);
+        fprintf(stderr, "Runtime error: %s\n", err);
+        status = 1;
+    }
+    arena_release(&vm.arena);
+    input_release();
+    free(vm.stack);
+    free(vm.frames);
+    return status;
+}
+
+// Runs a linked program with the --time and --stats reports, then frees it.
+static int run_linked(Program *program, Snapshot *resumed) {
+    printf("%s function: %s\n", resumed ? "Resuming" : "Running", program->functions[program->main_index].name);
+
+    if (interpiler_options.show_stats) memo_stats = calloc((size_t)program->function_count, sizeof(MemoStats));
+
+    struct timespec start, end;
+    timespec_get(&start, TIME_UTC);
+    int status = execute(program, resumed);
+    timespec_get(&end, TIME_UTC);
+    if (interpiler_options.show_time) {
+        double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        fflush(stdout);
+        fprintf(stderr, "Run time: %.3f ms\n", ms);
+    }
+    if (memo_stats) {
+        fflush(stdout);
+        for (int f = 0; f < program->function_count; f++) {
+            if (!program->functions[f].memo_size) continue;
+            fprintf(stderr, "Memo %s: %lld hits, %lld misses, %lld evicted\n", program->functions[f].name,
+                    (long long)memo_stats[f].hits, (long long)memo_stats[f].misses,
+                    (long long)memo_stats[f].evictions);
+        }
+        free(memo_stats);
+        memo_stats = NULL;
+    }
+    free_program(program);
+    return status;
+}
+
 // -----------------------------
 // Entry points
 // -----------------------------
-void run_program(ASTNode *root) {
+int run_program(ASTNode *root) {
     if (!root) {
         fprintf(stderr, "No AST to run.\n");
-        return;
+        return 1;
     }
 
-    if (root->type == AST_FUNCTION) {
-        printf("Running function: %s\n", root->value);
-        execute_node(root);
-    } else {
-        fprintf(stderr, "Top-level AST is not a function.\n");
+    if (root->type != AST_PROGRAM) {
+        fprintf(stderr, "Top-level AST is not a program.\n");
+        return 1;
+    }
+    run_passes(root);
+    if (interpiler_options.show_passes) report_passes();
+    Program *program = compile_program(root);
+    if (!modules_link(program)) {
+        free_program(program);
+        return 1;
+    }
+    if (!interpiler_options.quiet) {
+        printf("Bytecode:\n");
+        print_program(program);
+    }
+    return run_linked(program, NULL);
+}
+
+int resume_program(const char *image_path) {
+    Snapshot image;
+    if (!snapshot_load(image_path, &image)) return 1;
+    if (!interpiler_options.quiet) {
+        printf("Bytecode:\n");
+        print_program(image.program);
     }
+    int status = run_linked(image.program, &image);
+    snapshot_release(&image);
+    return status;
 }
 
 void interpret(ASTNode *root) {
@@ -2,8 +2,36 @@
 #define INTERPILER_H
 
 #include "parser.h"
+#include "compiler.h"
 
-void run_program(ASTNode *root);
+// Command-line switches that affect how programs are run
+typedef struct {
+    int quiet;       // no token / AST / bytecode dumps
+    int show_time;   // report the run time of the program
+    int show_stats;  // report @memo hits and misses
+    int opt_level;   // -O0 .. -O2: which optimization passes run (see passes.h)
+    int show_passes; // report each pass's changes and time
+    const char *snapshot_path;  // --snapshot: where pypstdio.snapshot() saves the run
+} InterpilerOptions;
+
+extern InterpilerOptions interpiler_options;
+
+// Compiles and runs a parsed program. Returns the exit status: 1 after a
+// compile, link or runtime error.
+int run_program(ASTNode *root);
 void interpret(ASTNode *root);
+// --resume: carries on with the run saved in a snapshot image (see
+// snapshot.h). Returns the exit status.
+int resume_program(const char *image_path);
+
+// pypstdio.task.wait (see builtins.c): waits for every spawned task
+const char *native_task_wait(Value *args, Value *result);
+// pypstdio.loop.run: runs this thread's coroutines until all have finished
+const char *native_loop_run(Value *args, Value *result);
+// pypstdio.iter: pulling values from generators and iterator combinators
+const char *native_iter_next(Value *args, Value *result);
+const char *native_iter_next_or(Value *args, Value *result);
+const char *native_iter_more(Value *args, Value *result);
+const char *native_iter_chunk(Value *args, Value *result);
 
 #endif
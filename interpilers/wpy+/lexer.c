@@ -1,8 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include "lexer.h"
+#include "utf8.h"
 
 // -----------------------------
 // Lexer state
@@ -10,6 +10,11 @@
 static const char *source = NULL;
 static int position = 0;
 static int line = 1;
+static int line_start = 0;    // position where the current line begins
+static int token_start = 0;   // position of the token being lexed
+
+void (*lex_line_start)(int line) = NULL;
+void (*lex_report)(int line, int column, const char *message) = NULL;
 
 // -----------------------------
 // Internal helpers
@@ -30,6 +35,27 @@ static char advance(void) {
     return is_at_end() ? '\0' : source[position++];
 }
 
+// ASCII classes. Bytes from 0x80 up start or continue UTF-8 sequences and
+// are classified by code point (see identifier_length).
+static int is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static int is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static int is_alpha(char c) {
+    return (unsigned char)((c | 0x20) - 'a') < 26;
+}
+
+// Consumes the '\n' under the cursor.
+static void newline(void) {
+    advance();
+    line++;
+    line_start = position;
+}
+
 static char *strdup_local(const char *s) {
     size_t n = strlen(s);
     char *result = malloc(n+1);
@@ -47,14 +73,20 @@ static char *strndup_local(const char *s, size_t n) {
     return result;
 }
 
-static Token make_token(TokenType type, const char *lexeme) {
+// The token takes `lexeme`, which must come from malloc.
+static Token take_token(TokenType type, char *lexeme) {
     Token t;
     t.type = type;
-    t.lexeme = strdup_local(lexeme);
+    t.lexeme = lexeme;
     t.line = line;
+    t.column = token_start >= line_start ? token_start - line_start : 0;
     return t;
 }
 
+static Token make_token(TokenType type, const char *lexeme) {
+    return take_token(type, strdup_local(lexeme));
+}
+
 // -----------------------------
 // Public API
 // -----------------------------
@@ -62,6 +94,7 @@ void set_source(const char *src) {
     source = src;
     position = 0;
     line = 1;
+    line_start = 0;
 
     // Strip UTF-8 BOM if present
     if (source &&
@@ -69,9 +102,19 @@ void set_source(const char *src) {
         (unsigned char)source[1] == 0xBB &&
         (unsigned char)source[2] == 0xBF) {
         position = 3;
+        line_start = 3;
     }
 }
 
+void set_source_at(const char *src, int offset, int first_line) {
+    set_source(src);
+    if (offset > position) {
+        position = offset;
+        line_start = offset;
+    }
+    line = first_line;
+}
+
 char *load_file(const char *path) {
     FILE *fp = fopen(path, "rb");
     if (!fp) { perror("open"); exit(1); }
@@ -79,21 +122,86 @@ char *load_file(const char *path) {
     long size = ftell(fp);
     rewind(fp);
     char *buf = malloc(size+1);
-    fread(buf,1,size,fp);
+    size = (long)fread(buf,1,size,fp);
     buf[size] = '\0';
     fclose(fp);
+    if (!check_encoding(path, buf, (size_t)size)) {
+        free(buf);
+        return NULL;
+    }
     return buf;
 }
 
+int check_encoding(const char *path, const char *src, size_t size) {
+    size_t bad = utf8_validate(src, size);
+    if (bad == size) return 1;
+    int bad_line = 1;
+    size_t bad_line_start = 0;
+    for (size_t i = 0; i < bad; i++) {
+        if (src[i] == '\n') {
+            bad_line++;
+            bad_line_start = i + 1;
+        }
+    }
+    fprintf(stderr, "Encoding error (line %d, column %d): invalid UTF-8 byte 0x%02X in %s\n",
+            bad_line, (int)(bad - bad_line_start) + 1, (unsigned char)src[bad], path);
+    return 0;
+}
+
+int identifier_length(const char *s) {
+    int n = 0;
+    for (;;) {
+        char c = s[n];
+        if ((unsigned char)c < 0x80) {
+            if (is_alpha(c) || c == '_' || (n > 0 && is_digit(c))) {
+                n++;
+                continue;
+            }
+            return n;
+        }
+        int length;
+        int cp = utf8_decode(s + n, &length);
+        if (n == 0 ? !unicode_id_start(cp) : !unicode_id_continue(cp)) return n;
+        n += length;
+    }
+}
+
+// -----------------------------
+// Escapes: \n \t \r \0 \\ \" \'
+// -----------------------------
+static char escape_char(char c) {
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case '0': return '\0';
+        default:  return c;
+    }
+}
+
+static void unescape(char *s) {
+    char *out = s;
+    for (; *s; s++) {
+        if (*s == '\\' && s[1]) *out++ = escape_char(*++s);
+        else *out++ = *s;
+    }
+    *out = '\0';
+}
+
 // -----------------------------
 // Tokenizer
 // -----------------------------
 Token next_token(void) {
     // Skip whitespace
-    while (!is_at_end() && isspace(peek())) {
-        if (peek() == '\n') line++;
-        advance();
+    while (!is_at_end() && is_space(peek())) {
+        if (peek() != '\n') {
+            advance();
+            continue;
+        }
+        newline();
+        if (lex_line_start) lex_line_start(line);
     }
+    token_start = position;
     if (is_at_end()) return make_token(TOKEN_EOF, "EOF");
 
     char c = advance();
@@ -104,69 +212,93 @@ Token next_token(void) {
             while (peek() != '\n' && !is_at_end()) advance();
             return next_token();
         } else if (peek() == '*') {
+            int start_line = line, start_column = token_start - line_start;
             advance();
             while (!(peek() == '*' && peek_next() == '/') && !is_at_end()) {
-                if (peek() == '\n') line++;
+                if (peek() == '\n') newline();
+                else advance();
+            }
+            if (!is_at_end()) {
+                advance();
                 advance();
+                return next_token();
             }
-            if (!is_at_end()) { advance(); advance(); }
-            return next_token();
+            // reported where it starts, as a "?" token like an unknown character
+            if (lex_report) lex_report(start_line, start_column, "unterminated comment");
+            else fprintf(stderr, "Unterminated comment at line %d\n", start_line);
+            Token t = make_token(TOKEN_IDENTIFIER, "?/*");
+            t.line = start_line;
+            t.column = start_column;
+            return t;
         }
         return make_token(TOKEN_SLASH, "/");
     }
 
     // Identifiers / keywords / types
-    if (isalpha(c) || c == '_') {
-        int start = position - 1;
-        while (isalnum(peek()) || peek() == '_') advance();
-        int len = position - start;
-        char *lex = strndup_local(source + start, len);
+    int word = is_alpha(c) || c == '_' || (unsigned char)c >= 0x80 ? identifier_length(source + token_start) : 0;
+    if (word) {
+        position = token_start + word;
+        char *lex = strndup_local(source + token_start, word);
 
         // keywords
-        if (strcmp(lex,"func")==0) return make_token(TOKEN_FUNC,lex);
-        if (strcmp(lex,"return")==0) return make_token(TOKEN_RETURN,lex);
-        if (strcmp(lex,"if")==0) return make_token(TOKEN_IF,lex);
-        if (strcmp(lex,"else")==0) return make_token(TOKEN_ELSE,lex);
-        if (strcmp(lex,"for")==0) return make_token(TOKEN_FOR,lex);
-        if (strcmp(lex,"while")==0) return make_token(TOKEN_WHILE,lex);
-        if (strcmp(lex,"use")==0) return make_token(TOKEN_USE,lex);
-        if (strcmp(lex,"end")==0) return make_token(TOKEN_END,lex);
+        if (strcmp(lex,"func")==0) return take_token(TOKEN_FUNC,lex);
+        if (strcmp(lex,"return")==0) return take_token(TOKEN_RETURN,lex);
+        if (strcmp(lex,"if")==0) return take_token(TOKEN_IF,lex);
+        if (strcmp(lex,"else")==0) return take_token(TOKEN_ELSE,lex);
+        if (strcmp(lex,"for")==0) return take_token(TOKEN_FOR,lex);
+        if (strcmp(lex,"while")==0) return take_token(TOKEN_WHILE,lex);
+        if (strcmp(lex,"use")==0) return take_token(TOKEN_USE,lex);
+        if (strcmp(lex,"end")==0) return take_token(TOKEN_END,lex);
 
         // types
-        if (strcmp(lex,"int")==0) return make_token(TOKEN_TYPE_INT,lex);
-        if (strcmp(lex,"char")==0) return make_token(TOKEN_TYPE_CHAR,lex);
-        if (strcmp(lex,"string")==0) return make_token(TOKEN_TYPE_CHAR_STRING,lex);
-        if (strcmp(lex,"float")==0) return make_token(TOKEN_TYPE_FLOAT,lex);
-        if (strcmp(lex,"bool")==0) return make_token(TOKEN_TYPE_BOOL,lex);
+        if (strcmp(lex,"int")==0) return take_token(TOKEN_TYPE_INT,lex);
+        if (strcmp(lex,"char")==0) return take_token(TOKEN_TYPE_CHAR,lex);
+        if (strcmp(lex,"string")==0) return take_token(TOKEN_TYPE_CHAR_STRING,lex);
+        if (strcmp(lex,"float")==0) return take_token(TOKEN_TYPE_FLOAT,lex);
+        if (strcmp(lex,"bool")==0) return take_token(TOKEN_TYPE_BOOL,lex);
 
-        return make_token(TOKEN_IDENTIFIER, lex);
+        return take_token(TOKEN_IDENTIFIER, lex);
     }
 
-    // Numbers
-    if (isdigit(c)) {
+    // Numbers (a fraction or an exponent makes it a float literal)
+    if (is_digit(c)) {
         int start = position - 1;
-        while (isdigit(peek())) advance();
+        while (is_digit(peek())) advance();
+        if (peek() == '.' && is_digit(peek_next())) {
+            advance();
+            while (is_digit(peek())) advance();
+        }
+        if ((peek() == 'e' || peek() == 'E') &&
+            (is_digit(peek_next()) ||
+             ((peek_next() == '+' || peek_next() == '-') && is_digit(source[position + 2])))) {
+            advance();
+            if (peek() == '+' || peek() == '-') advance();
+            while (is_digit(peek())) advance();
+        }
         int len = position - start;
         char *lex = strndup_local(source + start, len);
-        return make_token(TOKEN_NUMBER, lex);
+        return take_token(TOKEN_NUMBER, lex);
     }
 
     // Strings
     if (c == '"') {
         int start = position;
         while (peek() != '"' && !is_at_end()) {
-            if (peek() == '\n') line++;
-            advance();
+            if (peek() == '\\' && peek_next() != '\0') advance();
+            if (peek() == '\n') newline();
+            else advance();
         }
         int len = position - start;
         char *lex = strndup_local(source + start, len);
+        unescape(lex);
         if (peek() == '"') advance();
-        return make_token(TOKEN_STRING, lex);
+        return take_token(TOKEN_STRING, lex);
     }
 
     // Character literal
     if (c == '\'') {
         char ch = advance();
+        if (ch == '\\' && !is_at_end()) ch = escape_char(advance());
         char buf[2] = { ch, '\0' };
         if (peek() == '\'') advance(); // consume closing '
         return make_token(TOKEN_CHAR_LITERAL, buf);
@@ -175,33 +307,45 @@ Token next_token(void) {
     // Preprocessor directives
     if (c == '#') {
         int start = position;
-        while (isalpha(peek())) advance();
+        while (is_alpha(peek())) advance();
         int len = position - start;
         char *word = strndup_local(source + start, len);
 
         if (word && strcmp(word, "include") == 0) {
-            while (isspace(peek())) advance();
+            while (is_space(peek())) {
+                if (peek() == '\n') newline();
+                else advance();
+            }
             if (peek() == '<') {
                 advance();
                 int fname_start = position;
-                while (!is_at_end() && peek() != '>') advance();
+                while (!is_at_end() && peek() != '>') {
+                if (peek() == '\n') newline();
+                else advance();
+            }
                 int fname_len = position - fname_start;
                 char *fname = strndup_local(source + fname_start, fname_len);
                 if (peek() == '>') advance();
-                return make_token(TOKEN_INCLUDE, fname ? fname : "");
+                free(word);
+                return take_token(TOKEN_INCLUDE, fname);
             }
         }
 
         if (peek() == '<') {
             advance();
             int fname_start = position;
-            while (!is_at_end() && peek() != '>') advance();
+            while (!is_at_end() && peek() != '>') {
+                if (peek() == '\n') newline();
+                else advance();
+            }
             int fname_len = position - fname_start;
             char *fname = strndup_local(source + fname_start, fname_len);
             if (peek() == '>') advance();
-            return make_token(TOKEN_INCLUDE, fname ? fname : "");
+            free(word);
+            return take_token(TOKEN_INCLUDE, fname);
         }
 
+        free(word);
         while (!is_at_end() && peek() != '\n') advance();
         return next_token();
     }
@@ -212,12 +356,19 @@ Token next_token(void) {
         case ')': return make_token(TOKEN_RPAREN,")");
         case '{': return make_token(TOKEN_LBRACE,"{");
         case '}': return make_token(TOKEN_RBRACE,"}");
+        case '[': return make_token(TOKEN_LBRACKET,"[");
+        case ']': return make_token(TOKEN_RBRACKET,"]");
         case ';': return make_token(TOKEN_SEMICOLON,";");
         case '+': return make_token(TOKEN_PLUS,"+");
         case '-': return make_token(TOKEN_MINUS,"-");
         case '*': return make_token(TOKEN_STAR,"*");
-        case '<': return make_token(TOKEN_LT,"<");
-        case '>': return make_token(TOKEN_GT,">");
+        case '%': return make_token(TOKEN_PERCENT,"%");
+        case '<':
+            if (peek() == '=') { advance(); return make_token(TOKEN_LTEQ,"<="); }
+            return make_token(TOKEN_LT,"<");
+        case '>':
+            if (peek() == '=') { advance(); return make_token(TOKEN_GTEQ,">="); }
+            return make_token(TOKEN_GT,">");
         case '=':
             if (peek() == '=') { advance(); return make_token(TOKEN_EQEQ,"=="); }
             return make_token(TOKEN_EQUAL,"=");
@@ -226,10 +377,17 @@ Token next_token(void) {
             break;
         case '.': return make_token(TOKEN_DOT,".");
         case ',': return make_token(TOKEN_COMMA,",");
+        case '@': return make_token(TOKEN_AT,"@");
     }
 
-    // Unknown
-    fprintf(stderr,"Unexpected char '%c' at line %d\n", c, line);
+    // Unknown (a character outside ASCII is skipped whole)
+    int length = 1;
+    if ((unsigned char)c >= 0x80) {
+        utf8_decode(source + token_start, &length);
+        position = token_start + length;
+    }
+    if (lex_report) lex_report(line, token_start - line_start, "unexpected character");
+    else fprintf(stderr,"Unexpected char '%.*s' at line %d\n", length, source + token_start, line);
     return make_token(TOKEN_IDENTIFIER, "?");
 }
 
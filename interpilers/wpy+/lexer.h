@@ -2,11 +2,29 @@
 #define LEXER_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "tokens.h"
 
+// Reads a source file; NULL after reporting it is not valid UTF-8.
 char *load_file(const char *path);
+// Reports the first byte of src that is not valid UTF-8. 1 if there is none.
+int check_encoding(const char *path, const char *src, size_t size);
 void set_source(const char *src);
 Token next_token(void);
 int lex_line(const char *line, Token *tokens);
+// Bytes of the identifier at s: a letter or '_' (XID_Start outside ASCII),
+// then letters, digits and '_' (XID_Continue). 0 if none starts there.
+int identifier_length(const char *s);
+
+// -----------------------------
+// Incremental lexing (see lsp.c)
+// -----------------------------
+// Resumes lexing src at `offset`, the start of line `first_line`.
+void set_source_at(const char *src, int offset, int first_line);
+// Called each time the lexer reaches the start of a line outside any
+// comment or string: a point it could be restarted from.
+extern void (*lex_line_start)(int line);
+// When set, lexing errors go here instead of stderr.
+extern void (*lex_report)(int line, int column, const char *message);
 
 #endif
@@ -0,0 +1,1229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+#include "lsp.h"
+#include "lexer.h"
+#include "parser.h"
+#include "utf8.h"
+#include "builtins.h"
+#include "modules.h"
+
+// -----------------------------
+// Language server
+// -----------------------------
+// Each open document keeps its text, where its lines start, and its token
+// stream. An edit re-lexes from the start of the first damaged line and
+// stops as soon as the lexer reaches, past the damage, the start of a line
+// it could already restart from before the edit (outside any comment or
+// string): from there on the old tokens are kept, moved by the number of
+// lines the edit added.
+//
+// Functions are parsed one at a time against the signatures collected by
+// parse_begin(). After an edit only the functions whose tokens or lines it
+// touched are parsed again; the others keep their AST and error, moved
+// down or up. An edit to the #include/use header or to a signature, or one
+// that adds or removes a function, parses the whole file again.
+
+// -----------------------------
+// JSON
+// -----------------------------
+typedef enum { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT } JsonType;
+
+typedef struct Json {
+    JsonType type;
+    char *key;            // member name, inside an object
+    char *string;         // JSON_STRING, decoded to UTF-8
+    double number;        // JSON_NUMBER; JSON_BOOL: 0 or 1
+    struct Json *items;   // JSON_ARRAY elements, JSON_OBJECT members
+    int count;
+    const char *raw;      // the value as written in the message
+    int raw_length;
+} Json;
+
+static void json_free(Json *value) {
+    free(value->key);
+    free(value->string);
+    for (int i = 0; i < value->count; i++) json_free(&value->items[i]);
+    free(value->items);
+}
+
+static void skip_space(const char **p) {
+    while (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r') (*p)++;
+}
+
+static int hex4(const char *p, unsigned *code) {
+    *code = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                    c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0) return 0;
+        *code = *code * 16 + (unsigned)digit;
+    }
+    return 1;
+}
+
+static char *put_utf8(char *out, unsigned code) {
+    if (code < 0x80) {
+        *out++ = (char)code;
+    } else if (code < 0x800) {
+        *out++ = (char)(0xC0 | (code >> 6));
+        *out++ = (char)(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        *out++ = (char)(0xE0 | (code >> 12));
+        *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (code & 0x3F));
+    } else {
+        *out++ = (char)(0xF0 | (code >> 18));
+        *out++ = (char)(0x80 | ((code >> 12) & 0x3F));
+        *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (code & 0x3F));
+    }
+    return out;
+}
+
+// *p is at the opening quote. Decoding never makes a string longer, so
+// the result is allocated from the length of its escaped form.
+static char *json_string(const char **p) {
+    const char *end = *p + 1;
+    while (*end && *end != '"') end += *end == '\\' && end[1] ? 2 : 1;
+    if (*end != '"') return NULL;
+
+    char *result = malloc((size_t)(end - *p));
+    char *out = result;
+    const char *in = *p + 1;
+    while (in < end) {
+        if (*in != '\\') {
+            *out++ = *in++;
+            continue;
+        }
+        in++;
+        switch (*in++) {
+            case 'n': *out++ = '\n'; break;
+            case 't': *out++ = '\t'; break;
+            case 'r': *out++ = '\r'; break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'u': {
+                unsigned code, low;
+                if (in + 4 > end || !hex4(in, &code)) {
+                    free(result);
+                    return NULL;
+                }
+                in += 4;
+                if (code >= 0xD800 && code < 0xDC00 && in + 6 <= end && in[0] == '\\' && in[1] == 'u' &&
+                    hex4(in + 2, &low) && low >= 0xDC00 && low < 0xE000) {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    in += 6;
+                }
+                out = put_utf8(out, code);
+                break;
+            }
+            default: *out++ = in[-1]; break;   // \" \\ \/
+        }
+    }
+    *out = '\0';
+    *p = end + 1;
+    return result;
+}
+
+static int json_parse(const char **p, Json *value, int depth) {
+    memset(value, 0, sizeof(*value));
+    skip_space(p);
+    value->raw = *p;
+    if (depth > 64) return 0;
+
+    char c = **p;
+    if (c == '{' || c == '[') {
+        char close = c == '{' ? '}' : ']';
+        value->type = c == '{' ? JSON_OBJECT : JSON_ARRAY;
+        (*p)++;
+        skip_space(p);
+        if (**p == close) {
+            (*p)++;
+        } else {
+            for (;;) {
+                char *key = NULL;
+                if (value->type == JSON_OBJECT) {
+                    skip_space(p);
+                    if (**p != '"' || !(key = json_string(p))) return 0;
+                    skip_space(p);
+                    if (**p != ':') {
+                        free(key);
+                        return 0;
+                    }
+                    (*p)++;
+                }
+                Json item;
+                int ok = json_parse(p, &item, depth + 1);
+                item.key = key;
+                value->items = realloc(value->items, sizeof(Json) * (value->count + 1));
+                value->items[value->count++] = item;
+                if (!ok) return 0;
+                skip_space(p);
+                if (**p == ',') {
+                    (*p)++;
+                    continue;
+                }
+                if (**p != close) return 0;
+                (*p)++;
+                break;
+            }
+        }
+    } else if (c == '"') {
+        value->type = JSON_STRING;
+        if (!(value->string = json_string(p))) return 0;
+    } else if (strncmp(*p, "true", 4) == 0 || strncmp(*p, "false", 5) == 0) {
+        value->type = JSON_BOOL;
+        value->number = c == 't';
+        *p += c == 't' ? 4 : 5;
+    } else if (strncmp(*p, "null", 4) == 0) {
+        *p += 4;
+    } else {
+        char *end;
+        value->type = JSON_NUMBER;
+        value->number = strtod(*p, &end);
+        if (end == *p) return 0;
+        *p = end;
+    }
+    value->raw_length = (int)(*p - value->raw);
+    return 1;
+}
+
+static Json *member(Json *object, const char *key) {
+    if (!object || object->type != JSON_OBJECT) return NULL;
+    for (int i = 0; i < object->count; i++) {
+        if (strcmp(object->items[i].key, key) == 0) return &object->items[i];
+    }
+    return NULL;
+}
+
+static const char *string_of(Json *value) {
+    return value && value->type == JSON_STRING ? value->string : NULL;
+}
+
+static int int_of(Json *value) {
+    return value && value->type == JSON_NUMBER ? (int)value->number : 0;
+}
+
+// -----------------------------
+// Output
+// -----------------------------
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    int failed;      // a part could not be formatted (see send)
+    Json *id;        // of the request this is the response to, if any
+} Out;
+
+static void out_raw(Out *out, const char *text, size_t n) {
+    if (out->length + n + 1 > out->capacity) {
+        out->capacity = (out->length + n + 1) * 2;
+        out->data = realloc(out->data, out->capacity);
+    }
+    memcpy(out->data + out->length, text, n);
+    out->length += n;
+    out->data[out->length] = '\0';
+}
+
+static void out_text(Out *out, const char *text) {
+    out_raw(out, text, strlen(text));
+}
+
+static void out_format(Out *out, const char *format, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (n < 0) {
+        out->failed = 1;
+        return;
+    }
+    if (n < (int)sizeof(text)) {
+        out_raw(out, text, (size_t)n);
+        return;
+    }
+    char *long_text = malloc((size_t)n + 1);
+    if (!long_text) {
+        out->failed = 1;
+        return;
+    }
+    va_start(args, format);
+    vsnprintf(long_text, (size_t)n + 1, format, args);
+    va_end(args);
+    out_raw(out, long_text, (size_t)n);
+    free(long_text);
+}
+
+static void out_string(Out *out, const char *text) {
+    out_text(out, "\"");
+    const char *run = text;
+    for (const char *p = text; *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        out_raw(out, run, (size_t)(p - run));
+        if (c == '"' || c == '\\') {
+            char escaped[2] = { '\\', (char)c };
+            out_raw(out, escaped, 2);
+        } else if (c == '\n') {
+            out_text(out, "\\n");
+        } else {
+            out_format(out, "\\u%04x", c);
+        }
+        run = p + 1;
+    }
+    out_raw(out, run, strlen(run));
+    out_text(out, "\"");
+}
+
+// Writes `out` as one message and empties it. One that could not be
+// formatted is not sent: a notification is dropped, and a response is
+// replaced by an internal error.
+static void send(Out *out) {
+    if (out->failed) {
+        out->length = 0;
+        out->failed = 0;
+        if (!out->id) return;
+        out_text(out, "{\"jsonrpc\":\"2.0\",\"id\":");
+        out_raw(out, out->id->raw, (size_t)out->id->raw_length);
+        out_text(out, ",\"error\":{\"code\":-32603,\"message\":\"the response could not be formatted\"}}");
+    }
+    printf("Content-Length: %lu\r\n\r\n", (unsigned long)out->length);
+    fwrite(out->data, 1, out->length, stdout);
+    fflush(stdout);
+    out->length = 0;
+    out->id = NULL;
+}
+
+// The body of the next message, or NULL once stdin is closed.
+static char *read_message(void) {
+    char header[256];
+    long length = -1;
+    for (;;) {
+        if (!fgets(header, sizeof(header), stdin)) return NULL;
+        if (strncmp(header, "Content-Length:", 15) == 0) length = strtol(header + 15, NULL, 10);
+        if (header[0] != '\r' && header[0] != '\n') continue;
+        if (length >= 0) break;
+    }
+    char *body = malloc((size_t)length + 1);
+    if (fread(body, 1, (size_t)length, stdin) != (size_t)length) {
+        free(body);
+        return NULL;
+    }
+    body[length] = '\0';
+    return body;
+}
+
+// -----------------------------
+// Documents
+// -----------------------------
+typedef struct {
+    int line;         // as the lexer counts, from 1; 0: no error
+    int column;       // byte offset in the line; -1: the whole line
+    char *message;
+} Diagnostic;
+
+typedef struct {
+    int first, end;   // tokens[first, end): from `@memo`/`async`/`func` to the closing '}'
+    int line;         // line of tokens[first] when it was parsed
+    char *key;        // the tokens up to '{', to notice a changed signature
+    ASTNode *ast;     // NULL after an error
+    Diagnostic error;
+} FunctionSpan;
+
+typedef struct {
+    char *uri;
+    char *text;
+    int length, capacity;
+    int *lines;                // byte offset where each line starts
+    unsigned char *clean;      // per line: lexing can restart at its start
+    int line_count, line_capacity;
+    Token *tokens;             // ends with TOKEN_EOF
+    int token_count, token_capacity;
+    int unknown;               // "?" tokens: characters the lexer rejected
+    int header_end;            // first token after the #include and use lines
+    char *header_key;
+    Diagnostic header_error;   // from parse_begin()
+    int stray;                 // a token outside every function, or -1
+    FunctionSpan *functions;
+    int function_count;
+    Diagnostic check_error;    // from parse_check()
+} Document;
+
+// What the last edit re-lexed: tokens[first_token, end_token) are new, and
+// lines first_line..last_line (from 1) were edited. Tokens after them
+// moved by `shift` lines.
+typedef struct {
+    int first_token, end_token;
+    int first_line, last_line;
+    int shift;
+} Damage;
+
+static Document **documents = NULL;
+static int document_count = 0;
+static Document *parsed = NULL;         // whose header and signatures the parser holds
+static Diagnostic *reporting = NULL;    // where parser errors go
+
+static char *copy_text(const char *text, size_t n) {
+    char *result = malloc(n + 1);
+    memcpy(result, text, n);
+    result[n] = '\0';
+    return result;
+}
+
+static void diagnostic_clear(Diagnostic *d) {
+    free(d->message);
+    d->message = NULL;
+    d->line = 0;
+}
+
+static void report(int line, int column, const char *message) {
+    if (!reporting || reporting->message) return;
+    reporting->line = line;
+    reporting->column = column;
+    reporting->message = copy_text(message, strlen(message));
+}
+
+// Unknown characters come back as "?" identifiers, and an unterminated
+// comment as "?/*", and are reported from the token stream, so that
+// re-lexing part of a file does not lose them.
+static void ignore_lex_error(int line, int column, const char *message) {
+    (void)line;
+    (void)column;
+    (void)message;
+}
+
+static int is_unknown(Token *t) {
+    return t->type == TOKEN_IDENTIFIER && t->lexeme[0] == '?';
+}
+
+static Document *find_document(const char *uri) {
+    for (int i = 0; i < document_count; i++) {
+        if (strcmp(documents[i]->uri, uri) == 0) return documents[i];
+    }
+    return NULL;
+}
+
+// file:///home/x/a%20b.pyp -> /home/x/a b.pyp (C:/x/a.pyp on Windows)
+static char *uri_path(const char *uri) {
+    if (strncmp(uri, "file://", 7) == 0) uri += 7;
+    char *path = malloc(strlen(uri) + 1), *out = path;
+    unsigned code;
+    for (const char *p = uri; *p; p++) {
+        char hex[5] = { '0', '0', p[1], p[1] ? p[2] : '\0', '\0' };
+        if (*p == '%' && p[1] && p[2] && hex4(hex, &code)) {
+            *out++ = (char)code;
+            p += 2;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+    if (path[0] == '/' && path[1] && path[2] == ':') memmove(path, path + 1, strlen(path));
+    return path;
+}
+
+// Byte offset of an LSP position, whose character counts UTF-16 units.
+static int offset_at(Document *doc, int line, int character) {
+    if (line < 0) return 0;
+    if (line >= doc->line_count) return doc->length;
+    int offset = doc->lines[line];
+    for (int units = 0; units < character && offset < doc->length && doc->text[offset] != '\n';) {
+        unsigned char c = (unsigned char)doc->text[offset];
+        int bytes = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        units += bytes == 4 ? 2 : 1;
+        offset += bytes;
+    }
+    return offset < doc->length ? offset : doc->length;
+}
+
+// UTF-16 units before byte `column` of a line (0-based).
+static int units_at(Document *doc, int line, int column) {
+    int start = doc->lines[line], units = 0;
+    for (int offset = start; offset < start + column && offset < doc->length && doc->text[offset] != '\n';) {
+        unsigned char c = (unsigned char)doc->text[offset];
+        int bytes = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        units += bytes == 4 ? 2 : 1;
+        offset += bytes;
+    }
+    return units;
+}
+
+static int line_length(Document *doc, int line) {
+    int end = line + 1 < doc->line_count ? doc->lines[line + 1] - 1 : doc->length;
+    if (end > doc->lines[line] && doc->text[end - 1] == '\r') end--;
+    return end - doc->lines[line];
+}
+
+// Bytes of the word at `column` of a line (0-based), at least 1.
+static int word_length(Document *doc, int line, int column) {
+    const char *p = doc->text + doc->lines[line] + column;
+    int n = identifier_length(p);
+    if (!n) utf8_decode(p, &n);
+    return n;
+}
+
+static void ensure_lines(Document *doc, int count) {
+    if (count <= doc->line_capacity) return;
+    doc->line_capacity = count * 2;
+    doc->lines = realloc(doc->lines, sizeof(int) * doc->line_capacity);
+    doc->clean = realloc(doc->clean, doc->line_capacity);
+}
+
+static void ensure_tokens(Document *doc, int count) {
+    if (count <= doc->token_capacity) return;
+    doc->token_capacity = count * 2;
+    doc->tokens = realloc(doc->tokens, sizeof(Token) * doc->token_capacity);
+}
+
+// First token on or after `line` (from 1).
+static int first_token_at(Document *doc, int line) {
+    int low = 0, high = doc->token_count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (doc->tokens[mid].line < line) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// -----------------------------
+// Incremental lexing
+// -----------------------------
+static struct {
+    Document *doc;
+    int damage_end;   // last edited line (from 0); convergence only after it
+    int reached;      // last line whose start the lexer has reached
+    int converged;    // line where the old tokens take over, or -1
+} relex;
+
+static void on_line_start(int line) {
+    int index = line - 1;
+    if (relex.converged >= 0 || index >= relex.doc->line_count) return;
+    for (int i = relex.reached + 1; i < index; i++) relex.doc->clean[i] = 0;
+    relex.reached = index;
+    if (index > relex.damage_end && relex.doc->clean[index]) {
+        relex.converged = index;
+        return;
+    }
+    relex.doc->clean[index] = 1;
+}
+
+// Lexes again from the last restart point at or before line `first`
+// (from 0), past line `last`, until the old tokens can take over. The
+// lines after `last` held the old tokens of lines `shift` lines up.
+static Damage lex_range(Document *doc, int first, int last, int shift) {
+    int restart = first;
+    while (restart > 0 && !doc->clean[restart]) restart--;
+    int old_first = first_token_at(doc, restart + 1);
+
+    relex.doc = doc;
+    relex.damage_end = last;
+    relex.reached = restart;
+    relex.converged = -1;
+    lex_line_start = on_line_start;
+    set_source_at(doc->text, doc->lines[restart], restart + 1);
+
+    Token *fresh = NULL;
+    int fresh_count = 0, fresh_capacity = 0;
+    for (;;) {
+        Token t = next_token();
+        if (relex.converged >= 0) {
+            free(t.lexeme);
+            break;
+        }
+        if (fresh_count == fresh_capacity) {
+            fresh_capacity = fresh_capacity ? fresh_capacity * 2 : 64;
+            fresh = realloc(fresh, sizeof(Token) * fresh_capacity);
+        }
+        fresh[fresh_count++] = t;
+        doc->unknown += is_unknown(&t);
+        if (t.type == TOKEN_EOF) break;
+    }
+    lex_line_start = NULL;
+    if (relex.converged < 0) {
+        for (int i = relex.reached + 1; i < doc->line_count; i++) doc->clean[i] = 0;
+    }
+
+    // Splice: old tokens [old_first, old_end) make way for the fresh ones
+    int old_end = relex.converged >= 0 ? first_token_at(doc, relex.converged - shift + 1) : doc->token_count;
+    for (int i = old_first; i < old_end; i++) {
+        doc->unknown -= is_unknown(&doc->tokens[i]);
+        free(doc->tokens[i].lexeme);
+    }
+    int tail = doc->token_count - old_end;
+    ensure_tokens(doc, old_first + fresh_count + tail);
+    memmove(&doc->tokens[old_first + fresh_count], &doc->tokens[old_end], sizeof(Token) * tail);
+    if (fresh_count) memcpy(&doc->tokens[old_first], fresh, sizeof(Token) * fresh_count);
+    doc->token_count = old_first + fresh_count + tail;
+    if (shift) {
+        for (int i = old_first + fresh_count; i < doc->token_count; i++) doc->tokens[i].line += shift;
+    }
+    free(fresh);
+
+    Damage damage = { old_first, old_first + fresh_count, first + 1, last + 1, shift };
+    return damage;
+}
+
+static void set_text(Document *doc, const char *text) {
+    doc->length = (int)strlen(text);
+    if (doc->length + 1 > doc->capacity) {
+        doc->capacity = doc->length + 1;
+        doc->text = realloc(doc->text, doc->capacity);
+    }
+    memcpy(doc->text, text, (size_t)doc->length + 1);
+
+    doc->line_count = 1;
+    for (int i = 0; i < doc->length; i++) doc->line_count += doc->text[i] == '\n';
+    ensure_lines(doc, doc->line_count);
+    doc->lines[0] = 0;
+    for (int i = 0, line = 1; i < doc->length; i++) {
+        if (doc->text[i] == '\n') doc->lines[line++] = i + 1;
+    }
+    memset(doc->clean, 0, (size_t)doc->line_count);
+    doc->clean[0] = 1;
+
+    for (int i = 0; i < doc->token_count; i++) free(doc->tokens[i].lexeme);
+    doc->token_count = 0;
+    doc->unknown = 0;
+    lex_range(doc, 0, doc->line_count - 1, 0);
+}
+
+// Applies one contentChanges entry. Returns 0 if it replaced the whole text.
+static int apply_change(Document *doc, Json *change, Damage *damage) {
+    const char *insert = string_of(member(change, "text"));
+    Json *range = member(change, "range");
+    if (!insert) insert = "";
+    if (!range) {
+        set_text(doc, insert);
+        return 0;
+    }
+    Json *from = member(range, "start"), *to = member(range, "end");
+    int first = int_of(member(from, "line")), last = int_of(member(to, "line"));
+    if (first >= doc->line_count) first = doc->line_count - 1;
+    if (last >= doc->line_count) last = doc->line_count - 1;
+    int start = offset_at(doc, first, int_of(member(from, "character")));
+    int end = offset_at(doc, last, int_of(member(to, "character")));
+    if (first < 0 || last < first || end < start) return 0;   // parse it all again
+
+    // Text
+    int added = (int)strlen(insert), removed = end - start;
+    if (doc->length - removed + added + 1 > doc->capacity) {
+        doc->capacity = (doc->length - removed + added + 1) * 2;
+        doc->text = realloc(doc->text, doc->capacity);
+    }
+    memmove(doc->text + start + added, doc->text + end, (size_t)(doc->length - end + 1));
+    memcpy(doc->text + start, insert, (size_t)added);
+    doc->length += added - removed;
+
+    // Line starts; the lines after the edit keep their old restart marks
+    int new_lines = 0;
+    for (int i = 0; i < added; i++) new_lines += insert[i] == '\n';
+    int shift = new_lines - (last - first);
+    int after = doc->line_count - last - 1;
+    ensure_lines(doc, doc->line_count + shift);
+    memmove(&doc->lines[first + 1 + new_lines], &doc->lines[last + 1], sizeof(int) * after);
+    memmove(&doc->clean[first + 1 + new_lines], &doc->clean[last + 1], (size_t)after);
+    doc->line_count += shift;
+    for (int i = first + 1 + new_lines; i < doc->line_count; i++) doc->lines[i] += added - removed;
+    for (int i = 0, line = first + 1; i < added; i++) {
+        if (insert[i] != '\n') continue;
+        doc->lines[line] = start + i + 1;
+        doc->clean[line++] = 0;
+    }
+
+    *damage = lex_range(doc, first, first + new_lines, shift);
+    return 1;
+}
+
+// -----------------------------
+// Incremental parsing
+// -----------------------------
+// Tokens [from, to) as one string, or NULL if it could not be built.
+static char *join_tokens(Document *doc, int from, int to) {
+    Out out = { NULL, 0, 0, 0, NULL };
+    out_text(&out, "");
+    for (int i = from; i < to; i++) {
+        const char *lexeme = doc->tokens[i].lexeme ? doc->tokens[i].lexeme : "";
+        out_format(&out, "%d:", doc->tokens[i].type);
+        out_raw(&out, lexeme, strlen(lexeme) + 1);
+    }
+    if (out.failed) {
+        free(out.data);
+        return NULL;
+    }
+    return out.data;
+}
+
+// A missing key is never the same as another, so its code is parsed again.
+static int same_key(const char *a, const char *b) {
+    if (!a || !b) return 0;
+    for (;;) {
+        size_t n = strlen(a);
+        if (strcmp(a, b) != 0) return 0;
+        if (n == 0) return 1;
+        a += n + 1;
+        b += n + 1;
+    }
+}
+
+static char *function_key(Document *doc, FunctionSpan *span) {
+    int brace = span->first;
+    while (brace < span->end && doc->tokens[brace].type != TOKEN_LBRACE) brace++;
+    return join_tokens(doc, span->first, brace + 1 < span->end ? brace + 1 : span->end);
+}
+
+static void shift_lines(ASTNode *node, int shift) {
+    if (node->line) node->line += shift;
+    for (int i = 0; i < node->child_count; i++) shift_lines(node->children[i], shift);
+}
+
+static int starts_function(Document *doc, int i) {
+    Token *t = &doc->tokens[i];
+    return t->type == TOKEN_FUNC || t->type == TOKEN_AT ||
+           (t->type == TOKEN_IDENTIFIER && strcmp(t->lexeme, "async") == 0 && doc->tokens[i + 1].type == TOKEN_FUNC);
+}
+
+// Splits the tokens after the header into functions: each runs to the '}'
+// that closes its first '{'.
+static FunctionSpan *find_functions(Document *doc, int *count) {
+    Token *tokens = doc->tokens;
+    int i = 0;
+    for (;;) {
+        if (tokens[i].type == TOKEN_INCLUDE) i++;
+        else if (tokens[i].type == TOKEN_USE && tokens[i + 1].type == TOKEN_IDENTIFIER &&
+                 tokens[i + 2].type == TOKEN_SEMICOLON) i += 3;
+        else break;
+    }
+    doc->header_end = i;
+    doc->stray = -1;
+
+    FunctionSpan *spans = NULL;
+    int n = 0, capacity = 0;
+    while (tokens[i].type != TOKEN_EOF) {
+        if (!starts_function(doc, i)) {
+            if (doc->stray < 0) doc->stray = i;
+            i++;
+            continue;
+        }
+        int first = i, depth = 0;
+        while (tokens[i].type != TOKEN_EOF && tokens[i].type != TOKEN_LBRACE) i++;
+        while (tokens[i].type != TOKEN_EOF) {
+            if (tokens[i].type == TOKEN_LBRACE) depth++;
+            else if (tokens[i].type == TOKEN_RBRACE && --depth == 0) break;
+            i++;
+        }
+        if (tokens[i].type != TOKEN_EOF) i++;
+        if (n == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            spans = realloc(spans, sizeof(FunctionSpan) * capacity);
+        }
+        memset(&spans[n], 0, sizeof(FunctionSpan));
+        spans[n].first = first;
+        spans[n].end = i;
+        n++;
+    }
+    *count = n;
+    return spans;
+}
+
+static void free_functions(FunctionSpan *spans, int count) {
+    for (int i = 0; i < count; i++) {
+        free(spans[i].key);
+        free_ast(spans[i].ast);
+        diagnostic_clear(&spans[i].error);
+    }
+    free(spans);
+}
+
+static void parse_span(Document *doc, FunctionSpan *span) {
+    if (!span->key) span->key = function_key(doc, span);
+    span->line = doc->tokens[span->first].line;
+    reporting = &span->error;
+    span->ast = parse_function_at(doc->tokens, doc->token_count, span->first);
+    reporting = NULL;
+}
+
+// Whether the parser holds this document's header and signatures.
+static int begin(Document *doc) {
+    if (parsed == doc) return !doc->header_error.message;
+    char *path = uri_path(doc->uri);
+    modules_set_script(path);
+    free(path);
+    diagnostic_clear(&doc->header_error);
+    reporting = &doc->header_error;
+    int ok = parse_begin(doc->tokens, doc->token_count) >= 0;
+    reporting = NULL;
+    parsed = doc;
+    return ok;
+}
+
+static int touched(Document *doc, FunctionSpan *span, Damage *damage) {
+    return (span->first < damage->end_token && span->end > damage->first_token) ||
+           (doc->tokens[span->first].line <= damage->last_line &&
+            doc->tokens[span->end - 1].line >= damage->first_line);
+}
+
+// The function name in a key: the token after `func`.
+static const char *key_name(const char *key) {
+    if (!key) return "";
+    char func[16];
+    int n = snprintf(func, sizeof(func), "%d:", TOKEN_FUNC);
+    for (; *key; key += strlen(key) + 1) {
+        if (strncmp(key, func, (size_t)n) != 0) continue;
+        key += strlen(key) + 1;
+        return *key ? strchr(key, ':') + 1 : "";
+    }
+    return "";
+}
+
+// Whether the function calls one of `names`.
+static int calls_any(Document *doc, FunctionSpan *span, const char **names, int count) {
+    for (int i = span->first; i + 1 < span->end; i++) {
+        Token *t = &doc->tokens[i];
+        if (t->type != TOKEN_IDENTIFIER || doc->tokens[i + 1].type != TOKEN_LPAREN) continue;
+        for (int k = 0; k < count; k++) {
+            if (strcmp(t->lexeme, names[k]) == 0) return 1;
+        }
+    }
+    return 0;
+}
+
+// Moves an unchanged function's AST and error over from its old span.
+static void keep_span(Document *doc, FunctionSpan *now, FunctionSpan *old) {
+    *now = (FunctionSpan){ now->first, now->end, old->line, old->key, old->ast, old->error };
+    int shift = doc->tokens[now->first].line - old->line;
+    if (shift && now->ast) shift_lines(now->ast, shift);
+    if (shift && now->error.message) now->error.line += shift;
+    now->line += shift;
+    old->key = NULL;
+    old->ast = NULL;
+    old->error.message = NULL;
+}
+
+// Brings the functions' ASTs up to date after `damage`, or after any
+// change when damage is NULL.
+static void analyze(Document *doc, Damage *damage) {
+    int count, old_count = doc->function_count;
+    FunctionSpan *spans = find_functions(doc, &count), *old = doc->functions;
+    char *header_key = join_tokens(doc, 0, doc->header_end);
+    int full = !damage || !same_key(header_key, doc->header_key) || doc->header_error.message;
+    free(doc->header_key);
+    doc->header_key = header_key;
+
+    // The functions the edit did not touch keep their AST: those before it
+    // are matched from the front, those after it from the back.
+    int front = 0, back = 0;
+    while (!full && front < count && front < old_count && !touched(doc, &spans[front], damage) &&
+           spans[front].end - spans[front].first == old[front].end - old[front].first) {
+        front++;
+    }
+    while (!full && back < count - front && back < old_count - front) {
+        FunctionSpan *now = &spans[count - 1 - back], *was = &old[old_count - 1 - back];
+        if (touched(doc, now, damage) || now->end - now->first != was->end - was->first) break;
+        back++;
+    }
+
+    // Every caller of a function whose signature changed, appeared or went
+    // away is parsed again too
+    const char **changed = malloc(sizeof(char *) * (count + old_count + 1));
+    int changed_count = 0;
+    for (int i = front; !full && i < count - back; i++) {
+        spans[i].key = function_key(doc, &spans[i]);
+        if (count != old_count || !same_key(spans[i].key, old[i].key)) changed[changed_count++] = key_name(spans[i].key);
+    }
+    for (int i = front; !full && i < old_count - back; i++) {
+        if (count != old_count || !same_key(spans[i].key, old[i].key)) changed[changed_count++] = key_name(old[i].key);
+    }
+    if (!full && changed_count && parsed == doc) parsed = NULL;   // collect the signatures again
+    if (!full && !begin(doc)) full = 1;
+
+    if (full) {
+        if (parsed == doc) parsed = NULL;
+        int ok = begin(doc);
+        for (int i = 0; i < count; i++) {
+            if (ok) parse_span(doc, &spans[i]);
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            if (i >= front && i < count - back) {
+                parse_span(doc, &spans[i]);
+                continue;
+            }
+            keep_span(doc, &spans[i], &old[i < front ? i : old_count - count + i]);
+            if (changed_count && calls_any(doc, &spans[i], changed, changed_count)) {
+                free_ast(spans[i].ast);
+                diagnostic_clear(&spans[i].error);
+                parse_span(doc, &spans[i]);
+            } else if (changed_count && spans[i].ast) {
+                parse_relink(spans[i].ast);
+            }
+        }
+    }
+    free(changed);
+    free_functions(old, old_count);
+    doc->functions = spans;
+    doc->function_count = count;
+
+    // @memo purity depends on every function the memoized one calls
+    diagnostic_clear(&doc->check_error);
+    int memo = 0, complete = !doc->header_error.message;
+    for (int i = 0; i < count; i++) {
+        complete = complete && spans[i].ast;
+        memo = memo || (spans[i].ast && spans[i].ast->slot > 0);
+    }
+    if (memo && complete) {
+        ASTNode program;
+        memset(&program, 0, sizeof(program));
+        program.type = AST_PROGRAM;
+        program.child_count = count;
+        program.children = malloc(sizeof(ASTNode *) * count);
+        for (int i = 0; i < count; i++) program.children[i] = spans[i].ast;
+        reporting = &doc->check_error;
+        parse_check(&program);
+        reporting = NULL;
+        free(program.children);
+    }
+}
+
+// -----------------------------
+// Diagnostics
+// -----------------------------
+static void put_range(Out *out, Document *doc, int line, int column, int length) {
+    int index = line - 1;
+    if (index < 0) index = 0;
+    if (index >= doc->line_count) index = doc->line_count - 1;
+    int from = 0, to = units_at(doc, index, line_length(doc, index));
+    if (column >= 0 && column <= line_length(doc, index)) {
+        from = units_at(doc, index, column);
+        to = units_at(doc, index, column + (length ? length : word_length(doc, index, column)));
+    }
+    out_format(out, "{\"start\":{\"line\":%d,\"character\":%d},\"end\":{\"line\":%d,\"character\":%d}}",
+               index, from, index, to);
+}
+
+static void put_diagnostic(Out *out, Document *doc, int line, int column, const char *message, int *first) {
+    if (!*first) out_text(out, ",");
+    *first = 0;
+    out_text(out, "{\"range\":");
+    put_range(out, doc, line, column, 0);
+    out_text(out, ",\"severity\":1,\"source\":\"wpy+\",\"message\":");
+    out_string(out, message);
+    out_text(out, "}");
+}
+
+static void publish(Out *out, Document *doc) {
+    int first = 1;
+    out_text(out, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+    out_string(out, doc->uri);
+    out_text(out, ",\"diagnostics\":[");
+    for (int i = 0; doc->unknown && i < doc->token_count; i++) {
+        Token *t = &doc->tokens[i];
+        if (is_unknown(t)) {
+            put_diagnostic(out, doc, t->line, t->column,
+                           t->lexeme[1] ? "Lex error: unterminated comment" : "Lex error: unexpected character", &first);
+        }
+    }
+    if (doc->header_error.message) {
+        Diagnostic *d = &doc->header_error;
+        put_diagnostic(out, doc, d->line, d->column, d->message, &first);
+    }
+    if (doc->stray >= 0 && !doc->header_error.message && !is_unknown(&doc->tokens[doc->stray])) {
+        Token *t = &doc->tokens[doc->stray];
+        put_diagnostic(out, doc, t->line, t->column, "Parse error: expected 'func'", &first);
+    }
+    for (int i = 0; i < doc->function_count; i++) {
+        Diagnostic *d = &doc->functions[i].error;
+        if (d->message) put_diagnostic(out, doc, d->line, d->column, d->message, &first);
+    }
+    if (doc->check_error.message) {
+        Diagnostic *d = &doc->check_error;
+        put_diagnostic(out, doc, d->line, d->column, d->message, &first);
+    }
+    out_text(out, "]}}");
+    send(out);
+}
+
+// -----------------------------
+// Hover
+// -----------------------------
+static void put_signature(Out *text, ASTNode *func) {
+    out_format(text, "%s%sfunc %s(", func->slot > 0 ? "@memo " : "", func->int_value & FUNC_ASYNC ? "async " : "",
+               func->value);
+    for (int i = 0; i < func->param_count; i++) {
+        out_format(text, "%s%s %s", i ? ", " : "", var_type_name(func->children[i]->value_type),
+                   func->children[i]->value);
+    }
+    out_text(text, ")");
+    if (func->value_type != VAR_UNKNOWN) out_format(text, " %s", var_type_name(func->value_type));
+}
+
+// The last declaration of `name` on or before `line` under `node`.
+static ASTNode *find_declaration(ASTNode *node, const char *name, int line, ASTNode *best) {
+    if (node->line > line) return best;
+    if ((node->type == AST_PARAM && strcmp(node->value, name) == 0) ||
+        (node->type == AST_VAR_DECL && strcmp(node->var_name, name) == 0)) {
+        best = node;
+    }
+    for (int i = 0; i < node->child_count; i++) best = find_declaration(node->children[i], name, line, best);
+    return best;
+}
+
+// The pypstdio statements the parser reads itself, which builtins[] does
+// not list.
+static const char *const statements[][2] = {
+    { "print", "pypstdio.print(value, ...)  // the values, separated by spaces, then a newline" },
+    { "bench", "pypstdio.bench(string name, int runs, int warmup) { ... }  // warmup is optional" },
+    { "snapshot", "pypstdio.snapshot()  // saves main's variables under --snapshot" },
+};
+
+// Describes the identifier tokens[at] in `text`; 0 if there is nothing to say.
+static int describe(Out *text, Document *doc, int at) {
+    Token *tokens = doc->tokens;
+    const char *name = tokens[at].lexeme;
+
+    // pypstdio.a.b or module.f
+    int path_start = at;
+    while (path_start >= 2 && tokens[path_start - 1].type == TOKEN_DOT &&
+           identifier_length(tokens[path_start - 2].lexeme) > 0) {
+        path_start -= 2;
+    }
+    if (path_start < at) {
+        Out path = { NULL, 0, 0, 0, NULL };
+        int from = strcmp(tokens[path_start].lexeme, "pypstdio") == 0 ? path_start + 2 : path_start;
+        for (int i = from; i <= at; i += 2) out_format(&path, "%s%s", i > from ? "." : "", tokens[i].lexeme);
+        if (path.failed) {
+            free(path.data);
+            text->failed = 1;
+            return 0;
+        }
+        int found = 0;
+        if (from > path_start) {
+            for (int b = 0; b < builtin_count; b++) {
+                if (strcmp(builtins[b].name, path.data) != 0) continue;
+                out_format(text, "%spypstdio.%s(", found++ ? "\n" : "", builtins[b].name);
+                for (int p = 0; p < builtins[b].arity; p++) {
+                    out_format(text, "%s%s", p ? ", " : "", var_type_name(builtins[b].params[p]));
+                }
+                out_text(text, ")");
+                if (builtins[b].result != VAR_UNKNOWN) out_format(text, " %s", var_type_name(builtins[b].result));
+            }
+            for (size_t k = 0; !found && k < sizeof(statements) / sizeof(statements[0]); k++) {
+                if (strcmp(statements[k][0], path.data) == 0) {
+                    out_text(text, statements[k][1]);
+                    found = 1;
+                }
+            }
+        } else if (at == path_start + 2) {
+            const ModuleExport *e = module_function(path.data);
+            if (e) {
+                found = 1;
+                out_format(text, "%sfunc %s(", e->is_async ? "async " : "", path.data);
+                for (int p = 0; p < e->param_count; p++) {
+                    out_format(text, "%s%s", p ? ", " : "", var_type_name(e->params[p]));
+                }
+                out_text(text, ")");
+                if (e->return_type != VAR_UNKNOWN) out_format(text, " %s", var_type_name(e->return_type));
+            }
+        }
+        free(path.data);
+        return found;
+    }
+
+    // A function, where it is defined or called
+    if (tokens[at + 1].type == TOKEN_LPAREN) {
+        for (int i = 0; i < doc->function_count; i++) {
+            ASTNode *func = doc->functions[i].ast;
+            if (func && strcmp(func->value, name) == 0) {
+                put_signature(text, func);
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    // A variable of the enclosing function
+    for (int i = 0; i < doc->function_count; i++) {
+        FunctionSpan *span = &doc->functions[i];
+        if (at < span->first || at >= span->end) continue;
+        if (!span->ast) return 0;
+        ASTNode *decl = find_declaration(span->ast, name, tokens[at].line, NULL);
+        if (!decl) return 0;
+        out_format(text, "%s %s", var_type_name(decl->value_type), name);
+        out_format(text, decl->type == AST_PARAM ? "  // parameter of %s" : "  // local of %s", span->ast->value);
+        return 1;
+    }
+    return 0;
+}
+
+static void hover(Out *out, Document *doc, int line, int character) {
+    if (line < 0 || line >= doc->line_count) {
+        out_text(out, "null");
+        return;
+    }
+    int column = offset_at(doc, line, character) - doc->lines[line];
+    for (int i = first_token_at(doc, line + 1); i < doc->token_count && doc->tokens[i].line == line + 1; i++) {
+        Token *t = &doc->tokens[i];
+        if (t->type != TOKEN_IDENTIFIER || column < t->column ||
+            column >= t->column + word_length(doc, line, t->column)) {
+            continue;
+        }
+        Out text = { NULL, 0, 0, 0, NULL };
+        out_text(&text, "```pyp\n");
+        int described = describe(&text, doc, i);
+        out->failed |= text.failed;
+        if (described) {
+            out_text(&text, "\n```");
+            out_text(out, "{\"contents\":{\"kind\":\"markdown\",\"value\":");
+            out_string(out, text.data);
+            out_text(out, "},\"range\":");
+            put_range(out, doc, t->line, t->column, 0);
+            out_text(out, "}");
+            free(text.data);
+            return;
+        }
+        free(text.data);
+        break;
+    }
+    out_text(out, "null");
+}
+
+// -----------------------------
+// Protocol
+// -----------------------------
+static void open_document(Out *out, const char *uri, const char *text) {
+    Document *doc = find_document(uri);
+    if (!doc) {
+        doc = calloc(1, sizeof(Document));
+        doc->uri = copy_text(uri, strlen(uri));
+        documents = realloc(documents, sizeof(Document *) * (document_count + 1));
+        documents[document_count++] = doc;
+    }
+    set_text(doc, text);
+    analyze(doc, NULL);
+    publish(out, doc);
+}
+
+static void change_document(Out *out, Document *doc, Json *changes) {
+    for (int i = 0; changes && i < changes->count; i++) {
+        Damage damage;
+        analyze(doc, apply_change(doc, &changes->items[i], &damage) ? &damage : NULL);
+    }
+    publish(out, doc);
+}
+
+static void release_document(Document *doc) {
+    if (parsed == doc) {
+        parse_end();
+        parsed = NULL;
+    }
+    for (int i = 0; i < document_count; i++) {
+        if (documents[i] == doc) documents[i] = documents[--document_count];
+    }
+    free_functions(doc->functions, doc->function_count);
+    for (int i = 0; i < doc->token_count; i++) free(doc->tokens[i].lexeme);
+    diagnostic_clear(&doc->header_error);
+    diagnostic_clear(&doc->check_error);
+    free(doc->header_key);
+    free(doc->tokens);
+    free(doc->lines);
+    free(doc->clean);
+    free(doc->text);
+    free(doc->uri);
+    free(doc);
+}
+
+static void close_document(Out *out, Document *doc) {
+    out_text(out, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+    out_string(out, doc->uri);
+    out_text(out, ",\"diagnostics\":[]}}");
+    send(out);
+    release_document(doc);
+}
+
+static void respond(Out *out, Json *id) {
+    out->id = id;
+    out_text(out, "{\"jsonrpc\":\"2.0\",\"id\":");
+    if (id) out_raw(out, id->raw, (size_t)id->raw_length);
+    else out_text(out, "null");
+    out_text(out, ",\"result\":");
+}
+
+int run_lsp(void) {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    lex_report = ignore_lex_error;
+    parse_report = report;
+
+    Out out = { NULL, 0, 0, 0, NULL };
+    int shutdown = 0, code = 1;
+    char *body;
+    while ((body = read_message())) {
+        const char *p = body;
+        Json message;
+        int ok = json_parse(&p, &message, 0);
+        const char *method = ok ? string_of(member(&message, "method")) : NULL;
+        Json *id = member(&message, "id");
+        Json *params = member(&message, "params");
+        Json *document = member(params, "textDocument");
+        const char *uri = string_of(member(document, "uri"));
+        Document *doc = uri ? find_document(uri) : NULL;
+
+        if (!method) {
+            // a reply or garbage: the server sends no requests
+        } else if (strcmp(method, "initialize") == 0) {
+            respond(&out, id);
+            out_format(&out, "{\"capabilities\":{\"textDocumentSync\":{\"openClose\":true,\"change\":2},"
+                             "\"hoverProvider\":true},\"serverInfo\":{\"name\":\"wpy+\"}}}");
+            send(&out);
+        } else if (strcmp(method, "textDocument/didOpen") == 0 && uri) {
+            const char *text = string_of(member(document, "text"));
+            open_document(&out, uri, text ? text : "");
+        } else if (strcmp(method, "textDocument/didChange") == 0 && doc) {
+            change_document(&out, doc, member(params, "contentChanges"));
+        } else if (strcmp(method, "textDocument/didClose") == 0 && doc) {
+            close_document(&out, doc);
+        } else if (strcmp(method, "textDocument/hover") == 0) {
+            Json *position = member(params, "position");
+            respond(&out, id);
+            if (doc) hover(&out, doc, int_of(member(position, "line")), int_of(member(position, "character")));
+            else out_text(&out, "null");
+            out_text(&out, "}");
+            send(&out);
+        } else if (strcmp(method, "shutdown") == 0) {
+            shutdown = 1;
+            respond(&out, id);
+            out_text(&out, "null}");
+            send(&out);
+        } else if (strcmp(method, "exit") == 0) {
+            code = shutdown ? 0 : 1;
+            json_free(&message);
+            free(body);
+            break;
+        } else if (id) {
+            out_text(&out, "{\"jsonrpc\":\"2.0\",\"id\":");
+            out_raw(&out, id->raw, (size_t)id->raw_length);
+            out_text(&out, ",\"error\":{\"code\":-32601,\"message\":\"method not found\"}}");
+            send(&out);
+        }
+        json_free(&message);
+        free(body);
+    }
+
+    while (document_count > 0) release_document(documents[0]);
+    free(documents);
+    free(out.data);
+    parse_report = NULL;
+    lex_report = NULL;
+    modules_release();
+    return code;
+}
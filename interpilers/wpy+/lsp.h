@@ -0,0 +1,11 @@
+#ifndef LSP_H
+#define LSP_H
+
+// -----------------------------
+// Language server
+// -----------------------------
+// `wpy+ --lsp`: answers the Language Server Protocol on stdin/stdout until
+// the client sends `exit`. Returns the process exit code.
+int run_lsp(void);
+
+#endif // LSP_H
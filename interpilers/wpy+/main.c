@@ -6,16 +6,59 @@
 #include "interpiler.h"
 #include "lexer.h"
 #include "REPL.h"
+#include "modules.h"
+#include "lsp.h"
+
+static void print_options(void) {
+    printf("Options:\n");
+    printf("  --help, -h    Show this help message\n");
+    printf("  --version, -v Show version information\n");
+    printf("  --REPL, -R    Start interactive REPL mode\n");
+    printf("  --lsp         Run as a language server on stdin/stdout\n");
+    printf("  --quiet, -q   Do not dump tokens, AST and bytecode\n");
+    printf("  --time, -t    Report the run time of the program\n");
+    printf("  --stats, -s   Report @memo cache hits and misses\n");
+    printf("  -O0, -O1, -O2 Optimization level (default -O2)\n");
+    printf("  --passes, -p  Report what each optimization pass changed\n");
+    printf("  --snapshot <image>  Save the run at pypstdio.snapshot() and stop there\n");
+    printf("  --resume <image>    Carry on with a saved run (in place of the source file)\n");
+}
+
+// The switches after the source file (or --resume's image). 0 after
+// printing an error.
+static int parse_options(int argc, char *argv[], int first) {
+    for (int i = first; i < argc; i++) {
+        if (strcmp(argv[i], "--quiet") == 0 || strcmp(argv[i], "-q") == 0) {
+            interpiler_options.quiet = 1;
+        } else if (strcmp(argv[i], "--time") == 0 || strcmp(argv[i], "-t") == 0) {
+            interpiler_options.show_time = 1;
+        } else if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "-s") == 0) {
+            interpiler_options.show_stats = 1;
+        } else if (argv[i][0] == '-' && argv[i][1] == 'O' && argv[i][2] >= '0' && argv[i][2] <= '2' &&
+                   argv[i][3] == '\0') {
+            interpiler_options.opt_level = argv[i][2] - '0';
+        } else if (strcmp(argv[i], "--passes") == 0 || strcmp(argv[i], "-p") == 0) {
+            interpiler_options.show_passes = 1;
+        } else if (strcmp(argv[i], "--snapshot") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "wpy+.exe: --snapshot needs an image path\n");
+                return 0;
+            }
+            interpiler_options.snapshot_path = argv[++i];
+        } else {
+            fprintf(stderr, "wpy+.exe: unknown option: %s\n", argv[i]);
+            return 0;
+        }
+    }
+    return 1;
+}
 
 int main(int argc, char *argv[]) {
     // No arguments at all
     if (argc < 2) {
         printf("wpy+.exe: \033[1;31mfatal error:\033[0m no arguments provided \033[1;31mError Code: 1\033[0m\n");
         printf("Usage: wpy+.exe <source_file.pyp> [options]\n");
-        printf("Options:\n");
-        printf("  --help, -h    Show this help message\n");
-        printf("  --version, -v Show version information\n");
-        printf("  --REPL, -R    Start interactive REPL mode\n");
+        print_options();
         return 1;
     }
 
@@ -24,10 +67,7 @@ int main(int argc, char *argv[]) {
         strcmp(argv[1], "help") == 0   || strcmp(argv[1], "h") == 0) {
         printf("wpy+.exe: Python+ Interpreter\n");
         printf("Usage: wpy+.exe <source_file.pyp> [options]\n");
-        printf("Options:\n");
-        printf("  --help, -h    Show this help message\n");
-        printf("  --version, -v Show version information\n");
-        printf("  --REPL, -R    Start interactive REPL mode\n");
+        print_options();
         return 0;
     }
 
@@ -47,41 +87,70 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    // Otherwise, treat argv[1] as a filename
+    if (strcmp(argv[1], "--lsp") == 0) {
+        return run_lsp();
+    }
+
+    if (strcmp(argv[1], "--resume") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "wpy+.exe: --resume needs a snapshot image\n");
+            return 1;
+        }
+        if (!parse_options(argc, argv, 3)) return 1;
+        return resume_program(argv[2]);
+    }
+
+    // Otherwise, treat argv[1] as a filename followed by options
     const char *input_path = argv[1];
+    if (!parse_options(argc, argv, 2)) return 1;
+    int quiet = interpiler_options.quiet;
+
     char *source = load_file(input_path);
     if (!source) {
         fprintf(stderr, "wpy+.exe: failed to load file: %s\n", input_path);
         return 1;
     }
 
+    // Modules named by `use` are looked up next to the script
+    modules_set_script(input_path);
+
     // Initialize lexer with source buffer
     set_source(source);
 
     // 1. Lexing + debug
-    printf("Lexing...\n");
-    Token tokens[1024];
+    if (!quiet) printf("Lexing...\n");
+    int token_capacity = 1024;
+    Token *tokens = malloc(sizeof(Token) * token_capacity);
     int token_count = 0;
     Token tok;
     do {
         tok = next_token();
-        printf("Token: %d (%s)\n", tok.type, tok.lexeme ? tok.lexeme : "");
+        if (!quiet) printf("Token: %d (%s)\n", tok.type, tok.lexeme ? tok.lexeme : "");
+        if (token_count == token_capacity) {
+            token_capacity *= 2;
+            tokens = realloc(tokens, sizeof(Token) * token_capacity);
+        }
         tokens[token_count++] = tok;
     } while (tok.type != TOKEN_EOF);
 
     // 2. Parsing + Interpiling + debug
-    printf("Parsing...\n");
+    if (!quiet) printf("Parsing...\n");
     ASTNode *ast = parse(tokens, token_count);
+    int status = 0;
     if (!ast) {
         printf("Parser returned NULL — nothing to run.\n");
         return 1;
     } else {
-        printf("AST built successfully:\n");
-        print_ast(ast, 0);
-        run_program(ast);
+        if (!quiet) {
+            printf("AST built successfully:\n");
+            print_ast(ast, 0);
+        }
+        status = run_program(ast);
         free_ast(ast);
     }
 
+    modules_release();
+    free(tokens);
     free(source);
-    return 0;
+    return status;
 }
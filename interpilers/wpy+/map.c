@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "map.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define WPY_MAP_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// -----------------------------
+// Control tags
+// -----------------------------
+// A full slot stores the low 7 bits of its hash (high bit clear); the two
+// free states both have the high bit set.
+#define CTRL_EMPTY   0x80
+#define CTRL_DELETED 0xFE
+
+typedef unsigned long long u64;
+typedef unsigned int GroupMask;   // bit i refers to slot i of the group
+
+#ifdef WPY_MAP_SSE2
+static GroupMask group_match(const unsigned char *group, unsigned char tag) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)tag)));
+}
+
+static GroupMask group_free(const unsigned char *group) {
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+}
+#else
+static GroupMask group_match(const unsigned char *group, unsigned char tag) {
+    GroupMask mask = 0;
+    for (int i = 0; i < MAP_GROUP; i++) {
+        if (group[i] == tag) mask |= 1u << i;
+    }
+    return mask;
+}
+
+static GroupMask group_free(const unsigned char *group) {
+    GroupMask mask = 0;
+    for (int i = 0; i < MAP_GROUP; i++) {
+        if (group[i] & 0x80) mask |= 1u << i;
+    }
+    return mask;
+}
+#endif
+
+static GroupMask group_full(const unsigned char *group) {
+    return ~group_free(group) & ((1u << MAP_GROUP) - 1);
+}
+
+static int lowest_bit(GroupMask mask) {
+    return __builtin_ctz(mask);
+}
+
+// -----------------------------
+// Keys
+// -----------------------------
+static u64 mix64(u64 x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static u64 hash_key(const Map *map, Value key) {
+    if (map->key_type == VAR_INT) return mix64((u64)key.i);
+    u64 h = 0xcbf29ce484222325ULL;   // FNV-1a
+    const unsigned char *p = (const unsigned char *)key.str->chars;
+    for (long long i = 0; i < key.str->length; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return mix64(h);
+}
+
+static int keys_equal(const Map *map, Value a, Value b) {
+    if (map->key_type == VAR_INT) return a.i == b.i;
+    return str_equal(a.str, b.str);
+}
+
+// String keys are copied into chunks owned by the map. A key block comes
+// in one of MAP_KEY_CLASSES sizes: multiples of 16 bytes up to 512, then
+// powers of two. Removing an entry puts its block on the free list of its
+// size, and a later key of that size reuses it, so adding and removing
+// keys takes no more memory than the most keys ever held at once. The
+// free lists are kept outside the blocks: a freed key stays a whole
+// string until it is reused, so one the program got from map.key still
+// reads as a string.
+#define MAP_KEY_CLASSES 88
+
+struct MapChunk {
+    MapChunk *next;
+    size_t used;
+    size_t size;
+    _Alignas(void *) char data[];
+};
+
+struct MapKeyPool {
+    Str **blocks[MAP_KEY_CLASSES];
+    int count[MAP_KEY_CLASSES];
+    int capacity[MAP_KEY_CLASSES];
+};
+
+static int key_class(long long length) {
+    size_t bytes = STR_FLAT_SIZE(length);
+    if (bytes <= 512) return (int)((bytes + 15) / 16) - 1;
+    int c = 32;
+    for (size_t size = 1024; size < bytes; size *= 2) c++;
+    return c;
+}
+
+static size_t class_bytes(int c) {
+    return c < 32 ? (size_t)(c + 1) * 16 : (size_t)1024 << (c - 32);
+}
+
+static Str *copy_key(Map *map, const Str *s) {
+    int c = key_class(s->length);
+    Str *copy = NULL;
+    MapKeyPool *pool = map->free_keys;
+    if (pool && pool->count[c]) {
+        copy = pool->blocks[c][--pool->count[c]];
+    } else {
+        // the Str header, then its text
+        size_t len = class_bytes(c);
+        MapChunk *chunk = map->keys;
+        if (!chunk || chunk->size - chunk->used < len) {
+            size_t size = len > 4096 ? len : 4096;
+            chunk = malloc(sizeof(MapChunk) + size);
+            if (!chunk) return NULL;
+            chunk->next = map->keys;
+            chunk->used = 0;
+            chunk->size = size;
+            map->keys = chunk;
+        }
+        copy = (Str *)(chunk->data + chunk->used);
+        chunk->used += len;
+    }
+    char *text = (char *)(copy + 1);
+    memmove(text, s->chars, (size_t)s->length + 1);   // s may be the reused block itself
+    copy->length = s->length;
+    copy->chars = text;
+    copy->left = NULL;
+    copy->right = NULL;
+    copy->transient = 0;
+    return copy;
+}
+
+// Puts the key block of a removed entry up for reuse. 0 if out of memory,
+// in which case the block is simply not reused.
+static int release_key(Map *map, Str *key) {
+    if (!map->free_keys && !(map->free_keys = calloc(1, sizeof(MapKeyPool)))) return 0;
+    MapKeyPool *pool = map->free_keys;
+    int c = key_class(key->length);
+    if (pool->count[c] == pool->capacity[c]) {
+        int capacity = pool->capacity[c] ? pool->capacity[c] * 2 : 16;
+        Str **grown = realloc(pool->blocks[c], sizeof(Str *) * (size_t)capacity);
+        if (!grown) return 0;
+        pool->blocks[c] = grown;
+        pool->capacity[c] = capacity;
+    }
+    pool->blocks[c][pool->count[c]++] = key;
+    return 1;
+}
+
+// -----------------------------
+// Table
+// -----------------------------
+// Slots needed so that `count` entries stay under a 7/8 load factor.
+static long long capacity_for(long long count) {
+    long long capacity = MAP_GROUP;
+    while (capacity / 8 * 7 < count) capacity *= 2;
+    return capacity;
+}
+
+static int alloc_table(Map *map, long long capacity) {
+    unsigned char *ctrl = malloc((size_t)capacity);
+    MapEntry *entries = malloc(sizeof(MapEntry) * (size_t)capacity);
+    if (!ctrl || !entries) {
+        free(ctrl);
+        free(entries);
+        return 0;
+    }
+    memset(ctrl, CTRL_EMPTY, (size_t)capacity);
+    map->ctrl = ctrl;
+    map->entries = entries;
+    map->capacity = capacity;
+    map->tombstones = 0;
+    return 1;
+}
+
+// Groups are probed triangularly (g, g+1, g+3, g+6, ...), which visits every
+// group of a power-of-two table.
+static long long find_slot(const Map *map, Value key, u64 hash) {
+    u64 group_mask = (u64)(map->capacity / MAP_GROUP) - 1;
+    u64 g = (hash >> 7) & group_mask;
+    unsigned char tag = hash & 0x7F;
+    for (u64 step = 1;; step++) {
+        const unsigned char *ctrl = map->ctrl + g * MAP_GROUP;
+        for (GroupMask hits = group_match(ctrl, tag); hits; hits &= hits - 1) {
+            long long slot = (long long)(g * MAP_GROUP) + lowest_bit(hits);
+            if (keys_equal(map, map->entries[slot].key, key)) return slot;
+        }
+        // a group with an empty slot ends every probe that reaches it
+        if (group_match(ctrl, CTRL_EMPTY)) return -1;
+        g = (g + step) & group_mask;
+    }
+}
+
+static long long free_slot(const Map *map, u64 hash) {
+    u64 group_mask = (u64)(map->capacity / MAP_GROUP) - 1;
+    u64 g = (hash >> 7) & group_mask;
+    for (u64 step = 1;; step++) {
+        GroupMask free_mask = group_free(map->ctrl + g * MAP_GROUP);
+        if (free_mask) return (long long)(g * MAP_GROUP) + lowest_bit(free_mask);
+        g = (g + step) & group_mask;
+    }
+}
+
+static int rehash(Map *map, long long capacity) {
+    unsigned char *old_ctrl = map->ctrl;
+    MapEntry *old_entries = map->entries;
+    long long old_capacity = map->capacity;
+    if (!alloc_table(map, capacity)) return 0;
+
+    for (long long i = 0; i < old_capacity; i++) {
+        if (old_ctrl[i] & 0x80) continue;
+        u64 hash = hash_key(map, old_entries[i].key);
+        long long slot = free_slot(map, hash);
+        map->ctrl[slot] = hash & 0x7F;
+        map->entries[slot] = old_entries[i];
+    }
+    free(old_ctrl);
+    free(old_entries);
+    return 1;
+}
+
+Map *map_new(VarType key_type, long long capacity_hint) {
+    if (capacity_hint > (1LL << 40)) return NULL;
+    Map *map = calloc(1, sizeof(Map));
+    if (!map) return NULL;
+    map->key_type = key_type;
+    if (!alloc_table(map, capacity_for(capacity_hint))) {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+void map_free(Map *map) {
+    if (!map) return;
+    while (map->keys) {
+        MapChunk *next = map->keys->next;
+        free(map->keys);
+        map->keys = next;
+    }
+    if (map->free_keys) {
+        for (int c = 0; c < MAP_KEY_CLASSES; c++) free(map->free_keys->blocks[c]);
+        free(map->free_keys);
+    }
+    free(map->ctrl);
+    free(map->entries);
+    free(map);
+}
+
+void map_print(FILE *out, const Map *map) {
+    int first = 1;
+    fputc('{', out);
+    for (long long i = 0; i < map->capacity; i++) {
+        if (map->ctrl[i] & 0x80) continue;
+        if (!first) fputs(", ", out);
+        first = 0;
+        if (map->key_type == VAR_INT) fprintf(out, "%lld", map->entries[i].key.i);
+        else fputs(map->entries[i].key.str->chars, out);
+        fprintf(out, ": %lld", map->entries[i].value);
+    }
+    fputc('}', out);
+}
+
+// -----------------------------
+// Snapshots
+// -----------------------------
+int map_slot_full(const Map *map, long long slot) {
+    return !(map->ctrl[slot] & 0x80);
+}
+
+Map *map_restore(VarType key_type, long long capacity, long long tombstones, const unsigned char *ctrl,
+                 const MapEntry *entries) {
+    if (capacity < MAP_GROUP || (capacity & (capacity - 1)) || capacity > (1LL << 40)) return NULL;
+    Map *map = calloc(1, sizeof(Map));
+    if (!map) return NULL;
+    map->key_type = key_type;
+    if (!alloc_table(map, capacity)) {
+        free(map);
+        return NULL;
+    }
+    memcpy(map->ctrl, ctrl, (size_t)capacity);
+    memcpy(map->entries, entries, sizeof(MapEntry) * (size_t)capacity);
+    map->tombstones = tombstones;
+    for (long long i = 0; i < capacity; i++) {
+        if (ctrl[i] & 0x80) continue;
+        map->count++;
+        if (key_type == VAR_STRING &&
+            (!entries[i].key.str || !(map->entries[i].key.str = copy_key(map, entries[i].key.str)))) {
+            map_free(map);
+            return NULL;
+        }
+    }
+    return map;
+}
+
+// -----------------------------
+// Builtins
+// -----------------------------
+#define ARG_MAP(n) ((Map *)args[n].p)
+
+// String keys are hashed as flat text, so a rope key is flattened first.
+static int flatten_key(const Map *map, Value key) {
+    return map->key_type == VAR_INT || str_chars(key.str) != NULL;
+}
+
+const char *native_map_set(Value *args, Value *result) {
+    (void)result;
+    Map *map = ARG_MAP(0);
+    if (!flatten_key(map, args[1])) return "out of memory";
+    u64 hash = hash_key(map, args[1]);
+    long long slot = find_slot(map, args[1], hash);
+    if (slot >= 0) {
+        map->entries[slot].value = args[2].i;
+        return NULL;
+    }
+
+    if ((map->count + map->tombstones + 1) > map->capacity / 8 * 7) {
+        // mostly tombstones: clean up in place; otherwise grow
+        long long capacity = map->count + 1 > map->capacity / 16 * 7 ? map->capacity * 2 : map->capacity;
+        if (!rehash(map, capacity)) return "out of memory";
+    }
+
+    Value key = args[1];
+    if (map->key_type == VAR_STRING && !(key.str = copy_key(map, key.str))) return "out of memory";
+    slot = free_slot(map, hash);
+    if (map->ctrl[slot] == CTRL_DELETED) map->tombstones--;
+    map->ctrl[slot] = hash & 0x7F;
+    map->entries[slot].key = key;
+    map->entries[slot].value = args[2].i;
+    map->count++;
+    return NULL;
+}
+
+const char *native_map_get(Value *args, Value *result) {
+    Map *map = ARG_MAP(0);
+    if (!flatten_key(map, args[1])) return "out of memory";
+    long long slot = find_slot(map, args[1], hash_key(map, args[1]));
+    if (slot < 0) return "map key not found";
+    result->i = map->entries[slot].value;
+    return NULL;
+}
+
+const char *native_map_get_or(Value *args, Value *result) {
+    Map *map = ARG_MAP(0);
+    if (!flatten_key(map, args[1])) return "out of memory";
+    long long slot = find_slot(map, args[1], hash_key(map, args[1]));
+    result->i = slot < 0 ? args[2].i : map->entries[slot].value;
+    return NULL;
+}
+
+const char *native_map_has(Value *args, Value *result) {
+    Map *map = ARG_MAP(0);
+    if (!flatten_key(map, args[1])) return "out of memory";
+    result->i = find_slot(map, args[1], hash_key(map, args[1])) >= 0;
+    return NULL;
+}
+
+const char *native_map_remove(Value *args, Value *result) {
+    Map *map = ARG_MAP(0);
+    if (!flatten_key(map, args[1])) return "out of memory";
+    long long slot = find_slot(map, args[1], hash_key(map, args[1]));
+    result->i = slot >= 0;
+    if (slot < 0) return NULL;
+
+    // If the group still has an empty slot, no probe ever continued past it,
+    // so the slot can become empty again instead of a tombstone.
+    if (group_match(map->ctrl + (slot & ~(long long)(MAP_GROUP - 1)), CTRL_EMPTY)) {
+        map->ctrl[slot] = CTRL_EMPTY;
+    } else {
+        map->ctrl[slot] = CTRL_DELETED;
+        map->tombstones++;
+    }
+    if (map->key_type == VAR_STRING) release_key(map, map->entries[slot].key.str);
+    map->count--;
+    return NULL;
+}
+
+const char *native_map_len(Value *args, Value *result) {
+    result->i = ARG_MAP(0)->count;
+    return NULL;
+}
+
+// Cursor iteration: next(m, c) is the first occupied slot at or after c,
+// or -1. Cursors are invalidated by set() adding a key.
+const char *native_map_next(Value *args, Value *result) {
+    Map *map = ARG_MAP(0);
+    long long cursor = args[1].i < 0 ? 0 : args[1].i;
+    result->i = -1;
+    for (long long g = cursor & ~(long long)(MAP_GROUP - 1); g < map->capacity; g += MAP_GROUP) {
+        GroupMask full = group_full(map->ctrl + g);
+        if (g < cursor) full &= ~0u << (cursor - g);
+        if (full) {
+            result->i = g + lowest_bit(full);
+            break;
+        }
+    }
+    return NULL;
+}
+
+static const MapEntry *entry_at(const Map *map, long long slot) {
+    if (slot < 0 || slot >= map->capacity || (map->ctrl[slot] & 0x80)) return NULL;
+    return &map->entries[slot];
+}
+
+const char *native_map_key(Value *args, Value *result) {
+    const MapEntry *entry = entry_at(ARG_MAP(0), args[1].i);
+    if (!entry) return "invalid map cursor";
+    *result = entry->key;
+    return NULL;
+}
+
+const char *native_map_value(Value *args, Value *result) {
+    const MapEntry *entry = entry_at(ARG_MAP(0), args[1].i);
+    if (!entry) return "invalid map cursor";
+    result->i = entry->value;
+    return NULL;
+}
@@ -0,0 +1,62 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <stdio.h>
+#include "compiler.h"
+
+// -----------------------------
+// pypstdio.variable.map.int / .str
+// -----------------------------
+// Open-addressing hash table from int or string keys to int values.
+// Slots are split into groups of MAP_GROUP; each slot has a one-byte control
+// tag (empty, deleted, or 7 bits of the key's hash), so a probe compares a
+// whole group of tags at once and only touches entries whose tag matches.
+#define MAP_GROUP 16
+
+typedef struct {
+    Value key;             // .i for map.int, .str (owned by the map) for map.str
+    long long value;
+} MapEntry;
+
+typedef struct MapChunk MapChunk;
+typedef struct MapKeyPool MapKeyPool;
+
+typedef struct {
+    VarType key_type;      // VAR_INT or VAR_STRING
+    long long count;       // live entries
+    long long tombstones;  // deleted slots still ending probe groups
+    long long capacity;    // slots; a power of two, at least MAP_GROUP
+    unsigned char *ctrl;   // capacity control tags
+    MapEntry *entries;     // capacity entries
+    MapChunk *keys;        // storage for copied string keys
+    MapKeyPool *free_keys; // key blocks of removed entries, for reuse
+} Map;
+
+// `capacity_hint` entries fit without rehashing.
+Map *map_new(VarType key_type, long long capacity_hint);
+void map_free(Map *map);
+void map_print(FILE *out, const Map *map);
+
+// Snapshots (see snapshot.h) keep a map's exact layout, so cursors taken
+// before one still work after --resume. map_restore() makes a map of
+// `capacity` slots with these control tags and entries, copying the
+// string keys of the full slots; NULL if out of memory, if a full slot has
+// no key, or if `capacity` is not one a map can have.
+int map_slot_full(const Map *map, long long slot);
+Map *map_restore(VarType key_type, long long capacity, long long tombstones, const unsigned char *ctrl,
+                 const MapEntry *entries);
+
+// -----------------------------
+// Builtins (see builtins.c)
+// -----------------------------
+const char *native_map_set(Value *args, Value *result);
+const char *native_map_get(Value *args, Value *result);
+const char *native_map_get_or(Value *args, Value *result);
+const char *native_map_has(Value *args, Value *result);
+const char *native_map_remove(Value *args, Value *result);
+const char *native_map_len(Value *args, Value *result);
+const char *native_map_next(Value *args, Value *result);
+const char *native_map_key(Value *args, Value *result);
+const char *native_map_value(Value *args, Value *result);
+
+#endif // MAP_H
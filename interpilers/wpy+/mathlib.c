@@ -0,0 +1,23 @@
+#include <math.h>
+#include "mathlib.h"
+
+// Out-of-domain arguments give NaN or infinity, as in C.
+const char *native_math_sqrt(Value *args, Value *result) {
+    result->f = sqrt(args[0].f);
+    return NULL;
+}
+
+const char *native_math_exp(Value *args, Value *result) {
+    result->f = exp(args[0].f);
+    return NULL;
+}
+
+const char *native_math_log(Value *args, Value *result) {
+    result->f = log(args[0].f);
+    return NULL;
+}
+
+const char *native_math_pow(Value *args, Value *result) {
+    result->f = pow(args[0].f, args[1].f);
+    return NULL;
+}
@@ -0,0 +1,15 @@
+#ifndef MATHLIB_H
+#define MATHLIB_H
+
+#include "compiler.h"
+
+// -----------------------------
+// pypstdio.math on single floats
+// -----------------------------
+// The float[] overloads run on the SIMD kernels in array.c.
+const char *native_math_sqrt(Value *args, Value *result);
+const char *native_math_exp(Value *args, Value *result);
+const char *native_math_log(Value *args, Value *result);
+const char *native_math_pow(Value *args, Value *result);
+
+#endif // MATHLIB_H
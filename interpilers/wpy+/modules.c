@@ -0,0 +1,831 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L   // st_mtim
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "modules.h"
+#include "builtins.h"
+#include "interpiler.h"
+#include "lexer.h"
+#include "passes.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define PATH_LIST_SEPARATOR ';'
+#define make_dir(path) _mkdir(path)
+#define process_id() _getpid()
+#else
+#include <unistd.h>
+#define PATH_LIST_SEPARATOR ':'
+#define make_dir(path) mkdir(path, 0777)
+#define process_id() getpid()
+#endif
+
+#define CACHE_DIR     "__pypcache__"
+#define CACHE_MAGIC   "PYPC"
+#define CACHE_VERSION 7
+#define HASH_SEED     14695981039346656037ull   // FNV-1a
+
+// Constants in a cache file
+#define CONSTANT_RAW  0   // int or float bits
+#define CONSTANT_NAME 1   // Program.strings
+#define CONSTANT_TEXT 2   // Program.texts
+
+// -----------------------------
+// Registry
+// -----------------------------
+static Module **modules = NULL;
+static int module_count = 0;
+static char *script_dir = NULL;
+
+static char *strdup_local(const char *s) {
+    if (!s) return NULL;
+    size_t n = strlen(s);
+    char *result = malloc(n + 1);
+    if (!result) return NULL;
+    memcpy(result, s, n);
+    result[n] = '\0';
+    return result;
+}
+
+// a/b.pyp -> "a", b.pyp -> "."
+static char *dir_of(const char *path) {
+    const char *slash = strrchr(path, '/');
+    const char *backslash = strrchr(path, '\\');
+    if (backslash && (!slash || backslash > slash)) slash = backslash;
+    if (!slash) return strdup_local(".");
+    size_t n = (size_t)(slash - path);
+    if (n == 0) n = 1;   // "/b.pyp"
+    char *dir = malloc(n + 1);
+    memcpy(dir, path, n);
+    dir[n] = '\0';
+    return dir;
+}
+
+static char *join_path(const char *dir, const char *name, const char *suffix) {
+    size_t length = strlen(dir) + strlen(name) + strlen(suffix) + 2;
+    char *path = malloc(length);
+    snprintf(path, length, "%s/%s%s", dir, name, suffix);
+    return path;
+}
+
+static int is_file(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+void modules_set_script(const char *path) {
+    free(script_dir);
+    script_dir = dir_of(path);
+}
+
+// name.pyp in the script's directory, then in each WPY_PATH directory.
+static char *search(const char *name) {
+    char *path = join_path(script_dir ? script_dir : ".", name, ".pyp");
+    if (is_file(path)) return path;
+    free(path);
+
+    const char *list = getenv("WPY_PATH");
+    while (list && *list) {
+        const char *end = strchr(list, PATH_LIST_SEPARATOR);
+        size_t n = end ? (size_t)(end - list) : strlen(list);
+        if (n > 0) {
+            char *dir = malloc(n + 1);
+            memcpy(dir, list, n);
+            dir[n] = '\0';
+            path = join_path(dir, name, ".pyp");
+            free(dir);
+            if (is_file(path)) return path;
+            free(path);
+        }
+        list = end ? end + 1 : NULL;
+    }
+    return NULL;
+}
+
+Module *module_find(const char *name) {
+    for (int i = 0; i < module_count; i++) {
+        if (strcmp(modules[i]->name, name) == 0) return modules[i];
+    }
+    char *path = search(name);
+    if (!path) return NULL;
+
+    Module *module = calloc(1, sizeof(Module));
+    module->name = strdup_local(name);
+    module->path = path;
+    module->state = MODULE_FOUND;
+    modules = realloc(modules, sizeof(Module *) * (module_count + 1));
+    modules[module_count++] = module;
+    return module;
+}
+
+const ModuleExport *module_function(const char *qualified) {
+    const char *dot = strchr(qualified, '.');
+    if (!dot) return NULL;
+    size_t n = (size_t)(dot - qualified);
+    for (int i = 0; i < module_count; i++) {
+        Module *m = modules[i];
+        if (m->state != MODULE_LOADED || strlen(m->name) != n || strncmp(m->name, qualified, n) != 0) {
+            continue;
+        }
+        for (int k = 0; k < m->export_count; k++) {
+            if (strcmp(m->exports[k].name, dot + 1) == 0) return &m->exports[k];
+        }
+    }
+    return NULL;
+}
+
+// Whole file, NUL-terminated; NULL if it cannot be read.
+static char *read_file(const char *path, size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    char *data = NULL;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        long length = ftell(fp);
+        rewind(fp);
+        data = length >= 0 ? malloc((size_t)length + 1) : NULL;
+        if (data && fread(data, 1, (size_t)length, fp) == (size_t)length) {
+            data[length] = '\0';
+            *size = (size_t)length;
+        } else {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(fp);
+    return data;
+}
+
+static void free_exports(Module *m) {
+    for (int i = 0; i < m->export_count; i++) {
+        free(m->exports[i].name);
+        free(m->exports[i].params);
+        free(m->exports[i].changes);
+    }
+    free(m->exports);
+    m->exports = NULL;
+    m->export_count = 0;
+}
+
+// -----------------------------
+// Compiling from source
+// -----------------------------
+static int compile_source(Module *m) {
+    size_t size;
+    char *source = read_file(m->path, &size);
+    if (!source) {
+        fprintf(stderr, "wpy+.exe: failed to load module %s: %s\n", m->name, m->path);
+        return 0;
+    }
+    if (!check_encoding(m->path, source, size)) {
+        free(source);
+        return 0;
+    }
+    set_source(source);
+    int token_capacity = 1024;
+    Token *tokens = malloc(sizeof(Token) * token_capacity);
+    int token_count = 0;
+    Token tok;
+    do {
+        tok = next_token();
+        if (token_count == token_capacity) {
+            token_capacity *= 2;
+            tokens = realloc(tokens, sizeof(Token) * token_capacity);
+        }
+        tokens[token_count++] = tok;
+    } while (tok.type != TOKEN_EOF);
+
+    ASTNode *root = parse_module(tokens, token_count);
+    for (int i = 0; i < token_count; i++) free(tokens[i].lexeme);
+    free(tokens);
+    free(source);
+    if (!root) {
+        fprintf(stderr, "wpy+.exe: in module %s (%s)\n", m->name, m->path);
+        return 0;
+    }
+
+    run_passes(root);
+    m->program = compile_program(root);
+    m->export_count = root->child_count;
+    m->exports = calloc((size_t)root->child_count + 1, sizeof(ModuleExport));
+    for (int i = 0; i < root->child_count; i++) {
+        ASTNode *func = root->children[i];
+        ModuleExport *e = &m->exports[i];
+        e->name = strdup_local(func->value);
+        e->return_type = func->value_type;
+        e->is_async = (func->int_value & FUNC_ASYNC) != 0;
+        e->is_pure = (func->int_value & FUNC_PURE) != 0;
+        e->shares = (func->int_value & FUNC_SHARES) != 0;
+        e->param_count = func->param_count;
+        e->params = malloc(sizeof(VarType) * (func->param_count ? func->param_count : 1));
+        e->changes = malloc((size_t)func->param_count + 1);
+        for (int k = 0; k < func->param_count; k++) {
+            e->params[k] = func->children[k]->value_type;
+            e->changes[k] = (char)func->children[k]->int_value;
+        }
+    }
+    free_ast(root);
+    return 1;
+}
+
+// -----------------------------
+// Cache files
+// -----------------------------
+// Native byte order and sizes: a cache is only read back by the same
+// interpiler build, which fingerprint() tells apart.
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t n) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < n; i++) h = (h ^ p[i]) * 1099511628211ull;
+    return h;
+}
+
+// Changes whenever the bytecode format, opcodes or builtins do, and with
+// the -O level the code was optimized at (-1 where that does not matter).
+static uint64_t fingerprint(int opt_level) {
+    uint64_t h = HASH_SEED;
+    int sizes[] = { CACHE_VERSION, (int)sizeof(Value), (int)sizeof(Instr), (int)sizeof(ParallelLoop),
+                    (int)sizeof(VarType), OP_HALT, builtin_count, opt_level };
+    h = hash_bytes(h, sizes, sizeof(sizes));
+    for (int op = 0; op <= OP_HALT; op++) {
+        const char *name = opcode_name((OpCode)op);
+        h = hash_bytes(h, name, strlen(name) + 1);
+    }
+    for (int i = 0; i < builtin_count; i++) {
+        h = hash_bytes(h, builtins[i].name, strlen(builtins[i].name) + 1);
+        h = hash_bytes(h, &builtins[i].result, sizeof(VarType));
+        h = hash_bytes(h, &builtins[i].arity, sizeof(int));
+        h = hash_bytes(h, builtins[i].params, sizeof(builtins[i].params));
+    }
+    return h;
+}
+
+// Size and modification time of the source, to tell when it changed.
+static int source_stamp(const char *path, long long stamp[3]) {
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+    stamp[0] = (long long)st.st_size;
+    stamp[1] = (long long)st.st_mtime;
+#ifdef _WIN32
+    stamp[2] = 0;
+#else
+    stamp[2] = (long long)st.st_mtim.tv_nsec;
+#endif
+    return 1;
+}
+
+static char *cache_path(const Module *m) {
+    char *dir = dir_of(m->path);
+    char *cache_dir = join_path(dir, CACHE_DIR, "");
+    char *path = join_path(cache_dir, m->name, ".pypc");
+    free(cache_dir);
+    free(dir);
+    return path;
+}
+
+// Everything written is summed into the file's last 8 bytes, so a damaged
+// cache is recompiled rather than run.
+typedef struct {
+    FILE *fp;
+    uint64_t sum;
+} Writer;
+
+static void put(Writer *w, const void *data, size_t n) {
+    if (n == 0) return;
+    fwrite(data, 1, n, w->fp);
+    w->sum = hash_bytes(w->sum, data, n);
+}
+
+static void put_int(Writer *w, long long v) {
+    put(w, &v, sizeof(v));
+}
+
+static void put_text(Writer *w, const char *s, long long length) {
+    put_int(w, length);
+    put(w, s, (size_t)length);
+}
+
+static void put_signature(Writer *w, const ModuleExport *e) {
+    put_int(w, e->return_type);
+    put_int(w, e->is_async);
+    put_int(w, e->is_pure);
+    put_int(w, e->shares);
+    put_int(w, e->param_count);
+    for (int i = 0; i < e->param_count; i++) {
+        put_int(w, e->params[i]);
+        put_int(w, e->changes[i]);
+    }
+}
+
+// Writes constants[0..count), whose names and texts are owner's strings[]
+// and texts[], made in the same order as the constants.
+static void write_constants(Writer *w, const Value *constants, int count, const Program *owner) {
+    int names = 0, texts = 0;
+    for (int i = 0; i < count; i++) {
+        Value v = constants[i];
+        if (names < owner->string_count && v.s == owner->strings[names]) {
+            put_int(w, CONSTANT_NAME);
+            put_text(w, v.s, (long long)strlen(v.s));
+            names++;
+        } else if (texts < owner->text_count && v.str == owner->texts[texts]) {
+            put_int(w, CONSTANT_TEXT);
+            put_text(w, str_chars(v.str), v.str->length);
+            texts++;
+        } else {
+            put_int(w, CONSTANT_RAW);
+            put(w, &v, sizeof(v));
+        }
+    }
+}
+
+// A linked program (see modules_save_linked) is written without imports:
+// they are resolved already. Its constants are its own, then each loaded
+// module's in link order, which point at that module's strings.
+static void write_program(Writer *w, const Program *p, int linked) {
+    put_int(w, p->function_count);
+    for (int f = 0; f < p->function_count; f++) {
+        const Function *fn = &p->functions[f];
+        put_text(w, fn->name, (long long)strlen(fn->name));
+        put_int(w, fn->param_count);
+        put_int(w, fn->local_count);
+        put_int(w, fn->max_stack);
+        put_int(w, fn->memo_size);
+        put_int(w, fn->region);
+        put_int(w, fn->owns_source);
+        put_int(w, fn->code_count);
+        put(w, fn->code, sizeof(Instr) * (size_t)fn->code_count);
+        put(w, fn->lines, sizeof(int) * (size_t)fn->code_count);
+    }
+
+    put_int(w, p->constant_count);
+    if (linked) {
+        int own = p->constant_count;
+        for (int i = 0; i < module_count; i++) {
+            if (modules[i]->state == MODULE_LOADED) own -= modules[i]->program->constant_count;
+        }
+        write_constants(w, p->constants, own, p);
+        for (int i = 0, at = own; i < module_count; i++) {
+            const Program *from = modules[i]->program;
+            if (modules[i]->state != MODULE_LOADED) continue;
+            write_constants(w, p->constants + at, from->constant_count, from);
+            at += from->constant_count;
+        }
+    } else {
+        write_constants(w, p->constants, p->constant_count, p);
+    }
+
+    put_int(w, p->loop_count);
+    put(w, p->loops, sizeof(ParallelLoop) * (size_t)p->loop_count);
+
+    put_int(w, p->ffi_count);
+    for (int i = 0; i < p->ffi_count; i++) {
+        put_text(w, p->ffi[i].library, (long long)strlen(p->ffi[i].library));
+        put_text(w, p->ffi[i].symbol, (long long)strlen(p->ffi[i].symbol));
+        put_text(w, p->ffi[i].types, (long long)strlen(p->ffi[i].types));
+    }
+
+    put_int(w, linked ? 0 : p->import_count);
+    for (int i = 0; i < p->import_count && !linked; i++) {
+        put_text(w, p->imports[i], (long long)strlen(p->imports[i]));
+        // the signature the module was compiled against
+        put_signature(w, module_function(p->imports[i]));
+    }
+}
+
+// Written under a temporary name and renamed, so a reader never sees half
+// a file. Failing to write the cache is not an error.
+static void write_cache(const Module *m) {
+    long long stamp[3];
+    if (!source_stamp(m->path, stamp)) return;
+    char *dir = dir_of(m->path);
+    char *cache_dir = join_path(dir, CACHE_DIR, "");
+    make_dir(cache_dir);
+    free(cache_dir);
+    free(dir);
+
+    char *path = cache_path(m);
+    size_t length = strlen(path) + 32;
+    char *temp = malloc(length);
+    snprintf(temp, length, "%s.%d.tmp", path, (int)process_id());
+    Writer w = { fopen(temp, "wb"), HASH_SEED };
+    if (w.fp) {
+        uint64_t print = fingerprint(interpiler_options.opt_level);
+        put(&w, CACHE_MAGIC, 4);
+        put(&w, &print, sizeof(print));
+        put(&w, stamp, sizeof(stamp));
+        put_int(&w, m->export_count);
+        for (int i = 0; i < m->export_count; i++) {
+            put_text(&w, m->exports[i].name, (long long)strlen(m->exports[i].name));
+            put_signature(&w, &m->exports[i]);
+        }
+        write_program(&w, m->program, 0);
+        uint64_t sum = w.sum;
+        fwrite(&sum, 1, sizeof(sum), w.fp);
+        int ok = !ferror(w.fp);
+        if (fclose(w.fp) != 0) ok = 0;
+        if (!ok || rename(temp, path) != 0) remove(temp);
+    }
+    free(temp);
+    free(path);
+}
+
+// Reading: every get_* checks the bounds and clears `ok` on a short file.
+typedef struct {
+    const char *data;
+    size_t size;
+    size_t pos;
+    int ok;
+} Reader;
+
+static void get(Reader *r, void *out, size_t n) {
+    if (!r->ok || r->size - r->pos < n) {
+        r->ok = 0;
+        memset(out, 0, n);
+        return;
+    }
+    memcpy(out, r->data + r->pos, n);
+    r->pos += n;
+}
+
+static long long get_int(Reader *r) {
+    long long v;
+    get(r, &v, sizeof(v));
+    return v;
+}
+
+// A count or length that must fit in what is left of the file.
+static int get_count(Reader *r, size_t item_size) {
+    long long n = get_int(r);
+    if (n < 0 || n > INT32_MAX || (size_t)n > (r->size - r->pos) / (item_size ? item_size : 1)) {
+        r->ok = 0;
+        return 0;
+    }
+    return (int)n;
+}
+
+static char *get_text(Reader *r, long long *length) {
+    int n = get_count(r, 1);
+    char *s = malloc((size_t)n + 1);
+    get(r, s, (size_t)n);
+    s[n] = '\0';
+    if (length) *length = n;
+    return s;
+}
+
+static void get_signature(Reader *r, ModuleExport *e) {
+    e->return_type = (VarType)get_int(r);
+    e->is_async = (int)get_int(r);
+    e->is_pure = (int)get_int(r);
+    e->shares = (int)get_int(r);
+    e->param_count = get_count(r, 2 * sizeof(long long));
+    e->params = malloc(sizeof(VarType) * (e->param_count ? e->param_count : 1));
+    e->changes = malloc((size_t)e->param_count + 1);
+    for (int i = 0; i < e->param_count; i++) {
+        e->params[i] = (VarType)get_int(r);
+        e->changes[i] = (char)get_int(r);
+    }
+}
+
+static int same_signature(const ModuleExport *a, const ModuleExport *b) {
+    if (a->return_type != b->return_type || a->is_async != b->is_async || a->is_pure != b->is_pure ||
+        a->shares != b->shares || a->param_count != b->param_count) {
+        return 0;
+    }
+    for (int i = 0; i < a->param_count; i++) {
+        if (a->params[i] != b->params[i] || a->changes[i] != b->changes[i]) return 0;
+    }
+    return 1;
+}
+
+static Program *read_program(Reader *r) {
+    Program *p = calloc(1, sizeof(Program));
+    p->main_index = -1;
+    p->function_count = get_count(r, 8 * sizeof(long long));
+    p->functions = calloc((size_t)p->function_count + 1, sizeof(Function));
+    for (int f = 0; f < p->function_count && r->ok; f++) {
+        Function *fn = &p->functions[f];
+        fn->name = get_text(r, NULL);
+        fn->param_count = (int)get_int(r);
+        fn->local_count = (int)get_int(r);
+        fn->max_stack = (int)get_int(r);
+        fn->memo_size = (int)get_int(r);
+        fn->region = (int)get_int(r);
+        fn->owns_source = (int)get_int(r);
+        fn->code_count = get_count(r, sizeof(Instr) + sizeof(int));
+        fn->code_capacity = fn->code_count;
+        fn->code = malloc(sizeof(Instr) * ((size_t)fn->code_count + 1));
+        fn->lines = malloc(sizeof(int) * ((size_t)fn->code_count + 1));
+        get(r, fn->code, sizeof(Instr) * (size_t)fn->code_count);
+        get(r, fn->lines, sizeof(int) * (size_t)fn->code_count);
+    }
+
+    p->constant_count = p->constant_capacity = get_count(r, 2 * sizeof(long long));
+    p->constants = malloc(sizeof(Value) * ((size_t)p->constant_count + 1));
+    for (int i = 0; i < p->constant_count && r->ok; i++) {
+        long long kind = get_int(r), length;
+        if (kind == CONSTANT_NAME) {
+            p->strings = realloc(p->strings, sizeof(char *) * (p->string_count + 1));
+            p->strings[p->string_count] = get_text(r, NULL);
+            p->constants[i].s = p->strings[p->string_count++];
+        } else if (kind == CONSTANT_TEXT) {
+            char *s = get_text(r, &length);
+            p->texts = realloc(p->texts, sizeof(Str *) * (p->text_count + 1));
+            p->texts[p->text_count] = str_new(s, length);
+            p->constants[i].str = p->texts[p->text_count++];
+            free(s);
+        } else {
+            get(r, &p->constants[i], sizeof(Value));
+        }
+    }
+
+    p->loop_count = get_count(r, sizeof(ParallelLoop));
+    p->loops = malloc(sizeof(ParallelLoop) * ((size_t)p->loop_count + 1));
+    get(r, p->loops, sizeof(ParallelLoop) * (size_t)p->loop_count);
+
+    p->ffi_count = get_count(r, 3 * sizeof(long long));
+    p->ffi = calloc((size_t)p->ffi_count + 1, sizeof(FfiImport));
+    for (int i = 0; i < p->ffi_count && r->ok; i++) {
+        long long length;
+        p->ffi[i].library = get_text(r, NULL);
+        p->ffi[i].symbol = get_text(r, NULL);
+        p->ffi[i].types = get_text(r, &length);
+        p->ffi[i].param_count = (int)length - 1;
+        if (length < 1) r->ok = 0;
+    }
+
+    p->import_count = get_count(r, 2 * sizeof(long long));
+    p->imports = calloc((size_t)p->import_count + 1, sizeof(char *));
+    for (int i = 0; i < p->import_count && r->ok; i++) {
+        p->imports[i] = get_text(r, NULL);
+        ModuleExport expected;
+        get_signature(r, &expected);
+        // the imported module may have changed since this one was compiled
+        char *dot = strchr(p->imports[i], '.');
+        if (r->ok && dot) {
+            *dot = '\0';
+            Module *dependency = module_find(p->imports[i]);
+            *dot = '.';
+            if (!dependency || !module_load(dependency)) r->ok = 0;
+        }
+        const ModuleExport *actual = r->ok ? module_function(p->imports[i]) : NULL;
+        if (!actual || !same_signature(actual, &expected)) r->ok = 0;
+        free(expected.params);
+        free(expected.changes);
+    }
+    return p;
+}
+
+// Takes the module from its cache if that is still up to date.
+static int read_cache(Module *m) {
+    long long stamp[3], cached[3];
+    if (!source_stamp(m->path, stamp)) return 0;
+    char *path = cache_path(m);
+    size_t size = 0;
+    char *data = read_file(path, &size);
+    free(path);
+    if (!data) return 0;
+
+    uint64_t sum = 0;
+    if (size >= sizeof(sum)) memcpy(&sum, data + size - sizeof(sum), sizeof(sum));
+    if (size < sizeof(sum) || hash_bytes(HASH_SEED, data, size - sizeof(sum)) != sum) {
+        free(data);
+        return 0;
+    }
+    Reader r = { data, size - sizeof(sum), 0, 1 };
+    char magic[4];
+    uint64_t print;
+    get(&r, magic, 4);
+    get(&r, &print, sizeof(print));
+    get(&r, cached, sizeof(cached));
+    if (!r.ok || memcmp(magic, CACHE_MAGIC, 4) != 0 || print != fingerprint(interpiler_options.opt_level) ||
+        memcmp(stamp, cached, sizeof(stamp)) != 0) {
+        free(data);
+        return 0;
+    }
+
+    m->export_count = get_count(&r, 6 * sizeof(long long));
+    m->exports = calloc((size_t)m->export_count + 1, sizeof(ModuleExport));
+    for (int i = 0; i < m->export_count && r.ok; i++) {
+        m->exports[i].name = get_text(&r, NULL);
+        get_signature(&r, &m->exports[i]);
+    }
+    // exports are visible while the imports are checked, as when compiling
+    m->program = r.ok ? read_program(&r) : NULL;
+    free(data);
+    if (!r.ok || r.pos != r.size) {
+        free_program(m->program);
+        m->program = NULL;
+        free_exports(m);
+        return 0;
+    }
+    return 1;
+}
+
+// -----------------------------
+// Loading
+// -----------------------------
+int module_load(Module *m) {
+    if (m->state == MODULE_LOADED) return 1;
+    if (m->state == MODULE_LOADING) {
+        fprintf(stderr, "wpy+.exe: circular use of module %s\n", m->name);
+        return 0;
+    }
+    m->state = MODULE_LOADING;
+    if (read_cache(m)) {
+        m->state = MODULE_LOADED;
+        if (!interpiler_options.quiet) printf("Module %s: cached\n", m->name);
+        return 1;
+    }
+    if (!compile_source(m)) {
+        m->state = MODULE_FOUND;
+        return 0;
+    }
+    m->state = MODULE_LOADED;
+    write_cache(m);
+    if (!interpiler_options.quiet) printf("Module %s: compiled %s\n", m->name, m->path);
+    return 1;
+}
+
+// -----------------------------
+// Linking
+// -----------------------------
+static int resolve(const char *qualified) {
+    const char *dot = strchr(qualified, '.');
+    if (dot) {
+        size_t n = (size_t)(dot - qualified);
+        for (int i = 0; i < module_count; i++) {
+            Module *m = modules[i];
+            if (m->state != MODULE_LOADED || strlen(m->name) != n || strncmp(m->name, qualified, n) != 0) {
+                continue;
+            }
+            for (int k = 0; k < m->export_count; k++) {
+                if (strcmp(m->exports[k].name, dot + 1) == 0) return m->base + k;
+            }
+        }
+    }
+    fprintf(stderr, "wpy+.exe: cannot link %s\n", qualified);
+    return -1;
+}
+
+// Moves fn's operands from its own program's numbering (`from`) to the
+// linked program's: its functions start at `base`, its constants at
+// `constant_base`, its loops at `loop_base` and its foreign functions at
+// `ffi_base`.
+static int relocate(Function *fn, const Program *from, int base, int constant_base, int loop_base, int ffi_base) {
+    for (int i = 0; i < fn->code_count; i++) {
+        Instr *ins = &fn->code[i];
+        switch (ins->op) {
+            case OP_CONST:
+            case OP_PRINT_UNDEFINED:
+            case OP_RETURN_STATUS:
+            case OP_BENCH_START:
+            case OP_SNAPSHOT:
+                ins->a += constant_base;
+                break;
+            case OP_CALL:
+            case OP_TAIL_CALL:
+            case OP_SPAWN:
+            case OP_START:
+            case OP_ITER_NEW:
+                if (ins->a < from->function_count) {
+                    ins->a += base;
+                } else {
+                    ins->a = resolve(from->imports[ins->a - from->function_count]);
+                    if (ins->a < 0) return 0;
+                }
+                break;
+            case OP_PARALLEL:
+                ins->a += loop_base;
+                break;
+            case OP_CALL_FFI:
+                ins->a += ffi_base;
+                break;
+            default:
+                break;
+        }
+    }
+    return 1;
+}
+
+int modules_link(Program *program) {
+    int function_total = program->function_count;
+    int constant_total = program->constant_count;
+    int loop_total = program->loop_count;
+    for (int i = 0; i < module_count; i++) {
+        Module *m = modules[i];
+        if (m->state != MODULE_LOADED) continue;
+        m->base = function_total;
+        function_total += m->program->function_count;
+        constant_total += m->program->constant_count;
+        loop_total += m->program->loop_count;
+    }
+
+    // the program's own calls into modules first, with its numbering
+    for (int f = 0; f < program->function_count; f++) {
+        if (!relocate(&program->functions[f], program, 0, 0, 0, 0)) return 0;
+    }
+    if (function_total == program->function_count) return 1;
+
+    program->functions = realloc(program->functions, sizeof(Function) * (size_t)function_total);
+    if (constant_total > program->constant_capacity) {
+        program->constant_capacity = constant_total;
+        program->constants = realloc(program->constants, sizeof(Value) * (size_t)constant_total);
+    }
+    program->loops = realloc(program->loops, sizeof(ParallelLoop) * (size_t)(loop_total ? loop_total : 1));
+
+    // the module keeps its strings; the linked program only points at them
+    for (int i = 0; i < module_count; i++) {
+        Module *m = modules[i];
+        if (m->state != MODULE_LOADED) continue;
+        const Program *from = m->program;
+        int constant_base = program->constant_count, loop_base = program->loop_count;
+        int ffi_base = program->ffi_count;
+        for (int k = 0; k < from->constant_count; k++) program->constants[constant_base + k] = from->constants[k];
+        program->constant_count += from->constant_count;
+        for (int l = 0; l < from->loop_count; l++) {
+            program->loops[loop_base + l] = from->loops[l];
+            program->loops[loop_base + l].body += m->base;
+        }
+        program->loop_count += from->loop_count;
+        if (from->ffi_count) {
+            program->ffi = realloc(program->ffi, sizeof(FfiImport) * (size_t)(ffi_base + from->ffi_count));
+            for (int k = 0; k < from->ffi_count; k++) {
+                FfiImport *import = &program->ffi[ffi_base + k];
+                import->library = strdup_local(from->ffi[k].library);
+                import->symbol = strdup_local(from->ffi[k].symbol);
+                import->types = strdup_local(from->ffi[k].types);
+                import->param_count = from->ffi[k].param_count;
+            }
+            program->ffi_count += from->ffi_count;
+        }
+
+        for (int f = 0; f < from->function_count; f++) {
+            const Function *src = &from->functions[f];
+            Function *fn = &program->functions[m->base + f];
+            *fn = *src;
+            size_t length = strlen(m->name) + strlen(src->name) + 2;
+            fn->name = malloc(length);
+            snprintf(fn->name, length, "%s.%s", m->name, src->name);
+            fn->code = malloc(sizeof(Instr) * ((size_t)src->code_count + 1));
+            fn->lines = malloc(sizeof(int) * ((size_t)src->code_count + 1));
+            memcpy(fn->code, src->code, sizeof(Instr) * (size_t)src->code_count);
+            memcpy(fn->lines, src->lines, sizeof(int) * (size_t)src->code_count);
+            fn->code_capacity = src->code_count;
+            program->function_count++;
+            if (!relocate(fn, from, m->base, constant_base, loop_base, ffi_base)) return 0;
+        }
+    }
+    return 1;
+}
+
+// -----------------------------
+// Linked programs
+// -----------------------------
+// Laid out like a cache file, with no source stamp or exports: the
+// fingerprint, main_index, the program and the sum of them.
+int modules_save_linked(FILE *fp, const Program *program) {
+    Writer w = { fp, HASH_SEED };
+    uint64_t print = fingerprint(-1);
+    put(&w, &print, sizeof(print));
+    put_int(&w, program->main_index);
+    write_program(&w, program, 1);
+    uint64_t sum = w.sum;
+    fwrite(&sum, 1, sizeof(sum), fp);
+    return !ferror(fp);
+}
+
+Program *modules_load_linked(const char *data, size_t size, size_t *used) {
+    Reader r = { data, size, 0, 1 };
+    uint64_t print, sum;
+    get(&r, &print, sizeof(print));
+    if (!r.ok || print != fingerprint(-1)) return NULL;
+    long long main_index = get_int(&r);
+    Program *p = read_program(&r);
+    size_t end = r.pos;
+    get(&r, &sum, sizeof(sum));
+    if (!r.ok || hash_bytes(HASH_SEED, data, end) != sum || main_index < 0 || main_index >= p->function_count) {
+        free_program(p);
+        return NULL;
+    }
+    p->main_index = (int)main_index;
+    *used = r.pos;
+    return p;
+}
+
+void modules_release(void) {
+    for (int i = 0; i < module_count; i++) {
+        free(modules[i]->name);
+        free(modules[i]->path);
+        free_program(modules[i]->program);
+        free_exports(modules[i]);
+        free(modules[i]);
+    }
+    free(modules);
+    modules = NULL;
+    module_count = 0;
+    free(script_dir);
+    script_dir = NULL;
+}
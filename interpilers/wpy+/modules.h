@@ -0,0 +1,72 @@
+#ifndef MODULES_H
+#define MODULES_H
+
+#include <stdio.h>
+#include "compiler.h"
+
+// -----------------------------
+// Modules
+// -----------------------------
+// `use name;` makes the functions of name.pyp callable as name.f(...).
+// A module is found next to the entry script, then in the directories
+// listed in WPY_PATH. It is only read when the importing file actually
+// calls into it, and at most once per process.
+//
+// Each module compiles on its own into a Program whose calls to other
+// modules are imports (see Program.imports). The compiled form is cached in
+// __pypcache__/name.pypc beside the source and reused while the source,
+// the interpiler and the signatures it imports are unchanged. Before the
+// program runs, modules_link() appends every loaded module to it and
+// relocates their constant, function and loop indices.
+
+typedef struct {
+    char *name;            // function name inside its module
+    VarType return_type;   // VAR_UNKNOWN: returns no value
+    VarType *params;
+    char *changes;         // per parameter: may change the container passed in
+    int param_count;
+    int is_async;
+    int is_pure;           // see FUNC_PURE
+    int shares;            // see FUNC_SHARES
+} ModuleExport;
+
+typedef struct {
+    char *name;            // as written after `use`
+    char *path;            // source file
+    int state;             // MODULE_FOUND, MODULE_LOADING or MODULE_LOADED
+    Program *program;      // compiled on its own; main_index is -1
+    ModuleExport *exports; // one per function in the source, in order
+    int export_count;
+    int base;              // first function index once linked
+} Module;
+
+#define MODULE_FOUND   0
+#define MODULE_LOADING 1
+#define MODULE_LOADED  2
+
+// Directory of the entry script; modules are looked up there first.
+void modules_set_script(const char *path);
+
+// Finds name.pyp without reading it. NULL after printing an error.
+Module *module_find(const char *name);
+// Reads, parses and compiles the module (or takes it from its cache) the
+// first time; later calls return at once. 0 after printing an error.
+int module_load(Module *module);
+
+// The exported function "module.function", or NULL.
+const ModuleExport *module_function(const char *qualified);
+
+// Appends the loaded modules to `program` and resolves its imports.
+// 0 after printing an error.
+int modules_link(Program *program);
+void modules_release(void);
+
+// The linked `program`, with the constants it took from modules, in the
+// cache encoding; --snapshot images start with it (see snapshot.h). 0 on a
+// write error.
+int modules_save_linked(FILE *fp, const Program *program);
+// Reads what modules_save_linked wrote at the start of data[0..size) and
+// sets *used to its length. NULL if it is damaged or from another build.
+Program *modules_load_linked(const char *data, size_t size, size_t *used);
+
+#endif // MODULES_H
@@ -0,0 +1,171 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L   // sysconf
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "parallel.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#define PARALLEL_MAX_WORKERS 256
+
+// A participant's remaining chunks [lo, hi), packed as lo | hi << 32 so
+// both ends change in one compare-and-swap. Padded to a cache line so
+// neighbours' updates do not contend.
+typedef struct {
+    _Atomic uint64_t run;
+    char pad[64 - sizeof(uint64_t)];
+} Run;
+
+typedef struct {
+    pthread_once_t once;         // pool_start runs once, whichever thread asks first
+    int workers;                 // participants, counting the caller
+    Run *runs;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;         // a new job was posted
+    pthread_cond_t idle;         // the last busy worker finished
+    unsigned long generation;    // bumped once per job
+    int busy;                    // pool threads still working on the job
+    ChunkFn fn;
+    void *ctx;
+    _Atomic int active;          // a job is running (the pool runs one at a time)
+} Pool;
+
+static Pool pool = { .once = PTHREAD_ONCE_INIT,
+                     .lock = PTHREAD_MUTEX_INITIALIZER,
+                     .wake = PTHREAD_COND_INITIALIZER,
+                     .idle = PTHREAD_COND_INITIALIZER };
+
+// set while this thread runs chunks, so nested jobs run inline
+static _Thread_local int in_job;
+
+static uint64_t pack(uint32_t lo, uint32_t hi) {
+    return (uint64_t)lo | (uint64_t)hi << 32;
+}
+
+// Next chunk from the front of our own run, or -1.
+static int take(int self) {
+    _Atomic uint64_t *run = &pool.runs[self].run;
+    uint64_t r = atomic_load(run);
+    for (;;) {
+        uint32_t lo = (uint32_t)r, hi = (uint32_t)(r >> 32);
+        if (lo >= hi) return -1;
+        if (atomic_compare_exchange_weak(run, &r, pack(lo + 1, hi))) return (int)lo;
+    }
+}
+
+// Moves the back half of some other participant's run into ours and
+// returns its first chunk, or -1 when every run is empty.
+static int steal(int self) {
+    for (int k = 1; k < pool.workers; k++) {
+        _Atomic uint64_t *victim = &pool.runs[(self + k) % pool.workers].run;
+        uint64_t r = atomic_load(victim);
+        for (;;) {
+            uint32_t lo = (uint32_t)r, hi = (uint32_t)(r >> 32);
+            if (lo >= hi) break;
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (atomic_compare_exchange_weak(victim, &r, pack(lo, mid))) {
+                // our run is empty, and thieves only shrink non-empty runs
+                atomic_store(&pool.runs[self].run, pack(mid + 1, hi));
+                return (int)mid;
+            }
+        }
+    }
+    return -1;
+}
+
+static void participate(int self) {
+    in_job = 1;
+    for (;;) {
+        int chunk = take(self);
+        if (chunk < 0) chunk = steal(self);
+        if (chunk < 0) break;
+        pool.fn(pool.ctx, self, chunk);
+    }
+    in_job = 0;
+}
+
+static void *worker_main(void *arg) {
+    int self = (int)(intptr_t)arg;
+    unsigned long seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool.lock);
+        while (pool.generation == seen) pthread_cond_wait(&pool.wake, &pool.lock);
+        seen = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+
+        participate(self);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.busy == 0) pthread_cond_signal(&pool.idle);
+        pthread_mutex_unlock(&pool.lock);
+    }
+    return NULL;
+}
+
+static void pool_start(void) {
+    int workers = 1;
+    const char *env = getenv("WPY_THREADS");
+    if (env && atoi(env) > 0) {
+        workers = atoi(env);
+    } else {
+#ifdef _SC_NPROCESSORS_ONLN
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus > 0) workers = (int)cpus;
+#endif
+    }
+    if (workers > PARALLEL_MAX_WORKERS) workers = PARALLEL_MAX_WORKERS;
+
+    pool.runs = calloc((size_t)workers, sizeof(Run));
+    if (!pool.runs) workers = 1;
+    pool.workers = 1;
+    // threads that fail to start are simply left out
+    for (int i = 1; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_main, (void *)(intptr_t)i) != 0) break;
+        pthread_detach(thread);
+        pool.workers++;
+    }
+}
+
+int parallel_workers(void) {
+    pthread_once(&pool.once, pool_start);
+    return pool.workers;
+}
+
+void parallel_run(int chunk_count, ChunkFn fn, void *ctx) {
+    pthread_once(&pool.once, pool_start);
+    // nested jobs, and jobs from other threads while the pool is busy, run inline
+    if (in_job || pool.workers == 1 || chunk_count == 1 || atomic_exchange(&pool.active, 1)) {
+        int nested = in_job;
+        in_job = 1;
+        for (int chunk = 0; chunk < chunk_count; chunk++) fn(ctx, 0, chunk);
+        in_job = nested;
+        return;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.fn = fn;
+    pool.ctx = ctx;
+    for (int w = 0; w < pool.workers; w++) {
+        uint32_t lo = (uint32_t)((long long)chunk_count * w / pool.workers);
+        uint32_t hi = (uint32_t)((long long)chunk_count * (w + 1) / pool.workers);
+        atomic_store(&pool.runs[w].run, pack(lo, hi));
+    }
+    pool.busy = pool.workers - 1;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    participate(0);
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.busy > 0) pthread_cond_wait(&pool.idle, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+    atomic_store(&pool.active, 0);
+}
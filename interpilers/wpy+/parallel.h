@@ -0,0 +1,29 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// -----------------------------
+// Work-stealing thread pool
+// -----------------------------
+// One pool per interpiler process, started by the first `parallel for`.
+// A job is split into numbered chunks. Each participant (the calling
+// thread plus the pool's workers) starts with a contiguous run of chunk
+// numbers, takes chunks from the front of its own run, and when that is
+// empty steals the back half of another participant's run. Runs are
+// single 64-bit words updated with compare-and-swap, so taking and
+// stealing never lock.
+//
+// WPY_THREADS sets the number of participants (default: online CPUs).
+
+// Called once per chunk; `worker` is the participant's number, from 0 to
+// parallel_workers() - 1. The caller is always participant 0.
+typedef void (*ChunkFn)(void *ctx, int worker, int chunk);
+
+int parallel_workers(void);
+
+// Runs fn(ctx, worker, chunk) for every chunk in 0 .. chunk_count-1 and
+// returns when all have finished. Called from inside a chunk (a nested
+// `parallel for`), or by a task while another thread's job is running, it
+// runs the chunks in order on the calling thread.
+void parallel_run(int chunk_count, ChunkFn fn, void *ctx);
+
+#endif // PARALLEL_H
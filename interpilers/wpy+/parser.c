@@ -1,211 +1,2688 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include "parser.h"
+#include "builtins.h"
+#include "modules.h"
+#include "ffi.h"
 
 static int has_pypstdio = 0;
 
+// -----------------------------
+// Parser state
+// -----------------------------
+static Token *tokens_in = NULL;
+static int count_in = 0;
+static int current = 0;
+static int had_error = 0;
+
+void (*parse_report)(int line, int column, const char *message) = NULL;
+
+// Symbols declared in the function being parsed (name -> type, slot)
+typedef struct {
+    char *name;
+    VarType type;
+    int slot;
+} Symbol;
+
+static Symbol *symbols = NULL;
+static int symbol_count = 0;
+static int symbol_capacity = 0;
+static int symbol_high = 0;      // most slots in use at once in this function
+
+// Inside a parallel for body, which runs on several threads at once
+static int in_parallel = 0;
+// Inside a pypstdio.bench body
+static int in_bench = 0;
+// Statements being parsed, one for a statement directly in a function body
+static int statement_depth = 0;
+// The first `yield`, `return;` and `return value;` of a function returning
+// an iterator: yielding makes it a generator, which cannot return a value
+static Token *first_yield = NULL;
+static Token *bare_return = NULL;
+static Token *value_return = NULL;
+// set by `await` and `async f(...)` for the call they apply to
+static int awaiting = 0;
+
+// Function signatures, collected before any body is parsed so that
+// functions can call each other regardless of their order in the file.
+typedef struct {
+    char *name;
+    VarType return_type;   // VAR_UNKNOWN: returns no value
+    VarType *params;
+    int param_count;
+    int is_async;          // async func: runs as a coroutine
+} Signature;
+
+static Signature *signatures = NULL;
+static int signature_count = 0;
+static int signature_capacity = 0;
+// Open-addressing index of signatures[] by name: index + 1, 0 if empty
+static int *signature_slots = NULL;
+static int signature_slot_count = 0;   // a power of two
+static Signature *current_sig = NULL;
+
+// Modules named by `use` that this file calls into; their functions
+// follow the file's own in signatures[] as "module.function"
+static Module **used = NULL;
+static int used_count = 0;
+// parsing a module: no main
+static int parsing_module = 0;
+
+// Foreign functions declared in the header, called as pypstdio.ffi.name
+typedef struct {
+    char *name;
+    char *library;
+    char *types;       // the return type, then each parameter's (see TYPE_CODE)
+    int param_count;
+} Foreign;
+
+static Foreign *foreign = NULL;
+static int foreign_count = 0;
+
 // -----------------------------
 // Safe strdup replacement
 // -----------------------------
-static char *strdup_local(const char *s) {
-    if (!s) return NULL;
-    size_t n = strlen(s);
-    char *result = (char *)malloc(n + 1);
-    if (!result) return NULL;
-    memcpy(result, s, n);
-    result[n] = '\0';
-    return result;
+static char *strdup_local(const char *s) {
+    if (!s) return NULL;
+    size_t n = strlen(s);
+    char *result = (char *)malloc(n + 1);
+    if (!result) return NULL;
+    memcpy(result, s, n);
+    result[n] = '\0';
+    return result;
+}
+
+// -----------------------------
+// AST node constructors
+// -----------------------------
+static ASTNode *make_node(ASTNodeType type, const char *value) {
+    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
+    node->type = type;
+    node->value = value ? strdup_local(value) : NULL;
+    node->var_type = NULL;
+    node->var_name = NULL;
+    node->var_value = NULL;
+    node->children = NULL;
+    node->child_count = 0;
+    node->value_type = VAR_UNKNOWN;
+    node->op = TOKEN_EOF;
+    node->slot = -1;
+    node->local_count = 0;
+    node->param_count = 0;
+    node->line = 0;
+    node->int_value = 0;
+    node->float_value = 0.0;
+    return node;
+}
+
+static ASTNode *make_var_decl(const char *type, const char *name, const char *value) {
+    ASTNode *node = make_node(AST_VAR_DECL, NULL);
+    node->var_type  = strdup_local(type);
+    node->var_name  = strdup_local(name);
+    node->var_value = strdup_local(value);
+    return node;
+}
+
+static void add_child(ASTNode *parent, ASTNode *child) {
+    parent->children = (ASTNode **)realloc(parent->children, sizeof(ASTNode *) * (parent->child_count + 1));
+    parent->children[parent->child_count++] = child;
+}
+
+static ASTNode *make_int_literal(long long v, VarType type) {
+    char buf[32];
+    if (type == VAR_BOOL) snprintf(buf, sizeof(buf), "%s", v ? "true" : "false");
+    else if (type == VAR_CHAR) snprintf(buf, sizeof(buf), "%c", (char)v);
+    else snprintf(buf, sizeof(buf), "%lld", v);
+    ASTNode *node = make_node(AST_LITERAL, buf);
+    node->value_type = type;
+    node->int_value = v;
+    return node;
+}
+
+static ASTNode *make_float_literal(double v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.17g", v);
+    ASTNode *node = make_node(AST_LITERAL, buf);
+    node->value_type = VAR_FLOAT;
+    node->float_value = v;
+    return node;
+}
+
+// -----------------------------
+// Token helpers
+// -----------------------------
+static Token *peek_tok(void) {
+    return &tokens_in[current < count_in ? current : count_in - 1];
+}
+
+static Token *peek_at(int offset) {
+    int i = current + offset;
+    return &tokens_in[i < count_in ? i : count_in - 1];
+}
+
+static int check(TokenType type) {
+    return peek_tok()->type == type;
+}
+
+static int check_word(const char *word) {
+    Token *t = peek_tok();
+    return t->lexeme && strcmp(t->lexeme, word) == 0;
+}
+
+static Token *advance_tok(void) {
+    Token *t = peek_tok();
+    if (current < count_in && t->type != TOKEN_EOF) current++;
+    return t;
+}
+
+static int match(TokenType type) {
+    if (!check(type)) return 0;
+    advance_tok();
+    return 1;
+}
+
+static void error_at(Token *t, const char *kind, const char *msg) {
+    if (!had_error && parse_report) {
+        char text[256];
+        snprintf(text, sizeof(text), "%s error: %s", kind, msg);
+        parse_report(t->line, t->column, text);
+    } else if (!had_error) {
+        fprintf(stderr, "%s error (line %d): %s near '%s'\n",
+                kind, t->line, msg, t->lexeme ? t->lexeme : "");
+    }
+    had_error = 1;
+}
+
+static Token *expect(TokenType type, const char *msg) {
+    if (check(type)) return advance_tok();
+    error_at(peek_tok(), "Parse", msg);
+    return NULL;
+}
+
+static int expect_word(const char *word) {
+    if (check_word(word)) { advance_tok(); return 1; }
+    char msg[64];
+    snprintf(msg, sizeof(msg), "expected '%s'", word);
+    error_at(peek_tok(), "Parse", msg);
+    return 0;
+}
+
+// -----------------------------
+// Symbol table
+// -----------------------------
+static void reset_symbols(void) {
+    for (int i = 0; i < symbol_count; i++) free(symbols[i].name);
+    symbol_count = 0;
+    symbol_high = 0;
+}
+
+// Forgets the symbols declared after the first `count`; their slots are
+// reused by later declarations.
+static void truncate_symbols(int count) {
+    for (int i = count; i < symbol_count; i++) free(symbols[i].name);
+    symbol_count = count;
+}
+
+static Symbol *find_symbol(const char *name) {
+    for (int i = 0; i < symbol_count; i++) {
+        if (strcmp(symbols[i].name, name) == 0) return &symbols[i];
+    }
+    return NULL;
+}
+
+static Symbol *declare_symbol(const char *name, VarType type) {
+    Symbol *existing = find_symbol(name);
+    if (existing) return existing;
+    if (symbol_count == symbol_capacity) {
+        symbol_capacity = symbol_capacity ? symbol_capacity * 2 : 16;
+        symbols = (Symbol *)realloc(symbols, sizeof(Symbol) * symbol_capacity);
+    }
+    Symbol *sym = &symbols[symbol_count];
+    sym->name = strdup_local(name);
+    sym->type = type;
+    sym->slot = symbol_count;
+    symbol_count++;
+    if (symbol_count > symbol_high) symbol_high = symbol_count;
+    return sym;
+}
+
+const char *var_type_name(VarType type) {
+    switch (type) {
+        case VAR_INT:    return "int";
+        case VAR_CHAR:   return "char";
+        case VAR_STRING: return "string";
+        case VAR_FLOAT:  return "float";
+        case VAR_BOOL:   return "bool";
+        case VAR_ARRAY_INT:   return "int[]";
+        case VAR_ARRAY_FLOAT: return "float[]";
+        case VAR_MAP_INT:     return "map.int";
+        case VAR_MAP_STR:     return "map.str";
+        case VAR_BUILDER:     return "builder";
+        case VAR_READER:      return "file.reader";
+        case VAR_WRITER:      return "file.writer";
+        case VAR_CHANNEL_INT:   return "channel.int";
+        case VAR_CHANNEL_FLOAT: return "channel.float";
+        case VAR_ITER_INT:      return "iter.int";
+        case VAR_ITER_FLOAT:    return "iter.float";
+        default:         return "unknown";
+    }
+}
+
+int var_type_on_heap(VarType type) {
+    return type == VAR_STRING || type == VAR_ARRAY_INT || type == VAR_ARRAY_FLOAT || type == VAR_MAP_INT ||
+           type == VAR_MAP_STR || type == VAR_BUILDER || type == VAR_READER || type == VAR_WRITER ||
+           type == VAR_ITER_INT || type == VAR_ITER_FLOAT;
+}
+
+static VarType type_from_token(TokenType type) {
+    switch (type) {
+        case TOKEN_TYPE_INT:         return VAR_INT;
+        case TOKEN_TYPE_CHAR:        return VAR_CHAR;
+        case TOKEN_TYPE_CHAR_STRING: return VAR_STRING;
+        case TOKEN_TYPE_FLOAT:       return VAR_FLOAT;
+        case TOKEN_TYPE_BOOL:        return VAR_BOOL;
+        default:                     return VAR_UNKNOWN;
+    }
+}
+
+static int is_array_type(VarType t) {
+    return t == VAR_ARRAY_INT || t == VAR_ARRAY_FLOAT;
+}
+
+static int is_file_type(VarType t) {
+    return t == VAR_READER || t == VAR_WRITER;
+}
+
+static int is_channel_type(VarType t) {
+    return t == VAR_CHANNEL_INT || t == VAR_CHANNEL_FLOAT;
+}
+
+static int is_iter_type(VarType t) {
+    return t == VAR_ITER_INT || t == VAR_ITER_FLOAT;
+}
+
+// What an iterator of type t produces
+static VarType iter_element(VarType t) {
+    return t == VAR_ITER_FLOAT ? VAR_FLOAT : VAR_INT;
+}
+
+// Arrays, maps, builders and channels are created with a size, files with
+// a path; all of them are shared by reference.
+static int is_container_type(VarType t) {
+    return is_array_type(t) || t == VAR_MAP_INT || t == VAR_MAP_STR || t == VAR_BUILDER ||
+           is_file_type(t) || is_channel_type(t);
+}
+
+// Reads a type written at tokens[index] (`int`, `float[]`, `map.str`, `builder`,
+// `file.reader`, `channel.int`, `iter.float`, ...)
+// and returns how many tokens it spans in *span (0 if it is not a type).
+static VarType type_at(int index, int *span) {
+    *span = 0;
+    if (index >= count_in) return VAR_UNKNOWN;
+    if (tokens_in[index].type == TOKEN_IDENTIFIER && strcmp(tokens_in[index].lexeme, "builder") == 0 &&
+        index + 1 < count_in && tokens_in[index + 1].type == TOKEN_IDENTIFIER) {
+        *span = 1;
+        return VAR_BUILDER;
+    }
+    if (index + 2 < count_in && tokens_in[index].type == TOKEN_IDENTIFIER &&
+        strcmp(tokens_in[index].lexeme, "map") == 0 && tokens_in[index + 1].type == TOKEN_DOT) {
+        Token *key = &tokens_in[index + 2];
+        if (key->type == TOKEN_TYPE_INT || (key->lexeme && strcmp(key->lexeme, "str") == 0)) {
+            *span = 3;
+            return key->type == TOKEN_TYPE_INT ? VAR_MAP_INT : VAR_MAP_STR;
+        }
+        return VAR_UNKNOWN;
+    }
+    if (index + 2 < count_in && tokens_in[index].type == TOKEN_IDENTIFIER &&
+        strcmp(tokens_in[index].lexeme, "file") == 0 && tokens_in[index + 1].type == TOKEN_DOT) {
+        const char *kind = tokens_in[index + 2].lexeme;
+        if (kind && (strcmp(kind, "reader") == 0 || strcmp(kind, "writer") == 0)) {
+            *span = 3;
+            return strcmp(kind, "reader") == 0 ? VAR_READER : VAR_WRITER;
+        }
+        return VAR_UNKNOWN;
+    }
+    if (index + 2 < count_in && tokens_in[index].type == TOKEN_IDENTIFIER &&
+        strcmp(tokens_in[index].lexeme, "channel") == 0 && tokens_in[index + 1].type == TOKEN_DOT) {
+        TokenType elem = tokens_in[index + 2].type;
+        if (elem == TOKEN_TYPE_INT || elem == TOKEN_TYPE_FLOAT) {
+            *span = 3;
+            return elem == TOKEN_TYPE_INT ? VAR_CHANNEL_INT : VAR_CHANNEL_FLOAT;
+        }
+        return VAR_UNKNOWN;
+    }
+    if (index + 2 < count_in && tokens_in[index].type == TOKEN_IDENTIFIER &&
+        strcmp(tokens_in[index].lexeme, "iter") == 0 && tokens_in[index + 1].type == TOKEN_DOT) {
+        TokenType elem = tokens_in[index + 2].type;
+        if (elem == TOKEN_TYPE_INT || elem == TOKEN_TYPE_FLOAT) {
+            *span = 3;
+            return elem == TOKEN_TYPE_INT ? VAR_ITER_INT : VAR_ITER_FLOAT;
+        }
+        return VAR_UNKNOWN;
+    }
+    VarType t = type_from_token(tokens_in[index].type);
+    if (t == VAR_UNKNOWN) return t;
+    *span = 1;
+    if (index + 2 < count_in && tokens_in[index + 1].type == TOKEN_LBRACKET &&
+        tokens_in[index + 2].type == TOKEN_RBRACKET) {
+        *span = 3;
+        if (t == VAR_INT) return VAR_ARRAY_INT;
+        if (t == VAR_FLOAT) return VAR_ARRAY_FLOAT;
+        *span = 0;
+        return VAR_UNKNOWN;
+    }
+    return t;
+}
+
+static void reset_signatures(void) {
+    for (int i = 0; i < signature_count; i++) {
+        free(signatures[i].name);
+        free(signatures[i].params);
+    }
+    free(signatures);
+    free(signature_slots);
+    signatures = NULL;
+    signature_count = 0;
+    signature_capacity = 0;
+    signature_slots = NULL;
+    signature_slot_count = 0;
+    current_sig = NULL;
+}
+
+static unsigned name_hash(const char *name) {
+    unsigned h = 2166136261u;
+    for (; *name; name++) h = (h ^ (unsigned char)*name) * 16777619u;
+    return h;
+}
+
+static int find_signature(const char *name) {
+    if (!signature_slot_count) return -1;
+    unsigned mask = (unsigned)signature_slot_count - 1;
+    for (unsigned i = name_hash(name) & mask; signature_slots[i]; i = (i + 1) & mask) {
+        int index = signature_slots[i] - 1;
+        if (strcmp(signatures[index].name, name) == 0) return index;
+    }
+    return -1;
+}
+
+static void index_signature(int index) {
+    unsigned mask = (unsigned)signature_slot_count - 1;
+    unsigned i = name_hash(signatures[index].name) & mask;
+    while (signature_slots[i]) i = (i + 1) & mask;
+    signature_slots[i] = index + 1;
+}
+
+// Appends a signature named `name` (taken over) with no parameters.
+static Signature *add_signature(char *name) {
+    if (signature_count == signature_capacity) {
+        signature_capacity = signature_capacity ? signature_capacity * 2 : 16;
+        signatures = (Signature *)realloc(signatures, sizeof(Signature) * signature_capacity);
+    }
+    Signature *sig = &signatures[signature_count++];
+    sig->name = name;
+    sig->return_type = VAR_UNKNOWN;
+    sig->params = NULL;
+    sig->param_count = 0;
+    sig->is_async = 0;
+
+    if (signature_count * 2 > signature_slot_count) {
+        free(signature_slots);
+        signature_slot_count = signature_slot_count ? signature_slot_count * 2 : 32;
+        while (signature_count * 2 > signature_slot_count) signature_slot_count *= 2;
+        signature_slots = calloc((size_t)signature_slot_count, sizeof(int));
+        for (int i = 0; i < signature_count; i++) index_signature(i);
+    } else {
+        index_signature(signature_count - 1);
+    }
+    return sig;
+}
+
+static void reset_foreign(void) {
+    for (int i = 0; i < foreign_count; i++) {
+        free(foreign[i].name);
+        free(foreign[i].library);
+        free(foreign[i].types);
+    }
+    free(foreign);
+    foreign = NULL;
+    foreign_count = 0;
+}
+
+static Foreign *find_foreign(const char *name) {
+    for (int i = 0; i < foreign_count; i++) {
+        if (strcmp(foreign[i].name, name) == 0) return &foreign[i];
+    }
+    return NULL;
+}
+
+static Module *used_module(const char *name) {
+    for (int i = 0; i < used_count; i++) {
+        if (strcmp(used[i]->name, name) == 0) return used[i];
+    }
+    return NULL;
+}
+
+// Whether the tokens at `offset` start a call: name(...) or module.name(...).
+static int call_ahead(int offset) {
+    Token *name = peek_at(offset);
+    if (name->type != TOKEN_IDENTIFIER) return 0;
+    if (peek_at(offset + 1)->type == TOKEN_LPAREN) return 1;
+    return peek_at(offset + 1)->type == TOKEN_DOT && peek_at(offset + 2)->type == TOKEN_IDENTIFIER &&
+           peek_at(offset + 3)->type == TOKEN_LPAREN && used_module(name->lexeme) &&
+           !find_symbol(name->lexeme);
+}
+
+// Scans every `[async] func name(type a, ...) [type]` header ahead of
+// parsing, from the end of the file header (whose `ffi` lines declare
+// foreign functions, not the file's own).
+static void collect_signatures(void) {
+    for (int i = current; i + 2 < count_in; i++) {
+        if (tokens_in[i].type != TOKEN_FUNC || tokens_in[i + 1].type != TOKEN_IDENTIFIER ||
+            tokens_in[i + 2].type != TOKEN_LPAREN) {
+            continue;
+        }
+        if (find_signature(tokens_in[i + 1].lexeme) >= 0) {
+            error_at(&tokens_in[i + 1], "Semantic", "function defined twice");
+            return;
+        }
+
+        Signature *sig = add_signature(strdup_local(tokens_in[i + 1].lexeme));
+        sig->is_async = i > 0 && tokens_in[i - 1].type == TOKEN_IDENTIFIER &&
+                        strcmp(tokens_in[i - 1].lexeme, "async") == 0;
+
+        int k = i + 3, span;
+        while (k < count_in && tokens_in[k].type != TOKEN_RPAREN && tokens_in[k].type != TOKEN_EOF) {
+            VarType t = type_at(k, &span);
+            if (t != VAR_UNKNOWN) {
+                sig->params = (VarType *)realloc(sig->params, sizeof(VarType) * (sig->param_count + 1));
+                sig->params[sig->param_count++] = t;
+                k += span;
+            } else {
+                k++;
+            }
+        }
+        sig->return_type = type_at(k + 1, &span);
+    }
+}
+
+// -----------------------------
+// Expressions
+// -----------------------------
+static int is_numeric(VarType t) {
+    return t == VAR_INT || t == VAR_CHAR || t == VAR_FLOAT;
+}
+
+static ASTNode *parse_expression(void);
+
+// Checks that a value of type `from` may initialize a variable of type `to`.
+static int assignable(VarType to, VarType from) {
+    if (to == from) return 1;
+    if ((to == VAR_INT || to == VAR_CHAR) && (from == VAR_INT || from == VAR_CHAR)) return 1;
+    if (to == VAR_INT && from == VAR_BOOL) return 1;
+    if (to == VAR_FLOAT && (from == VAR_INT || from == VAR_CHAR)) return 1;
+    return 0;
+}
+
+// int arithmetic wraps around, exactly as the VM's does, so that folding
+// never changes a result.
+static long long wrap(uint64_t v) {
+    return (long long)v;
+}
+
+static long long negate(long long v) {
+    return wrap(0 - (uint64_t)v);
+}
+
+// Evaluates a binary operator over two constant operands.
+static ASTNode *fold_binary(TokenType op, ASTNode *l, ASTNode *r, VarType result) {
+    int is_float = l->value_type == VAR_FLOAT || r->value_type == VAR_FLOAT;
+    double lf = l->value_type == VAR_FLOAT ? l->float_value : (double)l->int_value;
+    double rf = r->value_type == VAR_FLOAT ? r->float_value : (double)r->int_value;
+    long long li = l->int_value, ri = r->int_value;
+    uint64_t lu = (uint64_t)li, ru = (uint64_t)ri;
+
+    switch (op) {
+        case TOKEN_PLUS:  return is_float ? make_float_literal(lf + rf) : make_int_literal(wrap(lu + ru), result);
+        case TOKEN_MINUS: return is_float ? make_float_literal(lf - rf) : make_int_literal(wrap(lu - ru), result);
+        case TOKEN_STAR:  return is_float ? make_float_literal(lf * rf) : make_int_literal(wrap(lu * ru), result);
+        case TOKEN_SLASH:
+            if (is_float) return make_float_literal(lf / rf);
+            if (ri == 0) return NULL; // left for the runtime to report
+            return make_int_literal(ri == -1 ? negate(li) : li / ri, result);
+        case TOKEN_PERCENT:
+            if (ri == 0) return NULL;
+            return make_int_literal(ri == -1 ? 0 : li % ri, result);
+        case TOKEN_EQEQ:  return make_int_literal(is_float ? lf == rf : li == ri, VAR_BOOL);
+        case TOKEN_BANGEQ:return make_int_literal(is_float ? lf != rf : li != ri, VAR_BOOL);
+        case TOKEN_LT:    return make_int_literal(is_float ? lf <  rf : li <  ri, VAR_BOOL);
+        case TOKEN_GT:    return make_int_literal(is_float ? lf >  rf : li >  ri, VAR_BOOL);
+        case TOKEN_LTEQ:  return make_int_literal(is_float ? lf <= rf : li <= ri, VAR_BOOL);
+        case TOKEN_GTEQ:  return make_int_literal(is_float ? lf >= rf : li >= ri, VAR_BOOL);
+        default:          return NULL;
+    }
+}
+
+// Joins two string literals.
+static ASTNode *concat_literals(ASTNode *l, ASTNode *r) {
+    size_t ll = strlen(l->value), rl = strlen(r->value);
+    char *text = malloc(ll + rl + 1);
+    memcpy(text, l->value, ll);
+    memcpy(text + ll, r->value, rl + 1);
+    ASTNode *folded = make_node(AST_LITERAL, text);
+    free(text);
+    folded->value_type = VAR_STRING;
+    return folded;
+}
+
+static ASTNode *make_binary(Token *op_tok, ASTNode *l, ASTNode *r) {
+    if (!l || !r) {
+        free_ast(l);
+        free_ast(r);
+        return NULL;
+    }
+
+    TokenType op = op_tok->type;
+    VarType lt = l->value_type, rt = r->value_type;
+    VarType result = VAR_UNKNOWN;
+
+    if (lt == VAR_UNKNOWN || rt == VAR_UNKNOWN) {
+        error_at(op_tok, "Semantic", "operand has no value (undeclared variable or call without return type)");
+    } else if (op == TOKEN_PLUS && lt == VAR_STRING && rt == VAR_STRING) {
+        result = VAR_STRING;
+    } else if (op == TOKEN_PLUS || op == TOKEN_MINUS || op == TOKEN_STAR ||
+               op == TOKEN_SLASH || op == TOKEN_PERCENT) {
+        if (!is_numeric(lt) || !is_numeric(rt)) {
+            error_at(op_tok, "Semantic", "arithmetic needs int, char or float operands");
+        } else if (op == TOKEN_PERCENT && (lt == VAR_FLOAT || rt == VAR_FLOAT)) {
+            error_at(op_tok, "Semantic", "'%' needs integer operands");
+        } else {
+            result = (lt == VAR_FLOAT || rt == VAR_FLOAT) ? VAR_FLOAT : VAR_INT;
+        }
+    } else if (op == TOKEN_EQEQ || op == TOKEN_BANGEQ) {
+        int comparable = lt == rt && !is_container_type(lt) && !is_iter_type(lt);
+        if ((is_numeric(lt) && is_numeric(rt)) || comparable) result = VAR_BOOL;
+        else error_at(op_tok, "Semantic", "cannot compare values of different types");
+    } else {
+        if (is_numeric(lt) && is_numeric(rt)) result = VAR_BOOL;
+        else error_at(op_tok, "Semantic", "ordering needs int, char or float operands");
+    }
+
+    if (result == VAR_UNKNOWN) {
+        free_ast(l);
+        free_ast(r);
+        return NULL;
+    }
+
+    // Constant folding
+    if (l->type == AST_LITERAL && r->type == AST_LITERAL && result == VAR_STRING) {
+        ASTNode *folded = concat_literals(l, r);
+        folded->line = op_tok->line;
+        free_ast(l);
+        free_ast(r);
+        return folded;
+    }
+    if (l->type == AST_LITERAL && r->type == AST_LITERAL && lt != VAR_STRING) {
+        ASTNode *folded = fold_binary(op, l, r, result);
+        if (folded) {
+            folded->line = op_tok->line;
+            free_ast(l);
+            free_ast(r);
+            return folded;
+        }
+    }
+
+    ASTNode *node = make_node(AST_BINARY, op_tok->lexeme);
+    node->op = op;
+    node->value_type = result;
+    node->line = op_tok->line;
+    add_child(node, l);
+    add_child(node, r);
+    return node;
+}
+
+// name(arg, ...) or module.name(arg, ...)  (the first name is consumed)
+static ASTNode *parse_call(Token *name_tok) {
+    int awaited = awaiting;
+    awaiting = 0;
+    const char *name = name_tok->lexeme;
+    char qualified[256];
+    if (check(TOKEN_DOT)) {
+        advance_tok();
+        Token *function_tok = advance_tok();
+        snprintf(qualified, sizeof(qualified), "%s.%s", name_tok->lexeme, function_tok->lexeme);
+        name = qualified;
+    }
+    int index = find_signature(name);
+    if (index < 0) {
+        char msg[320];
+        if (name == qualified) {
+            snprintf(msg, sizeof(msg), "module '%s' has no function '%s'", name_tok->lexeme,
+                     name + strlen(name_tok->lexeme) + 1);
+        } else {
+            snprintf(msg, sizeof(msg), "call to undefined function");
+        }
+        error_at(name_tok, "Semantic", msg);
+        return NULL;
+    }
+    if (strcmp(name, "main") == 0) {
+        error_at(name_tok, "Semantic", "'main' cannot be called");
+        return NULL;
+    }
+    Signature *sig = &signatures[index];
+    if (sig->is_async && !awaited) {
+        error_at(name_tok, "Semantic", "an async function must be awaited, or started with async f(...);");
+        return NULL;
+    }
+
+    advance_tok(); // (
+    ASTNode *call = make_node(AST_CALL, name);
+    call->slot = index;
+    call->value_type = sig->return_type;
+    call->line = name_tok->line;
+    while (!check(TOKEN_RPAREN) && !check(TOKEN_EOF)) {
+        ASTNode *arg = parse_expression();
+        if (!arg) {
+            free_ast(call);
+            return NULL;
+        }
+        add_child(call, arg);
+        if (!match(TOKEN_COMMA)) break;
+    }
+    if (!expect(TOKEN_RPAREN, "expected ')'")) {
+        free_ast(call);
+        return NULL;
+    }
+
+    if (call->child_count != sig->param_count) {
+        error_at(name_tok, "Semantic", "wrong number of arguments");
+        free_ast(call);
+        return NULL;
+    }
+    for (int i = 0; i < call->child_count; i++) {
+        if (!assignable(sig->params[i], call->children[i]->value_type)) {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "argument %d must be %s, got %s", i + 1,
+                     var_type_name(sig->params[i]), var_type_name(call->children[i]->value_type));
+            error_at(name_tok, "Semantic", msg);
+            free_ast(call);
+            return NULL;
+        }
+    }
+    return call;
+}
+
+// Builtin parameters take the same implicit conversions as variables.
+static int builtin_accepts(VarType param, VarType arg) {
+    return assignable(param, arg);
+}
+
+// pypstdio.iter.map(it, f), .filter(it, f) and .take(it, n)  (the path is
+// consumed). Each makes an iterator that pulls from `it` only as it is
+// pulled from itself. f is named like a call: `f` or `module.f`.
+static ASTNode *parse_iter(Token *first, const char *path) {
+    int kind = strcmp(path, "iter.map") == 0 ? ITER_MAP : strcmp(path, "iter.filter") == 0 ? ITER_FILTER : ITER_TAKE;
+    if (!expect(TOKEN_LPAREN, "expected '('")) return NULL;
+    ASTNode *source = parse_expression();
+    if (!source) return NULL;
+    ASTNode *node = make_node(AST_ITER, NULL);
+    node->int_value = kind;
+    node->line = first->line;
+    node->value_type = source->value_type;
+    add_child(node, source);
+    char msg[192];
+    if (!is_iter_type(source->value_type)) {
+        snprintf(msg, sizeof(msg), "pypstdio.%s needs an iterator, got %s", path, var_type_name(source->value_type));
+        error_at(first, "Semantic", msg);
+        free_ast(node);
+        return NULL;
+    }
+    if (!expect(TOKEN_COMMA, "expected ','")) {
+        free_ast(node);
+        return NULL;
+    }
+
+    if (kind == ITER_TAKE) {
+        ASTNode *count = parse_expression();
+        if (!count) {
+            free_ast(node);
+            return NULL;
+        }
+        add_child(node, count);
+        if (!assignable(VAR_INT, count->value_type)) {
+            error_at(first, "Semantic", "pypstdio.iter.take needs an int count");
+            free_ast(node);
+            return NULL;
+        }
+    } else {
+        Token *name_tok = expect(TOKEN_IDENTIFIER, "expected a function name");
+        if (!name_tok) {
+            free_ast(node);
+            return NULL;
+        }
+        const char *name = name_tok->lexeme;
+        char qualified[256];
+        if (check(TOKEN_DOT) && peek_at(1)->type == TOKEN_IDENTIFIER) {
+            advance_tok();
+            snprintf(qualified, sizeof(qualified), "%s.%s", name, advance_tok()->lexeme);
+            name = qualified;
+        }
+        int index = find_signature(name);
+        if (index < 0 || strcmp(name, "main") == 0) {
+            error_at(name_tok, "Semantic", "expected the name of a function");
+            free_ast(node);
+            return NULL;
+        }
+        Signature *sig = &signatures[index];
+        VarType elem = iter_element(source->value_type), result = sig->return_type;
+        int fits = !sig->is_async && sig->param_count == 1 && assignable(sig->params[0], elem);
+        if (kind == ITER_MAP) {
+            fits = fits && (is_numeric(result) || result == VAR_BOOL);
+            node->value_type = result == VAR_FLOAT ? VAR_ITER_FLOAT : VAR_ITER_INT;
+        } else {
+            fits = fits && result == VAR_BOOL;
+        }
+        if (!fits) {
+            snprintf(msg, sizeof(msg), "pypstdio.%s needs a function that takes one %s and returns %s", path,
+                     var_type_name(elem), kind == ITER_MAP ? "an int or float" : "a bool");
+            error_at(name_tok, "Semantic", msg);
+            free_ast(node);
+            return NULL;
+        }
+        node->value = strdup_local(name);
+        node->slot = index;
+    }
+    if (!expect(TOKEN_RPAREN, "expected ')'")) {
+        free_ast(node);
+        return NULL;
+    }
+    return node;
+}
+
+// pypstdio.ffi.name(args)  (the path is consumed). The arguments must
+// convert to the types of name's `ffi` declaration.
+static ASTNode *parse_ffi_call(Token *first, const char *name) {
+    const Foreign *f = find_foreign(name);
+    if (!f) {
+        error_at(first, "Semantic", "no ffi declaration of this function");
+        return NULL;
+    }
+    if (!expect(TOKEN_LPAREN, "expected '('")) return NULL;
+
+    ASTNode *call = make_node(AST_FFI, name);
+    call->line = first->line;
+    while (!check(TOKEN_RPAREN) && !check(TOKEN_EOF)) {
+        ASTNode *arg = parse_expression();
+        if (!arg) {
+            free_ast(call);
+            return NULL;
+        }
+        add_child(call, arg);
+        if (!match(TOKEN_COMMA)) break;
+    }
+    if (!expect(TOKEN_RPAREN, "expected ')'")) {
+        free_ast(call);
+        return NULL;
+    }
+    int fits = call->child_count == f->param_count;
+    for (int i = 0; fits && i < f->param_count; i++) {
+        fits = assignable((VarType)(f->types[i + 1] - TYPE_CODE(0)), call->children[i]->value_type);
+    }
+    if (!fits) {
+        char msg[192];
+        snprintf(msg, sizeof(msg), "arguments do not match the ffi declaration of %s", name);
+        error_at(first, "Semantic", msg);
+        free_ast(call);
+        return NULL;
+    }
+    call->var_value = strdup_local(f->library);
+    call->var_type = strdup_local(f->types);
+    call->value_type = ffi_result(f->types);
+    return call;
+}
+
+// pypstdio.<module>.<name>(args)  (the "pypstdio." prefix is consumed)
+static ASTNode *parse_builtin_call(void) {
+    int awaited = awaiting;
+    awaiting = 0;
+    Token *first = peek_tok();
+    char path[128] = "";
+    for (;;) {
+        Token *part = advance_tok();
+        if (!part->lexeme || !((part->lexeme[0] >= 'a' && part->lexeme[0] <= 'z') ||
+                               (part->lexeme[0] >= 'A' && part->lexeme[0] <= 'Z'))) {
+            error_at(part, "Parse", "expected pypstdio member name");
+            return NULL;
+        }
+        if (strlen(path) + strlen(part->lexeme) + 2 > sizeof(path)) {
+            error_at(part, "Parse", "pypstdio member name too long");
+            return NULL;
+        }
+        if (path[0]) strcat(path, ".");
+        strcat(path, part->lexeme);
+        if (!match(TOKEN_DOT)) break;
+    }
+    // C code runs as it would from any thread, so this is allowed in parallel for
+    if (strncmp(path, "ffi.", 4) == 0 && strchr(path + 4, '.') == NULL) return parse_ffi_call(first, path + 4);
+    int combinator = strcmp(path, "iter.map") == 0 || strcmp(path, "iter.filter") == 0 ||
+                     strcmp(path, "iter.take") == 0;
+    if (!combinator && !builtin_name_exists(path)) {
+        error_at(first, "Semantic", "unknown pypstdio member");
+        return NULL;
+    }
+    if (in_parallel && (strncmp(path, "input.", 6) == 0 || strncmp(path, "file.", 5) == 0 ||
+                        strncmp(path, "csv.", 4) == 0 || strncmp(path, "channel.", 8) == 0 ||
+                        strncmp(path, "task.", 5) == 0 || strncmp(path, "loop.", 5) == 0 ||
+                        strncmp(path, "iter.", 5) == 0)) {
+        // reads and writes would interleave in whatever order threads ran
+        error_at(first, "Semantic",
+                 "stdin, file, csv, channel, iter, task and loop builtins cannot be used inside parallel for");
+        return NULL;
+    }
+    if (current_sig->is_async && strcmp(path, "loop.run") == 0) {
+        error_at(first, "Semantic", "pypstdio.loop.run cannot be called from an async function");
+        return NULL;
+    }
+    if (combinator) return parse_iter(first, path);
+    if (!expect(TOKEN_LPAREN, "expected '('")) return NULL;
+
+    ASTNode *call = make_node(AST_BUILTIN, path);
+    call->line = first->line;
+    while (!check(TOKEN_RPAREN) && !check(TOKEN_EOF)) {
+        ASTNode *arg = parse_expression();
+        if (!arg) {
+            free_ast(call);
+            return NULL;
+        }
+        add_child(call, arg);
+        if (!match(TOKEN_COMMA)) break;
+    }
+    if (!expect(TOKEN_RPAREN, "expected ')'") || call->child_count > BUILTIN_MAX_PARAMS) {
+        if (!had_error) error_at(first, "Semantic", "too many arguments");
+        free_ast(call);
+        return NULL;
+    }
+
+    VarType arg_types[BUILTIN_MAX_PARAMS];
+    for (int i = 0; i < call->child_count; i++) arg_types[i] = call->children[i]->value_type;
+    int index = find_builtin(path, arg_types, call->child_count, builtin_accepts);
+    if (index < 0) {
+        char msg[192];
+        snprintf(msg, sizeof(msg), "no pypstdio.%s accepts these argument types", path);
+        error_at(first, "Semantic", msg);
+        free_ast(call);
+        return NULL;
+    }
+    if (builtin_awaits(index) && !awaited) {
+        char msg[160];
+        snprintf(msg, sizeof(msg), "pypstdio.%s must be awaited", path);
+        error_at(first, "Semantic", msg);
+        free_ast(call);
+        return NULL;
+    }
+    call->slot = index;
+    call->value_type = builtins[index].result;
+    return call;
+}
+
+// a[i]  (the array name is consumed)
+static ASTNode *parse_index(Token *name_tok, Symbol *sym) {
+    advance_tok(); // [
+    if (!is_array_type(sym->type)) {
+        error_at(name_tok, "Semantic", "only arrays can be indexed");
+        return NULL;
+    }
+    ASTNode *index = parse_expression();
+    if (!index) return NULL;
+    if (!expect(TOKEN_RBRACKET, "expected ']'")) {
+        free_ast(index);
+        return NULL;
+    }
+    if (index->value_type != VAR_INT && index->value_type != VAR_CHAR) {
+        error_at(name_tok, "Semantic", "array index must be an int");
+        free_ast(index);
+        return NULL;
+    }
+    ASTNode *node = make_node(AST_INDEX, name_tok->lexeme);
+    node->slot = sym->slot;
+    node->value_type = sym->type == VAR_ARRAY_INT ? VAR_INT : VAR_FLOAT;
+    node->line = name_tok->line;
+    add_child(node, index);
+    return node;
+}
+
+static ASTNode *parse_primary(void);
+
+// await f(args) / await pypstdio.io.read(fd, b): makes the call, letting the
+// event loop run other coroutines whenever it has to wait.
+static ASTNode *parse_await(void) {
+    Token *await_tok = advance_tok();
+    if (!current_sig->is_async) {
+        error_at(await_tok, "Semantic", "await outside an async function");
+        return NULL;
+    }
+    if (in_parallel) {
+        error_at(await_tok, "Semantic", "cannot await inside parallel for");
+        return NULL;
+    }
+    awaiting = 1;
+    ASTNode *call = parse_primary();
+    awaiting = 0;
+    if (!call) return NULL;
+    if (!(call->type == AST_CALL && signatures[call->slot].is_async) &&
+        !(call->type == AST_BUILTIN && builtin_awaits(call->slot))) {
+        error_at(await_tok, "Semantic", "await needs a call to an async function or an awaitable builtin");
+        free_ast(call);
+        return NULL;
+    }
+    return call;
+}
+
+static ASTNode *parse_primary(void) {
+    Token *t = peek_tok();
+
+    if (t->type == TOKEN_IDENTIFIER && strcmp(t->lexeme, "await") == 0 &&
+        peek_at(1)->type == TOKEN_IDENTIFIER && !find_symbol(t->lexeme)) {
+        return parse_await();
+    }
+
+    if (t->type == TOKEN_NUMBER) {
+        advance_tok();
+        if (strpbrk(t->lexeme, ".eE")) return make_float_literal(strtod(t->lexeme, NULL));
+        ASTNode *lit = make_int_literal(strtoll(t->lexeme, NULL, 10), VAR_INT);
+        lit->line = t->line;
+        return lit;
+    }
+    if (t->type == TOKEN_STRING) {
+        advance_tok();
+        ASTNode *lit = make_node(AST_LITERAL, t->lexeme);
+        lit->value_type = VAR_STRING;
+        lit->line = t->line;
+        return lit;
+    }
+    if (t->type == TOKEN_CHAR_LITERAL) {
+        advance_tok();
+        ASTNode *lit = make_int_literal((unsigned char)t->lexeme[0], VAR_CHAR);
+        lit->line = t->line;
+        return lit;
+    }
+    if (t->type == TOKEN_IDENTIFIER) {
+        advance_tok();
+        if (check(TOKEN_LPAREN)) return parse_call(t);
+        if (strcmp(t->lexeme, "pypstdio") == 0 && check(TOKEN_DOT) && !find_symbol(t->lexeme)) {
+            if (!has_pypstdio) {
+                error_at(t, "Semantic", "'pypstdio' used without #include <pypstdio>");
+                return NULL;
+            }
+            advance_tok();
+            return parse_builtin_call();
+        }
+        if (check(TOKEN_DOT) && call_ahead(-1)) return parse_call(t);
+        Symbol *sym = find_symbol(t->lexeme);
+        if (sym && check(TOKEN_LBRACKET)) return parse_index(t, sym);
+        if (!sym && strcmp(t->lexeme, "true") == 0) return make_int_literal(1, VAR_BOOL);
+        if (!sym && strcmp(t->lexeme, "false") == 0) return make_int_literal(0, VAR_BOOL);
+        ASTNode *id = make_node(AST_IDENTIFIER, t->lexeme);
+        id->line = t->line;
+        if (sym) {
+            id->slot = sym->slot;
+            id->value_type = sym->type;
+        }
+        return id;
+    }
+    if (match(TOKEN_LPAREN)) {
+        ASTNode *inner = parse_expression();
+        if (!expect(TOKEN_RPAREN, "expected ')'")) {
+            free_ast(inner);
+            return NULL;
+        }
+        return inner;
+    }
+
+    error_at(t, "Parse", "expected expression");
+    return NULL;
+}
+
+static ASTNode *parse_unary(void) {
+    if (check(TOKEN_MINUS)) {
+        Token *op_tok = advance_tok();
+        ASTNode *operand = parse_unary();
+        if (!operand) return NULL;
+        if (operand->value_type != VAR_INT && operand->value_type != VAR_CHAR &&
+            operand->value_type != VAR_FLOAT) {
+            error_at(op_tok, "Semantic", "unary '-' needs int, char or float operand");
+            free_ast(operand);
+            return NULL;
+        }
+        if (operand->type == AST_LITERAL) {
+            ASTNode *folded = operand->value_type == VAR_FLOAT
+                ? make_float_literal(-operand->float_value)
+                : make_int_literal(negate(operand->int_value), VAR_INT);
+            free_ast(operand);
+            return folded;
+        }
+        ASTNode *node = make_node(AST_UNARY, op_tok->lexeme);
+        node->op = TOKEN_MINUS;
+        node->value_type = operand->value_type == VAR_FLOAT ? VAR_FLOAT : VAR_INT;
+        node->line = op_tok->line;
+        add_child(node, operand);
+        return node;
+    }
+    return parse_primary();
+}
+
+static ASTNode *parse_factor(void) {
+    ASTNode *left = parse_unary();
+    while (left && (check(TOKEN_STAR) || check(TOKEN_SLASH) || check(TOKEN_PERCENT))) {
+        Token *op_tok = advance_tok();
+        left = make_binary(op_tok, left, parse_unary());
+    }
+    return left;
+}
+
+static ASTNode *parse_term(void) {
+    ASTNode *left = parse_factor();
+    while (left && (check(TOKEN_PLUS) || check(TOKEN_MINUS))) {
+        Token *op_tok = advance_tok();
+        left = make_binary(op_tok, left, parse_factor());
+    }
+    return left;
+}
+
+static ASTNode *parse_comparison(void) {
+    ASTNode *left = parse_term();
+    while (left && (check(TOKEN_LT) || check(TOKEN_GT) || check(TOKEN_LTEQ) || check(TOKEN_GTEQ))) {
+        Token *op_tok = advance_tok();
+        left = make_binary(op_tok, left, parse_term());
+    }
+    return left;
+}
+
+static ASTNode *parse_expression(void) {
+    ASTNode *left = parse_comparison();
+    while (left && (check(TOKEN_EQEQ) || check(TOKEN_BANGEQ))) {
+        Token *op_tok = advance_tok();
+        left = make_binary(op_tok, left, parse_comparison());
+    }
+    return left;
+}
+
+// -----------------------------
+// Statements
+// -----------------------------
+
+// pypstdio.variable.<type>(name, expr);  (the "pypstdio.variable." prefix is consumed)
+static ASTNode *parse_var_decl(void) {
+    Token *type_tok = advance_tok();
+    const char *type = type_tok->lexeme;
+    VarType declared;
+
+    if (strcmp(type, "int") == 0) {
+        declared = VAR_INT;
+    } else if (strcmp(type, "char") == 0) {
+        declared = VAR_CHAR;
+        // string: pypstdio.variable.char.str(name, "value");
+        if (match(TOKEN_DOT)) {
+            if (!expect_word("str")) return NULL;
+            declared = VAR_STRING;
+            type = "string";
+        }
+    } else if (strcmp(type, "bool") == 0) {
+        declared = VAR_BOOL;
+    } else if (strcmp(type, "float") == 0) {
+        declared = VAR_FLOAT;
+    } else if (strcmp(type, "array") == 0) {
+        // pypstdio.variable.array.int(name, length);
+        if (!expect(TOKEN_DOT, "expected '.'")) return NULL;
+        Token *elem_tok = advance_tok();
+        if (elem_tok->type == TOKEN_TYPE_INT) {
+            declared = VAR_ARRAY_INT;
+            type = "array.int";
+        } else if (elem_tok->type == TOKEN_TYPE_FLOAT) {
+            declared = VAR_ARRAY_FLOAT;
+            type = "array.float";
+        } else {
+            error_at(elem_tok, "Parse", "arrays hold int or float");
+            return NULL;
+        }
+    } else if (strcmp(type, "builder") == 0) {
+        // pypstdio.variable.builder(name, capacity_hint);
+        declared = VAR_BUILDER;
+    } else if (strcmp(type, "file") == 0) {
+        // pypstdio.variable.file.reader(name, path);
+        if (!expect(TOKEN_DOT, "expected '.'")) return NULL;
+        Token *kind_tok = advance_tok();
+        if (kind_tok->lexeme && strcmp(kind_tok->lexeme, "reader") == 0) {
+            declared = VAR_READER;
+            type = "file.reader";
+        } else if (kind_tok->lexeme && strcmp(kind_tok->lexeme, "writer") == 0) {
+            declared = VAR_WRITER;
+            type = "file.writer";
+        } else {
+            error_at(kind_tok, "Parse", "files are opened as reader or writer");
+            return NULL;
+        }
+    } else if (strcmp(type, "channel") == 0) {
+        // pypstdio.variable.channel.int(name, capacity);
+        if (!expect(TOKEN_DOT, "expected '.'")) return NULL;
+        Token *elem_tok = advance_tok();
+        if (elem_tok->type == TOKEN_TYPE_INT) {
+            declared = VAR_CHANNEL_INT;
+            type = "channel.int";
+        } else if (elem_tok->type == TOKEN_TYPE_FLOAT) {
+            declared = VAR_CHANNEL_FLOAT;
+            type = "channel.float";
+        } else {
+            error_at(elem_tok, "Parse", "channels carry int or float");
+            return NULL;
+        }
+    } else if (strcmp(type, "iter") == 0) {
+        // pypstdio.variable.iter.int(name, generator(args));
+        if (!expect(TOKEN_DOT, "expected '.'")) return NULL;
+        Token *elem_tok = advance_tok();
+        if (elem_tok->type == TOKEN_TYPE_INT) {
+            declared = VAR_ITER_INT;
+            type = "iter.int";
+        } else if (elem_tok->type == TOKEN_TYPE_FLOAT) {
+            declared = VAR_ITER_FLOAT;
+            type = "iter.float";
+        } else {
+            error_at(elem_tok, "Parse", "iterators produce int or float");
+            return NULL;
+        }
+    } else if (strcmp(type, "map") == 0) {
+        // pypstdio.variable.map.int(name, capacity_hint);
+        if (!expect(TOKEN_DOT, "expected '.'")) return NULL;
+        Token *key_tok = advance_tok();
+        if (key_tok->type == TOKEN_TYPE_INT) {
+            declared = VAR_MAP_INT;
+            type = "map.int";
+        } else if (key_tok->lexeme && strcmp(key_tok->lexeme, "str") == 0) {
+            declared = VAR_MAP_STR;
+            type = "map.str";
+        } else {
+            error_at(key_tok, "Parse", "map keys are int or str");
+            return NULL;
+        }
+    } else {
+        error_at(type_tok, "Parse", "unknown variable type");
+        return NULL;
+    }
+
+    if (!expect(TOKEN_LPAREN, "expected '('")) return NULL;
+    Token *name_tok = expect(TOKEN_IDENTIFIER, "expected variable name");
+    if (!name_tok) return NULL;
+    if (!expect(TOKEN_COMMA, "expected ','")) return NULL;
+    ASTNode *init = parse_expression();
+    if (!init) return NULL;
+    if (!expect(TOKEN_RPAREN, "expected ')'") || !expect(TOKEN_SEMICOLON, "expected ';'")) {
+        free_ast(init);
+        return NULL;
+    }
+
+    if (is_file_type(declared)) {
+        if (init->value_type != VAR_STRING) {
+            error_at(name_tok, "Semantic", "file path must be a string");
+            free_ast(init);
+            return NULL;
+        }
+    } else if (is_container_type(declared)) {
+        if (init->value_type != VAR_INT && init->value_type != VAR_CHAR) {
+            error_at(name_tok, "Semantic", is_array_type(declared) ? "array length must be an int"
+                                                                   : "capacity must be an int");
+            free_ast(init);
+            return NULL;
+        }
+    } else if (!assignable(declared, init->value_type)) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "cannot initialize %s variable with %s value",
+                 var_type_name(declared), var_type_name(init->value_type));
+        error_at(name_tok, "Semantic", msg);
+        free_ast(init);
+        return NULL;
+    }
+
+    Symbol *sym = find_symbol(name_tok->lexeme);
+    if (sym && sym->type != declared) {
+        error_at(name_tok, "Semantic", "variable redeclared with a different type");
+        free_ast(init);
+        return NULL;
+    }
+    if (!sym) sym = declare_symbol(name_tok->lexeme, declared);
+
+    ASTNode *decl = make_var_decl(type, name_tok->lexeme,
+                                  init->type == AST_LITERAL ? init->value : NULL);
+    decl->value_type = declared;
+    decl->slot = sym->slot;
+    decl->line = name_tok->line;
+    add_child(decl, init);
+    return decl;
+}
+
+// pypstdio.print(expr, ...);  (the "pypstdio.print" prefix is consumed)
+static ASTNode *parse_print(void) {
+    if (!expect(TOKEN_LPAREN, "expected '('")) return NULL;
+    ASTNode *print = make_node(AST_PRINT, NULL);
+    while (!check(TOKEN_RPAREN) && !check(TOKEN_EOF)) {
+        ASTNode *arg = parse_expression();
+        if (!arg) {
+            free_ast(print);
+            return NULL;
+        }
+        if ((arg->type == AST_CALL || arg->type == AST_BUILTIN || arg->type == AST_FFI) &&
+            arg->value_type == VAR_UNKNOWN) {
+            error_at(peek_tok(), "Semantic", "printed function returns no value");
+            free_ast(arg);
+            free_ast(print);
+            return NULL;
+        }
+        if (arg->value_type == VAR_WRITER || is_iter_type(arg->value_type)) {
+            error_at(peek_tok(), "Semantic", arg->value_type == VAR_WRITER ? "cannot print a file writer"
+                                                                           : "cannot print an iterator");
+            free_ast(arg);
+            free_ast(print);
+            return NULL;
+        }
+        add_child(print, arg);
+        if (!match(TOKEN_COMMA)) break;
+    }
+    if (!expect(TOKEN_RPAREN, "expected ')'") || !expect(TOKEN_SEMICOLON, "expected ';'")) {
+        free_ast(print);
+        return NULL;
+    }
+    return print;
+}
+
+static ASTNode *parse_block(void);
+
+// pypstdio.bench("name", iterations, warmup) { ... }  runs the block
+// `warmup` times untimed, then `iterations` times timed, and prints the
+// timings. The warmup count is optional.
+static ASTNode *parse_bench(void) {
+    Token *bench_tok = advance_tok();
+    if (in_parallel) {
+        error_at(bench_tok, "Semantic", "pypstdio.bench cannot be used inside parallel for");
+        return NULL;
+    }
+    if (!expect(TOKEN_LPAREN, "expected '('")) return NULL;
+    if (!check(TOKEN_STRING)) {
+        error_at(peek_tok(), "Semantic", "pypstdio.bench needs a string literal name");
+        return NULL;
+    }
+    ASTNode *node = make_node(AST_BENCH, advance_tok()->lexeme);
+    while (match(TOKEN_COMMA)) {
+        if (node->child_count == 2) {
+            error_at(bench_tok, "Semantic", "pypstdio.bench takes a name, an iteration count and a warmup count");
+            free_ast(node);
+            return NULL;
+        }
+        ASTNode *count = parse_expression();
+        if (!count) {
+            free_ast(node);
+            return NULL;
+        }
+        add_child(node, count);
+        if (!assignable(VAR_INT, count->value_type)) {
+            error_at(bench_tok, "Semantic", "pypstdio.bench counts must be ints");
+            free_ast(node);
+            return NULL;
+        }
+    }
+    if (node->child_count == 0) {
+        error_at(bench_tok, "Semantic", "pypstdio.bench needs an iteration count");
+        free_ast(node);
+        return NULL;
+    }
+    if (!expect(TOKEN_RPAREN, "expected ')'")) {
+        free_ast(node);
+        return NULL;
+    }
+
+    in_bench++;
+    ASTNode *body = parse_block();
+    in_bench--;
+    if (!body) {
+        free_ast(node);
+        return NULL;
+    }
+    add_child(node, body);
+    return node;
+}
+
+// pypstdio.snapshot();  with --snapshot, saves the run here and ends it
+// (see snapshot.h). Only main's own variables are saved, so it must stand
+// directly in main's body, where nothing else is running, and what is in
+// scope must be data: files, channels and iterators cannot be saved.
+static ASTNode *parse_snapshot(void) {
+    Token *snapshot_tok = advance_tok();
+    if (!expect(TOKEN_LPAREN, "expected '('") || !expect(TOKEN_RPAREN, "expected ')'") ||
+        !expect(TOKEN_SEMICOLON, "expected ';'")) {
+        return NULL;
+    }
+    if (strcmp(current_sig->name, "main") != 0 || statement_depth != 1) {
+        error_at(snapshot_tok, "Semantic", "pypstdio.snapshot() can only stand directly in main's body");
+        return NULL;
+    }
+    char *types = malloc((size_t)symbol_count + 1);
+    for (int i = 0; i < symbol_count; i++) {
+        VarType t = symbols[i].type;
+        if (is_file_type(t) || is_channel_type(t) || is_iter_type(t)) {
+            char msg[192];
+            snprintf(msg, sizeof(msg), "pypstdio.snapshot() cannot save %s, a %s", symbols[i].name,
+                     var_type_name(t));
+            error_at(snapshot_tok, "Semantic", msg);
+            free(types);
+            return NULL;
+        }
+        types[symbols[i].slot] = TYPE_CODE(t);
+    }
+    types[symbol_count] = '\0';
+    ASTNode *node = make_node(AST_SNAPSHOT, types);
+    free(types);
+    return node;
+}
+
+static ASTNode *parse_pypstdio(void) {
+    Token *pypstdio_tok = advance_tok();
+    if (!has_pypstdio) {
+        if (parse_report) error_at(pypstdio_tok, "Semantic", "'pypstdio' used without #include <pypstdio>");
+        else fprintf(stderr, "Semantic error: 'pypstdio' used without #include <pypstdio>\n");
+        had_error = 1;
+        return NULL;
+    }
+    if (!expect(TOKEN_DOT, "expected '.'")) return NULL;
+
+    if (check_word("variable")) {
+        advance_tok();
+        if (!expect(TOKEN_DOT, "expected '.'")) return NULL;
+        return parse_var_decl();
+    }
+    if (check_word("print")) {
+        advance_tok();
+        return parse_print();
+    }
+    if (check_word("bench") && peek_at(1)->type == TOKEN_LPAREN) {
+        return parse_bench();
+    }
+    if (check_word("snapshot") && peek_at(1)->type == TOKEN_LPAREN) {
+        return parse_snapshot();
+    }
+
+    // anything else is a builtin call used as a statement
+    ASTNode *call = parse_builtin_call();
+    if (call && !expect(TOKEN_SEMICOLON, "expected ';'")) {
+        free_ast(call);
+        return NULL;
+    }
+    return call;
+}
+
+static ASTNode *parse_return(void) {
+    Token *ret_tok = advance_tok();
+    ASTNode *ret;
+    if (in_parallel) {
+        error_at(ret_tok, "Semantic", "cannot return from inside parallel for");
+        return NULL;
+    }
+    if (in_bench) {
+        error_at(ret_tok, "Semantic", "cannot return from inside pypstdio.bench");
+        return NULL;
+    }
+    int is_main = strcmp(current_sig->name, "main") == 0;
+
+    if (is_main && check(TOKEN_IDENTIFIER) && !find_symbol(peek_tok()->lexeme) &&
+        peek_at(1)->type == TOKEN_SEMICOLON) {
+        // `return success;` / `return failure;` report a status word
+        ret = make_node(AST_RETURN, advance_tok()->lexeme);
+    } else if (!is_main && check(TOKEN_SEMICOLON)) {
+        // a generator ends with `return;`, which is only known once it yields
+        if (is_iter_type(current_sig->return_type)) {
+            if (!bare_return) bare_return = ret_tok;
+        } else if (current_sig->return_type != VAR_UNKNOWN) {
+            error_at(ret_tok, "Semantic", "missing return value");
+            return NULL;
+        }
+        ret = make_node(AST_RETURN, NULL);
+    } else {
+        ASTNode *value = parse_expression();
+        if (!value) return NULL;
+        if (value->value_type == VAR_UNKNOWN) {
+            error_at(ret_tok, "Semantic", "returned expression has no value");
+            free_ast(value);
+            return NULL;
+        }
+        if (is_main && (is_container_type(value->value_type) || is_iter_type(value->value_type))) {
+            error_at(ret_tok, "Semantic", "main can only return a plain value");
+            free_ast(value);
+            return NULL;
+        }
+        if (!is_main && !assignable(current_sig->return_type, value->value_type)) {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "cannot return %s from a function returning %s",
+                     var_type_name(value->value_type), var_type_name(current_sig->return_type));
+            error_at(ret_tok, "Semantic", msg);
+            free_ast(value);
+            return NULL;
+        }
+        if (is_iter_type(current_sig->return_type) && !value_return) value_return = ret_tok;
+        ret = make_node(AST_RETURN, NULL);
+        ret->value_type = is_main ? value->value_type : current_sig->return_type;
+        add_child(ret, value);
+    }
+    ret->line = ret_tok->line;
+    if (!expect(TOKEN_SEMICOLON, "expected ';'")) {
+        free_ast(ret);
+        return NULL;
+    }
+    return ret;
+}
+
+// yield expr;  hands a value to whatever pulls from the generator, which
+// then waits right here until the next value is asked for.
+static ASTNode *parse_yield(void) {
+    Token *yield_tok = advance_tok();
+    if (!is_iter_type(current_sig->return_type) || strcmp(current_sig->name, "main") == 0) {
+        error_at(yield_tok, "Semantic", "yield outside a generator (a function returning iter.int or iter.float)");
+        return NULL;
+    }
+    if (current_sig->is_async) {
+        error_at(yield_tok, "Semantic", "async functions cannot yield");
+        return NULL;
+    }
+    if (in_parallel) {
+        error_at(yield_tok, "Semantic", "cannot yield from inside parallel for");
+        return NULL;
+    }
+    if (in_bench) {
+        error_at(yield_tok, "Semantic", "cannot yield from inside pypstdio.bench");
+        return NULL;
+    }
+    ASTNode *value = parse_expression();
+    if (!value) return NULL;
+    VarType elem = iter_element(current_sig->return_type);
+    if (!assignable(elem, value->value_type)) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "cannot yield %s from a generator of %s", var_type_name(value->value_type),
+                 var_type_name(elem));
+        error_at(yield_tok, "Semantic", msg);
+        free_ast(value);
+        return NULL;
+    }
+    if (!expect(TOKEN_SEMICOLON, "expected ';'")) {
+        free_ast(value);
+        return NULL;
+    }
+    ASTNode *node = make_node(AST_YIELD, NULL);
+    node->value_type = elem;
+    add_child(node, value);
+    if (!first_yield) first_yield = yield_tok;
+    return node;
+}
+
+// name = expr  (no trailing ';')
+static ASTNode *parse_assignment(void) {
+    Token *name_tok = advance_tok();
+    Token *eq_tok = expect(TOKEN_EQUAL, "expected '='");
+    if (!eq_tok) return NULL;
+
+    Symbol *sym = find_symbol(name_tok->lexeme);
+    if (!sym) {
+        error_at(name_tok, "Semantic", "assignment to undeclared variable");
+        return NULL;
+    }
+    ASTNode *value = parse_expression();
+    if (!value) return NULL;
+    if (!assignable(sym->type, value->value_type)) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "cannot assign %s value to %s variable",
+                 var_type_name(value->value_type), var_type_name(sym->type));
+        error_at(eq_tok, "Semantic", msg);
+        free_ast(value);
+        return NULL;
+    }
+
+    ASTNode *assign = make_node(AST_ASSIGN, name_tok->lexeme);
+    assign->value_type = sym->type;
+    assign->slot = sym->slot;
+    assign->line = name_tok->line;
+    add_child(assign, value);
+    return assign;
+}
+
+// name[index] = expr;
+static ASTNode *parse_index_assignment(void) {
+    Token *name_tok = advance_tok();
+    Symbol *sym = find_symbol(name_tok->lexeme);
+    if (!sym) {
+        error_at(name_tok, "Semantic", "assignment to undeclared variable");
+        return NULL;
+    }
+    ASTNode *target = parse_index(name_tok, sym);
+    if (!target) return NULL;
+    Token *eq_tok = expect(TOKEN_EQUAL, "expected '='");
+    ASTNode *value = eq_tok ? parse_expression() : NULL;
+    if (!value || !expect(TOKEN_SEMICOLON, "expected ';'")) {
+        free_ast(target);
+        free_ast(value);
+        return NULL;
+    }
+    if (!assignable(target->value_type, value->value_type)) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "cannot store %s value in %s",
+                 var_type_name(value->value_type), var_type_name(sym->type));
+        error_at(eq_tok, "Semantic", msg);
+        free_ast(target);
+        free_ast(value);
+        return NULL;
+    }
+
+    // reuse the index node's children: [index, value]
+    target->type = AST_STORE_INDEX;
+    add_child(target, value);
+    return target;
+}
+
+// ( expr ) used by if / while
+static ASTNode *parse_condition(void) {
+    if (!expect(TOKEN_LPAREN, "expected '('")) return NULL;
+    ASTNode *cond = parse_expression();
+    if (!cond) return NULL;
+    if (!expect(TOKEN_RPAREN, "expected ')'")) {
+        free_ast(cond);
+        return NULL;
+    }
+    return cond;
+}
+
+// Conditions are bool, or int/char compared against zero.
+static int check_condition(ASTNode *cond, Token *at) {
+    VarType t = cond->value_type;
+    if (t == VAR_BOOL || t == VAR_INT || t == VAR_CHAR) return 1;
+    error_at(at, "Semantic", "condition must be bool, int or char");
+    return 0;
+}
+
+static ASTNode *parse_statement(void);
+
+static ASTNode *parse_block(void) {
+    Token *open = expect(TOKEN_LBRACE, "expected '{'");
+    if (!open) return NULL;
+    ASTNode *block = make_node(AST_BLOCK, NULL);
+    block->line = open->line;
+    while (!check(TOKEN_RBRACE) && !check(TOKEN_EOF) && !had_error) {
+        ASTNode *stmt = parse_statement();
+        if (stmt) add_child(block, stmt);
+    }
+    if (!expect(TOKEN_RBRACE, "expected '}'")) {
+        free_ast(block);
+        return NULL;
+    }
+    return block;
+}
+
+static ASTNode *parse_if(void) {
+    Token *if_tok = advance_tok();
+    ASTNode *cond = parse_condition();
+    if (!cond || !check_condition(cond, if_tok)) {
+        free_ast(cond);
+        return NULL;
+    }
+    ASTNode *node = make_node(AST_IF, NULL);
+    add_child(node, cond);
+
+    ASTNode *then_block = parse_block();
+    if (!then_block) {
+        free_ast(node);
+        return NULL;
+    }
+    add_child(node, then_block);
+
+    if (match(TOKEN_ELSE)) {
+        ASTNode *else_block;
+        if (check(TOKEN_IF)) {
+            // else if: wrap the nested if in a block
+            int line = peek_tok()->line;
+            ASTNode *nested = parse_if();
+            if (!nested) {
+                free_ast(node);
+                return NULL;
+            }
+            nested->line = line;
+            else_block = make_node(AST_BLOCK, NULL);
+            add_child(else_block, nested);
+        } else {
+            else_block = parse_block();
+            if (!else_block) {
+                free_ast(node);
+                return NULL;
+            }
+        }
+        add_child(node, else_block);
+    }
+    return node;
+}
+
+static ASTNode *parse_while(void) {
+    Token *while_tok = advance_tok();
+    ASTNode *cond = parse_condition();
+    if (!cond || !check_condition(cond, while_tok)) {
+        free_ast(cond);
+        return NULL;
+    }
+    ASTNode *body = parse_block();
+    if (!body) {
+        free_ast(cond);
+        return NULL;
+    }
+    ASTNode *node = make_node(AST_WHILE, NULL);
+    add_child(node, cond);
+    add_child(node, body);
+    return node;
+}
+
+static int check_parallel_for(ASTNode *node, int first_body_slot, Token *at);
+static int parse_reductions(ASTNode *node, int first_body_slot);
+
+// spawn f(args);  runs f on its own thread. The arguments are copied, so
+// only values that can be shared between threads are allowed: numbers,
+// arrays and channels.
+static ASTNode *parse_spawn(void) {
+    Token *spawn_tok = advance_tok();
+    if (in_parallel) {
+        error_at(spawn_tok, "Semantic", "cannot spawn inside parallel for");
+        return NULL;
+    }
+    if (current_sig->is_async) {
+        error_at(spawn_tok, "Semantic", "cannot spawn inside an async function");
+        return NULL;
+    }
+    ASTNode *call = parse_call(advance_tok());
+    if (!call) return NULL;
+    if (!expect(TOKEN_SEMICOLON, "expected ';'")) {
+        free_ast(call);
+        return NULL;
+    }
+    for (int i = 0; i < call->child_count; i++) {
+        VarType t = call->children[i]->value_type;
+        if (t != VAR_INT && t != VAR_CHAR && t != VAR_BOOL && t != VAR_FLOAT &&
+            !is_array_type(t) && !is_channel_type(t)) {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "cannot pass a %s to a spawned task", var_type_name(t));
+            error_at(spawn_tok, "Semantic", msg);
+            free_ast(call);
+            return NULL;
+        }
+    }
+    ASTNode *spawn = make_node(AST_SPAWN, NULL);
+    spawn->line = spawn_tok->line;
+    add_child(spawn, call);
+    return spawn;
+}
+
+// async f(args);  starts the async function f as a coroutine on this
+// thread's event loop and carries on. The loop runs it when the current
+// coroutine waits, at pypstdio.loop.run(), or when main returns.
+static ASTNode *parse_start(void) {
+    Token *async_tok = advance_tok();
+    if (in_parallel) {
+        error_at(async_tok, "Semantic", "cannot start coroutines inside parallel for");
+        return NULL;
+    }
+    awaiting = 1;
+    ASTNode *call = parse_call(advance_tok());
+    awaiting = 0;
+    if (!call) return NULL;
+    if (!signatures[call->slot].is_async) {
+        error_at(async_tok, "Semantic", "only async functions can be started with async");
+        free_ast(call);
+        return NULL;
+    }
+    if (!expect(TOKEN_SEMICOLON, "expected ';'")) {
+        free_ast(call);
+        return NULL;
+    }
+    ASTNode *start = make_node(AST_START, NULL);
+    start->line = async_tok->line;
+    add_child(start, call);
+    return start;
+}
+
+// for (init; cond; step) { ... }
+// init is a declaration or assignment statement, step an assignment.
+// With `parallel`, the header may be followed by reduce(a, b).
+static ASTNode *parse_for(int parallel) {
+    Token *for_tok = advance_tok();
+    if (!expect(TOKEN_LPAREN, "expected '('")) return NULL;
+
+    ASTNode *node = make_node(AST_FOR, NULL);
+    ASTNode *init = parse_statement();
+    if (!init) {
+        free_ast(node);
+        return NULL;
+    }
+    add_child(node, init);
+
+    ASTNode *cond = parse_expression();
+    if (!cond || !check_condition(cond, for_tok)) {
+        free_ast(cond);
+        free_ast(node);
+        return NULL;
+    }
+    add_child(node, cond);
+    if (!expect(TOKEN_SEMICOLON, "expected ';'")) {
+        free_ast(node);
+        return NULL;
+    }
+
+    if (!check(TOKEN_IDENTIFIER)) {
+        error_at(peek_tok(), "Parse", "expected assignment");
+        free_ast(node);
+        return NULL;
+    }
+    ASTNode *step = parse_assignment();
+    if (!step) {
+        free_ast(node);
+        return NULL;
+    }
+    add_child(node, step);
+    if (!expect(TOKEN_RPAREN, "expected ')'")) {
+        free_ast(node);
+        return NULL;
+    }
+
+    if (!parallel) {
+        ASTNode *body = parse_block();
+        if (!body) {
+            free_ast(node);
+            return NULL;
+        }
+        add_child(node, body);
+        return node;
+    }
+
+    // Variables declared in a parallel body are private to each iteration
+    // and go out of scope when the loop ends.
+    node->type = AST_PARALLEL_FOR;
+    int first_body_slot = symbol_count;
+    node->int_value = first_body_slot;
+    ASTNode *reductions = make_node(AST_BLOCK, NULL);
+    if (check_word("reduce") && !parse_reductions(reductions, first_body_slot)) {
+        free_ast(reductions);
+        free_ast(node);
+        return NULL;
+    }
+    in_parallel = 1;
+    ASTNode *body = parse_block();
+    in_parallel = 0;
+    if (body) add_child(node, body);
+    for (int i = 0; i < reductions->child_count; i++) add_child(node, reductions->children[i]);
+    reductions->child_count = 0;
+    free_ast(reductions);
+    if (!body || !check_parallel_for(node, first_body_slot, for_tok)) {
+        free_ast(node);
+        return NULL;
+    }
+    truncate_symbols(first_body_slot);
+    return node;
+}
+
+// reduce(a, b): int or float variables declared before the loop. Each
+// chunk of iterations sums into its own copy starting at zero; the
+// copies are added to the variable when the loop ends.
+static int parse_reductions(ASTNode *node, int first_body_slot) {
+    advance_tok();
+    if (!expect(TOKEN_LPAREN, "expected '('")) return 0;
+    do {
+        Token *name_tok = expect(TOKEN_IDENTIFIER, "expected variable name");
+        if (!name_tok) return 0;
+        Symbol *sym = find_symbol(name_tok->lexeme);
+        if (!sym || sym->slot >= first_body_slot) {
+            error_at(name_tok, "Semantic", "reduce needs a variable declared before the loop");
+            return 0;
+        }
+        if (sym->type != VAR_INT && sym->type != VAR_FLOAT) {
+            error_at(name_tok, "Semantic", "reduce variables must be int or float");
+            return 0;
+        }
+        if (node->child_count == PARALLEL_REDUCE_MAX) {
+            error_at(name_tok, "Semantic", "too many reduce variables");
+            return 0;
+        }
+        ASTNode *id = make_node(AST_IDENTIFIER, name_tok->lexeme);
+        id->slot = sym->slot;
+        id->value_type = sym->type;
+        add_child(node, id);
+    } while (match(TOKEN_COMMA));
+    return expect(TOKEN_RPAREN, "expected ')'") != NULL;
+}
+
+static int is_index_load(ASTNode *node, int slot) {
+    return node->type == AST_IDENTIFIER && node->slot == slot;
+}
+
+// Finds a statement under `node` that writes a slot below first_body_slot
+// other than a reduction; returns that slot, or -1.
+static int outer_write(ASTNode *node, ASTNode *loop, int first_body_slot) {
+    if ((node->type == AST_VAR_DECL || node->type == AST_ASSIGN) && node->slot >= 0 &&
+        node->slot < first_body_slot) {
+        int reduced = 0;
+        for (int i = 4; i < loop->child_count; i++) {
+            if (loop->children[i]->slot == node->slot) reduced = 1;
+        }
+        if (!reduced) return node->slot;
+    }
+    for (int i = 0; i < node->child_count; i++) {
+        int slot = outer_write(node->children[i], loop, first_body_slot);
+        if (slot >= 0) return slot;
+    }
+    return -1;
+}
+
+// The iterations must be countable up front, so the loop has to count an
+// int variable up by a constant: `i < bound` (or <=) and `i = i + step`.
+// The body may write variables of its own, array elements and reductions,
+// but no other variable declared before the loop.
+static int check_parallel_for(ASTNode *node, int first_body_slot, Token *at) {
+    ASTNode *init = node->children[0], *cond = node->children[1], *step = node->children[2];
+    int index = init->slot;
+    if ((init->type != AST_VAR_DECL && init->type != AST_ASSIGN) || init->value_type != VAR_INT) {
+        error_at(at, "Semantic", "parallel for must start by setting an int loop variable");
+        return 0;
+    }
+    if (cond->type != AST_BINARY || (cond->op != TOKEN_LT && cond->op != TOKEN_LTEQ) ||
+        !is_index_load(cond->children[0], index) ||
+        (cond->children[1]->value_type != VAR_INT && cond->children[1]->value_type != VAR_CHAR)) {
+        error_at(at, "Semantic", "parallel for condition must be `i < bound` or `i <= bound`");
+        return 0;
+    }
+    ASTNode *next = step->children[0];
+    if (step->slot != index || next->type != AST_BINARY || next->op != TOKEN_PLUS ||
+        !is_index_load(next->children[0], index) || next->children[1]->type != AST_LITERAL ||
+        next->children[1]->value_type != VAR_INT || next->children[1]->int_value <= 0) {
+        error_at(at, "Semantic", "parallel for step must be `i = i + constant`");
+        return 0;
+    }
+    for (int i = 4; i < node->child_count; i++) {
+        if (node->children[i]->slot == index) {
+            error_at(at, "Semantic", "the loop variable cannot be reduced");
+            return 0;
+        }
+    }
+    int slot = outer_write(node->children[3], node, first_body_slot);
+    if (slot >= 0) {
+        char msg[160];
+        if (slot == index) {
+            snprintf(msg, sizeof(msg), "parallel for body assigns its loop variable '%s'", symbols[slot].name);
+        } else {
+            snprintf(msg, sizeof(msg),
+                     "parallel for body assigns '%s', declared before the loop (reduce it, or use a new variable)",
+                     symbols[slot].name);
+        }
+        error_at(at, "Semantic", msg);
+        return 0;
+    }
+    return 1;
+}
+
+static ASTNode *parse_statement(void) {
+    int line = peek_tok()->line;
+    ASTNode *stmt = NULL;
+    statement_depth++;
+
+    if (check(TOKEN_IDENTIFIER) && check_word("pypstdio")) {
+        stmt = parse_pypstdio();
+    } else if (check(TOKEN_RETURN)) {
+        stmt = parse_return();
+    } else if (check(TOKEN_IF)) {
+        stmt = parse_if();
+    } else if (check(TOKEN_WHILE)) {
+        stmt = parse_while();
+    } else if (check(TOKEN_FOR)) {
+        stmt = parse_for(0);
+    } else if (check(TOKEN_IDENTIFIER) && check_word("parallel") && peek_at(1)->type == TOKEN_FOR) {
+        if (in_parallel) {
+            error_at(peek_tok(), "Semantic", "parallel for cannot be nested");
+        } else {
+            advance_tok();
+            stmt = parse_for(1);
+        }
+    } else if (check(TOKEN_IDENTIFIER) && check_word("spawn") && call_ahead(1)) {
+        stmt = parse_spawn();
+    } else if (check(TOKEN_IDENTIFIER) && check_word("async") && call_ahead(1)) {
+        stmt = parse_start();
+    } else if (check(TOKEN_IDENTIFIER) && check_word("await") && peek_at(1)->type == TOKEN_IDENTIFIER) {
+        stmt = parse_await();
+        if (stmt && !expect(TOKEN_SEMICOLON, "expected ';'")) {
+            free_ast(stmt);
+            stmt = NULL;
+        }
+    } else if (check(TOKEN_IDENTIFIER) && check_word("yield") && !find_symbol("yield") &&
+               find_signature("yield") < 0) {
+        stmt = parse_yield();
+    } else if (call_ahead(0)) {
+        stmt = parse_call(advance_tok());
+        if (stmt && !expect(TOKEN_SEMICOLON, "expected ';'")) {
+            free_ast(stmt);
+            stmt = NULL;
+        }
+    } else if (check(TOKEN_IDENTIFIER) && peek_at(1)->type == TOKEN_LBRACKET) {
+        stmt = parse_index_assignment();
+    } else if (check(TOKEN_IDENTIFIER) && peek_at(1)->type == TOKEN_EQUAL) {
+        stmt = parse_assignment();
+        if (stmt && !expect(TOKEN_SEMICOLON, "expected ';'")) {
+            free_ast(stmt);
+            stmt = NULL;
+        }
+    } else {
+        error_at(peek_tok(), "Parse", "unexpected token");
+    }
+
+    statement_depth--;
+    if (stmt) stmt->line = line;
+    return stmt;
+}
+
+// Results a @memo function keeps when no size is given
+#define MEMO_DEFAULT_SIZE 65536
+
+// @memo(size): remember the function's results by argument values
+static int parse_memo(void) {
+    advance_tok(); // @
+    if (!expect_word("memo")) return 0;
+    if (!match(TOKEN_LPAREN)) return MEMO_DEFAULT_SIZE;
+    Token *size_tok = expect(TOKEN_NUMBER, "expected the number of results to keep");
+    if (!size_tok) return 0;
+    long long size = strpbrk(size_tok->lexeme, ".eE") ? 0 : strtoll(size_tok->lexeme, NULL, 10);
+    if (size <= 0 || size > (1 << 30)) {
+        error_at(size_tok, "Semantic", "@memo size must be a positive int");
+        return 0;
+    }
+    if (!expect(TOKEN_RPAREN, "expected ')'")) return 0;
+    return (int)size;
+}
+
+static int is_memo_key(VarType t) {
+    return t == VAR_INT || t == VAR_CHAR || t == VAR_BOOL || t == VAR_FLOAT;
+}
+
+// [@memo[(size)]] [async] func name(type a, type b) [type] { ... }
+static ASTNode *parse_function(void) {
+    Token *memo_tok = check(TOKEN_AT) ? peek_tok() : NULL;
+    int memo = memo_tok ? parse_memo() : 0;
+    if (memo_tok && !memo) return NULL;
+    Token *async_tok = check_word("async") ? advance_tok() : NULL;
+    if (!expect(TOKEN_FUNC, "expected 'func'")) return NULL;
+    Token *name_tok = expect(TOKEN_IDENTIFIER, "expected function name");
+    if (!name_tok) return NULL;
+    if (!expect(TOKEN_LPAREN, "expected '('")) return NULL;
+
+    reset_symbols();
+    current_sig = &signatures[find_signature(name_tok->lexeme)];
+    first_yield = bare_return = value_return = NULL;
+    if (async_tok && strcmp(name_tok->lexeme, "main") == 0) {
+        error_at(async_tok, "Semantic", "main cannot be async");
+        return NULL;
+    }
+    if (memo_tok && async_tok) {
+        error_at(memo_tok, "Semantic", "async functions cannot be @memo");
+        return NULL;
+    }
+    if (memo_tok) {
+        int keyed = is_memo_key(current_sig->return_type);
+        for (int i = 0; i < current_sig->param_count; i++) keyed = keyed && is_memo_key(current_sig->params[i]);
+        if (!keyed) {
+            error_at(memo_tok, "Semantic", "@memo functions take and return int, char, bool or float values");
+            return NULL;
+        }
+    }
+    ASTNode *func = make_node(AST_FUNCTION, name_tok->lexeme);
+    func->line = name_tok->line;
+    func->value_type = current_sig->return_type;
+    func->int_value = current_sig->is_async ? FUNC_ASYNC : 0;
+    func->slot = memo;
+
+    while (!check(TOKEN_RPAREN) && !check(TOKEN_EOF)) {
+        Token *type_tok = peek_tok();
+        int span;
+        VarType type = type_at(current, &span);
+        current += span ? span : 1;
+        Token *param_tok = expect(TOKEN_IDENTIFIER, "expected parameter name");
+        if (type == VAR_UNKNOWN) error_at(type_tok, "Parse", "expected parameter type");
+        if (!param_tok || had_error) {
+            free_ast(func);
+            return NULL;
+        }
+        if (find_symbol(param_tok->lexeme)) {
+            error_at(param_tok, "Semantic", "parameter declared twice");
+            free_ast(func);
+            return NULL;
+        }
+        ASTNode *param = make_node(AST_PARAM, param_tok->lexeme);
+        param->value_type = type;
+        param->slot = declare_symbol(param_tok->lexeme, type)->slot;
+        add_child(func, param);
+        func->param_count++;
+        if (!match(TOKEN_COMMA)) break;
+    }
+    if (!expect(TOKEN_RPAREN, "expected ')'")) {
+        free_ast(func);
+        return NULL;
+    }
+    int span;
+    if (type_at(current, &span) != VAR_UNKNOWN) current += span; // return type
+    if (!expect(TOKEN_LBRACE, "expected '{'")) {
+        free_ast(func);
+        return NULL;
+    }
+
+    while (!check(TOKEN_RBRACE) && !check(TOKEN_EOF) && !had_error) {
+        ASTNode *stmt = parse_statement();
+        if (stmt) add_child(func, stmt);
+    }
+    expect(TOKEN_RBRACE, "expected '}'");
+
+    if (first_yield && value_return) {
+        error_at(value_return, "Semantic", "a generator cannot return a value; it ends with `return;`");
+    } else if (!first_yield && bare_return) {
+        error_at(bare_return, "Semantic", "missing return value");
+    }
+    if (had_error) {
+        free_ast(func);
+        return NULL;
+    }
+    if (first_yield) func->int_value |= FUNC_GENERATOR;
+    func->local_count = symbol_high;
+    return func;
+}
+
+// -----------------------------
+// Purity
+// -----------------------------
+// A pure function has no effect but its result: it takes and returns
+// only numbers, chars, bools and strings, so whatever containers it makes
+// die with the call; it does no I/O, starts no tasks or coroutines, and
+// calls only pure functions. Every function is classified, so modules can
+// export the flag; @memo requires it.
+static int is_value_type(VarType t) {
+    return t == VAR_INT || t == VAR_CHAR || t == VAR_BOOL || t == VAR_FLOAT || t == VAR_STRING;
+}
+
+// The first node under `node` that has an effect, given which of the
+// file's functions are (still) considered pure. NULL if there is none.
+static ASTNode *first_effect(ASTNode *node, const char *pure, int function_count) {
+    switch (node->type) {
+        case AST_PRINT:
+        case AST_SPAWN:
+        case AST_START:
+        case AST_BENCH:
+        case AST_SNAPSHOT:
+        case AST_FFI:
+            return node;
+        case AST_BUILTIN:
+            if (!builtin_pure(node->slot)) return node;
+            break;
+        case AST_VAR_DECL:
+            if (is_file_type(node->value_type) || is_channel_type(node->value_type)) return node;
+            break;
+        case AST_CALL:
+            if (node->slot < function_count ? !pure[node->slot] : !module_function(node->value)->is_pure) {
+                return node;
+            }
+            break;
+        default:
+            break;
+    }
+    for (int i = 0; i < node->child_count; i++) {
+        ASTNode *effect = first_effect(node->children[i], pure, function_count);
+        if (effect) return effect;
+    }
+    return NULL;
+}
+
+// Marks the pure functions with FUNC_PURE: every candidate starts out
+// pure (so recursion does not count against it) until it is found to
+// have an effect or call a function that is not pure.
+static void check_purity(ASTNode *program) {
+    int n = program->child_count;
+    char *pure = malloc((size_t)n + 1);
+    for (int f = 0; f < n; f++) {
+        ASTNode *func = program->children[f];
+        pure[f] = !(func->int_value & FUNC_ASYNC) && strcmp(func->value, "main") != 0 &&
+                  (func->value_type == VAR_UNKNOWN || is_value_type(func->value_type));
+        for (int i = 0; i < func->param_count; i++) pure[f] = pure[f] && is_value_type(func->children[i]->value_type);
+    }
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int f = 0; f < n; f++) {
+            if (pure[f] && first_effect(program->children[f], pure, n)) {
+                pure[f] = 0;
+                changed = 1;
+            }
+        }
+    }
+
+    for (int f = 0; f < n && !had_error; f++) {
+        ASTNode *func = program->children[f];
+        if (pure[f]) func->int_value |= FUNC_PURE;
+        if (func->slot <= 0 || pure[f]) continue;
+
+        ASTNode *effect = first_effect(func, pure, n);
+        char why[160];
+        if (effect->type == AST_PRINT) snprintf(why, sizeof(why), "it prints");
+        else if (effect->type == AST_BUILTIN) snprintf(why, sizeof(why), "it calls pypstdio.%s", effect->value);
+        else if (effect->type == AST_FFI) snprintf(why, sizeof(why), "it calls pypstdio.ffi.%s", effect->value);
+        else if (effect->type == AST_VAR_DECL) snprintf(why, sizeof(why), "it creates a %s", var_type_name(effect->value_type));
+        else if (effect->type == AST_CALL) snprintf(why, sizeof(why), "it calls %s, which is not pure", effect->value);
+        else snprintf(why, sizeof(why), "it starts tasks or coroutines");
+        if (parse_report) {
+            char text[256];
+            snprintf(text, sizeof(text), "Semantic error: @memo function '%s' is not pure: %s", func->value, why);
+            parse_report(effect->line ? effect->line : func->line, -1, text);
+        } else {
+            fprintf(stderr, "Semantic error (line %d): @memo function '%s' is not pure: %s\n",
+                    effect->line ? effect->line : func->line, func->value, why);
+        }
+        had_error = 1;
+    }
+    free(pure);
 }
 
 // -----------------------------
-// AST node constructors
+// Sharing
 // -----------------------------
-static ASTNode *make_node(ASTNodeType type, const char *value) {
-    ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
-    node->type = type;
-    node->value = value ? strdup_local(value) : NULL;
-    node->var_type = NULL;
-    node->var_name = NULL;
-    node->var_value = NULL;
-    node->children = NULL;
-    node->child_count = 0;
-    return node;
+// A task or coroutine may outlive the frame that started it, so whatever
+// strings and containers it was handed must outlive that frame too. A
+// function that hands any over, itself or through a call, is marked
+// FUNC_SHARES: its frames, and the frames of its callers, keep what they
+// allocated past their return instead of freeing it (see the compiler's
+// escape analysis).
+static int shares(ASTNode *node, const char *sharing, int function_count) {
+    if (node->type == AST_SPAWN || node->type == AST_START) {
+        ASTNode *call = node->children[0];
+        for (int i = 0; i < call->child_count; i++) {
+            if (var_type_on_heap(call->children[i]->value_type)) return 1;
+        }
+    }
+    if (node->type == AST_CALL &&
+        (node->slot < function_count ? sharing[node->slot] : module_function(node->value)->shares)) {
+        return 1;
+    }
+    for (int i = 0; i < node->child_count; i++) {
+        if (shares(node->children[i], sharing, function_count)) return 1;
+    }
+    return 0;
 }
 
-static ASTNode *make_var_decl(const char *type, const char *name, const char *value) {
-    ASTNode *node = make_node(AST_VAR_DECL, NULL);
-    node->var_type  = strdup_local(type);
-    node->var_name  = strdup_local(name);
-    node->var_value = strdup_local(value);
-    return node;
+static void check_sharing(ASTNode *program) {
+    int n = program->child_count;
+    char *sharing = calloc((size_t)n + 1, 1);
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int f = 0; f < n; f++) {
+            if (!sharing[f] && shares(program->children[f], sharing, n)) {
+                sharing[f] = 1;
+                changed = 1;
+            }
+        }
+    }
+    for (int f = 0; f < n; f++) {
+        if (sharing[f]) program->children[f]->int_value |= FUNC_SHARES;
+    }
+    free(sharing);
 }
 
 // -----------------------------
-// Parser
+// Parallel sharing
 // -----------------------------
-ASTNode *parse(Token *tokens, int token_count) {
-    if (token_count < 1) return NULL;
-    int i = 0;
+// The iterations of a parallel for run on several threads at once, and
+// maps, builders, readers and iterators cannot be changed from more than
+// one of them: a body may read the containers declared before its loop,
+// and store to their array elements, but not change them with a builtin
+// or a call. A function changes the container passed as parameter p if
+// its body does (AST_PARAM's int_value, which modules export).
 
-    // Handle includes
-    while (i < token_count && tokens[i].type == TOKEN_INCLUDE) {
-        if (tokens[i].lexeme && strstr(tokens[i].lexeme, "pypstdio")) {
-            has_pypstdio = 1;
+// Whether `node` names a container held in slots [lo, hi).
+static int container_in(ASTNode *node, int lo, int hi) {
+    return node->type == AST_IDENTIFIER && node->slot >= lo && node->slot < hi &&
+           var_type_on_heap(node->value_type) && node->value_type != VAR_STRING;
+}
+
+static int call_changes(ASTNode *call, int arg, ASTNode *program) {
+    if (call->slot >= 0 && call->slot < program->child_count) {
+        ASTNode *func = program->children[call->slot];
+        return arg >= func->param_count || func->children[arg]->int_value;
+    }
+    const ModuleExport *e = module_function(call->value);
+    return !e || arg >= e->param_count || e->changes[arg];
+}
+
+// The first node under `node` that changes a container in slots [lo, hi),
+// or NULL; *container is set to the container's identifier. Handing the
+// container on (to an iterator, a second name, a return) counts as a change.
+static ASTNode *first_change(ASTNode *node, int lo, int hi, ASTNode *program, ASTNode **container) {
+    int changes = 0;
+    switch (node->type) {
+        case AST_BUILTIN:
+            changes = builtin_changes(node->slot);
+            break;
+        case AST_CALL:
+            for (int i = 0; i < node->child_count; i++) {
+                if (call_changes(node, i, program)) changes |= 1 << i;
+            }
+            break;
+        case AST_ITER:
+        case AST_VAR_DECL:
+        case AST_ASSIGN:
+        case AST_RETURN:
+            changes = 1;
+            break;
+        default:
+            break;
+    }
+    for (int i = 0; i < node->child_count && i < 31; i++) {
+        if ((changes >> i & 1) && container_in(node->children[i], lo, hi)) {
+            *container = node->children[i];
+            return node;
         }
-        i++;
     }
+    for (int i = 0; i < node->child_count; i++) {
+        ASTNode *change = first_change(node->children[i], lo, hi, program, container);
+        if (change) return change;
+    }
+    return NULL;
+}
 
-    // Expect func
-    if (i >= token_count || tokens[i].type != TOKEN_FUNC) {
-        fprintf(stderr, "Parse error: expected 'func'\n");
-        return NULL;
+// Reports the first parallel for under `node` whose body changes a
+// container declared before the loop (AST_PARALLEL_FOR's int_value).
+static void check_parallel_loops(ASTNode *node, ASTNode *program) {
+    if (had_error) return;
+    if (node->type == AST_PARALLEL_FOR) {
+        ASTNode *container;
+        ASTNode *change = first_change(node->children[3], 0, (int)node->int_value, program, &container);
+        if (change) {
+            char how[160];
+            if (change->type == AST_BUILTIN) snprintf(how, sizeof(how), "with pypstdio.%s", change->value);
+            else if (change->type == AST_CALL) snprintf(how, sizeof(how), "by passing it to %s, which changes it", change->value);
+            else if (change->type == AST_ITER) snprintf(how, sizeof(how), "by iterating it");
+            else snprintf(how, sizeof(how), "through another name");
+            int line = change->line ? change->line : node->line;
+            if (parse_report) {
+                char text[320];
+                snprintf(text, sizeof(text), "Semantic error: parallel for body changes '%s', declared before the loop, %s",
+                         container->value, how);
+                parse_report(line, -1, text);
+            } else {
+                fprintf(stderr, "Semantic error (line %d): parallel for body changes '%s', declared before the loop, %s\n",
+                        line, container->value, how);
+            }
+            had_error = 1;
+            return;
+        }
     }
+    for (int i = 0; i < node->child_count; i++) check_parallel_loops(node->children[i], program);
+}
 
-    // Expect function name
-    if (i + 1 >= token_count || tokens[i + 1].type != TOKEN_IDENTIFIER) {
-        fprintf(stderr, "Parse error: expected function name\n");
-        return NULL;
+static void check_parallel_sharing(ASTNode *program) {
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int f = 0; f < program->child_count; f++) {
+            ASTNode *func = program->children[f], *container;
+            for (int p = 0; p < func->param_count; p++) {
+                ASTNode *param = func->children[p];
+                if (!param->int_value && first_change(func, param->slot, param->slot + 1, program, &container)) {
+                    param->int_value = 1;
+                    changed = 1;
+                }
+            }
+        }
     }
+    check_parallel_loops(program, program);
+}
 
-    ASTNode *func = make_node(AST_FUNCTION, tokens[i + 1].lexeme);
+// -----------------------------
+// Parser
+// -----------------------------
+static int at_function(void) {
+    return check(TOKEN_FUNC) || check(TOKEN_AT) ||
+           (check(TOKEN_IDENTIFIER) && check_word("async") && peek_at(1)->type == TOKEN_FUNC);
+}
 
-    // Scan body
-    for (int j = i + 2; j < token_count; j++) {
-        if (tokens[j].type == TOKEN_IDENTIFIER &&
-            strcmp(tokens[j].lexeme, "pypstdio") == 0) {
+// Whether the tokens from `from` on call into module `name`.
+static int calls_into(const char *name, int from) {
+    for (int i = from; i + 3 < count_in; i++) {
+        if (tokens_in[i].type == TOKEN_IDENTIFIER && strcmp(tokens_in[i].lexeme, name) == 0 &&
+            tokens_in[i + 1].type == TOKEN_DOT && tokens_in[i + 2].type == TOKEN_IDENTIFIER &&
+            tokens_in[i + 3].type == TOKEN_LPAREN) {
+            return 1;
+        }
+    }
+    return 0;
+}
 
-            if (!has_pypstdio) {
-                fprintf(stderr, "Semantic error: 'pypstdio' used without #include <pypstdio>\n");
-                free_ast(func);
-                return NULL;
+// use name;  ...  Every module is looked up, but only the ones this file
+// calls into are loaded. Loading parses the module with this same parser,
+// so the state of the file being parsed is set aside meanwhile.
+static int parse_uses(void) {
+    Token *names[64];
+    int count = 0;
+    while (check(TOKEN_USE)) {
+        advance_tok();
+        Token *name_tok = expect(TOKEN_IDENTIFIER, "expected module name after 'use'");
+        if (!name_tok || !expect(TOKEN_SEMICOLON, "expected ';'")) return 0;
+        if (strcmp(name_tok->lexeme, "pypstdio") == 0) {
+            error_at(name_tok, "Semantic", "pypstdio is brought in with #include <pypstdio>");
+            return 0;
+        }
+        for (int i = 0; i < count; i++) {
+            if (strcmp(names[i]->lexeme, name_tok->lexeme) == 0) {
+                error_at(name_tok, "Semantic", "module used twice");
+                return 0;
             }
+        }
+        if (count == 64) {
+            error_at(name_tok, "Semantic", "too many modules");
+            return 0;
+        }
+        names[count++] = name_tok;
+    }
 
-            // Variable declarations
-            if (j + 4 < token_count &&
-                tokens[j + 1].type == TOKEN_DOT &&
-                strcmp(tokens[j + 2].lexeme, "variable") == 0 &&
-                tokens[j + 3].type == TOKEN_DOT) {
-
-                const char *type = tokens[j + 4].lexeme;
-
-                // int and char (plain)
-                if ((strcmp(type, "int") == 0 || strcmp(type, "char") == 0) && j + 5 < token_count) {
-                    int k = j + 5;
-                    // If next is a dot, this is likely char.str; let the string branch handle it.
-                    if (tokens[k].type == TOKEN_DOT) {
-                        // fall through to char.str handler below
-                    } else {
-                        if (tokens[k].type != TOKEN_LPAREN) continue;
-                        k++;
-                        if (k >= token_count || tokens[k].type != TOKEN_IDENTIFIER) continue;
-                        char *var_name = tokens[k].lexeme;
-                        k++;
-                        if (k >= token_count || tokens[k].type != TOKEN_COMMA) continue;
-                        k++;
-
-                        char *var_value = NULL;
-                        if (strcmp(type, "int") == 0 && tokens[k].type == TOKEN_NUMBER) {
-                            var_value = tokens[k].lexeme;
-                        } else if (strcmp(type, "char") == 0 && tokens[k].type == TOKEN_CHAR_LITERAL) {
-                            var_value = tokens[k].lexeme;
-                        } else {
-                            continue;
-                        }
-
-                        k++;
-                        if (k >= token_count || tokens[k].type != TOKEN_RPAREN) continue;
-                        k++;
-                        if (k >= token_count || tokens[k].type != TOKEN_SEMICOLON) continue;
-                        k++;
-
-                        ASTNode *decl = make_var_decl(type, var_name, var_value);
-                        func->children = (ASTNode **)realloc(func->children, sizeof(ASTNode *) * (func->child_count + 1));
-                        func->children[func->child_count++] = decl;
-                        j = k - 1;
-                        continue;
-                    }
-                }
+    Module *found[64];
+    int load_count = 0;
+    for (int i = 0; i < count; i++) {
+        Module *module = module_find(names[i]->lexeme);
+        if (!module) {
+            error_at(names[i], "Semantic", "module not found");
+            return 0;
+        }
+        if (!calls_into(module->name, current)) continue;
 
-                // string: pypstdio.variable.char.str(name, "value");
-                if (strcmp(type, "char") == 0 &&
-                    j + 6 < token_count &&
-                    tokens[j + 5].type == TOKEN_DOT &&
-                    strcmp(tokens[j + 6].lexeme, "str") == 0) {
-
-                    int k = j + 7;
-                    if (tokens[k].type != TOKEN_LPAREN) continue;
-                    k++;
-                    if (k >= token_count || tokens[k].type != TOKEN_IDENTIFIER) continue;
-                    char *var_name = tokens[k].lexeme;
-                    k++;
-                    if (k >= token_count || tokens[k].type != TOKEN_COMMA) continue;
-                    k++;
-                    if (k >= token_count || tokens[k].type != TOKEN_STRING) continue;
-                    char *var_value = tokens[k].lexeme;
-                    k++;
-                    if (k >= token_count || tokens[k].type != TOKEN_RPAREN) continue;
-                    k++;
-                    if (k >= token_count || tokens[k].type != TOKEN_SEMICOLON) continue;
-                    k++;
-
-                    ASTNode *decl = make_var_decl("string", var_name, var_value);
-                    func->children = (ASTNode **)realloc(func->children, sizeof(ASTNode *) * (func->child_count + 1));
-                    func->children[func->child_count++] = decl;
-                    j = k - 1;
-                    continue;
-                }
-            }
+        Token *saved_tokens = tokens_in;
+        int saved_count = count_in, saved_current = current;
+        int saved_pypstdio = has_pypstdio, saved_module = parsing_module;
+        void (*saved_report)(int, int, const char *) = parse_report;
+        parse_report = NULL; // the module's own errors are about another file
+        int loaded = module_load(module);
+        parse_report = saved_report;
+        tokens_in = saved_tokens;
+        count_in = saved_count;
+        current = saved_current;
+        has_pypstdio = saved_pypstdio;
+        parsing_module = saved_module;
+        had_error = 0;
+        if (!loaded) {
+            error_at(names[i], "Semantic", "module failed to load");
+            return 0;
+        }
+        found[load_count++] = module;
+    }
 
-            // Print statement
-            if (j + 3 < token_count &&
-                tokens[j + 1].type == TOKEN_DOT &&
-                strcmp(tokens[j + 2].lexeme, "print") == 0 &&
-                tokens[j + 3].type == TOKEN_LPAREN) {
-
-                int k = j + 4;
-                ASTNode *print = make_node(AST_PRINT, NULL);
-
-                while (k < token_count && tokens[k].type != TOKEN_RPAREN) {
-                    if (tokens[k].type == TOKEN_STRING || tokens[k].type == TOKEN_CHAR_LITERAL) {
-                        ASTNode *lit = make_node(AST_LITERAL, tokens[k].lexeme);
-                        print->children = (ASTNode **)realloc(print->children, sizeof(ASTNode *) * (print->child_count + 1));
-                        print->children[print->child_count++] = lit;
-                    } else if (tokens[k].type == TOKEN_IDENTIFIER) {
-                        ASTNode *id = make_node(AST_IDENTIFIER, tokens[k].lexeme);
-                        print->children = (ASTNode **)realloc(print->children, sizeof(ASTNode *) * (print->child_count + 1));
-                        print->children[print->child_count++] = id;
-                    }
-                    k++;
-                    if (k < token_count && tokens[k].type == TOKEN_COMMA) k++;
-                }
+    used = malloc(sizeof(Module *) * (load_count ? load_count : 1));
+    memcpy(used, found, sizeof(Module *) * load_count);
+    used_count = load_count;
+    return 1;
+}
 
-                if (k >= token_count || tokens[k].type != TOKEN_RPAREN) continue;
-                k++;
-                if (k >= token_count || tokens[k].type != TOKEN_SEMICOLON) continue;
-                k++;
+// Adds each used module's functions to signatures[] as "module.function".
+static void collect_module_signatures(void) {
+    for (int m = 0; m < used_count; m++) {
+        for (int i = 0; i < used[m]->export_count; i++) {
+            const ModuleExport *e = &used[m]->exports[i];
+            size_t length = strlen(used[m]->name) + strlen(e->name) + 2;
+            char *name = malloc(length);
+            snprintf(name, length, "%s.%s", used[m]->name, e->name);
+            Signature *sig = add_signature(name);
+            sig->return_type = e->return_type;
+            sig->param_count = e->param_count;
+            sig->params = malloc(sizeof(VarType) * (e->param_count ? e->param_count : 1));
+            memcpy(sig->params, e->params, sizeof(VarType) * e->param_count);
+            sig->is_async = e->is_async;
+        }
+    }
+}
+
+// ffi "library" func name(type a, ...) [type];  ...  Declares C functions
+// for pypstdio.ffi (see ffi.h); "" names the interpiler's own libraries.
+static int parse_foreign(void) {
+    while (check(TOKEN_IDENTIFIER) && check_word("ffi")) {
+        advance_tok();
+        Token *library = expect(TOKEN_STRING, "expected a library path after 'ffi'");
+        if (!library || !expect(TOKEN_FUNC, "expected 'func'")) return 0;
+        Token *name_tok = expect(TOKEN_IDENTIFIER, "expected function name");
+        if (!name_tok || !expect(TOKEN_LPAREN, "expected '('")) return 0;
+        if (find_foreign(name_tok->lexeme)) {
+            error_at(name_tok, "Semantic", "foreign function declared twice");
+            return 0;
+        }
 
-                func->children = (ASTNode **)realloc(func->children, sizeof(ASTNode *) * (func->child_count + 1));
-                func->children[func->child_count++] = print;
-                j = k - 1;
-                continue;
+        char types[FFI_INT_ARGS + FFI_FLOAT_ARGS + 2];
+        int count = 0, ints = 0, floats = 0, span;
+        while (!check(TOKEN_RPAREN) && !check(TOKEN_EOF)) {
+            Token *type_tok = peek_tok();
+            VarType t = type_at(current, &span);
+            if (!ffi_param_type(t)) {
+                error_at(type_tok, "Semantic", "ffi parameters are int, char, bool, float, string, int[] or float[]");
+                return 0;
+            }
+            if (t == VAR_FLOAT ? ++floats > FFI_FLOAT_ARGS : ++ints > FFI_INT_ARGS) {
+                char msg[128];
+                snprintf(msg, sizeof(msg), "a foreign function takes at most %d float and %d other arguments",
+                         FFI_FLOAT_ARGS, FFI_INT_ARGS);
+                error_at(type_tok, "Semantic", msg);
+                return 0;
             }
+            current += span;
+            if (!expect(TOKEN_IDENTIFIER, "expected parameter name")) return 0;
+            types[1 + count++] = TYPE_CODE(t);
+            if (!match(TOKEN_COMMA)) break;
         }
+        if (!expect(TOKEN_RPAREN, "expected ')'")) return 0;
+        VarType result = VAR_UNKNOWN;
+        types[0] = TYPE_CODE(VAR_UNKNOWN);
+        if (check(TOKEN_IDENTIFIER) && check_word("int32")) {
+            advance_tok(); // a C int, see ffi.h
+            types[0] = FFI_INT32;
+        } else if (!check(TOKEN_SEMICOLON)) {
+            Token *type_tok = peek_tok();
+            result = type_at(current, &span);
+            if (result == VAR_UNKNOWN || !ffi_result_type(result)) {
+                error_at(type_tok, "Semantic",
+                         "a foreign function returns int, int32, char, bool, float, string or nothing");
+                return 0;
+            }
+            current += span;
+            types[0] = TYPE_CODE(result);
+        }
+        if (!expect(TOKEN_SEMICOLON, "expected ';'")) return 0;
+        types[1 + count] = '\0';
+
+        foreign = realloc(foreign, sizeof(Foreign) * (size_t)(foreign_count + 1));
+        Foreign *f = &foreign[foreign_count++];
+        f->name = strdup_local(name_tok->lexeme);
+        f->library = strdup_local(library->lexeme ? library->lexeme : "");
+        f->types = strdup_local(types);
+        f->param_count = count;
+    }
+    return 1;
+}
+
+// #include, `use` and `ffi` lines, up to the first function.
+static int parse_header(Token *tokens, int token_count) {
+    tokens_in = tokens;
+    count_in = token_count;
+    current = 0;
+    had_error = 0;
+    has_pypstdio = 0;
 
-        // Return statement
-        if (tokens[j].type == TOKEN_RETURN && j + 1 < token_count) {
-            ASTNode *ret = make_node(AST_RETURN, tokens[j + 1].lexeme);
-            func->children = (ASTNode **)realloc(func->children, sizeof(ASTNode *) * (func->child_count + 1));
-            func->children[func->child_count++] = ret;
+    // Handle includes
+    while (check(TOKEN_INCLUDE)) {
+        if (peek_tok()->lexeme && strstr(peek_tok()->lexeme, "pypstdio")) {
+            has_pypstdio = 1;
         }
+        advance_tok();
+    }
+    if (!parse_uses()) {
+        free(used);
+        used = NULL;
+        used_count = 0;
+        return 0;
+    }
+    // after the modules, which are parsed with this same table
+    reset_foreign();
+    if (!parse_foreign()) {
+        reset_foreign();
+        free(used);
+        used = NULL;
+        used_count = 0;
+        return 0;
+    }
+    return 1;
+}
+
+static ASTNode *parse_file(Token *tokens, int token_count) {
+    if (token_count < 1) return NULL;
+    if (!parse_header(tokens, token_count)) return NULL;
+
+    // Expect func
+    if (!at_function()) {
+        fprintf(stderr, "Parse error: expected 'func'\n");
+        reset_foreign();
+        free(used);
+        used = NULL;
+        used_count = 0;
+        return NULL;
+    }
+
+    reset_signatures();
+    collect_signatures();
+    collect_module_signatures();
+
+    ASTNode *program = make_node(AST_PROGRAM, NULL);
+    while (!had_error && at_function()) {
+        ASTNode *func = parse_function();
+        if (func) add_child(program, func);
+    }
+    if (!had_error && !check(TOKEN_EOF)) error_at(peek_tok(), "Parse", "expected 'func'");
+    if (!had_error && parsing_module && find_signature("main") >= 0) {
+        fprintf(stderr, "Semantic error: a module cannot define 'main'\n");
+        had_error = 1;
+    }
+    if (!had_error && !parsing_module && find_signature("main") < 0) {
+        fprintf(stderr, "Semantic error: no 'main' function\n");
+        had_error = 1;
+    }
+    if (!had_error) check_purity(program);
+    if (!had_error) check_sharing(program);
+    if (!had_error) check_parallel_sharing(program);
+
+    reset_signatures();
+    reset_foreign();
+    free(used);
+    used = NULL;
+    used_count = 0;
+    if (had_error) {
+        free_ast(program);
+        return NULL;
     }
+    return program;
+}
+
+ASTNode *parse(Token *tokens, int token_count) {
+    parsing_module = 0;
+    return parse_file(tokens, token_count);
+}
+
+ASTNode *parse_module(Token *tokens, int token_count) {
+    parsing_module = 1;
+    return parse_file(tokens, token_count);
+}
+
+// -----------------------------
+// One function at a time (see lsp.c)
+// -----------------------------
+int parse_begin(Token *tokens, int token_count) {
+    parse_end();
+    parsing_module = 0;
+    if (token_count < 1 || !parse_header(tokens, token_count)) return -1;
+    int header_end = current;
+    collect_signatures();
+    if (had_error) return -1;
+    collect_module_signatures();
+    parsing_module = find_signature("main") < 0;
+    return header_end;
+}
 
+ASTNode *parse_function_at(Token *tokens, int token_count, int at) {
+    tokens_in = tokens;
+    count_in = token_count;
+    current = at;
+    had_error = 0;
+    in_parallel = 0;
+    in_bench = 0;
+    statement_depth = 0;
+    awaiting = 0;
+    ASTNode *func = parse_function();
+    if (had_error) {
+        free_ast(func);
+        return NULL;
+    }
     return func;
 }
 
+void parse_relink(ASTNode *node) {
+    if (node->type == AST_CALL || (node->type == AST_ITER && node->value)) node->slot = find_signature(node->value);
+    for (int i = 0; i < node->child_count; i++) parse_relink(node->children[i]);
+}
+
+void parse_check(ASTNode *program) {
+    had_error = 0;
+    check_purity(program);
+    check_parallel_sharing(program);
+}
+
+void parse_end(void) {
+    reset_signatures();
+    reset_foreign();
+    free(used);
+    used = NULL;
+    used_count = 0;
+}
+
 // -----------------------------
 // AST utilities
 // -----------------------------
+// -----------------------------
+// Constant folding (see passes.c)
+// -----------------------------
+ASTNode *make_constant(VarType type, long long i, double f) {
+    return type == VAR_FLOAT ? make_float_literal(f) : make_int_literal(i, type);
+}
+
+int fold_constant(ASTNode *node) {
+    ASTNode *folded = NULL;
+    if (node->type == AST_UNARY && node->children[0]->type == AST_LITERAL) {
+        ASTNode *operand = node->children[0];
+        folded = operand->value_type == VAR_FLOAT
+            ? make_float_literal(-operand->float_value)
+            : make_int_literal(negate(operand->int_value), VAR_INT);
+    } else if (node->type == AST_BINARY && node->children[0]->type == AST_LITERAL &&
+               node->children[1]->type == AST_LITERAL) {
+        ASTNode *l = node->children[0], *r = node->children[1];
+        if (node->value_type == VAR_STRING) folded = concat_literals(l, r);
+        else if (l->value_type != VAR_STRING) folded = fold_binary(node->op, l, r, node->value_type);
+    }
+    if (!folded) return 0;
+
+    // the node keeps its place in the tree and takes the literal's fields
+    for (int i = 0; i < node->child_count; i++) free_ast(node->children[i]);
+    free(node->children);
+    free(node->value);
+    folded->line = node->line;
+    *node = *folded;
+    free(folded);
+    return 1;
+}
+
 void free_ast(ASTNode *node) {
     if (!node) return;
     for (int i = 0; i < node->child_count; i++) {
@@ -223,8 +2700,30 @@ void print_ast(ASTNode *node, int indent) {
     if (!node) return;
     for (int i = 0; i < indent; i++) printf("  ");
     switch (node->type) {
+        case AST_PROGRAM:
+            printf("Program\n");
+            break;
         case AST_FUNCTION:
-            printf("Function: %s\n", node->value);
+            printf("Function: %s%s%s%s", node->slot > 0 ? "@memo " : "",
+                   node->int_value & FUNC_ASYNC ? "async " : "", node->int_value & FUNC_GENERATOR ? "generator " : "",
+                   node->value);
+            if (node->value_type != VAR_UNKNOWN) printf(" -> %s", var_type_name(node->value_type));
+            printf("\n");
+            break;
+        case AST_PARAM:
+            printf("Param: %s %s\n", var_type_name(node->value_type), node->value);
+            break;
+        case AST_CALL:
+            printf("Call: %s\n", node->value);
+            break;
+        case AST_BUILTIN:
+            printf("Builtin: pypstdio.%s\n", node->value);
+            break;
+        case AST_INDEX:
+            printf("Index: %s\n", node->value);
+            break;
+        case AST_STORE_INDEX:
+            printf("StoreIndex: %s\n", node->value);
             break;
         case AST_PRINT:
             printf("Print\n");
@@ -236,14 +2735,61 @@ void print_ast(ASTNode *node, int indent) {
             printf("Identifier: %s\n", node->value);
             break;
         case AST_RETURN:
-            printf("Return: %s\n", node->value);
+            printf("Return: %s\n", node->value ? node->value : node->child_count ? "(expr)" : "");
             break;
         case AST_VAR_DECL:
             printf("VarDecl: type=%s name=%s value=%s\n",
                    node->var_type ? node->var_type : "(null)",
                    node->var_name ? node->var_name : "(null)",
-                   node->var_value ? node->var_value : "(null)");
+                   node->var_value ? node->var_value : "(expr)");
             break;
+        case AST_BINARY:
+            printf("Binary: %s (%s)\n", node->value, var_type_name(node->value_type));
+            break;
+        case AST_UNARY:
+            printf("Unary: %s (%s)\n", node->value, var_type_name(node->value_type));
+            break;
+        case AST_ASSIGN:
+            printf("Assign: %s\n", node->value);
+            break;
+        case AST_BLOCK:
+            printf("Block\n");
+            break;
+        case AST_IF:
+            printf("If\n");
+            break;
+        case AST_WHILE:
+            printf("While\n");
+            break;
+        case AST_FOR:
+            printf("For\n");
+            break;
+        case AST_PARALLEL_FOR:
+            printf("ParallelFor\n");
+            break;
+        case AST_SPAWN:
+            printf("Spawn\n");
+            break;
+        case AST_START:
+            printf("Start\n");
+            break;
+        case AST_BENCH:
+            printf("Bench: %s\n", node->value);
+            break;
+        case AST_YIELD:
+            printf("Yield\n");
+            break;
+        case AST_SNAPSHOT:
+            printf("Snapshot\n");
+            break;
+        case AST_FFI:
+            printf("Ffi: %s (in %s)\n", node->value, node->var_value[0] ? node->var_value : "the interpiler");
+            break;
+        case AST_ITER: {
+            static const char *kinds[] = { "map", "filter", "take" };
+            printf("Iter: %s%s%s\n", kinds[node->int_value], node->value ? " " : "", node->value ? node->value : "");
+            break;
+        }
         default:
             printf("Node\n");
             break;
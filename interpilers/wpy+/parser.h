@@ -3,16 +3,68 @@
 
 #include "tokens.h"
 
+// -----------------------------
+// Static value types
+// -----------------------------
+typedef enum {
+    VAR_UNKNOWN,      // unresolved identifier (reported at runtime)
+    VAR_INT,
+    VAR_CHAR,
+    VAR_STRING,
+    VAR_FLOAT,
+    VAR_BOOL,
+    VAR_ARRAY_INT,    // pypstdio.variable.array.int
+    VAR_ARRAY_FLOAT,  // pypstdio.variable.array.float
+    VAR_MAP_INT,      // pypstdio.variable.map.int: int -> int
+    VAR_MAP_STR,      // pypstdio.variable.map.str: string -> int
+    VAR_BUILDER,      // pypstdio.variable.builder
+    VAR_READER,       // pypstdio.variable.file.reader
+    VAR_WRITER,       // pypstdio.variable.file.writer
+    VAR_CHANNEL_INT,  // pypstdio.variable.channel.int
+    VAR_CHANNEL_FLOAT,// pypstdio.variable.channel.float
+    VAR_ITER_INT,     // pypstdio.variable.iter.int: a generator or pipeline of ints
+    VAR_ITER_FLOAT    // pypstdio.variable.iter.float
+} VarType;
+
 // -----------------------------
 // AST Node Types
 // -----------------------------
 typedef enum {
+    AST_PROGRAM,      // all functions of a source file
     AST_FUNCTION,     // func main() { ... }
+    AST_PARAM,        // int n  (leading children of AST_FUNCTION; int_value:
+                      // 1 if the function may change the container passed in)
     AST_PRINT,        // pypstdio.print(...)
     AST_RETURN,       // return ...
     AST_LITERAL,      // string/number literal
     AST_IDENTIFIER,   // variable/function names
-    AST_VAR_DECL      // pypstdio.variable.int(name, value)
+    AST_VAR_DECL,     // pypstdio.variable.int(name, value)
+    AST_BINARY,       // a + b, a < b, ...
+    AST_UNARY,        // -a
+    AST_ASSIGN,       // name = expr;
+    AST_BLOCK,        // { ... }
+    AST_IF,           // if (cond) { ... } else { ... }
+    AST_WHILE,        // while (cond) { ... }
+    AST_FOR,          // for (init; cond; step) { ... }
+    AST_CALL,         // name(args)
+    AST_BUILTIN,      // pypstdio.array.sum(args)
+    AST_INDEX,        // a[i]
+    AST_STORE_INDEX,  // a[i] = expr;
+    AST_PARALLEL_FOR, // parallel for (init; cond; step) reduce(a, b) { ... }
+                      // (int_value: the first slot declared in the body)
+    AST_SPAWN,        // spawn f(args);  (child: the AST_CALL)
+    AST_START,        // async f(args);  (child: the AST_CALL)
+    AST_BENCH,        // pypstdio.bench("name", n, warmup) { ... }  (value: the name;
+                      // children: the counts, then the body)
+    AST_YIELD,        // yield expr;  (in a generator function)
+    AST_ITER,         // pypstdio.iter.map(it, f) / filter(it, f) / take(it, n)
+                      // (int_value: ITER_*; value, slot: f, as for AST_CALL;
+                      // children: the source, then take's count)
+    AST_SNAPSHOT,     // pypstdio.snapshot();  (value: the types of main's live
+                      // slots, see TYPE_CODE)
+    AST_FFI           // pypstdio.ffi.name(args)  (value: name; var_value: its
+                      // library; var_type: its return type, then its
+                      // parameters', see TYPE_CODE)
 } ASTNodeType;
 
 // -----------------------------
@@ -27,18 +79,87 @@ typedef struct ASTNode {
     // For variable declarations
     char *var_type;   // e.g. "int", "string"
     char *var_name;   // e.g. "int1"
-    char *var_value;  // e.g. "10"
+    char *var_value;  // e.g. "10" (only set when the initializer is a literal)
 
-    // Children (for function bodies, print args, etc.)
+    // Children (for function bodies, print args, operands, initializers, etc.)
     struct ASTNode **children;
     int child_count;
+
+    // Static typing, filled in by the parser
+    VarType value_type;   // type of an expression / declared variable;
+                          // AST_FUNCTION: return type (VAR_UNKNOWN if none)
+    TokenType op;         // operator of AST_BINARY / AST_UNARY
+    int slot;             // local slot of a variable, -1 if undefined;
+                          // AST_CALL: index of the called function
+                          // AST_BUILTIN: index into builtins[]
+                          // AST_ITER: index of map's or filter's function
+                          // AST_FUNCTION: @memo size, 0 if not memoized
+    int local_count;      // AST_FUNCTION: number of local slots
+    int param_count;      // AST_FUNCTION: number of leading AST_PARAM children
+    int line;
+
+    // Constant value of AST_LITERAL (after folding);
+    // AST_FUNCTION: FUNC_* flags; AST_ITER: ITER_*
+    long long int_value;
+    double float_value;
 } ASTNode;
 
+#define FUNC_ASYNC 1   // async func: runs as a coroutine
+#define FUNC_PURE  2   // no effect but its result (see parse())
+#define FUNC_SHARES 4  // hands strings or containers to tasks or coroutines
+#define FUNC_GENERATOR 8  // yields: a call returns an iterator over its body
+
+// A VarType as one char, for AST_SNAPSHOT's and AST_FFI's type strings
+#define TYPE_CODE(type) ((char)('a' + (type)))
+
+#define ITER_MAP    0
+#define ITER_FILTER 1
+#define ITER_TAKE   2
+
 // -----------------------------
 // Parser API
 // -----------------------------
 ASTNode *parse(Token *tokens, int token_count);
+// Same, for a file brought in with `use`: it must not define main.
+ASTNode *parse_module(Token *tokens, int token_count);
 void free_ast(ASTNode *node);
 void print_ast(ASTNode *node, int indent);
+const char *var_type_name(VarType type);
+// Strings, arrays, maps, builders, files and iterators: values the VM
+// allocates and frees with frame regions (see interpiler.c). Channels are
+// not among them.
+int var_type_on_heap(VarType type);
+
+// -----------------------------
+// Constant folding (see passes.c)
+// -----------------------------
+// A literal of a scalar type: i holds the value unless type is VAR_FLOAT.
+ASTNode *make_constant(VarType type, long long i, double f);
+// Turns a unary or binary node whose operands are literals into the
+// literal it evaluates to, in place. Returns 1 if it did; a division by a
+// zero constant is left for the runtime to report.
+int fold_constant(ASTNode *node);
+
+// -----------------------------
+// Language server support (see lsp.c)
+// -----------------------------
+// While set, errors are passed here instead of printed. column is -1 when
+// the error is not tied to a token.
+extern void (*parse_report)(int line, int column, const char *message);
+
+// Reads the #include and `use` lines and the signatures of every function,
+// then keeps them for parse_function_at() until parse_end(). A file
+// without main is taken as a module. Returns the index of the first token
+// after the header, or -1 after reporting an error.
+int parse_begin(Token *tokens, int token_count);
+// Parses the function starting at tokens[at]. NULL after reporting an error.
+ASTNode *parse_function_at(Token *tokens, int token_count, int at);
+// Points the calls in a function parsed before the last parse_begin() at
+// the current signatures, which may have moved.
+void parse_relink(ASTNode *func);
+// Checks made across functions (@memo purity) on a program of every
+// function in file order.
+void parse_check(ASTNode *program);
+void parse_end(void);
 
 #endif // PARSER_H
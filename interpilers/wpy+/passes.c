@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "passes.h"
+#include "interpiler.h"
+
+// -----------------------------
+// Pass manager
+// -----------------------------
+typedef struct {
+    const char *name;
+    int level;                   // lowest -O level that runs the pass
+    int (*run)(ASTNode *func);   // rewrites one function, returns the changes made
+    int runs;
+    long long changes;
+    double ms;
+} Pass;
+
+// -----------------------------
+// Statement lists
+// -----------------------------
+// Statements live in a function's children after its parameters and in
+// blocks; every pass below rewrites them through these helpers.
+
+static int first_statement(ASTNode *list) {
+    return list->type == AST_FUNCTION ? list->param_count : 0;
+}
+
+static void remove_statement(ASTNode *list, int at) {
+    free_ast(list->children[at]);
+    memmove(&list->children[at], &list->children[at + 1],
+            sizeof(ASTNode *) * (size_t)(list->child_count - at - 1));
+    list->child_count--;
+}
+
+// Puts child `which` of list->children[at] in its parent's place.
+static void replace_statement(ASTNode *list, int at, int which) {
+    ASTNode *stmt = list->children[at];
+    list->children[at] = stmt->children[which];
+    stmt->children[which] = NULL;
+    free_ast(stmt);
+}
+
+// The statement lists nested directly in a statement. A pypstdio.bench
+// body is not among them: the passes leave benchmarks as written.
+static int nested_blocks(ASTNode *stmt, ASTNode **blocks) {
+    switch (stmt->type) {
+        case AST_BLOCK:
+            blocks[0] = stmt;
+            return 1;
+        case AST_IF:
+            blocks[0] = stmt->children[1];
+            if (stmt->child_count > 2) blocks[1] = stmt->children[2];
+            return stmt->child_count - 1;
+        case AST_WHILE:
+            blocks[0] = stmt->children[1];
+            return 1;
+        case AST_FOR:
+        case AST_PARALLEL_FOR:
+            blocks[0] = stmt->children[3];
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// An expression that cannot fail and does nothing but compute its value.
+static int is_pure(ASTNode *node) {
+    switch (node->type) {
+        case AST_LITERAL:
+        case AST_IDENTIFIER:
+            return 1;
+        case AST_UNARY:
+            return is_pure(node->children[0]);
+        case AST_BINARY:
+            // integer division by a variable may trap
+            if ((node->op == TOKEN_SLASH || node->op == TOKEN_PERCENT) && node->value_type != VAR_FLOAT &&
+                !(node->children[1]->type == AST_LITERAL && node->children[1]->int_value != 0)) {
+                return 0;
+            }
+            return is_pure(node->children[0]) && is_pure(node->children[1]);
+        default:
+            return 0;
+    }
+}
+
+static int is_scalar(VarType type) {
+    return type == VAR_INT || type == VAR_CHAR || type == VAR_BOOL || type == VAR_FLOAT;
+}
+
+// -----------------------------
+// undefined-names
+// -----------------------------
+// An identifier the parser could not resolve is only legal as a print
+// argument, where it prints as [undefined:name]. That is almost always a
+// typo, so it is reported before the program runs.
+static int warn_undefined(ASTNode *node) {
+    if (!node) return 0;
+    int count = 0;
+    for (int i = 0; i < node->child_count; i++) {
+        ASTNode *child = node->children[i];
+        if (node->type == AST_PRINT && child->type == AST_IDENTIFIER && child->slot < 0) {
+            fprintf(stderr, "Warning (line %d): undefined name '%s' prints as [undefined:%s]\n",
+                    child->line, child->value, child->value);
+            count++;
+        } else {
+            count += warn_undefined(child);
+        }
+    }
+    return count;
+}
+
+static int check_undefined_names(ASTNode *func) {
+    return warn_undefined(func);
+}
+
+// -----------------------------
+// const-prop
+// -----------------------------
+// A local written once, by a declaration with a literal initializer, holds
+// that literal wherever the declaration has run. Variables are visible
+// from their declaration to the end of the function, so only the reads in
+// the statements that follow it in its own block are sure to come after
+// it; those become literals and are folded with their neighbours.
+
+static void count_writes(ASTNode *node, int *writes) {
+    if (!node) return;
+    if ((node->type == AST_VAR_DECL || node->type == AST_ASSIGN) && node->slot >= 0) writes[node->slot]++;
+    // reduce variables are added to when the loop ends
+    if (node->type == AST_PARALLEL_FOR) {
+        for (int r = 4; r < node->child_count; r++) writes[node->children[r]->slot] += 2;
+    }
+    for (int i = 0; i < node->child_count; i++) count_writes(node->children[i], writes);
+}
+
+static ASTNode *declared_constant(ASTNode *stmt, const int *writes, int param_count) {
+    if (stmt->type != AST_VAR_DECL || stmt->slot < param_count || writes[stmt->slot] != 1) return NULL;
+    ASTNode *init = stmt->children[0];
+    if (init->type != AST_LITERAL || !is_scalar(stmt->value_type)) return NULL;
+
+    // the value the variable holds after the declaration's conversion
+    long long i = init->int_value;
+    double f = init->value_type == VAR_FLOAT ? init->float_value : (double)init->int_value;
+    if (stmt->value_type == VAR_CHAR) i = (char)i;
+    return make_constant(stmt->value_type, i, f);
+}
+
+static int substitute(ASTNode *node, int slot, ASTNode *value) {
+    // a benchmark's body runs as written
+    if (!node || node->type == AST_BENCH) return 0;
+    if (node->type == AST_IDENTIFIER && node->slot == slot) {
+        ASTNode *copy = make_constant(value->value_type, value->int_value, value->float_value);
+        copy->line = node->line;
+        free(node->value);
+        *node = *copy;
+        free(copy);
+        return 1;
+    }
+    int count = 0;
+    for (int i = 0; i < node->child_count; i++) count += substitute(node->children[i], slot, value);
+    if (count && (node->type == AST_UNARY || node->type == AST_BINARY)) count += fold_constant(node);
+    return count;
+}
+
+static int propagate_in(ASTNode *list, const int *writes, int param_count) {
+    int count = 0;
+    for (int i = first_statement(list); i < list->child_count; i++) {
+        ASTNode *stmt = list->children[i];
+        ASTNode *value = declared_constant(stmt, writes, param_count);
+        if (value) {
+            for (int j = i + 1; j < list->child_count; j++) {
+                count += substitute(list->children[j], stmt->slot, value);
+            }
+            free_ast(value);
+        }
+        ASTNode *blocks[2];
+        int block_count = nested_blocks(stmt, blocks);
+        for (int b = 0; b < block_count; b++) count += propagate_in(blocks[b], writes, param_count);
+    }
+    return count;
+}
+
+static int propagate_constants(ASTNode *func) {
+    int *writes = calloc((size_t)func->local_count + 1, sizeof(int));
+    count_writes(func, writes);
+    int count = propagate_in(func, writes, func->param_count);
+    free(writes);
+    return count;
+}
+
+// -----------------------------
+// dead-code
+// -----------------------------
+// Drops the branches a constant condition never takes, loops that never
+// run, and statements after one that cannot fall through: a return, an
+// if whose branches both end that way, or a loop on a true constant (the
+// language has no break, so only a return leaves it).
+
+static int is_constant(ASTNode *cond, int truth) {
+    return cond->type == AST_LITERAL && (cond->int_value != 0) == truth;
+}
+
+static int terminates(ASTNode *stmt) {
+    switch (stmt->type) {
+        case AST_RETURN:
+            return 1;
+        case AST_BLOCK:
+            for (int i = 0; i < stmt->child_count; i++) {
+                if (terminates(stmt->children[i])) return 1;
+            }
+            return 0;
+        case AST_IF:
+            return stmt->child_count > 2 && terminates(stmt->children[1]) && terminates(stmt->children[2]);
+        case AST_WHILE:
+            return is_constant(stmt->children[0], 1);
+        case AST_FOR:
+            return is_constant(stmt->children[1], 1);
+        default:
+            return 0;
+    }
+}
+
+static int remove_dead_in(ASTNode *list) {
+    int count = 0;
+    for (int i = first_statement(list); i < list->child_count; i++) {
+        ASTNode *stmt = list->children[i];
+        if (stmt->type == AST_IF && stmt->children[0]->type == AST_LITERAL) {
+            int taken = stmt->children[0]->int_value ? 1 : 2;
+            count++;
+            if (taken >= stmt->child_count) {
+                remove_statement(list, i--);
+                continue;
+            }
+            replace_statement(list, i, taken);
+        } else if (stmt->type == AST_WHILE && is_constant(stmt->children[0], 0)) {
+            count++;
+            remove_statement(list, i--);
+            continue;
+        } else if (stmt->type == AST_FOR && is_constant(stmt->children[1], 0)) {
+            // only the initial assignment runs
+            count++;
+            replace_statement(list, i, 0);
+        }
+        stmt = list->children[i];
+
+        ASTNode *blocks[2];
+        int block_count = nested_blocks(stmt, blocks);
+        for (int b = 0; b < block_count; b++) count += remove_dead_in(blocks[b]);
+
+        if (terminates(stmt)) {
+            while (list->child_count > i + 1) {
+                remove_statement(list, list->child_count - 1);
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+static int remove_dead_code(ASTNode *func) {
+    return remove_dead_in(func);
+}
+
+// -----------------------------
+// unused-vars
+// -----------------------------
+// Declarations and assignments of locals that are never read are dropped
+// when computing the value has no effect: scalars and strings from pure
+// expressions, and arrays, maps and builders of a constant size. Files
+// and channels are always kept. Dropping one statement can leave the
+// variables it read unused in turn, so this repeats until nothing changes.
+
+static void count_reads(ASTNode *node, int *reads) {
+    if (!node) return;
+    if ((node->type == AST_IDENTIFIER || node->type == AST_INDEX || node->type == AST_STORE_INDEX) &&
+        node->slot >= 0) {
+        reads[node->slot]++;
+    }
+    for (int i = 0; i < node->child_count; i++) count_reads(node->children[i], reads);
+}
+
+static int is_unused(ASTNode *stmt, const int *reads) {
+    if ((stmt->type != AST_VAR_DECL && stmt->type != AST_ASSIGN) || stmt->slot < 0 || reads[stmt->slot]) {
+        return 0;
+    }
+    ASTNode *value = stmt->children[0];
+    if (!is_pure(value)) return 0;
+    if (is_scalar(stmt->value_type) || stmt->value_type == VAR_STRING || stmt->type == AST_ASSIGN) return 1;
+    switch (stmt->value_type) {
+        case VAR_ARRAY_INT:
+        case VAR_ARRAY_FLOAT:
+        case VAR_MAP_INT:
+        case VAR_MAP_STR:
+        case VAR_BUILDER:
+            return value->type == AST_LITERAL && value->int_value >= 0;
+        default:
+            return 0;
+    }
+}
+
+static int remove_unused_in(ASTNode *list, const int *reads) {
+    int count = 0;
+    for (int i = first_statement(list); i < list->child_count; i++) {
+        ASTNode *stmt = list->children[i];
+        if (is_unused(stmt, reads)) {
+            remove_statement(list, i--);
+            count++;
+            continue;
+        }
+        ASTNode *blocks[2];
+        int block_count = nested_blocks(stmt, blocks);
+        for (int b = 0; b < block_count; b++) count += remove_unused_in(blocks[b], reads);
+    }
+    return count;
+}
+
+static int remove_unused_variables(ASTNode *func) {
+    int *reads = malloc(sizeof(int) * ((size_t)func->local_count + 1));
+    int total = 0, count;
+    do {
+        memset(reads, 0, sizeof(int) * ((size_t)func->local_count + 1));
+        count_reads(func, reads);
+        count = remove_unused_in(func, reads);
+        total += count;
+    } while (count);
+    free(reads);
+    return total;
+}
+
+// -----------------------------
+// Entry points
+// -----------------------------
+// In order: constants are propagated first so that the conditions they
+// decide are removed as dead code, which in turn leaves variables unused.
+static Pass passes[] = {
+    { "undefined-names", 0, check_undefined_names,   0, 0, 0.0 },
+    { "const-prop",      2, propagate_constants,     0, 0, 0.0 },
+    { "dead-code",       1, remove_dead_code,        0, 0, 0.0 },
+    { "unused-vars",     2, remove_unused_variables, 0, 0, 0.0 },
+};
+
+#define PASS_COUNT ((int)(sizeof(passes) / sizeof(passes[0])))
+
+void run_passes(ASTNode *program) {
+    if (!program || program->type != AST_PROGRAM) return;
+    for (int p = 0; p < PASS_COUNT; p++) {
+        Pass *pass = &passes[p];
+        if (pass->level > interpiler_options.opt_level) continue;
+
+        struct timespec start, end;
+        timespec_get(&start, TIME_UTC);
+        for (int f = 0; f < program->child_count; f++) pass->changes += pass->run(program->children[f]);
+        timespec_get(&end, TIME_UTC);
+        pass->ms += (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        pass->runs++;
+    }
+}
+
+void report_passes(void) {
+    fflush(stdout);
+    for (int p = 0; p < PASS_COUNT; p++) {
+        const Pass *pass = &passes[p];
+        if (!pass->runs) continue;
+        fprintf(stderr, "Pass %s: %lld changes in %.3f ms\n", pass->name, pass->changes, pass->ms);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include "parser.h"
+
+// -----------------------------
+// Optimization passes
+// -----------------------------
+// Run on a parsed program (or module) before it is compiled. Each pass
+// rewrites the typed AST in place and counts what it changed; the -O
+// level (interpiler_options.opt_level) picks which passes run:
+//
+//   -O0  undefined-names
+//   -O1  + dead-code
+//   -O2  + const-prop, unused-vars   (default)
+//
+// undefined-names only warns, so it runs at every level.
+void run_passes(ASTNode *program);
+
+// Prints each pass's changes and time, summed over every program and
+// module run through run_passes(), to stderr (--passes).
+void report_passes(void);
+
+#endif // PASSES_H
@@ -0,0 +1,392 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "snapshot.h"
+#include "modules.h"
+#include "array.h"
+#include "map.h"
+#include "builder.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// An image is the magic, the linked program, then the state: main's ip,
+// the slot types, the objects and the slots, every item padded to 8 bytes
+// and the state summed a word at a time into its last 8 bytes.
+#define SNAPSHOT_MAGIC "PYPSNAP1"
+
+static uint64_t sum_word(uint64_t sum, uint64_t word) {
+    return (sum ^ word) * 1099511628211ull;
+}
+
+// -----------------------------
+// Saving
+// -----------------------------
+typedef struct {
+    FILE *fp;
+    uint64_t sum;
+    int ok;
+} ImageWriter;
+
+static void put(ImageWriter *w, const void *data, size_t n) {
+    const unsigned char *p = data;
+    size_t whole = n & ~(size_t)7;
+    for (size_t i = 0; i < whole; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        w->sum = sum_word(w->sum, word);
+    }
+    if (n && fwrite(p, 1, n, w->fp) != n) w->ok = 0;
+    if (n > whole) {
+        uint64_t tail = 0;
+        static const char zeros[8];
+        memcpy(&tail, p + whole, n - whole);
+        w->sum = sum_word(w->sum, tail);
+        if (fwrite(zeros, 1, 8 - (n - whole), w->fp) != 8 - (n - whole)) w->ok = 0;
+    }
+}
+
+static void put_int(ImageWriter *w, long long v) {
+    put(w, &v, sizeof(v));
+}
+
+static int is_object_type(VarType t) {
+    return t == VAR_STRING || t == VAR_ARRAY_INT || t == VAR_ARRAY_FLOAT || t == VAR_MAP_INT ||
+           t == VAR_MAP_STR || t == VAR_BUILDER;
+}
+
+static void put_object(ImageWriter *w, VarType type, void *ptr) {
+    put_int(w, type);
+    if (type == VAR_STRING) {
+        Str *s = ptr;
+        const char *chars = str_chars(s);
+        if (!chars) {
+            w->ok = 0;
+            return;
+        }
+        put_int(w, s->length);
+        put(w, chars, (size_t)s->length + 1);
+    } else if (type == VAR_ARRAY_INT || type == VAR_ARRAY_FLOAT) {
+        Array *array = ptr;
+        put_int(w, array->length);
+        put(w, array->data, (size_t)array->length * 8);
+    } else if (type == VAR_BUILDER) {
+        Builder *b = ptr;
+        put_int(w, b->length);
+        put(w, b->data, (size_t)b->length);
+    } else {
+        Map *map = ptr;
+        put_int(w, map->capacity);
+        put_int(w, map->tombstones);
+        put(w, map->ctrl, (size_t)map->capacity);
+        if (map->key_type == VAR_INT) {
+            // free slots hold whatever was there before: write them as zeros
+            MapEntry *entries = malloc(sizeof(MapEntry) * (size_t)map->capacity);
+            if (!entries) {
+                w->ok = 0;
+                return;
+            }
+            memcpy(entries, map->entries, sizeof(MapEntry) * (size_t)map->capacity);
+            for (long long i = 0; i < map->capacity; i++) {
+                if (!map_slot_full(map, i)) memset(&entries[i], 0, sizeof(MapEntry));
+            }
+            put(w, entries, sizeof(MapEntry) * (size_t)map->capacity);
+            free(entries);
+            return;
+        }
+        // string keys live in the map's chunks: each slot's value, then its
+        // key's length (-1 if it has none) and text
+        for (long long i = 0; i < map->capacity; i++) {
+            Str *key = map_slot_full(map, i) ? map->entries[i].key.str : NULL;
+            put_int(w, key ? map->entries[i].value : 0);
+            put_int(w, key ? key->length : -1);
+            if (key) put(w, key->chars, (size_t)key->length + 1);
+        }
+    }
+}
+
+const char *snapshot_save(const char *path, const Program *program, int ip, const Value *slots,
+                          const char *types) {
+    int slot_count = (int)strlen(types);
+    // several slots may hold the same array, map or builder
+    void **objects = malloc(sizeof(void *) * ((size_t)slot_count + 1));
+    long long *refs = malloc(sizeof(long long) * ((size_t)slot_count + 1));
+    int object_count = 0;
+    for (int i = 0; i < slot_count; i++) {
+        VarType type = (VarType)(types[i] - TYPE_CODE(0));
+        refs[i] = -1;
+        if (!is_object_type(type) || !slots[i].p) continue;
+        for (int k = 0; k < object_count && refs[i] < 0; k++) {
+            if (objects[k] == slots[i].p) refs[i] = k;
+        }
+        if (refs[i] < 0) {
+            refs[i] = object_count;
+            objects[object_count++] = slots[i].p;
+        }
+    }
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        free(objects);
+        free(refs);
+        return "cannot create the snapshot file";
+    }
+    ImageWriter w = { fp, 14695981039346656037ull, 1 };
+    fwrite(SNAPSHOT_MAGIC, 1, 8, fp);
+    if (!modules_save_linked(fp, program)) w.ok = 0;
+    long at = ftell(fp);
+    static const char zeros[8];
+    if (at < 0 || fwrite(zeros, 1, (size_t)(-at & 7), fp) != (size_t)(-at & 7)) w.ok = 0;
+
+    put_int(&w, ip);
+    put_int(&w, slot_count);
+    put(&w, types, (size_t)slot_count);
+    put_int(&w, object_count);
+    for (int k = 0; k < object_count; k++) {
+        int i = 0;
+        while (refs[i] != k) i++;
+        put_object(&w, (VarType)(types[i] - TYPE_CODE(0)), objects[k]);
+    }
+    for (int i = 0; i < slot_count; i++) {
+        VarType type = (VarType)(types[i] - TYPE_CODE(0));
+        if (is_object_type(type)) put_int(&w, refs[i]);
+        else put(&w, &slots[i], sizeof(Value));
+    }
+    uint64_t sum = w.sum;
+    if (fwrite(&sum, 1, sizeof(sum), fp) != sizeof(sum)) w.ok = 0;
+    if (fclose(fp) != 0) w.ok = 0;
+    free(objects);
+    free(refs);
+    if (!w.ok) {
+        remove(path);
+        return "cannot write the snapshot file";
+    }
+    return NULL;
+}
+
+// -----------------------------
+// Loading
+// -----------------------------
+// Every get_* checks the bounds and clears `ok` on a short image.
+typedef struct {
+    const char *data;
+    size_t size;
+    size_t pos;
+    int ok;
+} ImageReader;
+
+// n bytes of the image, which stays mapped while the snapshot loads
+static const char *get(ImageReader *r, size_t n) {
+    size_t padded = (n + 7) & ~(size_t)7;
+    if (!r->ok || padded < n || r->size - r->pos < padded) {
+        r->ok = 0;
+        return NULL;
+    }
+    const char *p = r->data + r->pos;
+    r->pos += padded;
+    return p;
+}
+
+static long long get_int(ImageReader *r) {
+    long long v = 0;
+    const char *p = get(r, sizeof(v));
+    if (p) memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// A count of items of item_size bytes that must fit in what is left.
+static long long get_count(ImageReader *r, size_t item_size) {
+    long long n = get_int(r);
+    if (n < 0 || (size_t)n > (r->size - r->pos) / item_size) {
+        r->ok = 0;
+        return 0;
+    }
+    return n;
+}
+
+static void *get_map(ImageReader *r, VarType type) {
+    long long capacity = get_count(r, 1), tombstones = get_int(r);
+    const unsigned char *ctrl = (const unsigned char *)get(r, (size_t)capacity);
+    if (!ctrl) return NULL;
+    if (type == VAR_MAP_INT) {
+        const MapEntry *entries = (const MapEntry *)get(r, sizeof(MapEntry) * (size_t)capacity);
+        return entries ? map_restore(VAR_INT, capacity, tombstones, ctrl, entries) : NULL;
+    }
+
+    MapEntry *entries = calloc((size_t)capacity + 1, sizeof(MapEntry));
+    Str *keys = calloc((size_t)capacity + 1, sizeof(Str));
+    Map *map = NULL;
+    if (entries && keys) {
+        for (long long i = 0; i < capacity && r->ok; i++) {
+            entries[i].value = get_int(r);
+            long long length = get_int(r);
+            if (length < 0) continue;
+            keys[i].length = length;
+            keys[i].chars = get(r, (size_t)length + 1);
+            entries[i].key.str = &keys[i];
+        }
+        if (r->ok) map = map_restore(VAR_STRING, capacity, tombstones, ctrl, entries);
+    }
+    free(keys);
+    free(entries);
+    return map;
+}
+
+static void *get_object(ImageReader *r, VarType type) {
+    if (type == VAR_MAP_INT || type == VAR_MAP_STR) return get_map(r, type);
+    if (type == VAR_ARRAY_INT || type == VAR_ARRAY_FLOAT) {
+        long long length = get_count(r, 8);
+        const char *data = get(r, (size_t)length * 8);
+        Array *array = data ? array_new(type == VAR_ARRAY_INT ? VAR_INT : VAR_FLOAT, length) : NULL;
+        if (array) memcpy(array->data, data, (size_t)length * 8);
+        return array;
+    }
+    long long length = get_count(r, 1);
+    const char *data = get(r, (size_t)length + (type == VAR_STRING));
+    if (!data) return NULL;
+    if (type == VAR_STRING) return str_new(data, length);
+    Builder *b = builder_new(length);
+    if (b) {
+        memcpy(b->data, data, (size_t)length);
+        b->length = length;
+    }
+    return b;
+}
+
+static void free_object(SnapshotObject *obj) {
+    if (obj->type == VAR_STRING) str_free(obj->ptr);
+    else if (obj->type == VAR_BUILDER) builder_free(obj->ptr);
+    else if (obj->type == VAR_MAP_INT || obj->type == VAR_MAP_STR) map_free(obj->ptr);
+    else array_free(obj->ptr);
+}
+
+// Reads the state that follows the program. 0 if it is damaged.
+static int read_state(ImageReader *r, Snapshot *s) {
+    const Function *main_fn = &s->program->functions[s->program->main_index];
+    s->ip = (int)get_int(r);
+    s->slot_count = (int)get_count(r, 1);
+    const char *types = get(r, (size_t)s->slot_count);
+    if (!r->ok || s->ip < 0 || s->ip >= main_fn->code_count || s->slot_count > main_fn->local_count) return 0;
+    for (int i = 0; i < s->slot_count; i++) {
+        VarType type = (VarType)(types[i] - TYPE_CODE(0));
+        if (types[i] < TYPE_CODE(0) || type > VAR_ITER_FLOAT) return 0;
+    }
+
+    int count = (int)get_count(r, 16);
+    if (count > s->slot_count) return 0;
+    s->objects = calloc((size_t)count + 1, sizeof(SnapshotObject));
+    for (int k = 0; k < count && r->ok; k++) {
+        VarType type = (VarType)get_int(r);
+        if (!is_object_type(type)) return 0;
+        s->objects[k].type = type;
+        s->objects[k].ptr = get_object(r, type);
+        if (!s->objects[k].ptr) return 0;
+        s->object_count++;
+    }
+
+    s->slots = calloc((size_t)main_fn->local_count + 1, sizeof(Value));
+    for (int i = 0; i < s->slot_count && r->ok; i++) {
+        VarType type = (VarType)(types[i] - TYPE_CODE(0));
+        const char *p = get(r, sizeof(Value));
+        if (!p) return 0;
+        memcpy(&s->slots[i], p, sizeof(Value));
+        if (!is_object_type(type)) continue;
+        long long ref = s->slots[i].i;
+        if (ref < -1 || ref >= s->object_count || (ref >= 0 && s->objects[ref].type != type)) return 0;
+        s->slots[i].p = ref < 0 ? NULL : s->objects[ref].ptr;
+    }
+    return r->ok && r->pos == r->size;
+}
+
+// The whole file, mapped where possible. NULL if it cannot be read.
+static const char *map_image(const char *path, size_t *size) {
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *data = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) data = NULL;
+        *size = (size_t)st.st_size;
+    }
+    close(fd);
+    return data;
+#else
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    char *data = NULL;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        long length = ftell(fp);
+        rewind(fp);
+        data = length > 0 ? malloc((size_t)length) : NULL;
+        if (data && fread(data, 1, (size_t)length, fp) != (size_t)length) {
+            free(data);
+            data = NULL;
+        }
+        *size = (size_t)length;
+    }
+    fclose(fp);
+    return data;
+#endif
+}
+
+static void unmap_image(const char *data, size_t size) {
+#ifndef _WIN32
+    munmap((void *)data, size);
+#else
+    (void)size;
+    free((void *)data);
+#endif
+}
+
+int snapshot_load(const char *path, Snapshot *s) {
+    memset(s, 0, sizeof(*s));
+    size_t size = 0;
+    const char *data = map_image(path, &size);
+    if (!data) {
+        fprintf(stderr, "wpy+.exe: cannot read snapshot %s\n", path);
+        return 0;
+    }
+
+    size_t used = 0;
+    if (size >= 8 && memcmp(data, SNAPSHOT_MAGIC, 8) == 0) s->program = modules_load_linked(data + 8, size - 8, &used);
+    size_t start = (8 + used + 7) & ~(size_t)7;
+    int ok = s->program && size >= start + 8 && (size - start) % 8 == 0;
+    if (ok) {
+        uint64_t sum = 14695981039346656037ull, stored, word;
+        for (size_t i = start; i < size - 8; i += 8) {
+            memcpy(&word, data + i, 8);
+            sum = sum_word(sum, word);
+        }
+        memcpy(&stored, data + size - 8, 8);
+        ImageReader r = { data + start, size - start - 8, 0, 1 };
+        ok = sum == stored && read_state(&r, s);
+    }
+    unmap_image(data, size);
+    if (!ok) {
+        fprintf(stderr, "wpy+.exe: %s is not a snapshot from this wpy+.exe, or it is damaged\n", path);
+        for (int k = 0; k < s->object_count; k++) free_object(&s->objects[k]);
+        free_program(s->program);
+        snapshot_release(s);
+        s->program = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+void snapshot_release(Snapshot *s) {
+    free(s->slots);
+    free(s->objects);
+    s->slots = NULL;
+    s->objects = NULL;
+    s->slot_count = s->object_count = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "compiler.h"
+
+// -----------------------------
+// --snapshot / --resume images
+// -----------------------------
+// `wpy+.exe script.pyp --snapshot out.img` runs the script up to its
+// pypstdio.snapshot() and saves the run there: the linked program (see
+// modules_save_linked) and main's live slots, with the strings, arrays,
+// maps and builders they point at. `wpy+.exe --resume out.img` maps the
+// image and carries on from the next instruction, without lexing,
+// parsing, compiling or redoing the work before the snapshot.
+//
+// Arrays, map tables and builder contents are stored as they are in
+// memory, 8-byte aligned, and come back with one copy each; maps keep
+// their exact layout, so iteration order and cursors are unchanged. An
+// image only loads into the build that wrote it.
+
+typedef struct {
+    VarType type;   // VAR_STRING, VAR_ARRAY_*, VAR_MAP_* or VAR_BUILDER
+    void *ptr;
+} SnapshotObject;
+
+typedef struct {
+    Program *program;
+    int ip;                   // main carries on from this instruction
+    Value *slots;             // main's first slot_count slots
+    int slot_count;
+    SnapshotObject *objects;  // what the slots point at, for main's region
+    int object_count;
+} Snapshot;
+
+// Saves `program` and main's first strlen(types) slots, whose types are
+// given by `types` (see AST_SNAPSHOT), to resume at `ip`. NULL, or what
+// went wrong.
+const char *snapshot_save(const char *path, const Program *program, int ip, const Value *slots,
+                          const char *types);
+// Loads an image saved by snapshot_save. 0 after printing an error.
+int snapshot_load(const char *path, Snapshot *snapshot);
+// Frees the slots and object list, not the objects or the program.
+void snapshot_release(Snapshot *snapshot);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "str.h"
+
+Str *str_new(const char *chars, long long length) {
+    Str *s = malloc(sizeof(Str) + (size_t)length + 1);
+    if (!s) return NULL;
+    char *text = (char *)(s + 1);
+    memcpy(text, chars, (size_t)length);
+    text[length] = '\0';
+    s->length = length;
+    s->chars = text;
+    s->left = NULL;
+    s->right = NULL;
+    s->transient = 0;
+    return s;
+}
+
+// Bytes a copy of transient s takes inside a rope node, kept aligned for
+// whatever follows it.
+static size_t transient_size(const Str *s) {
+    if (!s->transient) return 0;
+    return (STR_FLAT_SIZE(s->length) + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+}
+
+static Str *copy_at(char *memory, const Str *s) {
+    Str *copy = (Str *)memory;
+    char *text = (char *)(copy + 1);
+    memcpy(text, s->chars, (size_t)s->length + 1);
+    copy->length = s->length;
+    copy->chars = text;
+    copy->left = NULL;
+    copy->right = NULL;
+    copy->transient = 0;
+    return copy;
+}
+
+Str *str_concat(Str *a, Str *b) {
+    if (a->length == 0) return b->transient ? str_new(b->chars, b->length) : b;
+    if (b->length == 0) return a->transient ? str_new(a->chars, a->length) : a;
+
+    long long length = a->length + b->length;
+    if (length <= STR_FLAT_MAX) {
+        void *memory = malloc(STR_FLAT_SIZE(length));
+        Str *s = memory ? str_concat_at(memory, a, b) : NULL;
+        if (!s) free(memory);
+        return s;
+    }
+
+    // the node, then copies of its transient halves: freed with it
+    size_t a_size = transient_size(a);
+    char *memory = malloc(sizeof(Str) + a_size + transient_size(b));
+    if (!memory) return NULL;
+    Str *s = (Str *)memory;
+    s->length = length;
+    s->chars = NULL;
+    s->left = a->transient ? copy_at(memory + sizeof(Str), a) : a;
+    s->right = b->transient ? copy_at(memory + sizeof(Str) + a_size, b) : b;
+    s->transient = 0;
+    return s;
+}
+
+Str *str_concat_at(void *memory, Str *a, Str *b) {
+    const char *ac = str_chars(a), *bc = str_chars(b);
+    if (!ac || !bc) return NULL;
+    Str *s = memory;
+    char *text = (char *)(s + 1);
+    memcpy(text, ac, (size_t)a->length);
+    memcpy(text + a->length, bc, (size_t)b->length + 1);
+    s->length = a->length + b->length;
+    s->chars = text;
+    s->left = NULL;
+    s->right = NULL;
+    s->transient = 0;
+    return s;
+}
+
+void str_free(Str *s) {
+    if (!s) return;
+    // a flattened rope owns its separately allocated text
+    if (s->left) free((char *)s->chars);
+    free(s);
+}
+
+// Copies the text of a rope into `out` without recursion: ropes built by
+// appending in a loop are as deep as they are long.
+static int flatten_into(Str *root, char *out) {
+    int cap = 64, top = 0;
+    Str **stack = malloc(sizeof(Str *) * cap);
+    if (!stack) return 0;
+    stack[top++] = root;
+    while (top > 0) {
+        Str *s = stack[--top];
+        if (s->chars) {
+            memcpy(out, s->chars, (size_t)s->length);
+            out += s->length;
+            continue;
+        }
+        if (top + 2 > cap) {
+            cap *= 2;
+            Str **grown = realloc(stack, sizeof(Str *) * cap);
+            if (!grown) {
+                free(stack);
+                return 0;
+            }
+            stack = grown;
+        }
+        stack[top++] = s->right;
+        stack[top++] = s->left;
+    }
+    free(stack);
+    return 1;
+}
+
+const char *str_chars(Str *s) {
+    if (s->chars) return s->chars;
+    char *text = malloc((size_t)s->length + 1);
+    if (!text || !flatten_into(s, text)) {
+        free(text);
+        return NULL;
+    }
+    text[s->length] = '\0';
+    s->chars = text;
+    return text;
+}
+
+int str_equal(Str *a, Str *b) {
+    if (a == b) return 1;
+    if (a->length != b->length) return 0;
+    const char *ac = str_chars(a), *bc = str_chars(b);
+    return ac && bc && memcmp(ac, bc, (size_t)a->length) == 0;
+}
+
+// -----------------------------
+// Number formatting
+// -----------------------------
+// Shortest round-trip digits come from Grisu3 (Loitsch, "Printing
+// floating-point numbers quickly and accurately with integers"), which
+// works in 64-bit integers and fails, rather than guess, on the few
+// values (about 0.5%) it cannot prove shortest; those take the slow way
+// through snprintf and strtod.
+
+// A float as f * 2^e, with 64 bits of significand.
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+// 10^k as a normalized DiyFp, every 8th k from -348 to 340.
+static const struct {
+    uint64_t f;
+    int e;
+    int k;
+} cached_powers[] = {
+    { 0xfa8fd5a0081c0288ULL, -1220, -348 },
+    { 0xbaaee17fa23ebf76ULL, -1193, -340 },
+    { 0x8b16fb203055ac76ULL, -1166, -332 },
+    { 0xcf42894a5dce35eaULL, -1140, -324 },
+    { 0x9a6bb0aa55653b2dULL, -1113, -316 },
+    { 0xe61acf033d1a45dfULL, -1087, -308 },
+    { 0xab70fe17c79ac6caULL, -1060, -300 },
+    { 0xff77b1fcbebcdc4fULL, -1034, -292 },
+    { 0xbe5691ef416bd60cULL, -1007, -284 },
+    { 0x8dd01fad907ffc3cULL, -980, -276 },
+    { 0xd3515c2831559a83ULL, -954, -268 },
+    { 0x9d71ac8fada6c9b5ULL, -927, -260 },
+    { 0xea9c227723ee8bcbULL, -901, -252 },
+    { 0xaecc49914078536dULL, -874, -244 },
+    { 0x823c12795db6ce57ULL, -847, -236 },
+    { 0xc21094364dfb5637ULL, -821, -228 },
+    { 0x9096ea6f3848984fULL, -794, -220 },
+    { 0xd77485cb25823ac7ULL, -768, -212 },
+    { 0xa086cfcd97bf97f4ULL, -741, -204 },
+    { 0xef340a98172aace5ULL, -715, -196 },
+    { 0xb23867fb2a35b28eULL, -688, -188 },
+    { 0x84c8d4dfd2c63f3bULL, -661, -180 },
+    { 0xc5dd44271ad3cdbaULL, -635, -172 },
+    { 0x936b9fcebb25c996ULL, -608, -164 },
+    { 0xdbac6c247d62a584ULL, -582, -156 },
+    { 0xa3ab66580d5fdaf6ULL, -555, -148 },
+    { 0xf3e2f893dec3f126ULL, -529, -140 },
+    { 0xb5b5ada8aaff80b8ULL, -502, -132 },
+    { 0x87625f056c7c4a8bULL, -475, -124 },
+    { 0xc9bcff6034c13053ULL, -449, -116 },
+    { 0x964e858c91ba2655ULL, -422, -108 },
+    { 0xdff9772470297ebdULL, -396, -100 },
+    { 0xa6dfbd9fb8e5b88fULL, -369, -92 },
+    { 0xf8a95fcf88747d94ULL, -343, -84 },
+    { 0xb94470938fa89bcfULL, -316, -76 },
+    { 0x8a08f0f8bf0f156bULL, -289, -68 },
+    { 0xcdb02555653131b6ULL, -263, -60 },
+    { 0x993fe2c6d07b7facULL, -236, -52 },
+    { 0xe45c10c42a2b3b06ULL, -210, -44 },
+    { 0xaa242499697392d3ULL, -183, -36 },
+    { 0xfd87b5f28300ca0eULL, -157, -28 },
+    { 0xbce5086492111aebULL, -130, -20 },
+    { 0x8cbccc096f5088ccULL, -103, -12 },
+    { 0xd1b71758e219652cULL, -77, -4 },
+    { 0x9c40000000000000ULL, -50, 4 },
+    { 0xe8d4a51000000000ULL, -24, 12 },
+    { 0xad78ebc5ac620000ULL, 3, 20 },
+    { 0x813f3978f8940984ULL, 30, 28 },
+    { 0xc097ce7bc90715b3ULL, 56, 36 },
+    { 0x8f7e32ce7bea5c70ULL, 83, 44 },
+    { 0xd5d238a4abe98068ULL, 109, 52 },
+    { 0x9f4f2726179a2245ULL, 136, 60 },
+    { 0xed63a231d4c4fb27ULL, 162, 68 },
+    { 0xb0de65388cc8ada8ULL, 189, 76 },
+    { 0x83c7088e1aab65dbULL, 216, 84 },
+    { 0xc45d1df942711d9aULL, 242, 92 },
+    { 0x924d692ca61be758ULL, 269, 100 },
+    { 0xda01ee641a708deaULL, 295, 108 },
+    { 0xa26da3999aef774aULL, 322, 116 },
+    { 0xf209787bb47d6b85ULL, 348, 124 },
+    { 0xb454e4a179dd1877ULL, 375, 132 },
+    { 0x865b86925b9bc5c2ULL, 402, 140 },
+    { 0xc83553c5c8965d3dULL, 428, 148 },
+    { 0x952ab45cfa97a0b3ULL, 455, 156 },
+    { 0xde469fbd99a05fe3ULL, 481, 164 },
+    { 0xa59bc234db398c25ULL, 508, 172 },
+    { 0xf6c69a72a3989f5cULL, 534, 180 },
+    { 0xb7dcbf5354e9beceULL, 561, 188 },
+    { 0x88fcf317f22241e2ULL, 588, 196 },
+    { 0xcc20ce9bd35c78a5ULL, 614, 204 },
+    { 0x98165af37b2153dfULL, 641, 212 },
+    { 0xe2a0b5dc971f303aULL, 667, 220 },
+    { 0xa8d9d1535ce3b396ULL, 694, 228 },
+    { 0xfb9b7cd9a4a7443cULL, 720, 236 },
+    { 0xbb764c4ca7a44410ULL, 747, 244 },
+    { 0x8bab8eefb6409c1aULL, 774, 252 },
+    { 0xd01fef10a657842cULL, 800, 260 },
+    { 0x9b10a4e5e9913129ULL, 827, 268 },
+    { 0xe7109bfba19c0c9dULL, 853, 276 },
+    { 0xac2820d9623bf429ULL, 880, 284 },
+    { 0x80444b5e7aa7cf85ULL, 907, 292 },
+    { 0xbf21e44003acdd2dULL, 933, 300 },
+    { 0x8e679c2f5e44ff8fULL, 960, 308 },
+    { 0xd433179d9c8cb841ULL, 986, 316 },
+    { 0x9e19db92b4e31ba9ULL, 1013, 324 },
+    { 0xeb96bf6ebadf77d9ULL, 1039, 332 },
+    { 0xaf87023b9bf0ee6bULL, 1066, 340 },
+};
+
+static DiyFp diy_normalize(DiyFp x) {
+    while (!(x.f & 0xFFC0000000000000ULL)) {
+        x.f <<= 10;
+        x.e -= 10;
+    }
+    while (!(x.f & 0x8000000000000000ULL)) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+// x * y, rounded to 64 bits.
+static DiyFp diy_times(DiyFp x, DiyFp y) {
+    uint64_t a = x.f >> 32, b = x.f & 0xFFFFFFFFu, c = y.f >> 32, d = y.f & 0xFFFFFFFFu;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t mid = (bd >> 32) + (ad & 0xFFFFFFFFu) + (bc & 0xFFFFFFFFu) + (1u << 31);
+    DiyFp r = { ac + (ad >> 32) + (bc >> 32) + (mid >> 32), x.e + y.e + 64 };
+    return r;
+}
+
+// Moves the last digit towards w while that stays inside the interval,
+// then checks the result is provably the closest. 0 when it is not.
+static int round_weed(char *digits, int length, uint64_t distance_too_high_w, uint64_t unsafe_interval,
+                      uint64_t rest, uint64_t ten_kappa, uint64_t unit) {
+    uint64_t small_distance = distance_too_high_w - unit;
+    uint64_t big_distance = distance_too_high_w + unit;
+    while (rest < small_distance && unsafe_interval - rest >= ten_kappa &&
+           (rest + ten_kappa < small_distance || small_distance - rest >= rest + ten_kappa - small_distance)) {
+        digits[length - 1]--;
+        rest += ten_kappa;
+    }
+    if (rest < big_distance && unsafe_interval - rest >= ten_kappa &&
+        (rest + ten_kappa < big_distance || big_distance - rest > rest + ten_kappa - big_distance)) {
+        return 0;
+    }
+    return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+}
+
+// Digits of the shortest number strictly inside (low, high), all three
+// scaled so that high's integer part fits in 32 bits. On success the
+// number is digits * 10^*kappa.
+static int digit_gen(DiyFp low, DiyFp w, DiyFp high, char *digits, int *length, int *kappa) {
+    uint64_t unit = 1;
+    uint64_t too_low = low.f - unit, too_high = high.f + unit;
+    uint64_t unsafe_interval = too_high - too_low;
+    int shift = -w.e;
+    uint64_t one = (uint64_t)1 << shift;
+    uint32_t integrals = (uint32_t)(too_high >> shift);
+    uint64_t fractionals = too_high & (one - 1);
+
+    uint32_t divisor = 1;
+    *kappa = 1;
+    while (integrals / divisor >= 10) {
+        divisor *= 10;
+        (*kappa)++;
+    }
+    *length = 0;
+    while (*kappa > 0) {
+        digits[(*length)++] = (char)('0' + integrals / divisor);
+        integrals %= divisor;
+        (*kappa)--;
+        uint64_t rest = ((uint64_t)integrals << shift) + fractionals;
+        if (rest < unsafe_interval) {
+            return round_weed(digits, *length, too_high - w.f, unsafe_interval, rest, (uint64_t)divisor << shift, unit);
+        }
+        divisor /= 10;
+    }
+    for (;;) {
+        fractionals *= 10;
+        unit *= 10;
+        unsafe_interval *= 10;
+        digits[(*length)++] = (char)('0' + (fractionals >> shift));
+        fractionals &= one - 1;
+        (*kappa)--;
+        if (fractionals < unsafe_interval) {
+            return round_weed(digits, *length, (too_high - w.f) * unit, unsafe_interval, fractionals, one, unit);
+        }
+    }
+}
+
+// Shortest digits of a finite v > 0, as digits * 10^*exponent. 0 when
+// Grisu3 cannot vouch for them.
+static int grisu3(double v, char *digits, int *length, int *exponent) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    uint64_t fraction = bits & 0x000FFFFFFFFFFFFFULL;
+    int biased = (int)(bits >> 52 & 0x7FF);
+    DiyFp x = biased ? (DiyFp){ fraction | 0x0010000000000000ULL, biased - 1075 } : (DiyFp){ fraction, -1074 };
+
+    // halfway to the neighbouring floats; the one below is closer at a power of two
+    DiyFp plus = diy_normalize((DiyFp){ (x.f << 1) + 1, x.e - 1 });
+    DiyFp minus = fraction == 0 && biased > 1 ? (DiyFp){ (x.f << 2) - 1, x.e - 2 } : (DiyFp){ (x.f << 1) - 1, x.e - 1 };
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+    DiyFp w = diy_normalize(x);
+
+    // the cached power that brings w's exponent into [-60, -32]
+    int min_exponent = -60 - (w.e + 64);
+    int k = (int)ceil((min_exponent + 63) * 0.30102999566398114);
+    int index = (348 + k - 1) / 8 + 1;
+    DiyFp ten_mk = { cached_powers[index].f, cached_powers[index].e };
+
+    int kappa;
+    int ok = digit_gen(diy_times(minus, ten_mk), diy_times(w, ten_mk), diy_times(plus, ten_mk), digits, length, &kappa);
+    *exponent = kappa - cached_powers[index].k;
+    return ok;
+}
+
+int str_format_float(char *buf, size_t size, double v) {
+    // whole numbers print like ints
+    if (v == 0.0) return snprintf(buf, size, signbit(v) ? "-0" : "0");
+    if (fabs(v) < 1e15 && v == (double)(long long)v) return snprintf(buf, size, "%lld", (long long)v);
+    if (isnan(v)) return snprintf(buf, size, "nan");
+    if (isinf(v)) return snprintf(buf, size, v < 0 ? "-inf" : "inf");
+
+    char digits[24];
+    int length, exponent;
+    if (!grisu3(fabs(v), digits, &length, &exponent)) {
+        // More digits never stop a value from round-tripping, so the
+        // shortest precision can be found by bisecting up to 17, which
+        // always round-trips. A normal float's own digits fill at least
+        // DBL_DIG; subnormals have fewer.
+        int lo = fabs(v) < DBL_MIN ? 1 : DBL_DIG, hi = 17;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            snprintf(buf, size, "%.*g", mid, v);
+            if (strtod(buf, NULL) == v) hi = mid;
+            else lo = mid + 1;
+        }
+        return snprintf(buf, size, "%.*g", lo, v);
+    }
+    while (length > 1 && digits[length - 1] == '0') {
+        length--;
+        exponent++;
+    }
+
+    // laid out as %g would with `length` digits of precision
+    char text[40];
+    int n = 0;
+    if (v < 0) text[n++] = '-';
+    int point = exponent + length - 1;   // the power of ten of the first digit
+    if (point < -4 || point >= length) {
+        text[n++] = digits[0];
+        if (length > 1) {
+            text[n++] = '.';
+            memcpy(text + n, digits + 1, (size_t)length - 1);
+            n += length - 1;
+        }
+        n += sprintf(text + n, "e%c%02d", point < 0 ? '-' : '+', abs(point));
+    } else if (point >= 0) {
+        memcpy(text + n, digits, (size_t)point + 1);
+        n += point + 1;
+        if (length > point + 1) {
+            text[n++] = '.';
+            memcpy(text + n, digits + point + 1, (size_t)(length - point - 1));
+            n += length - point - 1;
+        }
+    } else {
+        text[n++] = '0';
+        text[n++] = '.';
+        for (int i = point + 1; i < 0; i++) text[n++] = '0';
+        memcpy(text + n, digits, (size_t)length);
+        n += length;
+    }
+    text[n] = '\0';
+    if (size > 0) {
+        size_t copy = (size_t)n < size ? (size_t)n : size - 1;
+        memcpy(buf, text, copy);
+        buf[copy] = '\0';
+    }
+    return n;
+}
@@ -0,0 +1,50 @@
+#ifndef STR_H
+#define STR_H
+
+#include <stddef.h>
+
+// -----------------------------
+// Runtime strings
+// -----------------------------
+// A Str is either flat text or a rope: the concatenation of two other
+// strings. Concatenating builds a rope node in O(1); the text of a rope is
+// only assembled (once, then cached) when it is printed, compared or
+// hashed.
+typedef struct Str Str;
+
+struct Str {
+    long long length;
+    const char *chars;   // NUL-terminated text; NULL for a rope not yet flattened
+    Str *left;           // rope halves (NULL for flat strings)
+    Str *right;
+    int transient;       // flat text a file reader reuses on its next line (see file.h)
+};
+
+// Results up to this length are copied flat instead of becoming rope nodes:
+// a copy this short costs less than the extra node and the later flatten.
+#define STR_FLAT_MAX 32
+
+// Bytes a flat string of `length` chars takes: the Str, then its text.
+#define STR_FLAT_SIZE(length) (sizeof(Str) + (size_t)(length) + 1)
+
+// Flat copy of `length` bytes of `chars`, in one allocation.
+Str *str_new(const char *chars, long long length);
+// Rope (or a flat copy, for short results) of a followed by b. May return
+// a or b itself when the other is empty, unless it is transient; a rope
+// copies a transient half into its own allocation. Returns NULL only if
+// out of memory.
+Str *str_concat(Str *a, Str *b);
+// Flat a followed by b, built in `memory` of STR_FLAT_SIZE(a->length +
+// b->length) bytes that the caller owns. NULL only if out of memory.
+Str *str_concat_at(void *memory, Str *a, Str *b);
+void str_free(Str *s);
+
+// Text of s, flattening it on first use. NULL only if out of memory.
+const char *str_chars(Str *s);
+int str_equal(Str *a, Str *b);
+
+// Writes the shortest decimal form of v that reads back as exactly v
+// ("0.1", "3.5", "1e+100"). Returns the length written.
+int str_format_float(char *buf, size_t size, double v);
+
+#endif // STR_H
@@ -0,0 +1,71 @@
+#!/bin/sh
+# wpy+ regression tests (make check). Each test is a script in this
+# directory; its output must match <name>.out and its exit status the one
+# given to expect.
+cd "$(dirname "$0")" || exit 1
+WPY=${WPY:-../wpy+.exe}
+failed=0
+
+# expect <name> <status> [command feeding stdin]
+expect() {
+    name=$1
+    status=$2
+    if [ -n "$3" ]; then
+        actual=$(sh -c "$3" | "$WPY" "$name.pyp" --quiet 2>&1)
+    else
+        actual=$("$WPY" "$name.pyp" --quiet 2>&1 </dev/null)
+    fi
+    code=$?
+    if [ "$code" != "$status" ]; then
+        echo "FAIL $name: exit status $code, expected $status"
+        failed=1
+    elif [ "$actual" != "$(cat "$name.out")" ]; then
+        echo "FAIL $name: output differs"
+        echo "$actual" | diff "$name.out" - | head -20
+        failed=1
+    else
+        echo "ok   $name"
+    fi
+}
+
+expect input_numbers 1 "echo 00000000000000000001 -0009223372036854775808 +0 1.5 .5 -2e3 INF 0x1p3"
+expect float_format 0 "echo 0.1 0.3 2.5e-5 1e-4 123.456 1e15 1234567890123456 1e21 -1e-300 1.7976931348623157e308 5e-324 7.7088862104626e-310 0.30000000000000004 nan -nan inf -inf"
+expect int_wrap 0 "echo -9223372036854775808 -1 9223372036854775807"
+expect channel_capacity 1
+# a writer's last flush, at close, fails the run (/dev/full takes no bytes)
+if [ -w /dev/full ]; then
+    expect writer_full 1
+fi
+expect ffi 0
+expect ffi_missing 1
+
+# The language server: a hover on pypstdio.print and the diagnostic for an
+# unterminated comment (lsp.in holds the framed requests).
+if "$WPY" --lsp <lsp.in | cmp -s - lsp.out; then
+    echo "ok   lsp"
+else
+    echo "FAIL lsp: output differs"
+    failed=1
+fi
+
+# parallel for on more threads than most machines have CPUs
+WPY_THREADS=8
+export WPY_THREADS
+expect parallel 0
+expect parallel_shared 1
+expect parallel_tasks 0
+unset WPY_THREADS
+
+# Memory that must stay flat, in 128 MB of address space: reading a file
+# does not keep its lines (4M records, about 200 MB, of csv.field and
+# file.field strings), a map reuses the keys it removes, a loop frees
+# what each iteration made, and an iterator variable frees the one it
+# held when given another.
+(ulimit -v 131072 2>/dev/null
+ expect csv_flat 0 "yes 'a,b,\"c,d\",eeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeee' | head -n 4000000"
+ expect map_keys 0
+ expect loop_memory 0
+ expect iter_rebind 0
+ exit $failed) || failed=1
+
+exit $failed
@@ -24,11 +24,14 @@ typedef enum {
     TOKEN_MINUS,         // -
     TOKEN_STAR,          // *
     TOKEN_SLASH,         // /
+    TOKEN_PERCENT,       // %
     TOKEN_EQUAL,         // =
     TOKEN_EQEQ,          // ==
     TOKEN_BANGEQ,        // !=
     TOKEN_LT,            // <
     TOKEN_GT,            // >
+    TOKEN_LTEQ,          // <=
+    TOKEN_GTEQ,          // >=
     TOKEN_HASH,          // #
     TOKEN_INCLUDE,       // #include <...>
 
@@ -46,9 +49,12 @@ typedef enum {
     TOKEN_RPAREN,        // )
     TOKEN_LBRACE,        // {
     TOKEN_RBRACE,        // }
+    TOKEN_LBRACKET,      // [
+    TOKEN_RBRACKET,      // ]
     TOKEN_SEMICOLON,     // ;
     TOKEN_COMMA,         // ,
     TOKEN_DOT,           // .
+    TOKEN_AT,            // @ (function annotations)
 
     // Special
     TOKEN_COMMENT_ONELINE,   // //...
@@ -61,6 +67,7 @@ typedef struct {
     TokenType type;   // kind of token
     char *lexeme;     // actual text (heap-allocated copy)
     int line;         // line number in source
+    int column;       // byte offset of the token in its line
 } Token;
 
 #endif // TOKENS_H
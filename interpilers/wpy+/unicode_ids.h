@@ -0,0 +1,345 @@
+#ifndef UNICODE_IDS_H
+#define UNICODE_IDS_H
+
+#include <stdint.h>
+
+// -----------------------------
+// Unicode identifier classes
+// -----------------------------
+// XID_Start and XID_Continue (UAX #31) from Unicode 14.0.0, for code points
+// below U+40000; the only ones above are the variation selectors
+// U+E0100..U+E01EF, which continue identifiers (see utf8.c). '_' is left
+// out of XID_Start here: the lexer allows it itself.
+//
+// Code point cp is in block unicode_id_index[cp >> 7]. Each block holds
+// two 128-bit maps, indexed by cp & 127: words 0-1 XID_Start, words 2-3
+// XID_Continue. Generated from Python's unicodedata.
+
+#define UNICODE_ID_LIMIT 0x40000
+
+static const uint8_t unicode_id_index[2048] = {
+      0,   1,   2,   2,   2,   3,   4,   5,   2,   6,   7,   8,   9,  10,  11,  12,
+     13,  14,  15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25,  26,  27,  28,
+     29,  30,   2,   2,  31,  32,  33,  34,  35,   2,   2,   2,  36,  37,  38,  39,
+     40,  41,  42,  43,  44,  45,  46,  47,  48,  49,   2,  50,   2,   2,  51,  52,
+     53,  54,  55,  56,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,   2,  58,  59,  60,  57,  57,  57,  57,
+     61,  62,  63,  64,  57,  57,  57,  57,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,  65,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,  66,   2,   2,  67,  68,  69,  70,
+     71,  72,  73,  74,  75,  76,  77,  78,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,  79,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,   2,   2,  80,  81,  82,  83,  84,   2,  85,  86,  87,  88,  89,  90,
+     91,  92,  93,  94,  57,  95,  96,  97,   2,  98,  99, 100,   2,   2, 101, 102,
+    103, 104, 105, 106, 107, 108, 109, 110, 111, 112, 113,  57,  57, 114, 115, 116,
+    117, 118, 119, 120, 121, 122, 123,  57, 124, 125,  57, 126, 127, 128, 129,  57,
+    130, 131, 132, 133, 134, 135,  57,  57, 136, 137, 138, 139,  57, 140,  57, 141,
+      2,   2,   2,   2,   2,   2,   2, 142, 143,   2, 144,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57, 145,
+      2,   2,   2,   2,   2,   2,   2,   2, 146,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,   2,   2,   2,   2, 147,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+      2,   2,   2,   2, 148, 149, 150, 151,  57,  57,  57,  57, 152,  57, 153, 154,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2, 155,
+      2,   2,   2,   2,   2,   2,   2,   2,   2, 156,  56,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57, 157,
+      2,   2, 158,   2,   2, 159,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57, 160, 161,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57, 162,  57,
+     57,  57, 163, 164, 165,  57,  57,  57, 166, 167, 168,   2,   2, 169, 170, 171,
+     57,  57,  57,  57, 172, 173,  57,  57,  57,  57,  57,  57,  57,  57, 174,  57,
+    175,  57, 176,  57,  57, 177,  57,  57,  57,  57,  57,  57,  57,  57,  57, 178,
+      2, 179, 180,  57,  57,  57,  57,  57,  57,  57,  57,  57, 181, 182,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57, 183,  57,  57,  57,  57,  57,  57,  57,  57,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2, 184,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2, 185,   2,
+    186,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2, 187,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2, 188,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+      2,   2,   2,   2, 189,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,   2,
+      2,   2,   2,   2,   2,   2, 190,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+     57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,  57,
+};
+
+static const uint64_t unicode_id_blocks[191][4] = {
+    { 0x0000000000000000ull, 0x07fffffe07fffffeull, 0x03ff000000000000ull, 0x07fffffe87fffffeull },
+    { 0x0420040000000000ull, 0xff7fffffff7fffffull, 0x04a0040000000000ull, 0xff7fffffff7fffffull },
+    { 0xffffffffffffffffull, 0xffffffffffffffffull, 0xffffffffffffffffull, 0xffffffffffffffffull },
+    { 0xffffffffffffffffull, 0x0000501f0003ffc3ull, 0xffffffffffffffffull, 0x0000501f0003ffc3ull },
+    { 0x0000000000000000ull, 0xb8df000000000000ull, 0xffffffffffffffffull, 0xb8dfffffffffffffull },
+    { 0xfffffffbffffd740ull, 0xffbfffffffffffffull, 0xfffffffbffffd7c0ull, 0xffbfffffffffffffull },
+    { 0xfffffffffffffc03ull, 0xffffffffffffffffull, 0xfffffffffffffcfbull, 0xffffffffffffffffull },
+    { 0xfffeffffffffffffull, 0xffffffff027fffffull, 0xfffeffffffffffffull, 0xffffffff027fffffull },
+    { 0x00000000000001ffull, 0x000787ffffff0000ull, 0xbffffffffffe01ffull, 0x000787ffffff00b6ull },
+    { 0xffffffff00000000ull, 0xfffec000000007ffull, 0xffffffff07ff0000ull, 0xffffc3ffffffffffull },
+    { 0xffffffffffffffffull, 0x9c00c060002fffffull, 0xffffffffffffffffull, 0x9ffffdff9fefffffull },
+    { 0x0000fffffffd0000ull, 0xffffffffffffe000ull, 0xffffffffffff0000ull, 0xffffffffffffe7ffull },
+    { 0x0002003fffffffffull, 0x043007fffffffc00ull, 0x0003ffffffffffffull, 0x243fffffffffffffull },
+    { 0x00000110043fffffull, 0xffff07ff01ffffffull, 0x00003fffffffffffull, 0xffff07ff0fffffffull },
+    { 0xffffffff00007effull, 0x00000000000003ffull, 0xffffffffff007effull, 0xfffffffbffffffffull },
+    { 0x23fffffffffffff0ull, 0xfffe0003ff010000ull, 0xffffffffffffffffull, 0xfffeffcfffffffffull },
+    { 0x23c5fdfffff99fe1ull, 0x10030003b0004000ull, 0xf3c5fdfffff99fefull, 0x5003ffcfb080799full },
+    { 0x036dfdfffff987e0ull, 0x001c00005e000000ull, 0xd36dfdfffff987eeull, 0x003fffc05e023987ull },
+    { 0x23edfdfffffbbfe0ull, 0x0200000300010000ull, 0xf3edfdfffffbbfeeull, 0xfe00ffcf00013bbfull },
+    { 0x23edfdfffff99fe0ull, 0x00020003b0000000ull, 0xf3edfdfffff99feeull, 0x0002ffcfb0e0399full },
+    { 0x03ffc718d63dc7e8ull, 0x0000000000010000ull, 0xc3ffc718d63dc7ecull, 0x0000ffc000813dc7ull },
+    { 0x23fffdfffffddfe0ull, 0x0000000327000000ull, 0xf3fffdfffffddfffull, 0x0000ffcf27603ddfull },
+    { 0x23effdfffffddfe1ull, 0x0006000360000000ull, 0xf3effdfffffddfefull, 0x0006ffcf60603ddfull },
+    { 0x27fffffffffddff0ull, 0xfc00000380704000ull, 0xfffffffffffddfffull, 0xfc00ffcf80f07ddfull },
+    { 0x2ffbfffffc7fffe0ull, 0x000000000000007full, 0x2ffbfffffc7fffeeull, 0x000cffc0ff5f847full },
+    { 0x0005fffffffffffeull, 0x000000000000007full, 0x07fffffffffffffeull, 0x0000000003ff7fffull },
+    { 0x2005ffaffffff7d6ull, 0x00000000f000005full, 0x3fffffaffffff7d6ull, 0x00000000f3ff3f5full },
+    { 0x0000000000000001ull, 0x00001ffffffffeffull, 0xc2a003ff03000001ull, 0xfffe1ffffffffeffull },
+    { 0x0000000000001f00ull, 0x0000000000000000ull, 0x1ffffffffeffffdfull, 0x0000000000000040ull },
+    { 0x800007ffffffffffull, 0xffe1c0623c3f0000ull, 0xffffffffffffffffull, 0xffffffffffff03ffull },
+    { 0xffffffff00004003ull, 0xf7ffffffffff20bfull, 0xffffffff3fffffffull, 0xf7ffffffffff20bfull },
+    { 0xffffffffffffffffull, 0xffffffff3d7f3dffull, 0xffffffffffffffffull, 0xffffffff3d7f3dffull },
+    { 0x7f3dffffffff3dffull, 0xffffffffff7fff3dull, 0x7f3dffffffff3dffull, 0xffffffffff7fff3dull },
+    { 0xffffffffff3dffffull, 0x0000000007ffffffull, 0xffffffffff3dffffull, 0x0003fe00e7ffffffull },
+    { 0xffffffff0000ffffull, 0x3f3fffffffffffffull, 0xffffffff0000ffffull, 0x3f3fffffffffffffull },
+    { 0xfffffffffffffffeull, 0xffffffffffffffffull, 0xfffffffffffffffeull, 0xffffffffffffffffull },
+    { 0xffffffffffffffffull, 0xffff9fffffffffffull, 0xffffffffffffffffull, 0xffff9fffffffffffull },
+    { 0xffffffff07fffffeull, 0x01ffc7ffffffffffull, 0xffffffff07fffffeull, 0x01ffc7ffffffffffull },
+    { 0x0003ffff8003ffffull, 0x0001dfff0003ffffull, 0x001fffff803fffffull, 0x000ddfff000fffffull },
+    { 0x000fffffffffffffull, 0x0000000010800000ull, 0xffffffffffffffffull, 0x000003ff308fffffull },
+    { 0xffffffff00000000ull, 0x01ffffffffffffffull, 0xffffffff03ffb800ull, 0x01ffffffffffffffull },
+    { 0xffff05ffffffffffull, 0x003fffffffffffffull, 0xffff07ffffffffffull, 0x003fffffffffffffull },
+    { 0x000000007fffffffull, 0x001f3fffffff0000ull, 0x0fff0fff7fffffffull, 0x001f3fffffffffc0ull },
+    { 0xffff0fffffffffffull, 0x00000000000003ffull, 0xffff0fffffffffffull, 0x0000000007ff03ffull },
+    { 0xffffffff007fffffull, 0x00000000001fffffull, 0xffffffff0fffffffull, 0x9fffffff7fffffffull },
+    { 0x0000008000000000ull, 0x0000000000000000ull, 0xbfff008003ff03ffull, 0x0000000000007fffull },
+    { 0x000fffffffffffe0ull, 0x0000000000001fe0ull, 0xffffffffffffffffull, 0x000ff80003ff1fffull },
+    { 0xfc00c001fffffff8ull, 0x0000003fffffffffull, 0xffffffffffffffffull, 0x000fffffffffffffull },
+    { 0x0000000fffffffffull, 0x3ffffffffc00e000ull, 0x00ffffffffffffffull, 0x3fffffffffffe3ffull },
+    { 0xe7ffffffffff01ffull, 0x046fde0000000000ull, 0xe7ffffffffff01ffull, 0x07fffffffff70000ull },
+    { 0xffffffffffffffffull, 0x0000000000000000ull, 0xffffffffffffffffull, 0xffffffffffffffffull },
+    { 0xffffffff3f3fffffull, 0x3fffffffaaff3f3full, 0xffffffff3f3fffffull, 0x3fffffffaaff3f3full },
+    { 0x5fdfffffffffffffull, 0x1fdc1fff0fcf1fdcull, 0x5fdfffffffffffffull, 0x1fdc1fff0fcf1fdcull },
+    { 0x0000000000000000ull, 0x8002000000000000ull, 0x8000000000000000ull, 0x8002000000100001ull },
+    { 0x000000001fff0000ull, 0x0000000000000000ull, 0x000000001fff0000ull, 0x0001ffe21fff0000ull },
+    { 0xf3fffd503f2ffc84ull, 0xffffffff000043e0ull, 0xf3fffd503f2ffc84ull, 0xffffffff000043e0ull },
+    { 0x00000000000001ffull, 0x0000000000000000ull, 0x00000000000001ffull, 0x0000000000000000ull },
+    { 0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull },
+    { 0xffffffffffffffffull, 0x000c781fffffffffull, 0xffffffffffffffffull, 0x000ff81fffffffffull },
+    { 0xffff20bfffffffffull, 0x000080ffffffffffull, 0xffff20bfffffffffull, 0x800080ffffffffffull },
+    { 0x7f7f7f7f007fffffull, 0x000000007f7f7f7full, 0x7f7f7f7f007fffffull, 0xffffffff7f7f7f7full },
+    { 0x1f3e03fe000000e0ull, 0xfffffffffffffffeull, 0x1f3efffe000000e0ull, 0xfffffffffffffffeull },
+    { 0xfffffffee07fffffull, 0xf7ffffffffffffffull, 0xfffffffee67fffffull, 0xf7ffffffffffffffull },
+    { 0xfffeffffffffffe0ull, 0xffffffffffffffffull, 0xfffeffffffffffe0ull, 0xffffffffffffffffull },
+    { 0xffffffff00007fffull, 0xffff000000000000ull, 0xffffffff00007fffull, 0xffff000000000000ull },
+    { 0xffffffffffffffffull, 0x0000000000000000ull, 0xffffffffffffffffull, 0x0000000000000000ull },
+    { 0x0000000000001fffull, 0x3fffffffffff0000ull, 0x0000000000001fffull, 0x3fffffffffff0000ull },
+    { 0x00000c00ffff1fffull, 0x80007fffffffffffull, 0x00000fffffff1fffull, 0xbff0ffffffffffffull },
+    { 0xffffffff3fffffffull, 0x0000ffffffffffffull, 0xffffffffffffffffull, 0x0003ffffffffffffull },
+    { 0xfffffffcff800000ull, 0xffffffffffffffffull, 0xfffffffcff800000ull, 0xffffffffffffffffull },
+    { 0xfffffffffffff9ffull, 0xfffc000003eb07ffull, 0xfffffffffffff9ffull, 0xfffc000003eb07ffull },
+    { 0x00000007fffff7bbull, 0x000fffffffffffffull, 0x000010ffffffffffull, 0x000fffffffffffffull },
+    { 0x000ffffffffffffcull, 0x68fc000000000000ull, 0xffffffffffffffffull, 0xe8ffffff03ff003full },
+    { 0xffff003ffffffc00ull, 0x1fffffff0000007full, 0xffff3fffffffffffull, 0x1fffffff000fffffull },
+    { 0x0007fffffffffff0ull, 0x7c00ffdf00008000ull, 0xffffffffffffffffull, 0x7fffffff03ff8001ull },
+    { 0x000001ffffffffffull, 0xc47fffff00000ff7ull, 0x007fffffffffffffull, 0xfc7fffff03ff3fffull },
+    { 0x3e62ffffffffffffull, 0x001c07ff38000005ull, 0xffffffffffffffffull, 0x007cffff38000007ull },
+    { 0xffff7f7f007e7e7eull, 0xffff03fff7ffffffull, 0xffff7f7f007e7e7eull, 0xffff03fff7ffffffull },
+    { 0xffffffffffffffffull, 0x00000007ffffffffull, 0xffffffffffffffffull, 0x03ff37ffffffffffull },
+    { 0xffff000fffffffffull, 0x0ffffffffffff87full, 0xffff000fffffffffull, 0x0ffffffffffff87full },
+    { 0xffffffffffffffffull, 0xffff3fffffffffffull, 0xffffffffffffffffull, 0xffff3fffffffffffull },
+    { 0xffffffffffffffffull, 0x0000000003ffffffull, 0xffffffffffffffffull, 0x0000000003ffffffull },
+    { 0x5f7ffdffa0f8007full, 0xffffffffffffffdbull, 0x5f7ffdffe0f8007full, 0xffffffffffffffdbull },
+    { 0x0003ffffffffffffull, 0xfffffffffff80000ull, 0x0003ffffffffffffull, 0xfffffffffff80000ull },
+    { 0xffffffffffffffffull, 0xfffffff03fffffffull, 0xffffffffffffffffull, 0xfffffff03fffffffull },
+    { 0x3fffffffffffffffull, 0xffffffffffff0000ull, 0x3fffffffffffffffull, 0xffffffffffff0000ull },
+    { 0xfffffffffffcffffull, 0x03ff0000000000ffull, 0xfffffffffffcffffull, 0x03ff0000000000ffull },
+    { 0x0000000000000000ull, 0xaa8a000000000000ull, 0x0018ffff0000ffffull, 0xaa8a00000000e000ull },
+    { 0xffffffffffffffffull, 0x1fffffffffffffffull, 0xffffffffffffffffull, 0x1fffffffffffffffull },
+    { 0x07fffffe00000000ull, 0xffffffc007fffffeull, 0x87fffffe03ff0000ull, 0xffffffc007fffffeull },
+    { 0x7fffffff3fffffffull, 0x000000001cfcfcfcull, 0x7fffffffffffffffull, 0x000000001cfcfcfcull },
+    { 0xb7ffff7fffffefffull, 0x000000003fff3fffull, 0xb7ffff7fffffefffull, 0x000000003fff3fffull },
+    { 0xffffffffffffffffull, 0x07ffffffffffffffull, 0xffffffffffffffffull, 0x07ffffffffffffffull },
+    { 0x0000000000000000ull, 0x001fffffffffffffull, 0x0000000000000000ull, 0x001fffffffffffffull },
+    { 0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull, 0x2000000000000000ull },
+    { 0xffffffff1fffffffull, 0x000000000001ffffull, 0xffffffff1fffffffull, 0x000000010001ffffull },
+    { 0xffffe000ffffffffull, 0x003fffffffff07ffull, 0xffffe000ffffffffull, 0x07ffffffffff07ffull },
+    { 0xffffffff3fffffffull, 0x00000000003eff0full, 0xffffffff3fffffffull, 0x00000000003eff0full },
+    { 0xffff00003fffffffull, 0x0fffffffff0fffffull, 0xffff03ff3fffffffull, 0x0fffffffff0fffffull },
+    { 0xffff00ffffffffffull, 0xf7ff000fffffffffull, 0xffff00ffffffffffull, 0xf7ff000fffffffffull },
+    { 0x1bfbfffbffb7f7ffull, 0x0000000000000000ull, 0x1bfbfffbffb7f7ffull, 0x0000000000000000ull },
+    { 0x007fffffffffffffull, 0x000000ff003fffffull, 0x007fffffffffffffull, 0x000000ff003fffffull },
+    { 0x07fdffffffffffbfull, 0x0000000000000000ull, 0x07fdffffffffffbfull, 0x0000000000000000ull },
+    { 0x91bffffffffffd3full, 0x007fffff003fffffull, 0x91bffffffffffd3full, 0x007fffff003fffffull },
+    { 0x000000007fffffffull, 0x0037ffff00000000ull, 0x000000007fffffffull, 0x0037ffff00000000ull },
+    { 0x03ffffff003fffffull, 0x0000000000000000ull, 0x03ffffff003fffffull, 0x0000000000000000ull },
+    { 0xc0ffffffffffffffull, 0x0000000000000000ull, 0xc0ffffffffffffffull, 0x0000000000000000ull },
+    { 0x003ffffffeef0001ull, 0x1fffffff00000000ull, 0x873ffffffeeff06full, 0x1fffffff00000000ull },
+    { 0x000000001fffffffull, 0x0000001ffffffeffull, 0x000000001fffffffull, 0x0000007ffffffeffull },
+    { 0x003fffffffffffffull, 0x0007ffff003fffffull, 0x003fffffffffffffull, 0x0007ffff003fffffull },
+    { 0x000000000003ffffull, 0x0000000000000000ull, 0x000000000003ffffull, 0x0000000000000000ull },
+    { 0xffffffffffffffffull, 0x00000000000001ffull, 0xffffffffffffffffull, 0x00000000000001ffull },
+    { 0x0007ffffffffffffull, 0x0007ffffffffffffull, 0x0007ffffffffffffull, 0x0007ffffffffffffull },
+    { 0x0000000fffffffffull, 0x0000000000000000ull, 0x03ff00ffffffffffull, 0x0000000000000000ull },
+    { 0x000303ffffffffffull, 0x0000000000000000ull, 0x00031bffffffffffull, 0x0000000000000000ull },
+    { 0xffff00801fffffffull, 0xffff00000000003full, 0xffff00801fffffffull, 0xffff00000001ffffull },
+    { 0xffff000000000003ull, 0x007fffff0000001full, 0xffff00000000003full, 0x007fffff0000001full },
+    { 0x00fffffffffffff8ull, 0x0026000000000000ull, 0xffffffffffffffffull, 0x803fffc00000007full },
+    { 0x0000fffffffffff8ull, 0x000001ffffff0000ull, 0x07ffffffffffffffull, 0x03ff01ffffff0004ull },
+    { 0x0000007ffffffff8ull, 0x0047ffffffff0090ull, 0xffdfffffffffffffull, 0x004fffffffff00f0ull },
+    { 0x0007fffffffffff8ull, 0x000000001400001eull, 0xffffffffffffffffull, 0x0000000017ffde1full },
+    { 0x00000ffffffbffffull, 0x0000000000000000ull, 0x40fffffffffbffffull, 0x0000000000000000ull },
+    { 0xffff01ffbfffbd7full, 0x000000007fffffffull, 0xffff01ffbfffbd7full, 0x03ff07ffffffffffull },
+    { 0x23edfdfffff99fe0ull, 0x00000003e0010000ull, 0xfbedfdfffff99fefull, 0x001f1fcfe081399full },
+    { 0x001fffffffffffffull, 0x0000000380000780ull, 0xffffffffffffffffull, 0x00000003c3ff07ffull },
+    { 0x0000ffffffffffffull, 0x00000000000000b0ull, 0xffffffffffffffffull, 0x0000000003ff00bfull },
+    { 0x00007fffffffffffull, 0x000000000f000000ull, 0xff3fffffffffffffull, 0x000000003f000001ull },
+    { 0x0000ffffffffffffull, 0x0000000000000010ull, 0xffffffffffffffffull, 0x0000000003ff0011ull },
+    { 0x010007ffffffffffull, 0x0000000000000000ull, 0x01ffffffffffffffull, 0x00000000000003ffull },
+    { 0x0000000007ffffffull, 0x000000000000007full, 0x03ff0fffe7ffffffull, 0x000000000000007full },
+    { 0x00000fffffffffffull, 0x0000000000000000ull, 0x07ffffffffffffffull, 0x0000000000000000ull },
+    { 0xffffffff00000000ull, 0x80000000ffffffffull, 0xffffffff00000000ull, 0x800003ffffffffffull },
+    { 0x8000ffffff6ff27full, 0x0000000000000002ull, 0xf9bfffffff6ff27full, 0x0000000003ff000full },
+    { 0xfffffcff00000000ull, 0x0000000a0001ffffull, 0xfffffcff00000000ull, 0x0000001bfcffffffull },
+    { 0x0407fffffffff801ull, 0xfffffffff0010000ull, 0x7fffffffffffffffull, 0xffffffffffff0080ull },
+    { 0xffff0000200003ffull, 0x01ffffffffffffffull, 0xffff000023ffffffull, 0x01ffffffffffffffull },
+    { 0x00007ffffffffdffull, 0xfffc000000000001ull, 0xff7ffffffffffdffull, 0xfffc000003ff0001ull },
+    { 0x000000000000ffffull, 0x0000000000000000ull, 0x007ffefffffcffffull, 0x0000000000000000ull },
+    { 0x0001fffffffffb7full, 0xfffffdbf00000040ull, 0xb47ffffffffffb7full, 0xfffffdbf03ff00ffull },
+    { 0x00000000010003ffull, 0x0000000000000000ull, 0x000003ff01fb7fffull, 0x0000000000000000ull },
+    { 0x0000000000000000ull, 0x0007ffff00000000ull, 0x0000000000000000ull, 0x007fffff00000000ull },
+    { 0x0001000000000000ull, 0x0000000000000000ull, 0x0001000000000000ull, 0x0000000000000000ull },
+    { 0x0000000003ffffffull, 0x0000000000000000ull, 0x0000000003ffffffull, 0x0000000000000000ull },
+    { 0xffffffffffffffffull, 0x00007fffffffffffull, 0xffffffffffffffffull, 0x00007fffffffffffull },
+    { 0xffffffffffffffffull, 0x000000000000000full, 0xffffffffffffffffull, 0x000000000000000full },
+    { 0xffffffffffff0000ull, 0x0001ffffffffffffull, 0xffffffffffff0000ull, 0x0001ffffffffffffull },
+    { 0x00007fffffffffffull, 0x0000000000000000ull, 0x00007fffffffffffull, 0x0000000000000000ull },
+    { 0xffffffffffffffffull, 0x000000000000007full, 0xffffffffffffffffull, 0x000000000000007full },
+    { 0x01ffffffffffffffull, 0xffff00007fffffffull, 0x01ffffffffffffffull, 0xffff03ff7fffffffull },
+    { 0x7fffffffffffffffull, 0x00003fffffff0000ull, 0x7fffffffffffffffull, 0x001f3fffffff03ffull },
+    { 0x0000ffffffffffffull, 0xe0fffff80000000full, 0x007fffffffffffffull, 0xe0fffff803ff000full },
+    { 0x000000000000ffffull, 0x0000000000000000ull, 0x000000000000ffffull, 0x0000000000000000ull },
+    { 0x0000000000000000ull, 0xffffffffffffffffull, 0x0000000000000000ull, 0xffffffffffffffffull },
+    { 0xffffffffffffffffull, 0x00000000000107ffull, 0xffffffffffffffffull, 0xffffffffffff87ffull },
+    { 0x00000000fff80000ull, 0x0000000b00000000ull, 0x00000000ffff80ffull, 0x0003001b00000000ull },
+    { 0xffffffffffffffffull, 0x00ffffffffffffffull, 0xffffffffffffffffull, 0x00ffffffffffffffull },
+    { 0xffffffffffffffffull, 0x00000000003fffffull, 0xffffffffffffffffull, 0x00000000003fffffull },
+    { 0x0000000000000000ull, 0x6fef000000000000ull, 0x0000000000000000ull, 0x6fef000000000000ull },
+    { 0x00000007ffffffffull, 0xffff00f000070000ull, 0x00000007ffffffffull, 0xffff00f000070000ull },
+    { 0xffffffffffffffffull, 0x0fffffffffffffffull, 0xffffffffffffffffull, 0x0fffffffffffffffull },
+    { 0xffffffffffffffffull, 0x1fff07ffffffffffull, 0xffffffffffffffffull, 0x1fff07ffffffffffull },
+    { 0x0000000003ff01ffull, 0x0000000000000000ull, 0x0000000063ff01ffull, 0x0000000000000000ull },
+    { 0x0000000000000000ull, 0x0000000000000000ull, 0xffff3fffffffffffull, 0x000000000000007full },
+    { 0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull, 0xf807e3e000000000ull },
+    { 0x0000000000000000ull, 0x0000000000000000ull, 0x00003c0000000fe7ull, 0x0000000000000000ull },
+    { 0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull, 0x000000000000001cull },
+    { 0xffffffffffffffffull, 0xffffffffffdfffffull, 0xffffffffffffffffull, 0xffffffffffdfffffull },
+    { 0xebffde64dfffffffull, 0xffffffffffffffefull, 0xebffde64dfffffffull, 0xffffffffffffffefull },
+    { 0x7bffffffdfdfe7bfull, 0xfffffffffffdfc5full, 0x7bffffffdfdfe7bfull, 0xfffffffffffdfc5full },
+    { 0xffffff3fffffffffull, 0xf7fffffff7fffffdull, 0xffffff3fffffffffull, 0xf7fffffff7fffffdull },
+    { 0xffdfffffffdfffffull, 0xffff7fffffff7fffull, 0xffdfffffffdfffffull, 0xffff7fffffff7fffull },
+    { 0xfffffdfffffffdffull, 0x0000000000000ff7ull, 0xfffffdfffffffdffull, 0xffffffffffffcff7ull },
+    { 0x0000000000000000ull, 0x0000000000000000ull, 0xf87fffffffffffffull, 0x00201fffffffffffull },
+    { 0x0000000000000000ull, 0x0000000000000000ull, 0x0000fffef8000010ull, 0x0000000000000000ull },
+    { 0x000000007fffffffull, 0x0000000000000000ull, 0x000000007fffffffull, 0x0000000000000000ull },
+    { 0x0000000000000000ull, 0x0000000000000000ull, 0x000007dbf9ffff7full, 0x0000000000000000ull },
+    { 0x3f801fffffffffffull, 0x0000000000004000ull, 0x3fff1fffffffffffull, 0x00000000000043ffull },
+    { 0x00003fffffff0000ull, 0x00000fffffffffffull, 0x00007fffffff0000ull, 0x03ffffffffffffffull },
+    { 0x0000000000000000ull, 0x7fff6f7f00000000ull, 0x0000000000000000ull, 0x7fff6f7f00000000ull },
+    { 0xffffffffffffffffull, 0x000000000000001full, 0xffffffffffffffffull, 0x00000000007f001full },
+    { 0xffffffffffffffffull, 0x000000000000080full, 0xffffffffffffffffull, 0x0000000003ff0fffull },
+    { 0x0af7fe96ffffffefull, 0x5ef7f796aa96ea84ull, 0x0af7fe96ffffffefull, 0x5ef7f796aa96ea84ull },
+    { 0x0ffffbee0ffffbffull, 0x0000000000000000ull, 0x0ffffbee0ffffbffull, 0x0000000000000000ull },
+    { 0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull, 0x03ff000000000000ull },
+    { 0xffffffffffffffffull, 0x00000000ffffffffull, 0xffffffffffffffffull, 0x00000000ffffffffull },
+    { 0x01ffffffffffffffull, 0xffffffffffffffffull, 0x01ffffffffffffffull, 0xffffffffffffffffull },
+    { 0xffffffff3fffffffull, 0xffffffffffffffffull, 0xffffffff3fffffffull, 0xffffffffffffffffull },
+    { 0xffff0003ffffffffull, 0xffffffffffffffffull, 0xffff0003ffffffffull, 0xffffffffffffffffull },
+    { 0xffffffffffffffffull, 0x00000001ffffffffull, 0xffffffffffffffffull, 0x00000001ffffffffull },
+    { 0x000000003fffffffull, 0x0000000000000000ull, 0x000000003fffffffull, 0x0000000000000000ull },
+    { 0xffffffffffffffffull, 0x00000000000007ffull, 0xffffffffffffffffull, 0x00000000000007ffull },
+};
+
+#endif // UNICODE_IDS_H
@@ -0,0 +1,308 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "utf8.h"
+#include "unicode_ids.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WPY_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// -----------------------------
+// Scalar decoding
+// -----------------------------
+// Length of the well-formed sequence at s (Table 3-7 of the Unicode
+// Standard), 0 if there is none. Reads past a byte only if it continued
+// the sequence, so a NUL ends it safely.
+static int sequence_length(const unsigned char *s, size_t n) {
+    unsigned char c = s[0];
+    if (c < 0x80) return 1;
+    if (c < 0xC2 || c > 0xF4) return 0;
+    int length = c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+    if ((size_t)length > n) return 0;
+
+    // the second byte's range rules out overlong forms, surrogates and
+    // code points above U+10FFFF
+    unsigned char lo = 0x80, hi = 0xBF;
+    if (c == 0xE0) lo = 0xA0;
+    else if (c == 0xED) hi = 0x9F;
+    else if (c == 0xF0) lo = 0x90;
+    else if (c == 0xF4) hi = 0x8F;
+    if (s[1] < lo || s[1] > hi) return 0;
+    for (int i = 2; i < length; i++) {
+        if ((s[i] & 0xC0) != 0x80) return 0;
+    }
+    return length;
+}
+
+int utf8_decode(const char *s, int *length) {
+    const unsigned char *p = (const unsigned char *)s;
+    int n = sequence_length(p, 4);
+    if (!n) {
+        *length = 1;
+        return -1;
+    }
+    *length = n;
+    switch (n) {
+        case 1:  return p[0];
+        case 2:  return (p[0] & 0x1F) << 6 | (p[1] & 0x3F);
+        case 3:  return (p[0] & 0x0F) << 12 | (p[1] & 0x3F) << 6 | (p[2] & 0x3F);
+        default: return (p[0] & 0x07) << 18 | (p[1] & 0x3F) << 12 | (p[2] & 0x3F) << 6 | (p[3] & 0x3F);
+    }
+}
+
+static size_t validate_scalar(const unsigned char *s, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        // eight ASCII bytes at a time
+        uint64_t word;
+        if (i + 8 <= n) {
+            memcpy(&word, s + i, 8);
+            if (!(word & 0x8080808080808080ull)) {
+                i += 8;
+                continue;
+            }
+        }
+        if (s[i] < 0x80) {
+            i++;
+            continue;
+        }
+        int length = sequence_length(s + i, n - i);
+        if (!length) return i;
+        i += length;
+    }
+    return n;
+}
+
+#ifdef WPY_X86_SIMD
+// -----------------------------
+// Vector validation
+// -----------------------------
+// Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per
+// Byte" (2021). Every error shows up in a pair of adjacent bytes: three
+// 16-entry tables, indexed by the high and low nibble of the first byte
+// and the high nibble of the second, each give the errors the pair could
+// be; a byte pair is wrong when all three agree. The only errors that
+// need more context are a missing third or fourth byte, found by checking
+// that bytes two and three after a 3- or 4-byte lead are continuations.
+// Blocks of plain ASCII skip the tables.
+
+#define TOO_SHORT   (1 << 0)   // lead byte or ASCII followed by a lead byte or ASCII
+#define TOO_LONG    (1 << 1)   // ASCII followed by a continuation
+#define OVERLONG_3  (1 << 2)
+#define TOO_LARGE   (1 << 3)
+#define SURROGATE   (1 << 4)
+#define OVERLONG_2  (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4  (1 << 6)
+#define TWO_CONTS   (1 << 7)   // two continuations that need a third byte before them
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+static const unsigned char byte_1_high[16] = {
+    // 0_______: ASCII
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    // 10______: continuation
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    // 1100____, 1101____: 2-byte lead
+    TOO_SHORT | OVERLONG_2,
+    TOO_SHORT,
+    // 1110____: 3-byte lead
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    // 1111____: 4-byte lead
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+};
+
+static const unsigned char byte_1_low[16] = {
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,   // ____0000
+    CARRY | OVERLONG_2,                             // ____0001
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,                              // ____0100
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, // ____1101
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+
+static const unsigned char byte_2_high[16] = {
+    // 0_______: ASCII
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    // 1000____
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    // 1001____
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    // 101_____
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    // 11______: lead byte
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+};
+
+// A block ending in one of these leaves a sequence open: the last three
+// bytes may not be at least a 4-, 3- or 2-byte lead respectively.
+static const unsigned char incomplete_max[32] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+};
+
+// Each kernel returns 1 if all of s[0..n) is valid. The last block is
+// padded with zeros, which also ends any sequence the input leaves open.
+
+__attribute__((target("ssse3")))
+static int valid_ssse3(const unsigned char *s, size_t n) {
+    const __m128i table_1_high = _mm_loadu_si128((const __m128i *)byte_1_high);
+    const __m128i table_1_low = _mm_loadu_si128((const __m128i *)byte_1_low);
+    const __m128i table_2_high = _mm_loadu_si128((const __m128i *)byte_2_high);
+    const __m128i max = _mm_loadu_si128((const __m128i *)(incomplete_max + 16));
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i third = _mm_set1_epi8(0xE0 - 0x80);
+    const __m128i fourth = _mm_set1_epi8(0xF0 - 0x80);
+    const __m128i high_bit = _mm_set1_epi8((char)0x80);
+    __m128i error = _mm_setzero_si128(), prev = _mm_setzero_si128(), prev_incomplete = _mm_setzero_si128();
+    unsigned char tail[16];
+
+    for (size_t i = 0;; i += 16) {
+        int last = i + 16 > n;
+        __m128i input;
+        if (last) {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, s + i, n - i);
+            input = _mm_loadu_si128((const __m128i *)tail);
+        } else {
+            input = _mm_loadu_si128((const __m128i *)(s + i));
+        }
+
+        if (_mm_movemask_epi8(input) == 0) {
+            error = _mm_or_si128(error, prev_incomplete);
+        } else {
+            __m128i prev1 = _mm_alignr_epi8(input, prev, 15);
+            __m128i sc = _mm_and_si128(
+                _mm_and_si128(_mm_shuffle_epi8(table_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                              _mm_shuffle_epi8(table_1_low, _mm_and_si128(prev1, nibble))),
+                _mm_shuffle_epi8(table_2_high, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+            __m128i must23 = _mm_or_si128(_mm_subs_epu8(_mm_alignr_epi8(input, prev, 14), third),
+                                          _mm_subs_epu8(_mm_alignr_epi8(input, prev, 13), fourth));
+            error = _mm_or_si128(error, _mm_xor_si128(_mm_and_si128(must23, high_bit), sc));
+            prev_incomplete = _mm_subs_epu8(input, max);
+        }
+        prev = input;
+        if (last) break;
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+}
+
+__attribute__((target("avx2")))
+static int valid_avx2(const unsigned char *s, size_t n) {
+    const __m256i table_1_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)byte_1_high));
+    const __m256i table_1_low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)byte_1_low));
+    const __m256i table_2_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)byte_2_high));
+    const __m256i max = _mm256_loadu_si256((const __m256i *)incomplete_max);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i third = _mm256_set1_epi8(0xE0 - 0x80);
+    const __m256i fourth = _mm256_set1_epi8(0xF0 - 0x80);
+    const __m256i high_bit = _mm256_set1_epi8((char)0x80);
+    __m256i error = _mm256_setzero_si256(), prev = _mm256_setzero_si256(), prev_incomplete = _mm256_setzero_si256();
+    unsigned char tail[32];
+
+    for (size_t i = 0;; i += 32) {
+        int last = i + 32 > n;
+        __m256i input;
+        if (last) {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, s + i, n - i);
+            input = _mm256_loadu_si256((const __m256i *)tail);
+        } else {
+            input = _mm256_loadu_si256((const __m256i *)(s + i));
+        }
+
+        if (_mm256_movemask_epi8(input) == 0) {
+            error = _mm256_or_si256(error, prev_incomplete);
+        } else {
+            // the 16 bytes before each lane: the previous lane, or the
+            // previous block's high lane
+            __m256i before = _mm256_permute2x128_si256(prev, input, 0x21);
+            __m256i prev1 = _mm256_alignr_epi8(input, before, 15);
+            __m256i sc = _mm256_and_si256(
+                _mm256_and_si256(
+                    _mm256_shuffle_epi8(table_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                    _mm256_shuffle_epi8(table_1_low, _mm256_and_si256(prev1, nibble))),
+                _mm256_shuffle_epi8(table_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+            __m256i must23 = _mm256_or_si256(_mm256_subs_epu8(_mm256_alignr_epi8(input, before, 14), third),
+                                             _mm256_subs_epu8(_mm256_alignr_epi8(input, before, 13), fourth));
+            error = _mm256_or_si256(error, _mm256_xor_si256(_mm256_and_si256(must23, high_bit), sc));
+            prev_incomplete = _mm256_subs_epu8(input, max);
+        }
+        prev = input;
+        if (last) break;
+    }
+    return _mm256_testz_si256(error, error);
+}
+#endif // WPY_X86_SIMD
+
+// -----------------------------
+// Runtime dispatch
+// -----------------------------
+typedef int (*ValidateFn)(const unsigned char *s, size_t n);
+
+static ValidateFn active_validator = NULL;
+static const char *active_level = "scalar";
+
+static ValidateFn validator(void) {
+    if (active_validator) return active_validator;
+
+    ValidateFn picked = NULL;
+#ifdef WPY_X86_SIMD
+    const char *force = getenv("WPY_SIMD");
+    int allow_avx2 = !force || strcmp(force, "avx2") == 0;
+    int allow_ssse3 = !force || strcmp(force, "scalar") != 0;
+    __builtin_cpu_init();
+    if (allow_avx2 && __builtin_cpu_supports("avx2")) {
+        picked = valid_avx2;
+        active_level = "avx2";
+    } else if (allow_ssse3 && __builtin_cpu_supports("ssse3")) {
+        picked = valid_ssse3;
+        active_level = "ssse3";
+    }
+#endif
+    active_validator = picked;
+    return picked;
+}
+
+const char *utf8_simd_level(void) {
+    validator();
+    return active_level;
+}
+
+size_t utf8_validate(const char *s, size_t n) {
+    const unsigned char *p = (const unsigned char *)s;
+    ValidateFn valid = validator();
+    // the vector kernels only tell whether there is an error; the scalar
+    // pass finds where
+    if (valid && valid(p, n)) return n;
+    return validate_scalar(p, n);
+}
+
+// -----------------------------
+// Identifier classes
+// -----------------------------
+int unicode_id_start(int cp) {
+    if (cp < 0 || cp >= UNICODE_ID_LIMIT) return 0;
+    const uint64_t *block = unicode_id_blocks[unicode_id_index[cp >> 7]];
+    return (int)((block[(cp >> 6) & 1] >> (cp & 63)) & 1);
+}
+
+int unicode_id_continue(int cp) {
+    if (cp >= 0xE0100 && cp <= 0xE01EF) return 1;   // variation selectors
+    if (cp < 0 || cp >= UNICODE_ID_LIMIT) return 0;
+    const uint64_t *block = unicode_id_blocks[unicode_id_index[cp >> 7]];
+    return (int)((block[2 + ((cp >> 6) & 1)] >> (cp & 63)) & 1);
+}
@@ -0,0 +1,26 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+
+// -----------------------------
+// UTF-8
+// -----------------------------
+// Source files are UTF-8. utf8_validate() checks a whole buffer with SIMD
+// (AVX2 or SSSE3, picked at runtime like the array kernels; WPY_SIMD=scalar
+// turns it off) and returns the offset of the first byte that does not
+// belong to a well-formed sequence, or n if there is none. Overlong forms,
+// surrogates and code points above U+10FFFF are rejected.
+size_t utf8_validate(const char *s, size_t n);
+const char *utf8_simd_level(void);
+
+// Decodes the sequence at s, which ends at a NUL at the latest. Stores its
+// length in *length and returns the code point, or returns -1 with
+// *length = 1 if s does not start a well-formed sequence.
+int utf8_decode(const char *s, int *length);
+
+// Unicode identifier classes (UAX #31)
+int unicode_id_start(int cp);      // XID_Start
+int unicode_id_continue(int cp);   // XID_Continue
+
+#endif // UTF8_H